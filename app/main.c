@@ -26,19 +26,75 @@ int ReadYUV(char *ybuf, char *uvbuf, FILE *hInputYUVFile)
 	return 0;
 }
 
-int main()
+/* Output names ending in .ts get an MPEG-TS stream, anything else the raw
+   elementary stream */
+static int IsTsOutput(const char *path)
 {
+	size_t len = strlen(path);
+
+	return len > 3 && strcmp(path + len - 3, ".ts") == 0;
+}
+
+/* Encoder pts and dts count frames, TS wants 90 kHz */
+static int WritePacket(XlnxEncoderHandle *enc, XlnxTsMux *ts, FILE *out,
+                       char *buf, int len, int fps)
+{
+	XlnxEncoderFrameStats stats;
+
+	if (len <= 0)
+		return 0;
+	if (!ts)
+		return fwrite(buf, sizeof(char), len, out) == (size_t)len ? 0 : -1;
+	if (Encoder_GetFrameStats(enc, &stats) != 0)
+		return -1;
+	return TsMux_WritePacket(ts, buf, len, stats.pts * 90000 / fps,
+	                         stats.dts * 90000 / fps);
+}
+
+int main(int argc, char *argv[])
+{
+	XlnxEncoderConfig cfg;
+	XlnxEncoderHandle *enc;
+	XlnxTsMux *ts = NULL;
+	const char *inpath = "./test.yuv";
+	const char *outpath = "./xilinx_output.264";
+
+	Encoder_ConfigInit(&cfg);
+	if (Encoder_ConfigParseArgs(&cfg, argc, argv) != 0)
+		return -1;
+	if (cfg.input_file)
+		inpath = cfg.input_file;
+	if (cfg.output_file)
+		outpath = cfg.output_file;
+	/* The muxer needs the frame rate the timestamps count in */
+	if (cfg.fps <= 0)
+		cfg.fps = 25;
+
 	printf("Stert Encoding \n");
-	char* outBuf = (char*)malloc(1920*1080);
+	char* outBuf = NULL;
 	int outlen =0;
 	
 	static FILE* fin = NULL;
-	if (!fin) fin = fopen("./test.yuv", "rb");
+	if (!fin) fin = fopen(inpath, "rb");
 	
 	static FILE* fin2 = NULL;
-	if (!fin2) fin2 = fopen("./xilinx_output.264", "wb");
+	if (!fin2) fin2 = fopen(outpath, "wb");
+	if (!fin || !fin2)
+		return -1;
 	
-	Encoder_Init();
+	enc = Encoder_Open(&cfg);
+	if (!enc)
+		return -1;
+	/* Room for the largest packet the channel can produce */
+	outBuf = (char*)malloc(Encoder_GetMaxPacketSize(enc));
+	if (!outBuf)
+		return -1;
+	if (IsTsOutput(outpath)) {
+		ts = TsMux_Open(fileno(fin2), cfg.codec_id == ENCODER_ID_HEVC ?
+		                ENCODER_ID_HEVC : ENCODER_ID_H264);
+		if (!ts)
+			return -1;
+	}
 
     for(int i=0;i<900;i++) 
 	{
@@ -47,16 +103,26 @@ int main()
 		
         ReadYUV(ybuf, uvbuf, fin);
 		
-		Encoder_frame(ybuf,uvbuf,outBuf,&outlen);
-		
-		fwrite(outBuf, sizeof(char), outlen, fin2);
+		if (Encoder_EncodeFrame(enc, ybuf, uvbuf, outBuf, &outlen) < 0 ||
+		    WritePacket(enc, ts, fin2, outBuf, outlen, cfg.fps) != 0)
+			break;
 		
 		printf("==============%d \n",outlen);
     }
 
+	while (Encoder_FlushFrame(enc, outBuf, &outlen) == 0)
+	{
+		if (WritePacket(enc, ts, fin2, outBuf, outlen, cfg.fps) != 0)
+			break;
+	}
+
     printf("Encoding of input stream completed \n");
 
-    Encoder_Release();
+	TsMux_Close(ts);
+	fclose(fin2);
+	fclose(fin);
+    Encoder_Close(enc);
+	free(outBuf);
 
     return 0;
 }
@@ -97,7 +163,13 @@ int main()
 		out_buffer = (unsigned char*)malloc(1920*1080*3);
 	}
 	
-	Decoder_Init();
+	if(Decoder_Init() != 0){
+		printf("Decoder init failed\n");
+		free(tmpbuf);
+		free(host_buffer);
+		free(out_buffer);
+		return -1;
+	}
 
 	// Encoder_Init();
 	
@@ -108,10 +180,14 @@ int main()
 		if (H264FrameReader_ReadFrame(tmpbuf, &tmpbuf_len))
 		{
 			//printf("read h264 size = %d\n", tmpbuf_len);
-			Decoder_frame(tmpbuf,out_buffer,tmpbuf_len);
+			ret = Decoder_frame(tmpbuf,out_buffer,tmpbuf_len);
+			if (ret < 0) {
+				printf("Decoding failed\n");
+				break;
+			}
 			static FILE* fin2 = NULL;
 			if (!fin2) fin2 = fopen(outputpath, "wb");
-			fwrite(out_buffer, sizeof(char), 960*1080*3, fin2);
+			if (ret == 0) fwrite(out_buffer, sizeof(char), 960*1080*3, fin2);
 			usleep(5000);
 			current_read_len += tmpbuf_len;
 		}
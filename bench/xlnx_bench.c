@@ -0,0 +1,1698 @@
+#include "xilinx_encoder.h"
+#include "xlnx_scene_detect.h"
+#include "xlnx_xrm_load.h"
+#include "xlnx_yuv_convert.h"
+
+#include <getopt.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <xma.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define XLNX_BENCH_HAVE_TSC 1
+#endif
+
+#define XLNX_BENCH_WIDTH         1920
+#define XLNX_BENCH_HEIGHT        1080
+#define XLNX_BENCH_WIDTH_4K      3840
+#define XLNX_BENCH_HEIGHT_4K     2160
+/* Padding of decoder output frames, see dec_output_data */
+#define XLNX_BENCH_STRIDE_ALIGN  256
+#define XLNX_BENCH_HEIGHT_ALIGN  64
+#define XLNX_BENCH_STREAM_SIZE   (4 << 20)
+#define XLNX_BENCH_MIN_NAL       64
+#define XLNX_BENCH_MAX_NAL       65536
+#define XLNX_BENCH_OPTIONS_SIZE  4096
+#define XLNX_BENCH_MAX_SAMPLES   100000
+#define XLNX_BENCH_NAME_SIZE     64
+#define XLNX_BENCH_ALIGN(x, a)   (((x) + (a) - 1) & ~((a) - 1))
+/* Encoder cases, see xlnx_bench_enc_open */
+#define XLNX_BENCH_MAX_CHANNELS  16
+#define XLNX_BENCH_CH_WIDTH      1280
+#define XLNX_BENCH_CH_HEIGHT     720
+#define XLNX_BENCH_CH_FPS        30
+/* The deepest lookahead the encoder takes, ENC_MAX_LOOKAHEAD_DEPTH */
+#define XLNX_BENCH_LA_DEPTH      20
+/* Room a packet may take over a raw frame, see xlnx_enc_packet_size */
+#define XLNX_BENCH_PACKET_HDR    4096
+#define XLNX_BENCH_BITRATE_LOW   2000
+#define XLNX_BENCH_BITRATE_HIGH  4000
+#define XLNX_BENCH_PRESET        "live-1080p"
+#define XLNX_BENCH_LOWLAT_PRESET "live-1080p-lowlat"
+/* Frames a new channel may take before its first packet */
+#define XLNX_BENCH_FIRST_FRAMES  64
+/* Channel setups per op of the xrm_load cases */
+#define XLNX_BENCH_SETUPS        1000
+/* One second of 1080p30 at about 70 Mb/s for the mp4_mux case */
+#define XLNX_BENCH_MUX_FRAMES    30
+#define XLNX_BENCH_MUX_GOP       10
+#define XLNX_BENCH_MUX_AU_SIZE   (300 << 10)
+/* ABR input, one closed GOP of encoder output sent in a loop */
+#define XLNX_BENCH_ABR_FRAMES    XLNX_BENCH_MUX_FRAMES
+
+/* Library entry points without a public prototype */
+const char* AVCFindStartCode(const char *p, const char *end);
+int loadyuv(char *ybuf, char *uvbuf, FILE *hInputYUVFile);
+
+typedef enum {
+    XLNX_BENCH_CYCLES_NONE = 0,
+    XLNX_BENCH_CYCLES_PERF,
+    XLNX_BENCH_CYCLES_PERF_USER,
+    XLNX_BENCH_CYCLES_TSC
+} XlnxBenchCyclesSource;
+
+static const char *xlnx_bench_cycles_names[] = {
+    "none", "perf", "perf-user", "tsc"
+};
+
+typedef struct XlnxBench XlnxBench;
+
+/* Drives one encoder channel from its own thread, see xlnx_bench_workers_run */
+typedef struct {
+    XlnxBench  *bench;
+    int32_t    idx;
+    uint64_t   gen;
+    pthread_t  thread;
+} XlnxBenchWorker;
+
+typedef struct {
+    const char *name;
+    /* Builds the inputs and sets bytes, 0 on success */
+    int32_t    (*setup)(XlnxBench *bench);
+    /* Untimed, runs before every op, may be NULL */
+    void       (*reset)(XlnxBench *bench);
+    void       (*run)(XlnxBench *bench);
+} XlnxBenchDef;
+
+struct XlnxBench {
+    const XlnxBenchDef *def;
+    size_t             bytes;      /* input bytes one op processes */
+    size_t             items;      /* frames, channels or setups per op */
+    uint8_t            *src;
+    size_t             src_size;
+    uint8_t            *dst;
+    FILE               *file;
+    char               path[XLNX_BENCH_NAME_SIZE];
+    int32_t            reader_open;
+    XlnxSceneDetector  *scene_det;
+    XlnxEncoderConfig  cfg;
+    uint64_t           frame_num;
+    uint64_t           sink;
+    /* Set by a run that went wrong, the case is then reported as failed */
+    int32_t            failed;
+    XlnxEncoderHandle  *enc[XLNX_BENCH_MAX_CHANNELS];
+    int32_t            num_enc;
+    XlnxEncoderConfig  cfgs[XLNX_BENCH_MAX_CHANNELS];
+    XlnxEncoderGroup   *group;
+    XlnxEncoderPool    *pool;
+    xrmContext         *xrm_ctx;
+    xrmPluginFuncParam *plg_param;
+    XmaEncoderProperties enc_props;
+    XmaFilterProperties la_props;
+    int32_t            au_size[XLNX_BENCH_MUX_FRAMES];
+    size_t             au_offset[XLNX_BENCH_MUX_FRAMES];
+    XlnxAbrLadder      *ladders[XLNX_BENCH_MAX_CHANNELS];
+    int32_t            num_ladders;
+    size_t             pkt_size;   /* dst bytes per channel */
+    XlnxBenchWorker    workers[XLNX_BENCH_MAX_CHANNELS];
+    int32_t            num_workers;
+    pthread_mutex_t    lock;
+    pthread_cond_t     go;
+    pthread_cond_t     idle;
+    uint64_t           gen;
+    int32_t            pending;
+    int32_t            stop;
+};
+
+typedef struct {
+    char     name[XLNX_BENCH_NAME_SIZE];
+    size_t   bytes;
+    size_t   items;
+    int32_t  samples;
+    double   ns_median;
+    double   ns_min;
+    double   ns_mean;
+    double   ns_p90;
+    double   ns_stddev;
+    double   gb_per_s;
+    double   cycles_per_byte;
+    double   items_per_s;
+    double   cpu_us_per_item;    /* process CPU time, all threads */
+} XlnxBenchResult;
+
+typedef struct {
+    int32_t     min_samples;
+    int64_t     min_time_ns;
+    int64_t     warmup_ns;
+    uint64_t    seed;
+    const char  *filter;
+    const char  *csv_path;
+    const char  *baseline_path;
+    double      threshold_pct;
+    int32_t     list_only;
+} XlnxBenchOptions;
+
+static uint64_t xlnx_bench_rng;
+static int xlnx_bench_perf_fd = -1;
+static XlnxBenchCyclesSource xlnx_bench_cycles_source;
+
+/* xorshift64*, so every run sees the same inputs for a given seed */
+static uint64_t xlnx_bench_rand()
+{
+    xlnx_bench_rng ^= xlnx_bench_rng >> 12;
+    xlnx_bench_rng ^= xlnx_bench_rng << 25;
+    xlnx_bench_rng ^= xlnx_bench_rng >> 27;
+    return xlnx_bench_rng * 0x2545F4914F6CDD1DULL;
+}
+
+static int64_t xlnx_bench_now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* CPU time of every thread of the process, including library threads */
+static int64_t xlnx_bench_cpu_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int xlnx_bench_perf_open(int32_t exclude_kernel)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Core cycles from perf when the kernel allows it, else the TSC, which
+   ticks at a fixed reference rate */
+static void xlnx_bench_cycles_init()
+{
+    xlnx_bench_perf_fd = xlnx_bench_perf_open(0);
+    if(xlnx_bench_perf_fd >= 0) {
+        xlnx_bench_cycles_source = XLNX_BENCH_CYCLES_PERF;
+        return;
+    }
+    xlnx_bench_perf_fd = xlnx_bench_perf_open(1);
+    if(xlnx_bench_perf_fd >= 0) {
+        xlnx_bench_cycles_source = XLNX_BENCH_CYCLES_PERF_USER;
+        return;
+    }
+#ifdef XLNX_BENCH_HAVE_TSC
+    xlnx_bench_cycles_source = XLNX_BENCH_CYCLES_TSC;
+#else
+    xlnx_bench_cycles_source = XLNX_BENCH_CYCLES_NONE;
+#endif
+}
+
+static uint64_t xlnx_bench_cycles()
+{
+    uint64_t count = 0;
+
+    switch(xlnx_bench_cycles_source) {
+        case XLNX_BENCH_CYCLES_PERF:
+        case XLNX_BENCH_CYCLES_PERF_USER:
+            if(read(xlnx_bench_perf_fd, &count, sizeof(count)) !=
+                                                        sizeof(count)) {
+                count = 0;
+            }
+            break;
+#ifdef XLNX_BENCH_HAVE_TSC
+        case XLNX_BENCH_CYCLES_TSC:
+            count = __rdtsc();
+            break;
+#endif
+        default:
+            break;
+    }
+    return count;
+}
+
+static void xlnx_bench_fill(uint8_t *buf, size_t size)
+{
+    uint64_t r = 0;
+
+    for(size_t i = 0; i < size; i++) {
+        if((i & 7) == 0) {
+            r = xlnx_bench_rand();
+        }
+        buf[i] = (uint8_t)(r >> ((i & 7) * 8));
+    }
+}
+
+/* Annex B stream of NALs with random sizes. Payloads never hold two zero
+   bytes in a row, as after emulation prevention. */
+static size_t xlnx_bench_fill_annexb(uint8_t *buf, size_t size)
+{
+    size_t pos = 0;
+    size_t nal_size;
+    size_t end;
+
+    while(pos + 5 + XLNX_BENCH_MIN_NAL <= size) {
+        nal_size = XLNX_BENCH_MIN_NAL + xlnx_bench_rand() %
+                   (XLNX_BENCH_MAX_NAL - XLNX_BENCH_MIN_NAL);
+        if(xlnx_bench_rand() & 1) {
+            buf[pos++] = 0;
+        }
+        buf[pos++] = 0;
+        buf[pos++] = 0;
+        buf[pos++] = 1;
+        end = (pos + nal_size < size) ? pos + nal_size : size;
+        /* forbidden_zero_bit clear, nal_ref_idc 3, slice types 1 or 5 */
+        buf[pos++] = (xlnx_bench_rand() & 1) ? 0x65 : 0x61;
+        for(; pos < end; pos++) {
+            buf[pos] = (uint8_t)xlnx_bench_rand();
+            if(buf[pos] == 0 && buf[pos - 1] == 0) {
+                buf[pos] = 1;
+            }
+        }
+        /* A trailing zero would merge into the next start code */
+        if(buf[pos - 1] == 0) {
+            buf[pos - 1] = 0x80;
+        }
+    }
+    return pos;
+}
+
+static int32_t xlnx_bench_alloc(XlnxBench *bench, size_t src_size,
+                                size_t dst_size)
+{
+    bench->src = malloc(src_size);
+    bench->dst = malloc(dst_size);
+    if(!bench->src || !bench->dst) {
+        return -1;
+    }
+    bench->src_size = src_size;
+    xlnx_bench_fill(bench->src, src_size);
+    memset(bench->dst, 0, dst_size);
+    return 0;
+}
+
+/* Temporary file holding size bytes of src, left open for reading */
+static int32_t xlnx_bench_temp_file(XlnxBench *bench, size_t size,
+                                    const char *mode)
+{
+    int fd;
+
+    snprintf(bench->path, sizeof(bench->path), "/tmp/xlnx_bench_XXXXXX");
+    fd = mkstemp(bench->path);
+    if(fd < 0) {
+        bench->path[0] = '\0';
+        return -1;
+    }
+    bench->file = fdopen(fd, mode);
+    if(!bench->file) {
+        close(fd);
+        return -1;
+    }
+    if(size && (fwrite(bench->src, 1, size, bench->file) != size ||
+                fflush(bench->file) != 0)) {
+        return -1;
+    }
+    rewind(bench->file);
+    return 0;
+}
+
+static void xlnx_bench_workers_stop(XlnxBench *bench)
+{
+    pthread_mutex_lock(&bench->lock);
+    bench->stop = 1;
+    pthread_cond_broadcast(&bench->go);
+    pthread_mutex_unlock(&bench->lock);
+    for(int32_t i = 0; i < bench->num_workers; i++) {
+        pthread_join(bench->workers[i].thread, NULL);
+    }
+    bench->num_workers = 0;
+}
+
+static void xlnx_bench_teardown(XlnxBench *bench)
+{
+    xlnx_bench_workers_stop(bench);
+    for(int32_t i = 0; i < bench->num_enc; i++) {
+        Encoder_Close(bench->enc[i]);
+    }
+    for(int32_t i = 0; i < bench->num_ladders; i++) {
+        AbrLadder_Close(bench->ladders[i]);
+    }
+    EncoderGroup_Close(bench->group);
+    Encoder_PoolDestroy(bench->pool);
+    if(bench->xrm_ctx) {
+        xrmDestroyContext(bench->xrm_ctx);
+    }
+    free(bench->plg_param);
+    pthread_cond_destroy(&bench->idle);
+    pthread_cond_destroy(&bench->go);
+    pthread_mutex_destroy(&bench->lock);
+    if(bench->reader_open) {
+        H264FrameReader_Free();
+    }
+    if(bench->file) {
+        fclose(bench->file);
+    }
+    if(bench->path[0]) {
+        unlink(bench->path);
+    }
+    xlnx_scene_detector_destroy(bench->scene_det);
+    free(bench->src);
+    free(bench->dst);
+}
+
+static void xlnx_bench_rewind(XlnxBench *bench)
+{
+    rewind(bench->file);
+}
+
+static int32_t xlnx_bench_stream_setup(XlnxBench *bench)
+{
+    if(xlnx_bench_alloc(bench, XLNX_BENCH_STREAM_SIZE,
+                        XLNX_BENCH_STREAM_SIZE) != 0) {
+        return -1;
+    }
+    bench->bytes = xlnx_bench_fill_annexb(bench->src, bench->src_size);
+    return 0;
+}
+
+static void xlnx_bench_start_code_run(XlnxBench *bench)
+{
+    const char *p = (const char *)bench->src;
+    const char *end = p + bench->bytes;
+
+    while((p = AVCFindStartCode(p, end)) < end) {
+        bench->sink++;
+        p += 3;
+    }
+}
+
+static int32_t xlnx_bench_reader_setup(XlnxBench *bench)
+{
+    if(xlnx_bench_stream_setup(bench) != 0) {
+        return -1;
+    }
+    return xlnx_bench_temp_file(bench, bench->bytes, "w+b");
+}
+
+/* The reader loads the whole file on init, outside the timed op */
+static void xlnx_bench_reader_reset(XlnxBench *bench)
+{
+    if(bench->reader_open) {
+        H264FrameReader_Free();
+    }
+    bench->reader_open = (H264FrameReader_Init(bench->path) > 0);
+}
+
+static void xlnx_bench_reader_run(XlnxBench *bench)
+{
+    int size = 0;
+
+    while(H264FrameReader_ReadFrame(bench->dst, &size)) {
+        bench->sink += size;
+    }
+}
+
+static int32_t xlnx_bench_unpad_setup(XlnxBench *bench)
+{
+    size_t aligned =
+        (size_t)XLNX_BENCH_ALIGN(XLNX_BENCH_WIDTH, XLNX_BENCH_STRIDE_ALIGN) *
+        XLNX_BENCH_ALIGN(XLNX_BENCH_HEIGHT, XLNX_BENCH_HEIGHT_ALIGN);
+
+    bench->bytes = (size_t)XLNX_BENCH_WIDTH * XLNX_BENCH_HEIGHT * 3 / 2;
+    return xlnx_bench_alloc(bench, aligned * 3 / 2, bench->bytes);
+}
+
+static void xlnx_bench_unpad_run(XlnxBench *bench)
+{
+    bench->sink += xlnx_yuv_nv12_unpad(bench->src,
+                       XLNX_BENCH_ALIGN(XLNX_BENCH_WIDTH,
+                                        XLNX_BENCH_STRIDE_ALIGN),
+                       XLNX_BENCH_ALIGN(XLNX_BENCH_HEIGHT,
+                                        XLNX_BENCH_HEIGHT_ALIGN),
+                       XLNX_BENCH_WIDTH, XLNX_BENCH_HEIGHT, bench->dst);
+}
+
+static int32_t xlnx_bench_write_setup(XlnxBench *bench)
+{
+    if(xlnx_bench_unpad_setup(bench) != 0) {
+        return -1;
+    }
+    return xlnx_bench_temp_file(bench, 0, "w+b");
+}
+
+/* Rewrites the same file region, as dec_write_host_buffer_to_file does per
+   frame, including its flush */
+static void xlnx_bench_write_run(XlnxBench *bench)
+{
+    xlnx_yuv_nv12_write_unpadded(bench->src,
+        XLNX_BENCH_ALIGN(XLNX_BENCH_WIDTH, XLNX_BENCH_STRIDE_ALIGN),
+        XLNX_BENCH_ALIGN(XLNX_BENCH_HEIGHT, XLNX_BENCH_HEIGHT_ALIGN),
+        XLNX_BENCH_WIDTH, XLNX_BENCH_HEIGHT, bench->file);
+    fflush(bench->file);
+}
+
+/* loadyuv reads one 1920x1080 NV12 frame */
+static int32_t xlnx_bench_loadyuv_setup(XlnxBench *bench)
+{
+    bench->bytes = (size_t)XLNX_BENCH_WIDTH * XLNX_BENCH_HEIGHT * 3 / 2;
+    if(xlnx_bench_alloc(bench, bench->bytes, bench->bytes) != 0) {
+        return -1;
+    }
+    return xlnx_bench_temp_file(bench, bench->bytes, "r+b");
+}
+
+static void xlnx_bench_loadyuv_run(XlnxBench *bench)
+{
+    loadyuv((char *)bench->dst,
+            (char *)bench->dst + XLNX_BENCH_WIDTH * XLNX_BENCH_HEIGHT,
+            bench->file);
+}
+
+static int32_t xlnx_bench_options_setup(XlnxBench *bench, int32_t codec_id)
+{
+    int len;
+
+    Encoder_ConfigInit(&bench->cfg);
+    bench->cfg.codec_id = codec_id;
+    bench->cfg.width = XLNX_BENCH_WIDTH;
+    bench->cfg.height = XLNX_BENCH_HEIGHT;
+    if(xlnx_bench_alloc(bench, 1, XLNX_BENCH_OPTIONS_SIZE) != 0) {
+        return -1;
+    }
+    len = Encoder_GetOptions(&bench->cfg, (char *)bench->dst,
+                             XLNX_BENCH_OPTIONS_SIZE);
+    if(len <= 0) {
+        return -1;
+    }
+    bench->bytes = len;
+    return 0;
+}
+
+static int32_t xlnx_bench_options_h264_setup(XlnxBench *bench)
+{
+    return xlnx_bench_options_setup(bench, 0);
+}
+
+static int32_t xlnx_bench_options_hevc_setup(XlnxBench *bench)
+{
+    return xlnx_bench_options_setup(bench, 1);
+}
+
+static void xlnx_bench_options_run(XlnxBench *bench)
+{
+    bench->sink += Encoder_GetOptions(&bench->cfg, (char *)bench->dst,
+                                      XLNX_BENCH_OPTIONS_SIZE);
+}
+
+/* One 1080p chroma plane pair in, one NV12 UV plane out */
+static int32_t xlnx_bench_interleave_setup(XlnxBench *bench)
+{
+    size_t count = (size_t)XLNX_BENCH_WIDTH / 2 * XLNX_BENCH_HEIGHT / 2;
+
+    bench->bytes = 2 * count;
+    return xlnx_bench_alloc(bench, 2 * count, 2 * count);
+}
+
+static void xlnx_bench_interleave_c_run(XlnxBench *bench)
+{
+    xlnx_yuv_interleave_uv_c(bench->src, bench->src + bench->bytes / 2,
+                             bench->dst, bench->bytes / 2);
+}
+
+static void xlnx_bench_interleave_run(XlnxBench *bench)
+{
+    xlnx_yuv_interleave_uv(bench->src, bench->src + bench->bytes / 2,
+                           bench->dst, bench->bytes / 2);
+}
+
+static int32_t xlnx_bench_i420_setup(XlnxBench *bench, int32_t width,
+                                     int32_t height)
+{
+    bench->bytes = (size_t)width * height / 2;
+    bench->cfg.width = width;
+    bench->cfg.height = height;
+    return xlnx_bench_alloc(bench, bench->bytes, bench->bytes);
+}
+
+static int32_t xlnx_bench_i420_1080p_setup(XlnxBench *bench)
+{
+    return xlnx_bench_i420_setup(bench, XLNX_BENCH_WIDTH, XLNX_BENCH_HEIGHT);
+}
+
+static int32_t xlnx_bench_i420_2160p_setup(XlnxBench *bench)
+{
+    return xlnx_bench_i420_setup(bench, XLNX_BENCH_WIDTH_4K,
+                                 XLNX_BENCH_HEIGHT_4K);
+}
+
+static void xlnx_bench_i420_run(XlnxBench *bench)
+{
+    int32_t width = bench->cfg.width;
+    int32_t height = bench->cfg.height;
+
+    xlnx_yuv_i420_to_nv12_uv(bench->src, bench->src + bench->bytes / 2,
+                             width / 2, bench->dst, width, width, height);
+}
+
+/* Alternates two luma planes so every frame differs from the last */
+static int32_t xlnx_bench_scene_setup(XlnxBench *bench)
+{
+    bench->bytes = (size_t)XLNX_BENCH_WIDTH * XLNX_BENCH_HEIGHT;
+    if(xlnx_bench_alloc(bench, 2 * bench->bytes, 1) != 0) {
+        return -1;
+    }
+    bench->scene_det = xlnx_scene_detector_create(XLNX_BENCH_WIDTH,
+                                                  XLNX_BENCH_HEIGHT, 40);
+    return bench->scene_det ? 0 : -1;
+}
+
+static void xlnx_bench_scene_run(XlnxBench *bench)
+{
+    const uint8_t *luma = bench->src + (bench->frame_num++ & 1) * bench->bytes;
+
+    bench->sink += xlnx_scene_detector_process(bench->scene_det, luma,
+                                               XLNX_BENCH_WIDTH);
+}
+
+/* Opens count H264 channels of width x height at fps with a lookahead of
+   la_depth frames, 0 = off. src holds the NV12 frame they all encode, dst
+   one packet buffer per channel. Needs a device or a SIM=1 build. */
+static int32_t xlnx_bench_enc_open(XlnxBench *bench, int32_t count,
+                                   int32_t width, int32_t height, int32_t fps,
+                                   int32_t la_depth)
+{
+    size_t frame_size = (size_t)width * height * 3 / 2;
+
+    Encoder_ConfigInit(&bench->cfg);
+    bench->cfg.width = width;
+    bench->cfg.height = height;
+    bench->cfg.fps = fps;
+    bench->cfg.lookahead_depth = la_depth;
+    bench->pkt_size = frame_size + XLNX_BENCH_PACKET_HDR;
+    if(xlnx_bench_alloc(bench, frame_size, count * bench->pkt_size) != 0) {
+        return -1;
+    }
+    for(int32_t i = 0; i < count; i++) {
+        bench->enc[i] = Encoder_Open(&bench->cfg);
+        if(!bench->enc[i]) {
+            return -1;
+        }
+        bench->num_enc++;
+    }
+    bench->bytes = count * frame_size;
+    bench->items = count;
+    return 0;
+}
+
+/* Encodes the next frame on channel idx, its packet, if any, lands in dst */
+static int32_t xlnx_bench_enc_frame(XlnxBench *bench, int32_t idx)
+{
+    size_t luma = (size_t)bench->cfg.width * bench->cfg.height;
+    int len = 0;
+
+    if(Encoder_EncodeFrame(bench->enc[idx], (char *)bench->src,
+                           (char *)bench->src + luma,
+                           (char *)bench->dst + idx * bench->pkt_size,
+                           &len) != 0) {
+        __atomic_store_n(&bench->failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return len;
+}
+
+static void xlnx_bench_abr_packet(void *opaque, int rendition, 
+                                  const char *data, int size)
+{
+    XlnxBench *bench = opaque;
+
+    __atomic_fetch_add(&bench->sink, size, __ATOMIC_RELAXED);
+}
+
+/* Sends the next access unit of the looped GOP to ladder idx */
+static void xlnx_bench_abr_frame(XlnxBench *bench, int32_t idx)
+{
+    int32_t au = bench->frame_num % XLNX_BENCH_ABR_FRAMES;
+
+    if(AbrLadder_SendData(bench->ladders[idx], 
+                          bench->dst + bench->au_offset[au], 
+                          bench->au_size[au], xlnx_bench_abr_packet, 
+                          bench) != 0) {
+        __atomic_store_n(&bench->failed, 1, __ATOMIC_RELAXED);
+    }
+}
+
+static void *xlnx_bench_worker(void *arg)
+{
+    XlnxBenchWorker *worker = arg;
+    XlnxBench *bench = worker->bench;
+
+    pthread_mutex_lock(&bench->lock);
+    for(;;) {
+        while(worker->gen == bench->gen && !bench->stop) {
+            pthread_cond_wait(&bench->go, &bench->lock);
+        }
+        if(bench->stop) {
+            break;
+        }
+        worker->gen = bench->gen;
+        pthread_mutex_unlock(&bench->lock);
+        if(bench->num_ladders) {
+            xlnx_bench_abr_frame(bench, worker->idx);
+        } else {
+            xlnx_bench_enc_frame(bench, worker->idx);
+        }
+        pthread_mutex_lock(&bench->lock);
+        if(--bench->pending == 0) {
+            pthread_cond_signal(&bench->idle);
+        }
+    }
+    pthread_mutex_unlock(&bench->lock);
+    return NULL;
+}
+
+/* One thread per channel or ladder, as the handle API expects */
+static int32_t xlnx_bench_workers_start(XlnxBench *bench)
+{
+    XlnxBenchWorker *worker;
+
+    for(int32_t i = 0; i < bench->num_enc + bench->num_ladders; i++) {
+        worker = &bench->workers[i];
+        worker->bench = bench;
+        worker->idx = i;
+        worker->gen = bench->gen;
+        if(pthread_create(&worker->thread, NULL, xlnx_bench_worker,
+                          worker) != 0) {
+            return -1;
+        }
+        bench->num_workers++;
+    }
+    return 0;
+}
+
+/* Every channel encodes one frame, all at the same time */
+static void xlnx_bench_workers_run(XlnxBench *bench)
+{
+    pthread_mutex_lock(&bench->lock);
+    bench->gen++;
+    bench->pending = bench->num_workers;
+    pthread_cond_broadcast(&bench->go);
+    while(bench->pending > 0) {
+        pthread_cond_wait(&bench->idle, &bench->lock);
+    }
+    pthread_mutex_unlock(&bench->lock);
+}
+
+/* Channel scaling: items/s is the aggregate fps of count 720p30 channels,
+   cpu us/item the host CPU one channel spends per frame */
+static int32_t xlnx_bench_channels_setup(XlnxBench *bench, int32_t count)
+{
+    if(xlnx_bench_enc_open(bench, count, XLNX_BENCH_CH_WIDTH,
+                           XLNX_BENCH_CH_HEIGHT, XLNX_BENCH_CH_FPS, 0) != 0) {
+        return -1;
+    }
+    return xlnx_bench_workers_start(bench);
+}
+
+static int32_t xlnx_bench_channels_1_setup(XlnxBench *bench)
+{
+    return xlnx_bench_channels_setup(bench, 1);
+}
+
+static int32_t xlnx_bench_channels_2_setup(XlnxBench *bench)
+{
+    return xlnx_bench_channels_setup(bench, 2);
+}
+
+static int32_t xlnx_bench_channels_4_setup(XlnxBench *bench)
+{
+    return xlnx_bench_channels_setup(bench, 4);
+}
+
+static int32_t xlnx_bench_channels_8_setup(XlnxBench *bench)
+{
+    return xlnx_bench_channels_setup(bench, 8);
+}
+
+static int32_t xlnx_bench_channels_16_setup(XlnxBench *bench)
+{
+    return xlnx_bench_channels_setup(bench, 16);
+}
+
+/* Bitrate change on a live 720p30 channel: Encoder_Reconfigure against 
+   closing and reopening the channel with the new bitrate. The frame that
+   picks up the change is encoded in the untimed reset, so an op is the 
+   control path alone. */
+static int32_t xlnx_bench_bitrate_setup(XlnxBench *bench)
+{
+    if(xlnx_bench_enc_open(bench, 1, XLNX_BENCH_CH_WIDTH, 
+                           XLNX_BENCH_CH_HEIGHT, XLNX_BENCH_CH_FPS, 0) != 0) {
+        return -1;
+    }
+    bench->cfg.bit_rate = XLNX_BENCH_BITRATE_LOW;
+    bench->bytes = 0;
+    bench->items = 1;
+    return 0;
+}
+
+static void xlnx_bench_bitrate_reset(XlnxBench *bench)
+{
+    if(bench->num_enc) {
+        xlnx_bench_enc_frame(bench, 0);
+    }
+}
+
+/* Alternates between the two bitrates so every op is a real change */
+static int64_t xlnx_bench_next_bitrate(XlnxBench *bench)
+{
+    bench->cfg.bit_rate = bench->cfg.bit_rate == XLNX_BENCH_BITRATE_LOW ?
+                          XLNX_BENCH_BITRATE_HIGH : XLNX_BENCH_BITRATE_LOW;
+    return bench->cfg.bit_rate;
+}
+
+static void xlnx_bench_reconfigure_run(XlnxBench *bench)
+{
+    XlnxEncoderDynParams params;
+
+    memset(&params, 0, sizeof(params));
+    params.bit_rate = xlnx_bench_next_bitrate(bench);
+    if(Encoder_Reconfigure(bench->enc[0], &params) != 0) {
+        bench->failed = 1;
+    }
+}
+
+static void xlnx_bench_reinit_run(XlnxBench *bench)
+{
+    xlnx_bench_next_bitrate(bench);
+    Encoder_Close(bench->enc[0]);
+    bench->enc[0] = Encoder_Open(&bench->cfg);
+    if(!bench->enc[0]) {
+        bench->num_enc = 0;
+        bench->failed = 1;
+    }
+}
+
+/* Channel open time: Encoder_OpenPreset, which copies the cached preset
+   properties, against Encoder_Open of the same preset config, which 
+   derives them again. The previous channel is closed in the untimed 
+   reset. */
+static int32_t xlnx_bench_open_setup(XlnxBench *bench)
+{
+    Encoder_ConfigInit(&bench->cfg);
+    if(Encoder_ConfigPreset(&bench->cfg, XLNX_BENCH_PRESET) != 0) {
+        return -1;
+    }
+    bench->items = 1;
+    return 0;
+}
+
+static void xlnx_bench_open_reset(XlnxBench *bench)
+{
+    if(bench->num_enc) {
+        Encoder_Close(bench->enc[0]);
+        bench->num_enc = 0;
+    }
+}
+
+static void xlnx_bench_open_preset_run(XlnxBench *bench)
+{
+    bench->enc[0] = Encoder_OpenPreset(XLNX_BENCH_PRESET, -1);
+    if(!bench->enc[0]) {
+        bench->failed = 1;
+        return;
+    }
+    bench->num_enc = 1;
+}
+
+static void xlnx_bench_open_config_run(XlnxBench *bench)
+{
+    bench->enc[0] = Encoder_Open(&bench->cfg);
+    if(!bench->enc[0]) {
+        bench->failed = 1;
+        return;
+    }
+    bench->num_enc = 1;
+}
+
+/* Achieved fps of one channel fed as fast as it takes frames, items/s 
+   against the target rate of the config. Cores and slices are left to 
+   the encoder's pick from resolution and frame rate. */
+static int32_t xlnx_bench_fps_1080p30_setup(XlnxBench *bench)
+{
+    return xlnx_bench_enc_open(bench, 1, 1920, 1080, 30, 0);
+}
+
+static int32_t xlnx_bench_fps_1080p60_setup(XlnxBench *bench)
+{
+    return xlnx_bench_enc_open(bench, 1, 1920, 1080, 60, 0);
+}
+
+static int32_t xlnx_bench_fps_2160p30_setup(XlnxBench *bench)
+{
+    return xlnx_bench_enc_open(bench, 1, 3840, 2160, 30, 0);
+}
+
+static int32_t xlnx_bench_fps_2160p60_setup(XlnxBench *bench)
+{
+    return xlnx_bench_enc_open(bench, 1, 3840, 2160, 60, 0);
+}
+
+/* The same channel with the full lookahead window: the throughput cost of
+   routing every frame through the lookahead CU. The bitrate it saves at
+   equal quality needs real content and a card, the simulator emits dummy
+   packets sized by the target bit rate. */
+static int32_t xlnx_bench_la_1080p30_setup(XlnxBench *bench)
+{
+    return xlnx_bench_enc_open(bench, 1, 1920, 1080, 30,
+                               XLNX_BENCH_LA_DEPTH);
+}
+
+static int32_t xlnx_bench_la_1080p60_setup(XlnxBench *bench)
+{
+    return xlnx_bench_enc_open(bench, 1, 1920, 1080, 60,
+                               XLNX_BENCH_LA_DEPTH);
+}
+
+static void xlnx_bench_fps_run(XlnxBench *bench)
+{
+    xlnx_bench_enc_frame(bench, 0);
+}
+
+/* Starting count 720p30 channels one Encoder_Open at a time against one
+   EncoderGroup_Open. Everything is closed in the untimed reset, items/s 
+   is channels started per second. */
+static int32_t xlnx_bench_start_setup(XlnxBench *bench, int32_t count)
+{
+    Encoder_ConfigInit(&bench->cfg);
+    bench->cfg.width = XLNX_BENCH_CH_WIDTH;
+    bench->cfg.height = XLNX_BENCH_CH_HEIGHT;
+    bench->cfg.fps = XLNX_BENCH_CH_FPS;
+    bench->cfg.lookahead_depth = 0;
+    for(int32_t i = 0; i < count; i++) {
+        bench->cfgs[i] = bench->cfg;
+    }
+    bench->items = count;
+    return 0;
+}
+
+static int32_t xlnx_bench_start_4_setup(XlnxBench *bench)
+{
+    return xlnx_bench_start_setup(bench, 4);
+}
+
+static int32_t xlnx_bench_start_16_setup(XlnxBench *bench)
+{
+    return xlnx_bench_start_setup(bench, 16);
+}
+
+static void xlnx_bench_start_reset(XlnxBench *bench)
+{
+    for(int32_t i = 0; i < bench->num_enc; i++) {
+        Encoder_Close(bench->enc[i]);
+    }
+    bench->num_enc = 0;
+    EncoderGroup_Close(bench->group);
+    bench->group = NULL;
+}
+
+static void xlnx_bench_start_single_run(XlnxBench *bench)
+{
+    for(size_t i = 0; i < bench->items; i++) {
+        bench->enc[i] = Encoder_Open(&bench->cfg);
+        if(!bench->enc[i]) {
+            bench->failed = 1;
+            return;
+        }
+        bench->num_enc++;
+    }
+}
+
+static void xlnx_bench_start_group_run(XlnxBench *bench)
+{
+    bench->group = EncoderGroup_Open(bench->cfgs, bench->items);
+    if(!bench->group) {
+        bench->failed = 1;
+    }
+}
+
+/* Time to first packet of a live-1080p-lowlat channel, opened with 
+   Encoder_OpenPreset or acquired from a warm pool. The channel is closed
+   or released in the untimed reset. On the simulator the frames of the 
+   previous op still hold the CU, run with XLNX_SIM_SPEED=0 to see the 
+   open path alone. */
+static int32_t xlnx_bench_first_setup(XlnxBench *bench)
+{
+    size_t frame_size;
+
+    Encoder_ConfigInit(&bench->cfg);
+    if(Encoder_ConfigPreset(&bench->cfg, XLNX_BENCH_LOWLAT_PRESET) != 0) {
+        return -1;
+    }
+    frame_size = (size_t)bench->cfg.width * bench->cfg.height * 3 / 2;
+    bench->pkt_size = frame_size + XLNX_BENCH_PACKET_HDR;
+    if(xlnx_bench_alloc(bench, frame_size, bench->pkt_size) != 0) {
+        return -1;
+    }
+    bench->items = 1;
+    return 0;
+}
+
+static int32_t xlnx_bench_first_pool_setup(XlnxBench *bench)
+{
+    const char *preset = XLNX_BENCH_LOWLAT_PRESET;
+
+    if(xlnx_bench_first_setup(bench) != 0) {
+        return -1;
+    }
+    bench->pool = Encoder_PoolCreate(&preset, 1, 1, -1);
+    return bench->pool ? 0 : -1;
+}
+
+static void xlnx_bench_first_reset(XlnxBench *bench)
+{
+    if(!bench->num_enc) {
+        return;
+    }
+    if(bench->pool) {
+        Encoder_PoolRelease(bench->pool, bench->enc[0]);
+    } else {
+        Encoder_Close(bench->enc[0]);
+    }
+    bench->num_enc = 0;
+}
+
+/* Feeds frames to the new channel until a packet comes out */
+static void xlnx_bench_first_packet(XlnxBench *bench)
+{
+    int32_t len = 0;
+
+    if(!bench->enc[0]) {
+        bench->failed = 1;
+        return;
+    }
+    bench->num_enc = 1;
+    for(int32_t i = 0; i < XLNX_BENCH_FIRST_FRAMES && len == 0; i++) {
+        len = xlnx_bench_enc_frame(bench, 0);
+    }
+    if(len <= 0) {
+        bench->failed = 1;
+    }
+}
+
+static void xlnx_bench_first_open_run(XlnxBench *bench)
+{
+    bench->enc[0] = Encoder_OpenPreset(XLNX_BENCH_LOWLAT_PRESET, -1);
+    xlnx_bench_first_packet(bench);
+}
+
+static void xlnx_bench_first_pool_run(XlnxBench *bench)
+{
+    bench->enc[0] = Encoder_PoolAcquire(bench->pool, 
+                                        XLNX_BENCH_LOWLAT_PRESET);
+    xlnx_bench_first_packet(bench);
+}
+
+/* Encoder plus lookahead load lookups of XLNX_BENCH_SETUPS channel 
+   setups, the way every setup did them before the cache against 
+   xlnx_xrm_load_query */
+static int32_t xlnx_bench_xrm_load_setup(XlnxBench *bench)
+{
+    bench->xrm_ctx = (xrmContext *)xrmCreateContext(XRM_API_VERSION_1);
+    if(!bench->xrm_ctx) {
+        return -1;
+    }
+    bench->plg_param = calloc(1, sizeof(*bench->plg_param));
+    if(!bench->plg_param) {
+        return -1;
+    }
+    bench->enc_props.width = XLNX_BENCH_WIDTH;
+    bench->enc_props.height = XLNX_BENCH_HEIGHT;
+    bench->enc_props.framerate.numerator = 60;
+    bench->enc_props.framerate.denominator = 1;
+    bench->la_props.input.width = XLNX_BENCH_WIDTH;
+    bench->la_props.input.height = XLNX_BENCH_HEIGHT;
+    bench->la_props.input.framerate = bench->enc_props.framerate;
+    bench->items = XLNX_BENCH_SETUPS;
+    return 0;
+}
+
+/* dlopen, convert, dlclose, ask the plugin and strtok its answer */
+static int32_t xlnx_bench_xrm_load_old(XlnxBench *bench, const char *kind, 
+                                       void *props, int32_t skip)
+{
+    xrmPluginFuncParam *plg_param = bench->plg_param;
+    void (*convert)(void *props, char *func_name, char *json_job);
+    char *token;
+    void *handle;
+
+    memset(plg_param, 0, sizeof(*plg_param));
+    handle = dlopen(XMA_PROPS_TO_JSON_SO, RTLD_NOW);
+    if(!handle) {
+        return -1;
+    }
+    convert = dlsym(handle, "convertXmaPropsToJson");
+    if(!convert) {
+        dlclose(handle);
+        return -1;
+    }
+    convert(props, (char *)kind, plg_param->input);
+    dlclose(handle);
+    if(xrmExecPluginFunc(bench->xrm_ctx, "xrmU30EncPlugin", 0, 
+                         plg_param) != XRM_SUCCESS) {
+        return -1;
+    }
+    token = strtok(plg_param->output, " ");
+    while(token && skip-- > 0) {
+        token = strtok(NULL, " ");
+    }
+    return token ? atoi(token) : -1;
+}
+
+static void xlnx_bench_xrm_uncached_run(XlnxBench *bench)
+{
+    int32_t enc_load;
+    int32_t la_load;
+
+    for(int32_t i = 0; i < XLNX_BENCH_SETUPS; i++) {
+        enc_load = xlnx_bench_xrm_load_old(bench, "ENCODER", 
+                                           &bench->enc_props, 0);
+        la_load = xlnx_bench_xrm_load_old(bench, "LOOKAHEAD", 
+                                          &bench->la_props, 2);
+        if(enc_load < 0 || la_load < 0) {
+            bench->failed = 1;
+            return;
+        }
+        bench->sink += enc_load + la_load;
+    }
+}
+
+static void xlnx_bench_xrm_cached_run(XlnxBench *bench)
+{
+    XlnxXrmLoad enc_load;
+    XlnxXrmLoad la_load;
+
+    for(int32_t i = 0; i < XLNX_BENCH_SETUPS; i++) {
+        if(xlnx_xrm_load_query(bench->xrm_ctx, "xrmU30EncPlugin", "ENCODER",
+                               &bench->enc_props, &enc_load) != 0 ||
+           xlnx_xrm_load_query(bench->xrm_ctx, "xrmU30EncPlugin", 
+                               "LOOKAHEAD", &bench->la_props, 
+                               &la_load) != 0) {
+            bench->failed = 1;
+            return;
+        }
+        bench->sink += enc_load.values[0] + la_load.values[2];
+    }
+}
+
+/* Ladders of the default shape XRM has room for on device 0, where the
+   first channel of the process lands and every later one has to follow */
+static int32_t xlnx_bench_abr_per_card()
+{
+    XlnxCapacityJob job;
+    const char *counts;
+    char *json;
+    int32_t num = -1;
+
+    if(Capacity_ParseJob("abr:h264:1920x1080@60", &job) != 0) {
+        return -1;
+    }
+    json = Capacity_PlanJson(&job, 1, 1);
+    counts = json ? strstr(json, "\"per_device\": [") : NULL;
+    if(!counts || sscanf(counts + strlen("\"per_device\": ["), "%d", 
+                         &num) != 1) {
+        num = -1;
+    }
+    free(json);
+    return num;
+}
+
+/* Renditions per card: as many default ladders (1080p60 H264 in, 1080p, 
+   720p, 480p and 360p out) as one card takes, each fed one access unit 
+   per op from its own thread. items/s is rendition frames per second, 
+   over 60 it is how many renditions the card carries at 1080p60 in real
+   time. The input is encoded here, random data would not decode on a 
+   card. */
+static int32_t xlnx_bench_abr_setup(XlnxBench *bench)
+{
+    XlnxAbrLadderConfig abr;
+    size_t frame_size;
+    size_t luma;
+    size_t room;
+    size_t size = 0;
+    int32_t num_aus = 0;
+    int32_t capacity;
+    int32_t ret;
+    int len;
+
+    AbrLadder_ConfigInit(&abr);
+    capacity = xlnx_bench_abr_per_card();
+    if(capacity <= 0) {
+        return -1;
+    }
+    Encoder_ConfigInit(&bench->cfg);
+    bench->cfg.width = abr.width;
+    bench->cfg.height = abr.height;
+    bench->cfg.fps = abr.fps;
+    bench->cfg.gop_size = XLNX_BENCH_ABR_FRAMES;
+    bench->cfg.num_bframes = 0;
+    bench->cfg.lookahead_depth = 0;
+    bench->enc[0] = Encoder_Open(&bench->cfg);
+    if(!bench->enc[0]) {
+        return -1;
+    }
+    bench->num_enc = 1;
+    luma = (size_t)abr.width * abr.height;
+    frame_size = luma * 3 / 2;
+    room = Encoder_GetMaxPacketSize(bench->enc[0]);
+    if(xlnx_bench_alloc(bench, frame_size, 
+                        XLNX_BENCH_ABR_FRAMES * room) != 0) {
+        return -1;
+    }
+    for(int32_t i = 0; ; i++) {
+        len = 0;
+        if(i < XLNX_BENCH_ABR_FRAMES) {
+            ret = Encoder_EncodeFrame(bench->enc[0], (char *)bench->src,
+                                      (char *)bench->src + luma,
+                                      (char *)bench->dst + size, &len);
+        } else if(Encoder_FlushFrame(bench->enc[0], (char *)bench->dst + 
+                                     size, &len) != 0) {
+            break;
+        } else {
+            ret = 0;
+        }
+        if(ret != 0 || num_aus == XLNX_BENCH_ABR_FRAMES) {
+            return -1;
+        }
+        if(len > 0) {
+            bench->au_offset[num_aus] = size;
+            bench->au_size[num_aus++] = len;
+            size += len;
+        }
+    }
+    Encoder_Close(bench->enc[0]);
+    bench->num_enc = 0;
+    if(num_aus != XLNX_BENCH_ABR_FRAMES) {
+        return -1;
+    }
+
+    for(int32_t i = 0; i < capacity && i < XLNX_BENCH_MAX_CHANNELS; i++) {
+        bench->ladders[i] = AbrLadder_Open(&abr);
+        if(!bench->ladders[i]) {
+            return -1;
+        }
+        bench->num_ladders++;
+    }
+    bench->bytes = bench->num_ladders * size / XLNX_BENCH_ABR_FRAMES;
+    bench->items = bench->num_ladders * abr.num_renditions;
+    return xlnx_bench_workers_start(bench);
+}
+
+static void xlnx_bench_abr_run(XlnxBench *bench)
+{
+    xlnx_bench_workers_run(bench);
+    bench->frame_num++;
+}
+
+/* Encoder shaped access units: an IDR with SPS and PPS every
+   XLNX_BENCH_MUX_GOP frames, P slices in between */
+static int32_t xlnx_bench_mp4_mux_setup(XlnxBench *bench)
+{
+    static const uint8_t sps_pps[] = {
+        0, 0, 0, 1, 0x67, 0x64, 0x00, 0x28, 0xac,
+        0, 0, 0, 1, 0x68, 0xee, 0x3c, 0x80
+    };
+    size_t slot = XLNX_BENCH_MUX_AU_SIZE;
+    const char *p, *end;
+    uint8_t *au;
+    size_t len;
+
+    if(xlnx_bench_alloc(bench, XLNX_BENCH_MUX_FRAMES * slot, 1) != 0) {
+        return -1;
+    }
+    bench->file = fopen("/dev/null", "wb");
+    if(!bench->file) {
+        return -1;
+    }
+    for(int32_t i = 0; i < XLNX_BENCH_MUX_FRAMES; i++) {
+        au = bench->src + i * slot;
+        len = 0;
+        if(i % XLNX_BENCH_MUX_GOP == 0) {
+            memcpy(au, sps_pps, sizeof(sps_pps));
+            len = sizeof(sps_pps);
+        }
+        len += xlnx_bench_fill_annexb(au + len, slot - len);
+        end = (const char *)au + len;
+        /* Slice headers say IDR on key frames only */
+        for(p = AVCFindStartCode((const char *)au, end); p < end;
+            p = AVCFindStartCode(p + 3, end)) {
+            if((uint8_t)p[3] == 0x65 || (uint8_t)p[3] == 0x61) {
+                ((char *)p)[3] = i % XLNX_BENCH_MUX_GOP ? 0x41 : 0x65;
+            }
+        }
+        bench->au_size[i] = len;
+        bench->bytes += len;
+    }
+    bench->items = XLNX_BENCH_MUX_FRAMES;
+    return 0;
+}
+
+/* Init segment and one chunk per access unit, written to /dev/null so the
+   muxer's own CPU cost is what gets measured */
+static void xlnx_bench_mp4_mux_run(XlnxBench *bench)
+{
+    XlnxMp4Mux *mux;
+    int64_t ts;
+
+    mux = Mp4Mux_Open(fileno(bench->file), 0, XLNX_BENCH_WIDTH,
+                      XLNX_BENCH_HEIGHT, 30);
+    if(!mux) {
+        bench->failed = 1;
+        return;
+    }
+    for(int32_t i = 0; i < XLNX_BENCH_MUX_FRAMES; i++) {
+        ts = (int64_t)i * 3000;
+        if(Mp4Mux_WritePacket(mux, (char *)bench->src + i *
+                              XLNX_BENCH_MUX_AU_SIZE, bench->au_size[i], ts,
+                              ts) != 0) {
+            bench->failed = 1;
+            break;
+        }
+    }
+    Mp4Mux_Close(mux);
+}
+
+static const XlnxBenchDef xlnx_benches[] = {
+    {"start_code_scan",      xlnx_bench_stream_setup, NULL,
+                             xlnx_bench_start_code_run},
+    {"h264_reader",          xlnx_bench_reader_setup, xlnx_bench_reader_reset,
+                             xlnx_bench_reader_run},
+    {"dec_unpad_1080p",      xlnx_bench_unpad_setup, NULL,
+                             xlnx_bench_unpad_run},
+    {"dec_write_1080p",      xlnx_bench_write_setup, xlnx_bench_rewind,
+                             xlnx_bench_write_run},
+    {"loadyuv_1080p",        xlnx_bench_loadyuv_setup, xlnx_bench_rewind,
+                             xlnx_bench_loadyuv_run},
+    {"enc_options_h264",     xlnx_bench_options_h264_setup, NULL,
+                             xlnx_bench_options_run},
+    {"enc_options_hevc",     xlnx_bench_options_hevc_setup, NULL,
+                             xlnx_bench_options_run},
+    {"interleave_uv_c",      xlnx_bench_interleave_setup, NULL,
+                             xlnx_bench_interleave_c_run},
+    {"interleave_uv",        xlnx_bench_interleave_setup, NULL,
+                             xlnx_bench_interleave_run},
+    {"i420_to_nv12_1080p",   xlnx_bench_i420_1080p_setup, NULL,
+                             xlnx_bench_i420_run},
+    {"i420_to_nv12_2160p",   xlnx_bench_i420_2160p_setup, NULL,
+                             xlnx_bench_i420_run},
+    {"scene_detect_1080p",   xlnx_bench_scene_setup, NULL,
+                             xlnx_bench_scene_run},
+    {"enc_720p30_x1",        xlnx_bench_channels_1_setup, NULL,
+                             xlnx_bench_workers_run},
+    {"enc_720p30_x2",        xlnx_bench_channels_2_setup, NULL,
+                             xlnx_bench_workers_run},
+    {"enc_720p30_x4",        xlnx_bench_channels_4_setup, NULL,
+                             xlnx_bench_workers_run},
+    {"enc_720p30_x8",        xlnx_bench_channels_8_setup, NULL,
+                             xlnx_bench_workers_run},
+    {"enc_720p30_x16",       xlnx_bench_channels_16_setup, NULL,
+                             xlnx_bench_workers_run},
+    {"enc_reconfigure",      xlnx_bench_bitrate_setup, xlnx_bench_bitrate_reset,
+                             xlnx_bench_reconfigure_run},
+    {"enc_reinit",           xlnx_bench_bitrate_setup, xlnx_bench_bitrate_reset,
+                             xlnx_bench_reinit_run},
+    {"enc_open_preset",      xlnx_bench_open_setup, xlnx_bench_open_reset,
+                             xlnx_bench_open_preset_run},
+    {"enc_open_config",      xlnx_bench_open_setup, xlnx_bench_open_reset,
+                             xlnx_bench_open_config_run},
+    {"enc_fps_1080p30",      xlnx_bench_fps_1080p30_setup, NULL,
+                             xlnx_bench_fps_run},
+    {"enc_fps_1080p60",      xlnx_bench_fps_1080p60_setup, NULL,
+                             xlnx_bench_fps_run},
+    {"enc_fps_2160p30",      xlnx_bench_fps_2160p30_setup, NULL,
+                             xlnx_bench_fps_run},
+    {"enc_fps_2160p60",      xlnx_bench_fps_2160p60_setup, NULL,
+                             xlnx_bench_fps_run},
+    {"enc_la_1080p30",       xlnx_bench_la_1080p30_setup, NULL,
+                             xlnx_bench_fps_run},
+    {"enc_la_1080p60",       xlnx_bench_la_1080p60_setup, NULL,
+                             xlnx_bench_fps_run},
+    {"enc_start_x4",         xlnx_bench_start_4_setup, xlnx_bench_start_reset,
+                             xlnx_bench_start_single_run},
+    {"enc_start_x16",        xlnx_bench_start_16_setup, xlnx_bench_start_reset,
+                             xlnx_bench_start_single_run},
+    {"enc_group_x4",         xlnx_bench_start_4_setup, xlnx_bench_start_reset,
+                             xlnx_bench_start_group_run},
+    {"enc_group_x16",        xlnx_bench_start_16_setup, xlnx_bench_start_reset,
+                             xlnx_bench_start_group_run},
+    {"enc_first_open",       xlnx_bench_first_setup, xlnx_bench_first_reset,
+                             xlnx_bench_first_open_run},
+    {"enc_first_pool",       xlnx_bench_first_pool_setup, 
+                             xlnx_bench_first_reset, 
+                             xlnx_bench_first_pool_run},
+    {"xrm_load_uncached",    xlnx_bench_xrm_load_setup, NULL,
+                             xlnx_bench_xrm_uncached_run},
+    {"xrm_load_cached",      xlnx_bench_xrm_load_setup, NULL,
+                             xlnx_bench_xrm_cached_run},
+    {"mp4_mux_1080p",        xlnx_bench_mp4_mux_setup, NULL,
+                             xlnx_bench_mp4_mux_run},
+    {"abr_1080p60",          xlnx_bench_abr_setup, NULL,
+                             xlnx_bench_abr_run},
+};
+
+#define XLNX_BENCH_COUNT (sizeof(xlnx_benches) / sizeof(xlnx_benches[0]))
+
+static int xlnx_bench_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Sorted samples in, value at fraction q out */
+static double xlnx_bench_quantile(const double *sorted, int32_t count,
+                                  double q)
+{
+    return sorted[(int32_t)(q * (count - 1) + 0.5)];
+}
+
+static int32_t xlnx_bench_measure(const XlnxBenchDef *def,
+                                  const XlnxBenchOptions *opts,
+                                  double *ns, double *cycles, double *cpu,
+                                  XlnxBenchResult *result)
+{
+    XlnxBench bench;
+    int64_t start;
+    int64_t t0;
+    int64_t cpu0;
+    uint64_t c0;
+    int32_t n = 0;
+    double sum = 0;
+    double var = 0;
+
+    memset(&bench, 0, sizeof(bench));
+    bench.def = def;
+    pthread_mutex_init(&bench.lock, NULL);
+    pthread_cond_init(&bench.go, NULL);
+    pthread_cond_init(&bench.idle, NULL);
+    xlnx_bench_rng = opts->seed;
+    if(def->setup(&bench) != 0 || (bench.bytes == 0 && bench.items == 0)) {
+        fprintf(stderr, "%s: setup failed, skipped\n", def->name);
+        xlnx_bench_teardown(&bench);
+        return -1;
+    }
+    if(bench.items == 0) {
+        bench.items = 1;
+    }
+
+    /* Warm caches, page in buffers and let the clock settle */
+    start = xlnx_bench_now_ns();
+    do {
+        if(def->reset) {
+            def->reset(&bench);
+        }
+        def->run(&bench);
+    } while(xlnx_bench_now_ns() - start < opts->warmup_ns);
+
+    start = xlnx_bench_now_ns();
+    while(n < XLNX_BENCH_MAX_SAMPLES &&
+          (n < opts->min_samples ||
+           xlnx_bench_now_ns() - start < opts->min_time_ns)) {
+        if(def->reset) {
+            def->reset(&bench);
+        }
+        cpu0 = xlnx_bench_cpu_ns();
+        t0 = xlnx_bench_now_ns();
+        c0 = xlnx_bench_cycles();
+        def->run(&bench);
+        cycles[n] = (double)(xlnx_bench_cycles() - c0);
+        ns[n] = (double)(xlnx_bench_now_ns() - t0);
+        cpu[n] = (double)(xlnx_bench_cpu_ns() - cpu0);
+        n++;
+    }
+    if(bench.failed) {
+        fprintf(stderr, "%s: run failed, skipped\n", def->name);
+        xlnx_bench_teardown(&bench);
+        return -1;
+    }
+
+    memset(result, 0, sizeof(*result));
+    snprintf(result->name, sizeof(result->name), "%s", def->name);
+    result->bytes = bench.bytes;
+    result->items = bench.items;
+    result->samples = n;
+    for(int32_t i = 0; i < n; i++) {
+        sum += ns[i];
+    }
+    result->ns_mean = sum / n;
+    for(int32_t i = 0; i < n; i++) {
+        var += (ns[i] - result->ns_mean) * (ns[i] - result->ns_mean);
+    }
+    result->ns_stddev = n > 1 ? sqrt(var / (n - 1)) : 0;
+    qsort(ns, n, sizeof(*ns), xlnx_bench_cmp);
+    qsort(cycles, n, sizeof(*cycles), xlnx_bench_cmp);
+    qsort(cpu, n, sizeof(*cpu), xlnx_bench_cmp);
+    result->ns_min = ns[0];
+    result->ns_median = xlnx_bench_quantile(ns, n, 0.5);
+    result->ns_p90 = xlnx_bench_quantile(ns, n, 0.9);
+    result->gb_per_s = bench.bytes / result->ns_median;
+    if(xlnx_bench_cycles_source != XLNX_BENCH_CYCLES_NONE && bench.bytes) {
+        result->cycles_per_byte = xlnx_bench_quantile(cycles, n, 0.5) /
+                                  bench.bytes;
+    }
+    result->items_per_s = bench.items * 1e9 / result->ns_median;
+    result->cpu_us_per_item = xlnx_bench_quantile(cpu, n, 0.5) / 1000 /
+                              bench.items;
+
+    xlnx_bench_teardown(&bench);
+    return 0;
+}
+
+static int32_t xlnx_bench_write_csv(const char *path,
+                                    const XlnxBenchOptions *opts,
+                                    const XlnxBenchResult *results,
+                                    int32_t count)
+{
+    FILE *file = strcmp(path, "-") == 0 ? stdout : fopen(path, "w");
+
+    if(!file) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return -1;
+    }
+    fprintf(file, "# xlnx_bench seed=%llu cycles=%s yuv_kernel=%s "
+            "scene_kernel=%s\n", (unsigned long long)opts->seed,
+            xlnx_bench_cycles_names[xlnx_bench_cycles_source],
+            xlnx_yuv_convert_kernel_name(), xlnx_scene_detect_kernel_name());
+    fprintf(file, "name,bytes,samples,ns_median,ns_min,ns_mean,ns_p90,"
+            "ns_stddev,gb_per_s,cycles_per_byte,items,items_per_s,"
+            "cpu_us_per_item\n");
+    for(int32_t i = 0; i < count; i++) {
+        fprintf(file, "%s,%zu,%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.4f,%.4f,%zu,"
+                "%.1f,%.2f\n", results[i].name, results[i].bytes,
+                results[i].samples, results[i].ns_median, results[i].ns_min,
+                results[i].ns_mean, results[i].ns_p90, results[i].ns_stddev,
+                results[i].gb_per_s, results[i].cycles_per_byte,
+                results[i].items, results[i].items_per_s,
+                results[i].cpu_us_per_item);
+    }
+    if(file != stdout) {
+        fclose(file);
+    }
+    return 0;
+}
+
+/* Compares medians with an earlier -csv file. Returns the number of
+   benchmarks slower than the threshold, -1 when the file is unreadable. */
+static int32_t xlnx_bench_compare(const char *path,
+                                  const XlnxBenchOptions *opts,
+                                  const XlnxBenchResult *results,
+                                  int32_t count)
+{
+    FILE *file = fopen(path, "r");
+    char line[512];
+    char name[XLNX_BENCH_NAME_SIZE];
+    double base;
+    double delta;
+    int32_t regressions = 0;
+
+    if(!file) {
+        fprintf(stderr, "Cannot read baseline %s\n", path);
+        return -1;
+    }
+    printf("\n%-22s %12s %12s %9s\n", "baseline", "base ns/op", "ns/op",
+           "delta");
+    while(fgets(line, sizeof(line), file)) {
+        if(line[0] == '#' || strncmp(line, "name,", 5) == 0 ||
+           sscanf(line, "%63[^,],%*[^,],%*[^,],%lf", name, &base) != 2 ||
+           base <= 0) {
+            continue;
+        }
+        for(int32_t i = 0; i < count; i++) {
+            if(strcmp(results[i].name, name) != 0) {
+                continue;
+            }
+            delta = (results[i].ns_median - base) * 100 / base;
+            printf("%-22s %12.0f %12.0f %+8.1f%%%s\n", name, base,
+                   results[i].ns_median, delta,
+                   delta > opts->threshold_pct ? "  REGRESSION" : "");
+            regressions += (delta > opts->threshold_pct);
+        }
+    }
+    fclose(file);
+    return regressions;
+}
+
+static void xlnx_bench_usage(const char *prog)
+{
+    printf("Usage: %s [options]\n"
+           "  -list                 print the benchmark names\n"
+           "  -filter <text>        run benchmarks whose name contains text\n"
+           "  -samples <n>          minimum timed ops per benchmark (30)\n"
+           "  -time_ms <ms>         minimum timed run per benchmark (500)\n"
+           "  -warmup_ms <ms>       untimed run before sampling (100)\n"
+           "  -seed <n>             seed of the synthetic inputs (1)\n"
+           "  -csv <file|->         write results as CSV\n"
+           "  -baseline <file>      compare with an earlier -csv file, exit 1"
+           " on regressions\n"
+           "  -threshold <pct>      slowdown counted as regression (5)\n",
+           prog);
+}
+
+static int32_t xlnx_bench_parse_args(XlnxBenchOptions *opts, int argc,
+                                     char *argv[])
+{
+    static struct option long_opts[] = {
+        {"list",      no_argument,       NULL, 'l'},
+        {"filter",    required_argument, NULL, 'f'},
+        {"samples",   required_argument, NULL, 'n'},
+        {"time_ms",   required_argument, NULL, 't'},
+        {"warmup_ms", required_argument, NULL, 'w'},
+        {"seed",      required_argument, NULL, 's'},
+        {"csv",       required_argument, NULL, 'c'},
+        {"baseline",  required_argument, NULL, 'b'},
+        {"threshold", required_argument, NULL, 'r'},
+        {"help",      no_argument,       NULL, 'h'},
+        {NULL,        0,                 NULL, 0}
+    };
+    int opt;
+
+    opts->min_samples = 30;
+    opts->min_time_ns = 500 * 1000000LL;
+    opts->warmup_ns = 100 * 1000000LL;
+    opts->seed = 1;
+    opts->threshold_pct = 5;
+    while((opt = getopt_long_only(argc, argv, "", long_opts, NULL)) != -1) {
+        switch(opt) {
+            case 'l': opts->list_only = 1; break;
+            case 'f': opts->filter = optarg; break;
+            case 'n': opts->min_samples = atoi(optarg); break;
+            case 't': opts->min_time_ns = atoll(optarg) * 1000000; break;
+            case 'w': opts->warmup_ns = atoll(optarg) * 1000000; break;
+            case 's': opts->seed = strtoull(optarg, NULL, 0); break;
+            case 'c': opts->csv_path = optarg; break;
+            case 'b': opts->baseline_path = optarg; break;
+            case 'r': opts->threshold_pct = atof(optarg); break;
+            default:
+                xlnx_bench_usage(argv[0]);
+                return -1;
+        }
+    }
+    if(opts->min_samples < 1 || opts->min_samples > XLNX_BENCH_MAX_SAMPLES) {
+        fprintf(stderr, "-samples must be 1 - %d\n", XLNX_BENCH_MAX_SAMPLES);
+        return -1;
+    }
+    /* xorshift never leaves 0 */
+    if(opts->seed == 0) {
+        opts->seed = 1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    XlnxBenchOptions opts;
+    XlnxBenchResult results[XLNX_BENCH_COUNT];
+    XlnxBenchResult *res;
+    double *ns;
+    double *cycles;
+    double *cpu;
+    int32_t count = 0;
+    int32_t regressions = 0;
+
+    memset(&opts, 0, sizeof(opts));
+    if(xlnx_bench_parse_args(&opts, argc, argv) != 0) {
+        return 1;
+    }
+    if(opts.list_only) {
+        for(size_t i = 0; i < XLNX_BENCH_COUNT; i++) {
+            printf("%s\n", xlnx_benches[i].name);
+        }
+        return 0;
+    }
+
+    ns = malloc(XLNX_BENCH_MAX_SAMPLES * sizeof(*ns));
+    cycles = malloc(XLNX_BENCH_MAX_SAMPLES * sizeof(*cycles));
+    cpu = malloc(XLNX_BENCH_MAX_SAMPLES * sizeof(*cpu));
+    if(!ns || !cycles || !cpu) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    xlnx_bench_cycles_init();
+
+    printf("cycles: %s, yuv kernel: %s, scene kernel: %s, seed %llu\n",
+           xlnx_bench_cycles_names[xlnx_bench_cycles_source],
+           xlnx_yuv_convert_kernel_name(), xlnx_scene_detect_kernel_name(),
+           (unsigned long long)opts.seed);
+    printf("%-22s %9s %8s %12s %12s %12s %8s %8s %8s %10s %9s\n", "name",
+           "bytes/op", "samples", "ns/op", "min", "mean", "stddev%", "GB/s",
+           "cyc/B", "items/s", "cpu us/it");
+    for(size_t i = 0; i < XLNX_BENCH_COUNT; i++) {
+        if(opts.filter && !strstr(xlnx_benches[i].name, opts.filter)) {
+            continue;
+        }
+        res = &results[count];
+        if(xlnx_bench_measure(&xlnx_benches[i], &opts, ns, cycles, cpu,
+                              res) != 0) {
+            continue;
+        }
+        printf("%-22s %9zu %8d %12.0f %12.0f %12.0f %8.1f %8.3f %8.3f "
+               "%10.1f %9.2f\n", res->name, res->bytes, res->samples,
+               res->ns_median, res->ns_min, res->ns_mean,
+               res->ns_stddev * 100 / res->ns_mean, res->gb_per_s,
+               res->cycles_per_byte, res->items_per_s,
+               res->cpu_us_per_item);
+        count++;
+    }
+
+    if(opts.csv_path &&
+       xlnx_bench_write_csv(opts.csv_path, &opts, results, count) != 0) {
+        regressions = -1;
+    }
+    if(opts.baseline_path && regressions == 0) {
+        regressions = xlnx_bench_compare(opts.baseline_path, &opts, results,
+                                         count);
+    }
+
+    if(xlnx_bench_perf_fd >= 0) {
+        close(xlnx_bench_perf_fd);
+    }
+    free(ns);
+    free(cycles);
+    free(cpu);
+    return regressions == 0 ? 0 : 1;
+}
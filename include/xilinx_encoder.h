@@ -9,18 +9,596 @@ extern "C" {
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <stdint.h>
 #include <dlfcn.h>
 
+typedef enum
+{
+    ENCODER_ID_H264 = 0,
+    ENCODER_ID_HEVC
+} XlnxEncoderCodecID;
+
+/* Encoder configuration. Encoder_ConfigInit() marks every field as unset;
+   unset fields keep the library defaults when the encoder is created. */
+typedef struct XlnxEncoderConfig
+{
+    int32_t device_id;        /* -1 lets XRM pick the device */
+    int32_t codec_id;         /* ENCODER_ID_H264 or ENCODER_ID_HEVC */
+    int32_t width;
+    int32_t height;
+    int32_t input_stride;     /* luma bytes per line of the widest 
+                                 Encoder_EncodeFrameStrided input, unset = 
+                                 width; sizes the lookahead input lines */
+    int32_t pix_fmt;          /* 0 = nv12, 1 = yuv420p */
+    int64_t bit_rate;         /* kbps */
+    int64_t max_bitrate;      /* kbps */
+    int32_t fps;
+    int32_t gop_size;
+    int32_t control_rate;     /* 0 = const-qp, 1 = cbr, 2 = vbr, 3 = low-latency */
+    int32_t slice_qp;         /* -1 = auto */
+    int32_t min_qp;
+    int32_t max_qp;
+    int32_t num_bframes;
+    int32_t idr_period;
+    char    profile[16];      /* "baseline", "main", "high", "main-intra" */
+    int32_t level;            /* 10 * level, e.g. 41 for 4.1 */
+    int32_t num_slices;
+    int32_t qp_mode;          /* 0 = uniform, 1 = auto, 2 = relative-load */
+    int32_t gop_mode;         /* 0 = default, 1 = pyramidal, 2 = low-delay-p, 
+                                 3 = low-delay-b */
+    int32_t aspect_ratio;     /* 0 = auto, 1 = 4:3, 2 = 16:9, 3 = none */
+    int32_t scaling_list;
+    int32_t lookahead_depth;  /* up to 1080p; above that it has to stay 0,
+                                 there is no downscaled lookahead for 4K */
+    int32_t temporal_aq;
+    int32_t spatial_aq;
+    int32_t spatial_aq_gain;
+    int32_t num_cores;        /* 0 = firmware default; unset picks from 
+                                 resolution and frame rate */
+    int32_t tune_metrics;
+    int32_t latency_logging;
+    int32_t low_latency;      /* 1 = low-delay-p, no B frames, no lookahead, 
+                                 low-latency RC; explicit fields still win */
+    int32_t scene_cut;        /* 0 = off, else host side scene change score 
+                                 1 - 100 that forces an IDR, e.g. 10 */
+    int64_t num_frames;
+    int32_t loop_count;
+    const char *input_file;
+    const char *output_file;
+} XlnxEncoderConfig;
+
+void Encoder_ConfigInit(XlnxEncoderConfig *cfg);
+
+/* Parses ffmpeg style options, e.g. "-c:v mpsoc_vcu_h264 -b:v 5M -g 120".
+   Returns 0 on success, 2 when -help was requested and -1 on error. */
+int Encoder_ConfigParseArgs(XlnxEncoderConfig *cfg, int argc, char *argv[]);
+
+/* Parses "key=value" pairs separated by ',' or whitespace, using the same
+   keys as Encoder_ConfigParseArgs, e.g. "c:v=hevc,b:v=8M,cores=2". File 
+   names set here are heap copies owned by the caller, release input_file 
+   and output_file with free(). Encoder_ConfigParseArgs points them into 
+   argv instead. */
+int Encoder_ConfigParseString(XlnxEncoderConfig *cfg, const char *options);
+
+/* Independent encoder channel. Each handle owns its own XRM reservation and
+   XMA sessions, so several handles can run in one process, one thread per
+   handle. All handles share the device XMA was first initialized on.
+   Encoder_ConfigParseArgs uses getopt and must not run concurrently. */
+typedef struct XlnxEncoderHandle XlnxEncoderHandle;
+
+XlnxEncoderHandle *Encoder_Open(const XlnxEncoderConfig *cfg);
+
+/* Writes the encoder options string Encoder_Open would hand to the device
+   for cfg, without touching XRM or XMA sessions. Returns its length like 
+   snprintf, or -1 when cfg is invalid. */
+int Encoder_GetOptions(const XlnxEncoderConfig *cfg, char *options, int size);
+
+/* Named presets: "live-1080p-lowlat", "live-1080p", "live-720p-lowlat",
+   "vod-1080p-quality" and "vod-4k-quality". Encoder_ConfigPreset fills cfg
+   with a preset so fields can be changed before Encoder_Open; the same is
+   available as "-preset <name>" in the option parsers. */
+int Encoder_ConfigPreset(XlnxEncoderConfig *cfg, const char *preset);
+
+/* Opens a channel from a preset as is. The validated XMA properties and
+   encoder options of every preset are built once per process, so only the
+   XRM and XMA calls remain per channel. device_id -1 lets XRM pick. */
+XlnxEncoderHandle *Encoder_OpenPreset(const char *preset, int device_id);
+
+/* Time taken by Encoder_Open/Encoder_OpenPreset for this handle */
+int64_t Encoder_GetOpenTimeUs(const XlnxEncoderHandle *handle);
+
+/* Time from opening, or taking the handle from a pool, to its first 
+   encoded packet. 0 until that packet arrives. */
+int64_t Encoder_GetFirstPacketUs(const XlnxEncoderHandle *handle);
+
+/* Warm channels. Encoder_PoolCreate opens sessions_per_preset channels 
+   of each named preset up front and fails when one of them only opens 
+   through an allocation fallback. Acquire hands one out without touching
+   XRM or XMA, and opens a new channel when none is left. This saves the 
+   open, not the device's own time to the first packet, which dominates 
+   it. Release resets the channel for the next user: its XRM 
+   reservation is kept and only the XMA sessions of a channel that encoded 
+   are recreated. Packets taken from a channel remain valid after release.
+   Acquired handles must be released or closed before Encoder_PoolDestroy. */
+typedef struct XlnxEncoderPool XlnxEncoderPool;
+
+XlnxEncoderPool *Encoder_PoolCreate(const char *const *presets, 
+                                    int num_presets, int sessions_per_preset,
+                                    int device_id);
+
+XlnxEncoderHandle *Encoder_PoolAcquire(XlnxEncoderPool *pool, 
+                                       const char *preset);
+
+void Encoder_PoolRelease(XlnxEncoderPool *pool, XlnxEncoderHandle *handle);
+
+void Encoder_PoolDestroy(XlnxEncoderPool *pool);
+
+/* Opens num_channels channels from a single XRM reservation. The group 
+   starts whole or not at all: without room for every channel nothing is
+   reserved, and when a channel fails to start the others are closed and
+   the reservation released. All channels land on one device, device_id
+   must be left unset, so a group that would only fit split across devices
+   is refused even when opening the channels one by one would succeed. 
+   This is for callers that need all or nothing, not a faster open: the 
+   group costs more host work than the same opens one by one and only 
+   comes out ahead when every XRM call is a slow daemon round trip. 
+   Channels are driven like any handle but only closed through 
+   EncoderGroup_Close. */
+#define XLNX_ENC_GROUP_MAX_CHANNELS 32
+
+typedef struct XlnxEncoderGroup XlnxEncoderGroup;
+
+XlnxEncoderGroup *EncoderGroup_Open(const XlnxEncoderConfig *cfgs, 
+                                    int num_channels);
+
+XlnxEncoderHandle *EncoderGroup_GetChannel(XlnxEncoderGroup *group, 
+                                           int channel);
+
+/* Time taken by EncoderGroup_Open for all channels together */
+int64_t EncoderGroup_GetOpenTimeUs(const XlnxEncoderGroup *group);
+
+void EncoderGroup_Close(XlnxEncoderGroup *group);
+
+int Encoder_EncodeFrame(XlnxEncoderHandle *handle, char *ybuf, char *uvbuf,
+                        char *outBuf, int *outlen);
+
+/* Caller owned input frame. Planes are read in place, so padded layouts
+   such as 256 aligned decoder output need no repacking. NV12 uses planes
+   0 (Y) and 1 (UV); yuv420p uses 0 (Y), 1 (U) and 2 (V). Every plane has
+   to lie within size bytes without overlapping another, lines at least 
+   as long as the plane is wide. With lookahead on, lines may be at most
+   the 256 byte aligned input_stride of the config. */
+typedef struct XlnxEncoderFrame
+{
+    char    *buffer;          /* base address of the frame */
+    size_t  size;             /* bytes at buffer */
+    int32_t offset[3];        /* byte offset of each plane from buffer */
+    int32_t stride[3];        /* bytes per line of each plane */
+    int32_t force_idr;        /* 1 = code this frame as IDR */
+} XlnxEncoderFrame;
+
+int Encoder_EncodeFrameStrided(XlnxEncoderHandle *handle, 
+                               const XlnxEncoderFrame *frame, char *outBuf, 
+                               int *outlen);
+
+int Encoder_FlushFrame(XlnxEncoderHandle *handle, char *outBuf, int *outlen);
+
+/* outBuf of the encode and flush calls has to hold Encoder_GetMaxPacketSize
+   bytes, a raw frame plus headers, unless Encoder_SetOutputCapacity 
+   declared a smaller buffer. A packet larger than the buffer is never 
+   copied: the call returns XLNX_ENC_NEED_SPACE with the packet size in 
+   *outlen and the packet waits for Encoder_ReceivePacket. */
+#define XLNX_ENC_NEED_SPACE 3
+
+int Encoder_GetMaxPacketSize(const XlnxEncoderHandle *handle);
+
+/* Bytes outBuf holds from now on. 0 on success, -1 on a bad capacity. */
+int Encoder_SetOutputCapacity(XlnxEncoderHandle *handle, int capacity);
+
+#define XLNX_ENC_PICTURE_UNKNOWN (-1)
+#define XLNX_ENC_PICTURE_I       0
+#define XLNX_ENC_PICTURE_P       1
+#define XLNX_ENC_PICTURE_B       2
+
+/* Statistics of one encoded frame, taken when its packet is received */
+typedef struct XlnxEncoderFrameStats
+{
+    int64_t frame_num;        /* output packet index, gaps in a stats ring 
+                                 stream mean dropped entries */
+    int64_t pts;
+    int64_t dts;              /* decode order, in pts units */
+    int32_t size;             /* bytes */
+    int32_t picture_type;     /* XLNX_ENC_PICTURE_*, from the slice header */
+    int32_t is_idr;
+    int64_t latency_us;       /* frame submit to packet receive */
+    int32_t la_valid;         /* 1 when the lookahead fields are set */
+    int32_t la_qp_map_size;   /* bytes of lookahead QP map */
+    float   la_qp_offset;     /* mean relative QP of the lookahead QP map */
+} XlnxEncoderFrameStats;
+
+/* Encoded packet handed out by reference. data stays valid until the last
+   Encoder_PacketUnref, then the buffer goes back to the channel's pool. 
+   Packets may outlive their handle. */
+typedef struct XlnxEncoderPacket
+{
+    const char *data;
+    int32_t    size;
+    int64_t    pts;
+    XlnxEncoderFrameStats stats;
+} XlnxEncoderPacket;
+
+/* With outBuf == NULL the encode and flush calls keep the packet in the
+   handle instead of copying it, *outlen still reports its size. This takes
+   that packet with one reference, or returns NULL when there is none. */
+XlnxEncoderPacket *Encoder_ReceivePacket(XlnxEncoderHandle *handle);
+
+XlnxEncoderPacket *Encoder_PacketRef(XlnxEncoderPacket *pkt);
+
+void Encoder_PacketUnref(XlnxEncoderPacket *pkt);
+
+/* Stats of the last packet returned by the encode or flush calls */
+int Encoder_GetFrameStats(XlnxEncoderHandle *handle, 
+                          XlnxEncoderFrameStats *stats);
+
+/* Also publishes the stats of every packet into a lock-free ring of at 
+   least capacity entries, read by one monitoring thread with 
+   Encoder_PollStats. The encode loop never waits, entries are dropped 
+   while the ring is full. Call before the first frame; the reader has to 
+   stop before Encoder_Close. */
+int Encoder_EnableStatsRing(XlnxEncoderHandle *handle, int capacity);
+
+/* Returns 1 and fills stats when an entry was pending, 0 otherwise */
+int Encoder_PollStats(XlnxEncoderHandle *handle, XlnxEncoderFrameStats *stats);
+
+/* Per frame latency stages of a channel */
+#define XLNX_LAT_INPUT       0  /* host frame copy or conversion */
+#define XLNX_LAT_LA          1  /* lookahead send and receive call */
+#define XLNX_LAT_LA_OUT      2  /* frame submit to lookahead output */
+#define XLNX_LAT_SEND        3  /* encoder send call */
+#define XLNX_LAT_RECV        4  /* encoder receive call returning a packet */
+#define XLNX_LAT_ENCODE_OUT  5  /* frame submit to packet receive */
+#define XLNX_LAT_COPY_OUT    6  /* packet copy to outBuf or NAL callbacks */
+#define XLNX_LAT_NUM_STAGES  7
+
+/* Distribution of one stage. Values come from log-linear buckets and are
+   the highest value of their bucket, within 1/32 of the sample. */
+typedef struct XlnxLatencyStats
+{
+    int64_t count;
+    int64_t min_ns;
+    int64_t mean_ns;
+    int64_t p50_ns;
+    int64_t p90_ns;
+    int64_t p99_ns;
+    int64_t p999_ns;
+    int64_t max_ns;
+} XlnxLatencyStats;
+
+/* Fills stats[XLNX_LAT_NUM_STAGES] with the frames seen since the handle
+   was opened or last reset, and starts a new window when reset is set. 
+   The encode loop is never blocked; one thread at a time may read. */
+int Encoder_GetLatencyStats(XlnxEncoderHandle *handle, 
+                            XlnxLatencyStats *stats, int reset);
+
+void Encoder_Close(XlnxEncoderHandle *handle);
+
+/* Runtime changes for a live encoder. Fields <= 0 keep the current value.
+   Changes apply from the next frame that reaches the encoder, without a
+   session restart. The device cannot change the frame rate, the VBR max
+   bitrate or the resolution of a running session: Encoder_Reconfigure
+   fails when fps or max_bitrate differ from the running values, those 
+   need a new handle. In CBR the max bitrate follows bit_rate. */
+typedef struct XlnxEncoderDynParams
+{
+    int64_t bit_rate;         /* kbps */
+    int64_t max_bitrate;      /* kbps, must match the running value */
+    int32_t fps;              /* must match the running value */
+    int32_t force_idr;        /* 1 = next frame submitted is coded as IDR */
+} XlnxEncoderDynParams;
+
+int Encoder_Reconfigure(XlnxEncoderHandle *handle, 
+                        const XlnxEncoderDynParams *params);
+
+/* One NAL unit of an encoded access unit, start code included. data points
+   into the encoder output buffer and is only valid during the callback. */
+typedef struct XlnxEncoderNal
+{
+    const char *data;
+    int32_t    size;
+    int32_t    nal_type;      /* H264 nal_unit_type or HEVC nal_unit_type */
+    int32_t    last_in_frame; /* 1 on the last NAL of the access unit */
+    int64_t    pts;
+    int64_t    latency_us;    /* frame submit to NAL delivery */
+} XlnxEncoderNal;
+
+typedef void (*XlnxEncoderNalCallback)(void *opaque, const XlnxEncoderNal *nal);
+
+/* With a callback set, encoded data is delivered NAL by NAL and the 
+   outBuf/outlen of the encode calls stay empty. Pass NULL to go back to 
+   whole packets. XMA hands out whole access units only, so every NAL of a
+   frame arrives once the frame is fully encoded, from the same encode
+   call that would have returned its packet. This saves the copy to outBuf
+   but gives no latency gain over whole packets, and all NALs of a frame
+   report the same latency_us. */
+int Encoder_SetNalCallback(XlnxEncoderHandle *handle, 
+                           XlnxEncoderNalCallback callback, void *opaque);
+
+int Encoder_InitWithConfig(const XlnxEncoderConfig *cfg);
+
+#define XLNX_ABR_MAX_RENDITIONS 8
+
+/* ABR ladder: the input bitstream is decoded once, the hardware multiscaler
+   produces every rendition and each rendition has its own encoder. The 
+   whole ladder is reserved as one XRM CU pool on a single card. */
+typedef struct XlnxAbrLadderConfig
+{
+    int32_t codec_id;                   /* input codec, ENCODER_ID_* */
+    int32_t width;                      /* input resolution */
+    int32_t height;
+    int32_t fps;
+    int32_t num_renditions;
+    XlnxEncoderConfig renditions[XLNX_ABR_MAX_RENDITIONS];
+} XlnxAbrLadderConfig;
+
+typedef struct XlnxAbrLadder XlnxAbrLadder;
+
+/* Called for every encoded packet; rendition indexes cfg->renditions */
+typedef void (*XlnxAbrPacketCallback)(void *opaque, int rendition, 
+                                      const char *data, int size);
+
+/* 1080p60 H264 input, 1080p/720p/480p/360p H264 output */
+void AbrLadder_ConfigInit(XlnxAbrLadderConfig *cfg);
+
+/* Number of complete ladders XRM can still reserve, or -1 on error */
+int AbrLadder_QueryCapacity(const XlnxAbrLadderConfig *cfg);
+
+XlnxAbrLadder *AbrLadder_Open(const XlnxAbrLadderConfig *cfg);
+
+/* Sends one access unit of the input bitstream */
+int AbrLadder_SendData(XlnxAbrLadder *ladder, unsigned char *inBuf, 
+                       int inSize, XlnxAbrPacketCallback cb, void *opaque);
+
+int AbrLadder_Flush(XlnxAbrLadder *ladder, XlnxAbrPacketCallback cb, 
+                    void *opaque);
+
+void AbrLadder_Close(XlnxAbrLadder *ladder);
+
+/* Capacity planning: how many streams of a shape fit per device and across
+   all devices, from the XRM load plugins and CU pool availability. Nothing
+   is reserved, so the answer is a snapshot of what is free right now. */
+#define XLNX_CAPACITY_DECODE 0
+#define XLNX_CAPACITY_ENCODE 1
+#define XLNX_CAPACITY_ABR    2
+
+#define XLNX_CAPACITY_MAX_DEVICES 16
+
+typedef struct XlnxCapacityJob
+{
+    int32_t type;
+    char    name[64];                   /* label in the JSON output */
+    XlnxEncoderConfig   encode;         /* XLNX_CAPACITY_ENCODE */
+    /* XLNX_CAPACITY_ABR; XLNX_CAPACITY_DECODE only uses the input codec,
+       resolution and fps */
+    XlnxAbrLadderConfig ladder;
+} XlnxCapacityJob;
+
+/* Parses "<decode|encode|abr>:<h264|hevc>:<width>x<height>@<fps>", with an
+   optional ":la" or ":la=<depth>" for encodes. abr uses the renditions of
+   the default ladder that are not larger than the input. 0 on success. */
+int Capacity_ParseJob(const char *spec, XlnxCapacityJob *job);
+
+/* Plans every job on its own, plus the mix: complete sets of one stream of
+   every job placed together on a device. Devices 0 to max_devices - 1 are
+   probed. Returns a JSON document to be released with free(), or NULL:
+   {"devices": [0, 1],
+    "jobs": [{"name": "...", "type": "encode", "per_device": [4, 4], 
+              "total": 8}],
+    "mix": {"per_device": [2, 2], "total": 4}}
+   A job XRM could not size reports "error" instead of counts; mix is null
+   when a job failed or the set has more CUs than one XRM CU list. */
+char *Capacity_PlanJson(const XlnxCapacityJob *jobs, int num_jobs, 
+                        int max_devices);
+
+/* Device placement for encoders and decoders opened with device_id -1.
+   XRM picks by default. Best fit puts a channel on the device with the
+   least room that still takes it, so small channels pack together and
+   whole devices stay free for 4K; worst fit spreads channels out. The 
+   chosen device is pinned with xrmCuAllocFromDev. XMA runs a process on 
+   one device, so this places the first channel of a process and later 
+   channels follow it. Returns 0, or -1 for an unknown policy. */
+#define XLNX_PLACEMENT_XRM       0
+#define XLNX_PLACEMENT_BEST_FIT  1
+#define XLNX_PLACEMENT_WORST_FIT 2
+
+int Encoder_SetPlacementPolicy(int policy);
+
+/* What Encoder_Open, Encoder_OpenPreset, EncoderGroup_Open, AbrLadder_Open
+   and Decoder_Init do when XRM has no room or the device refuses a 
+   session: retry up to retries times, sleeping backoff_ms and doubling up
+   to max_backoff_ms in between, then apply each enabled fallback that 
+   still changes the job and retry again after it. Invalid configurations
+   fail at once. The default makes a single attempt. */
+#define XLNX_ALLOC_ANY_DEVICE     0x1   /* drop the device_id pin; only 
+                                           before XMA chose the process
+                                           device */
+#define XLNX_ALLOC_NO_LOOKAHEAD   0x2   /* encode without lookahead */
+#define XLNX_ALLOC_DROP_RENDITION 0x4   /* ABR: drop the largest rendition,
+                                           down to one */
+
+typedef struct XlnxAllocPolicy
+{
+    int32_t retries;
+    int32_t backoff_ms;
+    int32_t max_backoff_ms;
+    int32_t fallbacks;                  /* XLNX_ALLOC_* */
+} XlnxAllocPolicy;
+
+typedef struct XlnxAllocOutcome
+{
+    int32_t status;                     /* 0 opened, -1 failed */
+    int32_t attempts;
+    int32_t device_id;                  /* -1 when it failed */
+    int32_t fallbacks;                  /* XLNX_ALLOC_* that were applied */
+    /* ABR: cfg->renditions indexes that were dropped, as a bit mask; 
+       packets keep the indexes of the configuration */
+    int32_t dropped_renditions;
+    int64_t backoff_us;                 /* time spent waiting */
+} XlnxAllocOutcome;
+
+/* Process wide, like the placement policy. 0, or -1 for a negative 
+   value, max_backoff_ms below backoff_ms or an unknown fallback. */
+int Encoder_SetAllocPolicy(const XlnxAllocPolicy *policy);
+
+/* Outcome of the last open on the calling thread, including one that 
+   returned NULL */
+void Encoder_GetAllocOutcome(XlnxAllocOutcome *outcome);
+
+/* Telemetry: a sampler thread takes per device CU headroom from XRM, the
+   queue depth and device buffer pool occupancy of every open channel, and
+   XRM reservation and allocation latencies, and publishes them as one 
+   snapshot. Channels only store counters and never wait on the sampler or
+   on readers. */
+#define XLNX_TELEMETRY_MAX_CHANNELS 64
+
+/* Hard CUs, shared by load */
+#define XLNX_TELEMETRY_CU_DECODER   0
+#define XLNX_TELEMETRY_CU_SCALER    1
+#define XLNX_TELEMETRY_CU_LOOKAHEAD 2
+#define XLNX_TELEMETRY_CU_ENCODER   3
+#define XLNX_TELEMETRY_NUM_CUS      4
+
+#define XLNX_TELEMETRY_ENCODER   0
+#define XLNX_TELEMETRY_ABR       1
+
+#define XLNX_TELEMETRY_XRM_RESERVE 0    /* xrmCuPoolReserve */
+#define XLNX_TELEMETRY_XRM_ALLOC   1    /* CU and CU list allocations */
+#define XLNX_TELEMETRY_XRM_NUM     2
+
+typedef struct XlnxDeviceTelemetry
+{
+    int32_t device_id;
+    /* Load still free on each kind of hard CU, in percent of one CU and 
+       summed over the CUs of that kind on the device */
+    int32_t cu_free_pct[XLNX_TELEMETRY_NUM_CUS];
+    int32_t free_dec_channels;          /* soft kernel channels */
+    int32_t free_enc_channels;
+    int32_t num_channels;               /* of this process */
+} XlnxDeviceTelemetry;
+
+typedef struct XlnxChannelTelemetry
+{
+    int32_t id;                         /* unique within the process */
+    int32_t kind;                       /* XLNX_TELEMETRY_ENCODER or _ABR */
+    int32_t device_id;
+    int64_t frames_in;                  /* frames or access units sent */
+    int64_t frames_out;                 /* packets or frames received */
+    int32_t queue_depth;                /* frames_in - frames_out */
+    /* Device buffer pool feeding the encoder (the lookahead's or the 
+       scaler's) or the ABR decoder's output pool; 0 when the channel has
+       seen no device buffer yet */
+    int32_t pool_free;
+    int32_t pool_size;
+} XlnxChannelTelemetry;
+
+typedef struct XlnxXrmLatency
+{
+    int64_t count;
+    int64_t failed;
+    int64_t total_us;
+    int64_t max_us;
+} XlnxXrmLatency;
+
+typedef struct XlnxTelemetrySnapshot
+{
+    int64_t sample_num;                 /* 1 for the first sample */
+    int64_t sample_us;                  /* CLOCK_MONOTONIC */
+    int64_t sample_cost_us;             /* time the sampler took */
+    int32_t num_devices;
+    XlnxDeviceTelemetry devices[XLNX_CAPACITY_MAX_DEVICES];
+    int32_t num_channels;               /* beyond the max are counted only */
+    XlnxChannelTelemetry channels[XLNX_TELEMETRY_MAX_CHANNELS];
+    XlnxXrmLatency xrm[XLNX_TELEMETRY_XRM_NUM];  /* since process start */
+} XlnxTelemetrySnapshot;
+
+/* Starts the sampler, every period_ms. Devices are discovered once here.
+   0 on success, -1 when it is already running or could not start. */
+int Telemetry_Start(int period_ms);
+
+void Telemetry_Stop();
+
+/* Copies the latest snapshot, safe from any thread at any time. Readers 
+   never block the sampler or each other. 0 on success, -1 before the 
+   first sample. */
+int Telemetry_GetSnapshot(XlnxTelemetrySnapshot *snapshot);
+
+/* MPEG-TS muxer for encoder output: one H264 or HEVC program (PMT PID
+   0x1000, video PID 0x100). PAT and PMT are repeated before every IDR and
+   PCR is carried on the first packet of every PES. Each packet goes out in
+   a single writev, with the payload referenced from data, not copied. */
+typedef struct XlnxTsMux XlnxTsMux;
+
+/* fd stays owned by the caller; codec_id is ENCODER_ID_H264 or 
+   ENCODER_ID_HEVC */
+XlnxTsMux *TsMux_Open(int fd, int codec_id);
+
+/* One access unit in decode order; pts and dts are in 90 kHz units */
+int TsMux_WritePacket(XlnxTsMux *mux, const char *data, int size, 
+                      int64_t pts, int64_t dts);
+
+void TsMux_Close(XlnxTsMux *mux);
+
+/* Fragmented MP4 (CMAF) muxer for encoder output. The init segment is
+   written on the first packet, which must be an IDR carrying the parameter
+   sets. Every packet goes out as its own moof + mdat chunk once the next
+   packet's dts gives its sample duration, so one packet is held in memory;
+   every IDR opens a new segment. */
+typedef struct XlnxMp4Mux XlnxMp4Mux;
+
+typedef struct XlnxMp4MuxStats
+{
+    int64_t bytes_written;
+    int64_t mux_time_ns;      /* CPU time spent muxing, writes excluded */
+    int64_t num_fragments;
+    int64_t num_segments;
+} XlnxMp4MuxStats;
+
+/* fd stays owned by the caller; codec_id is ENCODER_ID_H264 or 
+   ENCODER_ID_HEVC */
+XlnxMp4Mux *Mp4Mux_Open(int fd, int codec_id, int width, int height, int fps);
+
+/* One access unit in decode order with dts rising; pts and dts are in 
+   90 kHz units. data is copied, the caller can reuse it on return. */
+int Mp4Mux_WritePacket(XlnxMp4Mux *mux, const char *data, int size, 
+                       int64_t pts, int64_t dts);
+
+/* Writes the held packet, lasting as long as the one before it. Called by
+   Mp4Mux_Close; stats count it only after this. */
+int Mp4Mux_Flush(XlnxMp4Mux *mux);
+
+void Mp4Mux_GetStats(const XlnxMp4Mux *mux, XlnxMp4MuxStats *stats);
+
+void Mp4Mux_Close(XlnxMp4Mux *mux);
+
 int Encoder_Init();
 
 int Encoder_frame(char *ybuf,char *uvbuf,char *outBuf,int *outlen);
 
+int Encoder_flush(char *outBuf,int *outlen);
+
+int Encoder_reconfigure(const XlnxEncoderDynParams *params);
+
 void Encoder_Release();
 
-void Decoder_Init();
+/* 0 on success, -1 when no decoder could be allocated under the 
+   allocation policy. Errors are returned, the process is never exited. */
+int Decoder_Init();
 
+/* XMA_SUCCESS (0) with a frame in outbuffer, a positive status when no 
+   frame was ready, negative on error */
 int Decoder_frame(unsigned char* inbuffer,unsigned char* outbuffer,int insize);
 
+void Decoder_release();
+
 int dec_write_host_buffer_to_file(unsigned char* hostbuf,FILE* file);
 
 int H264FrameReader_Init(const char* filename);
@@ -0,0 +1,106 @@
+#include "xlnx_alloc_policy.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <xma.h>
+
+#define XLNX_ALLOC_MODULE "xlnx_alloc"
+
+#define XLNX_ALLOC_ALL (XLNX_ALLOC_ANY_DEVICE | XLNX_ALLOC_NO_LOOKAHEAD | \
+                        XLNX_ALLOC_DROP_RENDITION)
+
+static pthread_mutex_t xlnx_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static XlnxAllocPolicy xlnx_alloc_policy = {0, 0, 0, 0};
+
+/* Opens run on the caller's thread, so the last outcome is kept per thread
+   and needs no handle */
+static __thread XlnxAllocOutcome xlnx_alloc_last = {-1, 0, -1, 0, 0, 0};
+
+int Encoder_SetAllocPolicy(const XlnxAllocPolicy *policy)
+{
+    if(!policy || policy->retries < 0 || policy->backoff_ms < 0 || 
+       policy->max_backoff_ms < policy->backoff_ms ||
+       (policy->fallbacks & ~XLNX_ALLOC_ALL)) {
+        return -1;
+    }
+    pthread_mutex_lock(&xlnx_alloc_lock);
+    xlnx_alloc_policy = *policy;
+    pthread_mutex_unlock(&xlnx_alloc_lock);
+    return 0;
+}
+
+void Encoder_GetAllocOutcome(XlnxAllocOutcome *outcome)
+{
+    if(outcome) {
+        *outcome = xlnx_alloc_last;
+    }
+}
+
+void xlnx_alloc_begin(XlnxAllocAttempt *attempt)
+{
+    memset(attempt, 0, sizeof(*attempt));
+    pthread_mutex_lock(&xlnx_alloc_lock);
+    attempt->policy = xlnx_alloc_policy;
+    pthread_mutex_unlock(&xlnx_alloc_lock);
+    attempt->backoff_ms = attempt->policy.backoff_ms;
+    attempt->outcome.status = -1;
+    attempt->outcome.attempts = 1;
+    attempt->outcome.device_id = -1;
+}
+
+static void xlnx_alloc_sleep(XlnxAllocAttempt *attempt)
+{
+    struct timespec ts;
+
+    ts.tv_sec = attempt->backoff_ms / 1000;
+    ts.tv_nsec = (long)(attempt->backoff_ms % 1000) * 1000000;
+    while(nanosleep(&ts, &ts) != 0) {
+    }
+    attempt->outcome.backoff_us += (int64_t)attempt->backoff_ms * 1000;
+
+    attempt->backoff_ms *= 2;
+    if(attempt->backoff_ms > attempt->policy.max_backoff_ms) {
+        attempt->backoff_ms = attempt->policy.max_backoff_ms;
+    }
+}
+
+int32_t xlnx_alloc_next(XlnxAllocAttempt *attempt, int32_t applicable)
+{
+    int32_t fallbacks = attempt->policy.fallbacks & applicable;
+    int32_t fallback;
+
+    if(attempt->retries < attempt->policy.retries) {
+        attempt->retries++;
+        attempt->outcome.attempts++;
+        xma_logmsg(XMA_INFO_LOG, XLNX_ALLOC_MODULE, 
+                   "Allocation failed, retry %d in %d ms\n", 
+                   attempt->retries, attempt->backoff_ms);
+        xlnx_alloc_sleep(attempt);
+        return XLNX_ALLOC_RETRY;
+    }
+    if(!fallbacks) {
+        return -1;
+    }
+
+    /* Lowest flag first: another device before a lesser job */
+    fallback = fallbacks & -fallbacks;
+    attempt->retries = 0;
+    attempt->backoff_ms = attempt->policy.backoff_ms;
+    attempt->outcome.attempts++;
+    attempt->outcome.fallbacks |= fallback;
+    xma_logmsg(XMA_NOTICE_LOG, XLNX_ALLOC_MODULE, 
+               "Allocation failed, falling back to %s\n", 
+               fallback == XLNX_ALLOC_ANY_DEVICE ? "any device" : 
+               fallback == XLNX_ALLOC_NO_LOOKAHEAD ? "no lookahead" : 
+                                                    "fewer renditions");
+    return fallback;
+}
+
+void xlnx_alloc_end(XlnxAllocAttempt *attempt, int32_t status, 
+                    int32_t device_id)
+{
+    attempt->outcome.status = status;
+    attempt->outcome.device_id = status == 0 ? device_id : -1;
+    xlnx_alloc_last = attempt->outcome;
+}
@@ -0,0 +1,30 @@
+#ifndef _XLNX_ALLOC_POLICY_H_
+#define _XLNX_ALLOC_POLICY_H_
+
+#include "xilinx_encoder.h"
+
+#include <stdint.h>
+
+#define XLNX_ALLOC_RETRY 0
+
+/* One open going through the allocation policy */
+typedef struct XlnxAllocAttempt {
+    XlnxAllocPolicy  policy;
+    XlnxAllocOutcome outcome;
+    int32_t          retries;           /* since the last fallback */
+    int32_t          backoff_ms;
+} XlnxAllocAttempt;
+
+/* Takes the process policy for a new open, counting its first attempt */
+void xlnx_alloc_begin(XlnxAllocAttempt *attempt);
+
+/* After a failed attempt: sleeps and returns XLNX_ALLOC_RETRY while 
+   retries are left, then the first enabled fallback out of applicable for
+   the caller to apply before the next attempt, or -1 to give up */
+int32_t xlnx_alloc_next(XlnxAllocAttempt *attempt, int32_t applicable);
+
+/* Records the result for Encoder_GetAllocOutcome on this thread */
+void xlnx_alloc_end(XlnxAllocAttempt *attempt, int32_t status, 
+                    int32_t device_id);
+
+#endif
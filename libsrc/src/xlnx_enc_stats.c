@@ -0,0 +1,237 @@
+#include "xlnx_enc_stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define XLNX_ENC_STATS_CODEC_HEVC 1
+/* Enough RBSP for every header field read here */
+#define XLNX_ENC_STATS_RBSP_SIZE  32
+#define XLNX_ENC_STATS_CACHE_LINE 64
+#define XLNX_ENC_STATS_ALIGNED    \
+            __attribute__((aligned(XLNX_ENC_STATS_CACHE_LINE)))
+
+typedef struct {
+    const uint8_t *buf;
+    int32_t       size;
+    int32_t       pos;
+} XlnxEncBitReader;
+
+struct XlnxEncStatsRing {
+    /* Producer and consumer indices live on their own cache lines */
+    XLNX_ENC_STATS_ALIGNED uint64_t head;
+    XLNX_ENC_STATS_ALIGNED uint64_t tail;
+    XLNX_ENC_STATS_ALIGNED uint32_t mask;
+    XlnxEncoderFrameStats *entries;
+};
+
+/* Copies the start of a NAL payload without emulation prevention bytes */
+static int32_t xlnx_enc_stats_unescape(const uint8_t *src, int32_t size,
+                                       uint8_t *dst)
+{
+    int32_t n = 0;
+    int32_t zeros = 0;
+
+    for(int32_t i = 0; i < size && n < XLNX_ENC_STATS_RBSP_SIZE; i++) {
+        if(zeros >= 2 && src[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = src[i] ? 0 : zeros + 1;
+        dst[n++] = src[i];
+    }
+    return n;
+}
+
+static uint32_t xlnx_enc_read_bits(XlnxEncBitReader *br, int32_t count)
+{
+    uint32_t val = 0;
+
+    for(int32_t i = 0; i < count; i++, br->pos++) {
+        val <<= 1;
+        if(br->pos < br->size * 8) {
+            val |= (br->buf[br->pos >> 3] >> (7 - (br->pos & 7))) & 1;
+        }
+    }
+    return val;
+}
+
+/* Exp-Golomb ue(v), header values read here stay far below 2^16 */
+static uint32_t xlnx_enc_read_ue(XlnxEncBitReader *br)
+{
+    int32_t zeros = 0;
+
+    while(zeros < 16 && br->pos < br->size * 8 && 
+          xlnx_enc_read_bits(br, 1) == 0) {
+        zeros++;
+    }
+    return ((1u << zeros) - 1) + xlnx_enc_read_bits(br, zeros);
+}
+
+static int32_t xlnx_enc_next_start_code(const uint8_t *data, int32_t size,
+                                        int32_t pos)
+{
+    const uint8_t *one;
+
+    for(int32_t i = pos + 2; i < size; i++) {
+        one = memchr(data + i, 1, size - i);
+        if(!one) {
+            break;
+        }
+        i = one - data;
+        if(data[i - 1] == 0 && data[i - 2] == 0) {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+/* Returns 1 once the first slice was parsed */
+static int32_t xlnx_enc_stats_parse_h264(const uint8_t *nal, int32_t size,
+                                         XlnxEncoderFrameStats *stats)
+{
+    uint8_t rbsp[XLNX_ENC_STATS_RBSP_SIZE];
+    XlnxEncBitReader br;
+    int32_t nal_type = nal[0] & 0x1f;
+
+    if(nal_type != 1 && nal_type != 5) {
+        return 0;
+    }
+    br.buf = rbsp;
+    br.size = xlnx_enc_stats_unescape(nal + 1, size - 1, rbsp);
+    br.pos = 0;
+    xlnx_enc_read_ue(&br); /* first_mb_in_slice */
+    switch(xlnx_enc_read_ue(&br) % 5) {
+        case 0: case 3: stats->picture_type = XLNX_ENC_PICTURE_P; break;
+        case 1:         stats->picture_type = XLNX_ENC_PICTURE_B; break;
+        default:        stats->picture_type = XLNX_ENC_PICTURE_I; break;
+    }
+    stats->is_idr = (nal_type == 5);
+    return 1;
+}
+
+static int32_t xlnx_enc_stats_parse_hevc(XlnxEncStatsParser *parser, 
+                                         const uint8_t *nal, int32_t size,
+                                         XlnxEncoderFrameStats *stats)
+{
+    uint8_t rbsp[XLNX_ENC_STATS_RBSP_SIZE];
+    XlnxEncBitReader br;
+    int32_t nal_type = (nal[0] >> 1) & 0x3f;
+    uint32_t pps_id;
+
+    if(size < 3 || (nal_type > 21 && nal_type != 34)) {
+        return 0;
+    }
+    br.buf = rbsp;
+    br.size = xlnx_enc_stats_unescape(nal + 2, size - 2, rbsp);
+    br.pos = 0;
+
+    if(nal_type == 34) {
+        pps_id = xlnx_enc_read_ue(&br);
+        xlnx_enc_read_ue(&br); /* pps_seq_parameter_set_id */
+        xlnx_enc_read_bits(&br, 2); /* dependent slices, output flag */
+        if(pps_id < XLNX_ENC_STATS_MAX_PPS) {
+            parser->hevc_extra_bits[pps_id] = xlnx_enc_read_bits(&br, 3);
+        }
+        return 0;
+    }
+
+    /* The first slice segment of a picture is never dependent */
+    xlnx_enc_read_bits(&br, 1); /* first_slice_segment_in_pic_flag */
+    if(nal_type >= 16) {
+        xlnx_enc_read_bits(&br, 1); /* no_output_of_prior_pics_flag */
+    }
+    pps_id = xlnx_enc_read_ue(&br);
+    if(pps_id < XLNX_ENC_STATS_MAX_PPS) {
+        xlnx_enc_read_bits(&br, parser->hevc_extra_bits[pps_id]);
+    }
+    switch(xlnx_enc_read_ue(&br)) {
+        case 0:  stats->picture_type = XLNX_ENC_PICTURE_B; break;
+        case 1:  stats->picture_type = XLNX_ENC_PICTURE_P; break;
+        default: stats->picture_type = XLNX_ENC_PICTURE_I; break;
+    }
+    stats->is_idr = (nal_type == 19 || nal_type == 20);
+    return 1;
+}
+
+void xlnx_enc_stats_parse_au(XlnxEncStatsParser *parser, int32_t codec_id,
+                             const uint8_t *data, int32_t size, 
+                             XlnxEncoderFrameStats *stats)
+{
+    int32_t start = xlnx_enc_next_start_code(data, size, 0);
+    int32_t next;
+    int32_t done = 0;
+
+    stats->picture_type = XLNX_ENC_PICTURE_UNKNOWN;
+    stats->is_idr = 0;
+
+    /* Parameter sets and SEI come first, stop at the first slice */
+    while(!done && start < size) {
+        next = xlnx_enc_next_start_code(data, size, start);
+        /* Trailing zeros of the next start code do not matter here */
+        if(codec_id == XLNX_ENC_STATS_CODEC_HEVC) {
+            done = xlnx_enc_stats_parse_hevc(parser, data + start, 
+                                             next - start, stats);
+        } else {
+            done = xlnx_enc_stats_parse_h264(data + start, next - start, 
+                                             stats);
+        }
+        start = next;
+    }
+}
+
+XlnxEncStatsRing *xlnx_enc_stats_ring_create(uint32_t capacity)
+{
+    XlnxEncStatsRing *ring;
+    uint32_t size = 1;
+
+    while(size < capacity && size < (1u << 30)) {
+        size <<= 1;
+    }
+    if(posix_memalign((void **)&ring, XLNX_ENC_STATS_CACHE_LINE, 
+                      sizeof(XlnxEncStatsRing)) != 0) {
+        return NULL;
+    }
+    memset(ring, 0, sizeof(XlnxEncStatsRing));
+    ring->mask = size - 1;
+    ring->entries = calloc(size, sizeof(XlnxEncoderFrameStats));
+    if(!ring->entries) {
+        free(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void xlnx_enc_stats_ring_destroy(XlnxEncStatsRing *ring)
+{
+    if(!ring) {
+        return;
+    }
+    free(ring->entries);
+    free(ring);
+}
+
+int32_t xlnx_enc_stats_ring_push(XlnxEncStatsRing *ring, 
+                                 const XlnxEncoderFrameStats *stats)
+{
+    uint64_t head = ring->head;
+
+    if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        return -1;
+    }
+    ring->entries[head & ring->mask] = *stats;
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int32_t xlnx_enc_stats_ring_pop(XlnxEncStatsRing *ring, 
+                                XlnxEncoderFrameStats *stats)
+{
+    uint64_t tail = ring->tail;
+
+    if(tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *stats = ring->entries[tail & ring->mask];
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
@@ -0,0 +1,38 @@
+#ifndef _XLNX_ENC_STATS_H_
+#define _XLNX_ENC_STATS_H_
+
+#include "xilinx_encoder.h"
+
+#include <stdint.h>
+
+#define XLNX_ENC_STATS_MAX_PPS 64
+
+/* PPS fields needed to reach the HEVC slice_type */
+typedef struct XlnxEncStatsParser {
+    uint8_t hevc_extra_bits[XLNX_ENC_STATS_MAX_PPS];
+} XlnxEncStatsParser;
+
+/* Sets picture_type and is_idr from the first slice header of an access 
+   unit, and remembers the parameter sets seen on the way */
+void xlnx_enc_stats_parse_au(XlnxEncStatsParser *parser, int32_t codec_id,
+                             const uint8_t *data, int32_t size, 
+                             XlnxEncoderFrameStats *stats);
+
+/* Single producer, single consumer ring. The producer never blocks, a full
+   ring drops the entry. */
+typedef struct XlnxEncStatsRing XlnxEncStatsRing;
+
+/* capacity is rounded up to a power of two */
+XlnxEncStatsRing *xlnx_enc_stats_ring_create(uint32_t capacity);
+
+void xlnx_enc_stats_ring_destroy(XlnxEncStatsRing *ring);
+
+/* 0 on success, -1 when the ring is full */
+int32_t xlnx_enc_stats_ring_push(XlnxEncStatsRing *ring, 
+                                 const XlnxEncoderFrameStats *stats);
+
+/* 1 when an entry was taken, 0 when the ring is empty */
+int32_t xlnx_enc_stats_ring_pop(XlnxEncStatsRing *ring, 
+                                XlnxEncoderFrameStats *stats);
+
+#endif
@@ -1,9 +1,19 @@
 #include "xilinx_encoder.h"
+#include "xlnx_yuv_convert.h"
+#include "xlnx_packet_pool.h"
+#include "xlnx_scene_detect.h"
+#include "xlnx_enc_stats.h"
+#include "xlnx_xrm_load.h"
+#include "xlnx_placement.h"
+#include "xlnx_telemetry.h"
+#include "xlnx_latency_hist.h"
+#include "xlnx_alloc_policy.h"
 
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdarg.h>
 #include <limits.h>
 #include <getopt.h>
 #include <dlfcn.h>
@@ -22,6 +32,7 @@
 #include <stdbool.h>
 #include <time.h>
 #include <errno.h>
+#include <pthread.h>
 
 #define FLAG_HELP             "help"
 #define FLAG_DEVICE_ID        "d"
@@ -58,6 +69,10 @@
 #define FLAG_TUNE_METRICS     "tune-metrics"
 #define FLAG_LATENCY_LOGGING  "latency_logging"
 #define FLAG_OUTPUT_FILE      "o"
+#define FLAG_GOP_MODE         "gop-mode"
+#define FLAG_LOW_LATENCY      "low-latency"
+#define FLAG_PRESET           "preset"
+#define FLAG_SCENE_CUT        "scene-cut"
 
 typedef struct {
     xrmContext*       xrm_ctx;
@@ -70,6 +85,8 @@ typedef struct {
     int32_t           enc_num;
     int32_t           enc_res_in_use;
     int32_t           lookahead_res_inuse;
+    /* XRM context and CU pool belong to an ABR ladder, not to this encoder */
+    int32_t           shared_pool;
 } XlnxEncoderXrmCtx;
 
 /* HEVC Encoder supported profiles */
@@ -79,12 +96,6 @@ typedef enum
     ENC_HEVC_MAIN_INTRA
 } XlnxHevcProfiles;
 
-typedef enum
-{
-    ENCODER_ID_H264 = 0,
-    ENCODER_ID_HEVC
-} XlnxEncoderCodecID;
-
 typedef enum
 {
     LOOKAHEAD_ID_H264 = 0,
@@ -133,7 +144,11 @@ typedef enum
     LATENCY_LOGGING_ARG,
     NUM_CORES_ARG,
     TUNE_METRICS_ARG,
-    OUTPUT_FILE_ARG
+    OUTPUT_FILE_ARG,
+    GOP_MODE_ARG,
+    LOW_LATENCY_ARG,
+    PRESET_ARG,
+    SCENE_CUT_ARG
 } XlnxEncArgIdentifiers;
 
 typedef enum
@@ -243,10 +258,84 @@ typedef struct {
     char    *enc_options;
 }XlnxEncoderProperties;
 
+/* Runtime encoder parameters. The layout matches the EncDynParams payload the
+   U30 encoder plugin reads from XMA_FRAME_DYNAMIC_PARAMS side data; it is
+   applied from the frame it is attached to, without a session restart. The
+   plugin only acts on the fields behind an is_*_changed flag; frame_rate
+   and rc_mode are informational. */
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    double   frame_rate;
+    uint16_t rc_mode;
+    bool     is_bitrate_changed;
+    uint32_t bit_rate;
+    bool     is_bframes_changed;
+    uint8_t  num_b_frames;
+    bool     is_min_max_qp_changed;
+    int16_t  min_qp;
+    int16_t  max_qp;
+    bool     is_temporal_aq_mode_changed;
+    uint8_t  temporal_aq_mode;
+    bool     is_spatial_aq_mode_changed;
+    uint8_t  spatial_aq_mode;
+    bool     is_spatial_aq_gain_changed;
+    uint32_t spatial_aq_gain;
+} XlnxEncDynParams;
+
+/* The SDK does not install the header declaring EncDynParams, so the copy
+   above is pinned to the plugin's layout: a field moved here would be
+   read from the wrong offset on the card */
+_Static_assert(sizeof(XlnxEncDynParams) == 48, "EncDynParams size");
+_Static_assert(offsetof(XlnxEncDynParams, frame_rate) == 8, 
+               "EncDynParams frame_rate");
+_Static_assert(offsetof(XlnxEncDynParams, rc_mode) == 16, 
+               "EncDynParams rc_mode");
+_Static_assert(offsetof(XlnxEncDynParams, is_bitrate_changed) == 18, 
+               "EncDynParams is_bitrate_changed");
+_Static_assert(offsetof(XlnxEncDynParams, bit_rate) == 20, 
+               "EncDynParams bit_rate");
+_Static_assert(offsetof(XlnxEncDynParams, is_bframes_changed) == 24, 
+               "EncDynParams is_bframes_changed");
+_Static_assert(offsetof(XlnxEncDynParams, num_b_frames) == 25, 
+               "EncDynParams num_b_frames");
+_Static_assert(offsetof(XlnxEncDynParams, is_min_max_qp_changed) == 26, 
+               "EncDynParams is_min_max_qp_changed");
+_Static_assert(offsetof(XlnxEncDynParams, min_qp) == 28, 
+               "EncDynParams min_qp");
+_Static_assert(offsetof(XlnxEncDynParams, max_qp) == 30, 
+               "EncDynParams max_qp");
+_Static_assert(offsetof(XlnxEncDynParams, is_temporal_aq_mode_changed) == 32,
+               "EncDynParams is_temporal_aq_mode_changed");
+_Static_assert(offsetof(XlnxEncDynParams, temporal_aq_mode) == 33, 
+               "EncDynParams temporal_aq_mode");
+_Static_assert(offsetof(XlnxEncDynParams, is_spatial_aq_mode_changed) == 34, 
+               "EncDynParams is_spatial_aq_mode_changed");
+_Static_assert(offsetof(XlnxEncDynParams, spatial_aq_mode) == 35, 
+               "EncDynParams spatial_aq_mode");
+_Static_assert(offsetof(XlnxEncDynParams, is_spatial_aq_gain_changed) == 36, 
+               "EncDynParams is_spatial_aq_gain_changed");
+_Static_assert(offsetof(XlnxEncDynParams, spatial_aq_gain) == 40, 
+               "EncDynParams spatial_aq_gain");
+
+/* Lookahead side data summary of one frame in flight */
+typedef struct XlnxEncLaStats
+{
+    int32_t valid;
+    int32_t qp_map_size;
+    float   qp_offset;
+} XlnxEncLaStats;
+
+/* Frames that can be in flight between submit and output: lookahead depth
+   plus encoder reordering, rounded up */
+#define XLNX_ENC_MAX_INFLIGHT      64
+
 /* Encoder Context */
 typedef struct {
     XmaDataBuffer         xma_buffer;
     XmaFrame              in_frame;
+    /* Wraps caller owned planes passed to Encoder_EncodeFrameStrided */
+    XmaFrame              ext_frame;
     XmaEncoderSession     *enc_session;
     XmaFrame              *enc_in_frame;
     XmaFrame              *la_in_frame;
@@ -260,6 +349,45 @@ typedef struct {
     uint32_t              la_bypass;
     uint32_t              enc_state;
     int32_t               pts;
+    /* Input frames already live in xvbm device buffers (ABR ladder) */
+    int32_t               zero_copy_input;
+    /* Widest strided input line, 0 when input is packed */
+    int32_t               input_stride;
+    /* Set by Encoder_Reconfigure, consumed by the next frame sent */
+    XlnxEncDynParams      dyn_params;
+    int32_t               dyn_params_pending;
+    int32_t               force_idr;
+    /* pts of frames to be coded as IDR once they leave the lookahead,
+       -1 when the slot is free */
+    int64_t               idr_pts[XLNX_ENC_MAX_INFLIGHT];
+    /* Host side scene change detection, threshold 0 when off */
+    int32_t               scene_cut;
+    XlnxSceneDetector     *scene_det;
+    /* Per NAL delivery, see Encoder_SetNalCallback */
+    XlnxEncoderNalCallback nal_cb;
+    void                  *nal_opaque;
+    /* Frames in flight, indexed by pts */
+    int64_t               submit_us[XLNX_ENC_MAX_INFLIGHT];
+    XlnxEncLaStats        la_stats[XLNX_ENC_MAX_INFLIGHT];
+    /* Per packet statistics, see Encoder_GetFrameStats */
+    XlnxEncStatsParser    stats_parser;
+    XlnxEncoderFrameStats last_stats;
+    XlnxEncStatsRing      *stats_ring;
+    /* Per stage frame latency, see Encoder_GetLatencyStats */
+    XlnxLatencyHistSet    latency;
+    /* Output bitstream buffers: out_pkt receives the next packet,
+       ready_pkt waits for Encoder_ReceivePacket */
+    XlnxPacketPool        *pkt_pool;
+    XlnxPacketBuf         *out_pkt;
+    XlnxPacketBuf         *ready_pkt;
+    /* Bytes the caller's outBuf holds, see Encoder_SetOutputCapacity. A
+       larger packet is kept in ready_pkt and out_too_small set. */
+    size_t                out_capacity;
+    int32_t               out_too_small;
+    /* Channel start and its first packet, see Encoder_GetFirstPacketUs */
+    int64_t               start_us;
+    int64_t               first_pkt_us;
+    XlnxTelemetryChannel  telemetry;
     FILE                  *in_file;
     FILE                  *out_file;
 } XlnxEncoderCtx;
@@ -269,6 +397,13 @@ typedef struct {
 #define ENC_APP_DONE               1
 #define ENC_APP_STOP               2
 
+/* Output packet sizing, see xlnx_enc_packet_size */
+#define XLNX_ENC_PACKET_MIN_SIZE   (64 * 1024)
+#define XLNX_ENC_PACKET_HDR_SIZE   4096
+/* How long a frame waits for room when the encoder reports XMA_TRY_AGAIN */
+#define XLNX_ENC_SEND_RETRIES      1000
+#define XLNX_ENC_SEND_RETRY_US     100
+
 #define ENC_DEFAULT_NUM_B_FRAMES   2
 #define ENC_DEFAULT_LEVEL          10
 #define ENC_DEFAULT_FRAMERATE      25
@@ -307,6 +442,14 @@ typedef struct {
 #define ENC_SUPPORTED_MIN_QP       0
 #define ENC_SUPPORTED_MAX_QP       51
 
+#define ENC_SUPPORTED_MAX_NUM_B_FRAMES 7
+#define ENC_SUPPORTED_MAX_SLICES   68
+#define ENC_SUPPORTED_MAX_NUM_CORES 4
+/* One encoder core sustains about 1080p60, all four together 2160p60 */
+#define XLNX_ENC_CORE_PIXEL_RATE   (1920LL * 1080 * 60)
+#define ENC_SUPPORTED_MAX_PIXEL_RATE \
+            (XLNX_ENC_CORE_PIXEL_RATE * ENC_SUPPORTED_MAX_NUM_CORES)
+
 #define ENC_OPTION_DISABLE         0
 #define ENC_OPTION_ENABLE          1
 
@@ -372,7 +515,6 @@ typedef struct {
 
 
 #define DEFAULT_DEVICE_ID    -1
-#define XMA_PROPS_TO_JSON_SO "/opt/xilinx/xrm/plugin/libxmaPropsTOjson.so"
 #define XCLBIN_PARAM_NAME    "/opt/xilinx/xcdr/xclbins/transcode.xclbin"
 
 #define RET_ERROR     XMA_ERROR
@@ -427,8 +569,104 @@ static const char *XLNX_LA_EXT_PARAMS[] = {
     "latency_logging"
 };
 
+static struct option xlnx_enc_options[] =
+{
+    {FLAG_HELP,            no_argument,       0, HELP_ARG},
+    {FLAG_DEVICE_ID,       required_argument, 0, DEVICE_ID_ARG},
+    {FLAG_STREAM_LOOP,     required_argument, 0, LOOP_COUNT_ARG},
+    {FLAG_INPUT_FILE,      required_argument, 0, INPUT_FILE_ARG},
+    {FLAG_CODEC_TYPE,      required_argument, 0, ENCODER_ARG},
+    {FLAG_INPUT_WIDTH,     required_argument, 0, INPUT_WIDTH_ARG},
+    {FLAG_INPUT_HEIGHT,    required_argument, 0, INPUT_HEIGHT_ARG},
+    {FLAG_INPUT_PIX_FMT,   required_argument, 0, INPUT_PIX_FMT_ARG},
+    {FLAG_BITRATE,         required_argument, 0, BITRATE_ARG},
+    {FLAG_BIT_RATE,        required_argument, 0, BITRATE_ARG},
+    {FLAG_FPS,             required_argument, 0, FPS_ARG},
+    {FLAG_INTRA_PERIOD,    required_argument, 0, INTRA_PERIOD_ARG},
+    {FLAG_CONTROL_RATE,    required_argument, 0, CONTROL_RATE_ARG},
+    {FLAG_MAX_BITRATE,     required_argument, 0, MAX_BITRATE_ARG},
+    {FLAG_SLICE_QP,        required_argument, 0, SLICE_QP_ARG},
+    {FLAG_MIN_QP,          required_argument, 0, MIN_QP_ARG},
+    {FLAG_MAX_QP,          required_argument, 0, MAX_QP_ARG},
+    {FLAG_NUM_BFRAMES,     required_argument, 0, NUM_BFRAMES_ARG},
+    {FLAG_IDR_PERIOD,      required_argument, 0, IDR_PERIOD_ARG},
+    {FLAG_PROFILE,         required_argument, 0, PROFILE_ARG},
+    {FLAG_LEVEL,           required_argument, 0, LEVEL_ARG},
+    {FLAG_NUM_SLICES,      required_argument, 0, NUM_SLICES_ARG},
+    {FLAG_QP_MODE,         required_argument, 0, QP_MODE_ARG},
+    {FLAG_ASPECT_RATIO,    required_argument, 0, ASPECT_RATIO_ARG},
+    {FLAG_SCALING_LIST,    required_argument, 0, SCALING_LIST_ARG},
+    {FLAG_LOOKAHEAD_DEPTH, required_argument, 0, LOOKAHEAD_DEPTH_ARG},
+    {FLAG_TEMPORAL_AQ,     required_argument, 0, TEMPORAL_AQ_ARG},
+    {FLAG_SPATIAL_AQ,      required_argument, 0, SPATIAL_AQ_ARG},
+    {FLAG_SPATIAL_AQ_GAIN, required_argument, 0, SPATIAL_AQ_GAIN_ARG},
+    {FLAG_QP,              required_argument, 0, QP_ARG},
+    {FLAG_NUM_FRAMES,      required_argument, 0, NUM_FRAMES_ARG},
+    {FLAG_NUM_CORES,       required_argument, 0, NUM_CORES_ARG},
+    {FLAG_TUNE_METRICS,    required_argument, 0, TUNE_METRICS_ARG},
+    {FLAG_LATENCY_LOGGING, required_argument, 0, LATENCY_LOGGING_ARG},
+    {FLAG_OUTPUT_FILE,     required_argument, 0, OUTPUT_FILE_ARG},
+    {FLAG_GOP_MODE,        required_argument, 0, GOP_MODE_ARG},
+    {FLAG_LOW_LATENCY,     required_argument, 0, LOW_LATENCY_ARG},
+    {FLAG_PRESET,          required_argument, 0, PRESET_ARG},
+    {FLAG_SCENE_CUT,       required_argument, 0, SCENE_CUT_ARG},
+    {0, 0, 0, 0}
+};
+
+static XlnxEncProfileLookup xlnx_enc_codec_lookup[] = {
+    {H264_CODEC_NAME, ENCODER_ID_H264},
+    {"h264",          ENCODER_ID_H264},
+    {HEVC_CODEC_NAME, ENCODER_ID_HEVC},
+    {"hevc",          ENCODER_ID_HEVC},
+    {"h265",          ENCODER_ID_HEVC}
+};
+
+static XlnxEncProfileLookup xlnx_enc_pix_fmt_lookup[] = {
+    {"nv12",    YUV_NV12_ID},
+    {"yuv420p", YUV_420P_ID}
+};
+
+static XlnxEncProfileLookup xlnx_enc_h264_profile_lookup[] = {
+    {"baseline", ENC_H264_BASELINE},
+    {"main",     ENC_H264_MAIN},
+    {"high",     ENC_H264_HIGH}
+};
+
+static XlnxEncProfileLookup xlnx_enc_hevc_profile_lookup[] = {
+    {"main",       ENC_HEVC_MAIN},
+    {"main-intra", ENC_HEVC_MAIN_INTRA}
+};
+
+static XlnxEncProfileLookup xlnx_enc_control_rate_lookup[] = {
+    {"const-qp",    ENC_RC_CONST_QP_MODE},
+    {"cbr",         ENC_RC_CBR_MODE},
+    {"vbr",         ENC_RC_VBR_MODE},
+    {"low-latency", ENC_RC_LOW_LATENCY_MODE}
+};
+
+static XlnxEncProfileLookup xlnx_enc_qp_mode_lookup[] = {
+    {"uniform",       ENC_UNIFORM_QP_MODE},
+    {"auto",          ENC_AUTO_QP_MODE},
+    {"relative-load", ENC_RELATIVE_LOAD_QP_MODE}
+};
+
+static XlnxEncProfileLookup xlnx_enc_gop_mode_lookup[] = {
+    {"default",     ENC_DEFAULT_GOP_MODE},
+    {"pyramidal",   ENC_PYRAMIDAL_GOP_MODE},
+    {"low-delay-p", ENC_LOW_DELAY_P_MODE},
+    {"low-delay-b", ENC_LOW_DELAY_B_MODE}
+};
+
+static XlnxEncProfileLookup xlnx_enc_aspect_ratio_lookup[] = {
+    {"auto", ENC_ASPECT_RATIO_AUTO},
+    {"4:3",  ENC_ASPECT_RATIO_4_3},
+    {"16:9", ENC_ASPECT_RATIO_16_9},
+    {"none", ENC_ASPECT_RATIO_NONE}
+};
+
+#define XLNX_ENC_LOOKUP_SIZE(table) (sizeof(table) / sizeof((table)[0]))
+
 #define DEFAULT_DEVICE_ID    -1
-#define XMA_PROPS_TO_JSON_SO "/opt/xilinx/xrm/plugin/libxmaPropsTOjson.so"
 #define XCLBIN_PARAM_NAME    "/opt/xilinx/xcdr/xclbins/transcode.xclbin"
 
 #define RET_ERROR     XMA_ERROR
@@ -450,6 +688,9 @@ static const char *XLNX_LA_EXT_PARAMS[] = {
 
 #define DEC_APP_ERROR              XMA_ERROR
 #define DEC_APP_SUCCESS            XMA_SUCCESS
+/* Decoder_frame waits this long for room in the output pool */
+#define XLNX_DEC_SEND_RETRIES      1000
+#define XLNX_DEC_SEND_RETRY_US     100
 
 #define XLNX_DEC_APP_MODULE     "xlnx_decoder"
 #define XRM_PRECISION_1000000_BIT_MASK(load) ((load << 8))
@@ -485,6 +726,8 @@ typedef struct XlnxDecoderXrmCtx
     int                       decode_res_in_use;
     xrmContext*               xrm_ctx;
     xrmCuListResource         decode_cu_list_res;
+    /* XRM context and CU pool belong to an ABR ladder, not to this decoder */
+    int                       shared_pool;
 } XlnxDecoderXrmCtx;
 
 typedef struct XlnxDecoderChannelCtx
@@ -505,12 +748,62 @@ typedef struct XlnxDecoderCtx
     XlnxDecoderProperties     dec_params;
 	XlnxDecoderChannelCtx     channel_ctx;
     XlnxDecoderXrmCtx         dec_xrm_ctx;
+    /* Frames taken to make room for input while outbuffer was already
+       filled, handed out first by the next Decoder_frame calls. held_cap
+       buffers are allocated, the first num_held are in use. */
+    unsigned char**           held_frames;
+    int32_t                   num_held;
+    int32_t                   held_cap;
 } XlnxDecoderCtx;
 
+/* XMA can be initialized only once per process and only for the device it
+   was initialized with. Every channel goes through this helper so concurrent
+   encoder and decoder handles share that single initialization. */
+static pthread_mutex_t xlnx_xma_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int32_t xlnx_xma_init_device = -1;
+
+static int32_t xlnx_xma_initialize(int32_t device_id, char *xclbin_name)
+{
+    XmaXclbinParameter xclbin_param;
+    int32_t ret = XMA_SUCCESS;
+
+    pthread_mutex_lock(&xlnx_xma_init_lock);
+    if(xlnx_xma_init_device < 0) {
+        xclbin_param.device_id = device_id;
+        xclbin_param.xclbin_name = xclbin_name;
+        ret = xma_initialize(&xclbin_param, 1);
+        if(ret == XMA_SUCCESS) {
+            xlnx_xma_init_device = device_id;
+        }
+    }
+    else if(xlnx_xma_init_device != device_id) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_APP_UTILS_MODULE, 
+                   "XMA is initialized on device %d, device %d needs a "
+                   "separate process\n", xlnx_xma_init_device, device_id);
+        ret = XMA_ERROR;
+    }
+    pthread_mutex_unlock(&xlnx_xma_init_lock);
+
+    return ret;
+}
+
+/* Device XMA was initialized on, -1 before the first channel is created */
+static int32_t xlnx_xma_get_device()
+{
+    int32_t device_id;
+
+    pthread_mutex_lock(&xlnx_xma_init_lock);
+    device_id = xlnx_xma_init_device;
+    pthread_mutex_unlock(&xlnx_xma_init_lock);
+
+    return device_id;
+}
+
 void xlnx_dec_cleanup_decoder_props(XmaDecoderProperties* dec_xma_props)
 {
     if(dec_xma_props->params) {
         free(dec_xma_props->params);
+        dec_xma_props->params = NULL;
     }
 }
 
@@ -594,11 +887,8 @@ int32_t xlnx_dec_create_xma_props(XlnxDecoderProperties* param_ctx,
     return DEC_APP_SUCCESS;
 }
 
-int32_t xlnx_dec_create_context(XlnxDecoderCtx* ctx)
+void xlnx_dec_set_default_params(XlnxDecoderProperties* param_ctx)
 {
-	XlnxDecoderXrmCtx dec_xrm_ctx;
-    XlnxDecoderProperties* param_ctx  = &ctx->dec_params;
-	
     param_ctx->device_id          =  DEFAULT_DEVICE_ID;//arguments.device_id;
     param_ctx->fps                =  60;//parse_data.fr_num / parse_data.fr_den;
     param_ctx->width              =  1920;//parse_data.width;
@@ -612,6 +902,12 @@ int32_t xlnx_dec_create_context(XlnxDecoderCtx* ctx)
     param_ctx->scan_type          = 1;
     param_ctx->profile_idc = 100;
     param_ctx->level_idc = 40;
+}
+
+int32_t xlnx_dec_create_context(XlnxDecoderCtx* ctx)
+{
+	XlnxDecoderXrmCtx dec_xrm_ctx;
+    XlnxDecoderProperties* param_ctx  = &ctx->dec_params;
 	
 	XmaFrame*             xframe        = calloc(1, sizeof(*xframe));
     xframe->side_data                   = NULL;
@@ -653,14 +949,18 @@ void xlnx_dec_cleanup_xrm_ctx(XlnxDecoderXrmCtx* dec_xrm_ctx)
         
         dec_xrm_ctx->decode_res_in_use = 0;
     }
+    if(dec_xrm_ctx->shared_pool) {
+        return;
+    }
     if(dec_xrm_ctx->xrm_reserve_id) {
         /* Put the resource back into the pool of available. */
         xrmCuPoolRelinquish(dec_xrm_ctx->xrm_ctx, 
                             dec_xrm_ctx->xrm_reserve_id); 
+        dec_xrm_ctx->xrm_reserve_id = 0;
     }
-    if(dec_xrm_ctx->xrm_ctx) {
-        xrmDestroyContext(dec_xrm_ctx->xrm_ctx);
-    }
+    /* Failed reservations clean up early, the context goes away once */
+    xrmDestroyContext(dec_xrm_ctx->xrm_ctx);
+    dec_xrm_ctx->xrm_ctx = NULL;
 }
 
 int32_t xlnx_dec_cu_alloc_device_id(XlnxDecoderXrmCtx* dec_xrm_ctx, 
@@ -690,17 +990,17 @@ int32_t xlnx_dec_cu_alloc_device_id(XlnxDecoderXrmCtx* dec_xrm_ctx,
 
     int32_t ret;
     int32_t device_id = dec_props->dev_index;
-    ret = xrmCuAllocFromDev(dec_xrm_ctx->xrm_ctx, device_id, 
-                            &decode_cu_list_prop.cuProps[0], 
-                            &dec_xrm_ctx->decode_cu_list_res.cuResources[0]);
+    ret = xlnx_xrm_cu_alloc_from_dev(dec_xrm_ctx->xrm_ctx, device_id, 
+                                     &decode_cu_list_prop.cuProps[0], 
+                                     &dec_xrm_ctx->decode_cu_list_res.cuResources[0]);
     if(ret != XMA_SUCCESS) {
         DECODER_APP_LOG_ERROR("xrm failed to allocate decoder resources on "
                               "device %d\n", dec_xrm_ctx->xrm_reserve_id);
         return ret;
     }
-    ret = xrmCuAllocFromDev(dec_xrm_ctx->xrm_ctx, device_id, 
-                            &decode_cu_list_prop.cuProps[1], 
-                            &dec_xrm_ctx->decode_cu_list_res.cuResources[1]);
+    ret = xlnx_xrm_cu_alloc_from_dev(dec_xrm_ctx->xrm_ctx, device_id, 
+                                     &decode_cu_list_prop.cuProps[1], 
+                                     &dec_xrm_ctx->decode_cu_list_res.cuResources[1]);
     if(ret != XMA_SUCCESS) {
         DECODER_APP_LOG_ERROR("xrm failed to allocate decoder resources on "
                               "device %d\n", dec_xrm_ctx->xrm_reserve_id);
@@ -744,8 +1044,8 @@ int32_t xlnx_dec_allocate_xrm_dec_cu(XlnxDecoderXrmCtx* dec_xrm_ctx,
                                         XRM_MAX_CU_LOAD_GRANULARITY_1000000);
     decode_cu_list_prop.cuProps[1].poolId = dec_xrm_ctx->xrm_reserve_id;
 
-    if(xrmCuListAlloc(dec_xrm_ctx->xrm_ctx, &decode_cu_list_prop, 
-                      &dec_xrm_ctx->decode_cu_list_res) != 0) {
+    if(xlnx_xrm_cu_list_alloc(dec_xrm_ctx->xrm_ctx, &decode_cu_list_prop, 
+                              &dec_xrm_ctx->decode_cu_list_res) != 0) {
         DECODER_APP_LOG_ERROR("xrm_allocation: fail to allocate cu list "
                               "from reserve id %d\n", 
                               dec_xrm_ctx->xrm_reserve_id);
@@ -772,7 +1072,8 @@ int32_t xlnx_dec_allocate_xrm_dec_cu(XlnxDecoderXrmCtx* dec_xrm_ctx,
 static int32_t dec_fill_pool_props(xrmCuPoolProperty* dec_cu_pool_prop, 
                                    int dec_load)
 {
-    int32_t cu_num = 0;
+    /* Appends to the CU list, so a ladder can reserve everything at once */
+    int32_t cu_num = dec_cu_pool_prop->cuListProp.cuNum;
     dec_cu_pool_prop->cuListProp.sameDevice = true;
     dec_cu_pool_prop->cuListNum = 1;
     strcpy(dec_cu_pool_prop->cuListProp.cuProps[cu_num].kernelName, 
@@ -798,31 +1099,17 @@ static int32_t dec_fill_pool_props(xrmCuPoolProperty* dec_cu_pool_prop,
 static int32_t dec_load_calc(XlnxDecoderXrmCtx* dec_xrm_ctx, 
                              XmaDecoderProperties* dec_props, int* dec_load)
 {
-    int32_t func_id = 0;
     int32_t ret;
-    char pluginName[XRM_MAX_NAME_LEN];
-    xrmPluginFuncParam plg_param;
-
-    memset(&plg_param, 0, sizeof(xrmPluginFuncParam));
-    void *handle;
-    void (*convertXmaPropsToJson)(void* props, char* funcName, char* jsonJob);
+    XlnxXrmLoad load;
 
-    /* Loading propstojson library to convert decoder properties to json */
-    handle = dlopen(XMA_PROPS_TO_JSON_SO, RTLD_NOW );
-
-    convertXmaPropsToJson = dlsym(handle, "convertXmaPropsToJson");
-    (*convertXmaPropsToJson) (dec_props, "DECODER", plg_param.input);
-    dlclose(handle);
-
-    strcpy(pluginName, "xrmU30DecPlugin");
-
-    if((ret = xrmExecPluginFunc(dec_xrm_ctx->xrm_ctx, pluginName, func_id, 
-                                &plg_param)) != XRM_SUCCESS) {
+    if((ret = xlnx_xrm_load_query(dec_xrm_ctx->xrm_ctx, "xrmU30DecPlugin", 
+                                  "DECODER", dec_props, &load)) != 
+                                  XRM_SUCCESS) {
         DECODER_APP_LOG_ERROR("XRM decoder plugin failed to calculate decoder "
                               "load. %d\n", ret);
         return DEC_APP_ERROR;
     }
-    *dec_load = atoi((char*)(strtok(plg_param.output, " ")));
+    *dec_load = load.values[0];
     return DEC_APP_SUCCESS;
 }
 
@@ -833,10 +1120,7 @@ static int32_t dec_reserve_xrm_device_id(XlnxDecoderXrmCtx* dec_xrm_ctx,
     int device_id = dec_props->dev_index;
     if(device_id != -1) {
         /* xclbin configuration */
-        XmaXclbinParameter xclbin_param;
-        xclbin_param.device_id = device_id;
-        xclbin_param.xclbin_name = XCLBIN_PARAM_NAME; 
-        if(xma_initialize(&xclbin_param, 1) != XMA_SUCCESS) {
+        if(xlnx_xma_initialize(device_id, XCLBIN_PARAM_NAME) != XMA_SUCCESS) {
             DECODER_APP_LOG_ERROR("XMA Initialization failed\n");
             xlnx_dec_cleanup_xrm_ctx(dec_xrm_ctx);
             return DEC_APP_ERROR;
@@ -845,8 +1129,9 @@ static int32_t dec_reserve_xrm_device_id(XlnxDecoderXrmCtx* dec_xrm_ctx,
         return DEC_APP_SUCCESS;
     }
     /* Query XRM to get reservation index for the required CU */
-    dec_xrm_ctx->xrm_reserve_id = xrmCuPoolReserve(dec_xrm_ctx->xrm_ctx, 
-                                                   dec_cu_pool_prop);
+    dec_xrm_ctx->xrm_reserve_id = xlnx_xrm_pool_reserve(
+                                      dec_xrm_ctx->xrm_ctx,
+                                      dec_cu_pool_prop);
     if(dec_xrm_ctx->xrm_reserve_id == 0) {
         DECODER_APP_LOG_ERROR("xrm_cu_pool_reserve: fail to reserve decode "
                               "cu pool\n");
@@ -868,11 +1153,8 @@ static int32_t dec_reserve_xrm_device_id(XlnxDecoderXrmCtx* dec_xrm_ctx,
         return DEC_APP_ERROR;
     }
     /* xclbin configuration */
-    XmaXclbinParameter xclbin_param;
-    xclbin_param.device_id = cu_pool_res.cuResources[0].deviceId;
-    xclbin_param.xclbin_name = cu_pool_res.cuResources[0].xclbinFileName; 
-
-    if((xma_initialize(&xclbin_param, 1)) != XMA_SUCCESS) {
+    if(xlnx_xma_initialize(cu_pool_res.cuResources[0].deviceId, 
+                      cu_pool_res.cuResources[0].xclbinFileName) != XMA_SUCCESS) {
         DECODER_APP_LOG_ERROR("XMA Initialization failed\n");
         xlnx_dec_cleanup_xrm_ctx(dec_xrm_ctx);
         return DEC_APP_ERROR;
@@ -916,9 +1198,22 @@ int32_t xlnx_dec_reserve_xrm_resource(XlnxDecoderXrmCtx* dec_xrm_ctx,
     }
     DECODER_APP_LOG_INFO("Num CU pools available %d \n", num_cu_pool);
 
+    /* Once XMA is bound to a device, later channels have to run on it */
+    if(dec_props->dev_index == -1 && xlnx_xma_get_device() >= 0) {
+        dec_props->dev_index = xlnx_xma_get_device();
+    }
+    else if(dec_props->dev_index == -1) {
+        dec_props->dev_index = xlnx_placement_select(dec_xrm_ctx->xrm_ctx, 
+                                                     &dec_cu_pool_prop);
+        if(dec_props->dev_index >= 0) {
+            DECODER_APP_LOG_INFO("Placed decoder on device %d\n", 
+                                 dec_props->dev_index);
+        }
+    }
+
     /* If the device reservation ID is not sent through command line get the 
      * next available device id */
-    dec_reserve_xrm_device_id(dec_xrm_ctx, dec_props, &dec_cu_pool_prop);
+    ret = dec_reserve_xrm_device_id(dec_xrm_ctx, dec_props, &dec_cu_pool_prop);
     if(ret != DEC_APP_SUCCESS) {
         DECODER_APP_LOG_ERROR("xrm_allocation_query: fail to query allocated "
                               "cu list\n");
@@ -935,7 +1230,8 @@ int32_t xlnx_dec_fpga_init(XlnxDecoderCtx* ctx)
     if(ret != DEC_APP_SUCCESS) {
         return DEC_APP_ERROR;
     }
-    if(ctx->dec_params.device_id == -1) {
+    /* dev_index is set once a device was given or placed */
+    if(ctx->dec_xma_props.dev_index == -1) {
         return xlnx_dec_allocate_xrm_dec_cu(&ctx->dec_xrm_ctx, 
                                        &ctx->dec_xma_props);
     }
@@ -950,6 +1246,7 @@ void xlnx_dec_cleanup_ctx(XlnxDecoderCtx* ctx)
     }
     if(ctx->xma_dec_session) {
         xma_dec_session_destroy(ctx->xma_dec_session);
+        ctx->xma_dec_session = NULL;
     }
     xlnx_dec_cleanup_xrm_ctx(&ctx->dec_xrm_ctx);
     xlnx_dec_cleanup_decoder_props(&ctx->dec_xma_props);
@@ -970,12 +1267,11 @@ uint8_t* xlnx_dec_get_buffer_from_fpga(XlnxDecoderCtx* ctx, size_t*buffer_size)
                                                       buffer);
     ret = xvbm_buffer_read(decoded_frame->data[0].buffer, host_buffer, 
                            (*buffer_size), 0);
+    xvbm_buffer_pool_entry_free(decoded_frame->data[0].buffer);
     if(ret != XMA_SUCCESS) {
         DECODER_APP_LOG_ERROR("xvbm_buffer_read failed\n");
-        xlnx_dec_cleanup_ctx(ctx);
-        exit(DEC_APP_ERROR);
+        return NULL;
     }
-    xvbm_buffer_pool_entry_free(decoded_frame->data[0].buffer);
     return host_buffer;
 }
 
@@ -1484,7 +1780,8 @@ void xlnx_la_free_xma_props(XmaFilterProperties *xma_la_props)
 static int32_t xlnx_enc_fill_pool_props(xrmCuPoolProperty *enc_cu_pool_prop, 
                                         XlnxEncoderXrmCtx *enc_xrm_ctx)
 {
-    int32_t cu_num = 0;
+    /* Appends to the CU list, so a ladder can reserve everything at once */
+    int32_t cu_num = enc_cu_pool_prop->cuListProp.cuNum;
     enc_cu_pool_prop->cuListProp.sameDevice = true;
     enc_cu_pool_prop->cuListNum = 1;
 
@@ -1530,83 +1827,57 @@ static int32_t xlnx_la_load_calc(XlnxEncoderXrmCtx *enc_xrm_ctx,
                                  XmaEncoderProperties *xma_enc_props)
 {
 
-    int32_t la_load = 0;
-    int32_t skip_value = 0;
-    int32_t func_id = 0;
-    char pluginName[XRM_MAX_NAME_LEN];
     XmaFilterProperties filter_props;
-    xrmPluginFuncParam plg_param;
+    XlnxXrmLoad load;
 
-    /* Update the lookahead props that are needed for libxmaPropsTOjson */
+    /* Update the lookahead props that are needed for libxmaPropsTOjson. The
+       rest is cleared so equal configurations convert to equal input. */
+    memset(&filter_props, 0, sizeof(filter_props));
     filter_props.input.width = xma_enc_props->width;
     filter_props.input.height = xma_enc_props->height;
     filter_props.input.framerate.numerator = xma_enc_props->framerate.numerator;
     filter_props.input.framerate.denominator = 
                                  xma_enc_props->framerate.denominator;
 
-    memset(&plg_param, 0, sizeof(xrmPluginFuncParam));
-    void *handle;
-    void (*convertXmaPropsToJson)(void* props, char* funcName, char* jsonJob);
-
-    /* Loading propstojson library to convert LA properties to json */
-    handle = dlopen("/opt/xilinx/xrm/plugin/libxmaPropsTOjson.so", RTLD_NOW );
-
-    convertXmaPropsToJson = dlsym(handle, "convertXmaPropsToJson");
-    (*convertXmaPropsToJson) (&filter_props, "LOOKAHEAD", plg_param.input);
-    dlclose(handle);
-
-    strcpy(pluginName, "xrmU30EncPlugin");
-
-    if (xrmExecPluginFunc(enc_xrm_ctx->xrm_ctx, pluginName, func_id, &plg_param) 
-                          != XRM_SUCCESS) {
+    if (xlnx_xrm_load_query(enc_xrm_ctx->xrm_ctx, "xrmU30EncPlugin", 
+                            "LOOKAHEAD", &filter_props, &load) != XRM_SUCCESS) {
         xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
                    "XRM LA plugin failed \n");
         return ENC_APP_FAILURE;
     }
-    else
-    {
-        skip_value = atoi((char *)(strtok(plg_param.output, " ")));
-        skip_value = atoi((char *)(strtok(NULL, " ")));
-        /* To silence the warning of skip_value set, but not used */
-        (void)skip_value;
-        la_load = atoi((char *)(strtok(NULL, " ")));
-    }
-    return la_load;
+    /* The plugin prints encoder load and count before the LA load */
+    return load.values[2];
 
 }
 
 static int32_t xlnx_enc_load_calc(XlnxEncoderXrmCtx *enc_xrm_ctx,
                                   XmaEncoderProperties *xma_enc_props, 
                                   int32_t lookahead_enable,
+                                  int32_t num_cores,
                                   xrmCuPoolProperty *enc_cu_pool_prop)
 {
+    int32_t core_load;
+    XlnxXrmLoad load;
 
-    int32_t func_id = 0;
-    char pluginName[XRM_MAX_NAME_LEN];
-    xrmPluginFuncParam plg_param;
-
-    memset(&plg_param, 0, sizeof(xrmPluginFuncParam));
-    void *handle;
-    void (*convertXmaPropsToJson)(void* props, char* funcName, char* jsonJob);
-
-    /* Loading propstojson library to convert encoder properties to json */
-    handle = dlopen("/opt/xilinx/xrm/plugin/libxmaPropsTOjson.so", RTLD_NOW );
-
-    convertXmaPropsToJson = dlsym(handle, "convertXmaPropsToJson");
-    (*convertXmaPropsToJson) (xma_enc_props, "ENCODER", plg_param.input);
-    dlclose(handle);
-
-    strcpy(pluginName, "xrmU30EncPlugin");
-
-    if (xrmExecPluginFunc(enc_xrm_ctx->xrm_ctx, pluginName, func_id, 
-                          &plg_param) != XRM_SUCCESS) {
+    if (xlnx_xrm_load_query(enc_xrm_ctx->xrm_ctx, "xrmU30EncPlugin", 
+                            "ENCODER", xma_enc_props, &load) != XRM_SUCCESS) {
         xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
                 "XRM encoder plugin failed \n");
         return ENC_APP_FAILURE;
     }
-    else {
-        enc_xrm_ctx->enc_load = atoi((char*)(strtok(plg_param.output, " ")));
-        enc_xrm_ctx->enc_num = atoi((char*)(strtok(NULL, " ")));
+    enc_xrm_ctx->enc_load = load.values[0];
+    enc_xrm_ctx->enc_num = load.values[1];
+
+    /* The plugin sizes the load from resolution and frame rate only. A 
+       channel spread over more cores keeps them busy, so it reserves at 
+       least their share of the encoder CU. */
+    core_load = num_cores * XRM_MAX_CU_LOAD_GRANULARITY_1000000 / 
+                ENC_SUPPORTED_MAX_NUM_CORES;
+    if(enc_xrm_ctx->enc_load < core_load) {
+        xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+                "Raising encoder load from %d to %d for %d cores\n", 
+                enc_xrm_ctx->enc_load, core_load, num_cores);
+        enc_xrm_ctx->enc_load = core_load;
     }
 
     /* If LA is enabled, calculate the load to reserve the CU*/
@@ -1626,7 +1897,7 @@ static int32_t xlnx_enc_load_calc(XlnxEncoderXrmCtx *enc_xrm_ctx,
 
 int32_t xlnx_enc_device_init(XlnxEncoderXrmCtx *enc_xrm_ctx,
                         XmaEncoderProperties *xma_enc_props,
-                        int32_t lookahead_enable)
+                        int32_t lookahead_enable, int32_t num_cores)
 {
 
     xrmCuPoolProperty enc_cu_pool_prop;
@@ -1645,7 +1916,7 @@ int32_t xlnx_enc_device_init(XlnxEncoderXrmCtx *enc_xrm_ctx,
 
     /* Calculate encoder load based on encoder properties */
     ret = xlnx_enc_load_calc(enc_xrm_ctx, xma_enc_props, lookahead_enable, 
-                             &enc_cu_pool_prop);
+                             num_cores, &enc_cu_pool_prop);
     if(ret != ENC_APP_SUCCESS) {
         xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
                 "Enc load calculation failed %d \n", ret);
@@ -1661,12 +1932,26 @@ int32_t xlnx_enc_device_init(XlnxEncoderXrmCtx *enc_xrm_ctx,
         return ENC_APP_FAILURE;
     }
 
+    /* Once an earlier channel initialized XMA, later channels have to run on
+       the same device */
+    if(enc_xrm_ctx->device_id < 0 && xlnx_xma_get_device() >= 0) {
+        enc_xrm_ctx->device_id = xlnx_xma_get_device();
+    }
+    else if(enc_xrm_ctx->device_id < 0) {
+        enc_xrm_ctx->device_id = xlnx_placement_select(enc_xrm_ctx->xrm_ctx, 
+                                                       &enc_cu_pool_prop);
+        if(enc_xrm_ctx->device_id >= 0) {
+            xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+                    "Placed encoder on device %d\n", enc_xrm_ctx->device_id);
+        }
+    }
+
     /* If the device reservation ID is not sent through command line, get the
        next available device id */
     if(enc_xrm_ctx->device_id < 0) {
 
         /* Query XRM to get reservation index for the required CU */
-        enc_xrm_ctx->enc_res_idx = xrmCuPoolReserve(enc_xrm_ctx->xrm_ctx, 
+        enc_xrm_ctx->enc_res_idx = xlnx_xrm_pool_reserve(enc_xrm_ctx->xrm_ctx, 
                 &enc_cu_pool_prop);
         if (enc_xrm_ctx->enc_res_idx == 0) {
             xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
@@ -1687,12 +1972,9 @@ int32_t xlnx_enc_device_init(XlnxEncoderXrmCtx *enc_xrm_ctx,
         }
 
         /* xclbin configuration */
-        XmaXclbinParameter xclbin_param;
-        xclbin_param.device_id = enc_cu_pool_res.cuResources[0].deviceId;
-        xclbin_param.xclbin_name = 
-                                 enc_cu_pool_res.cuResources[0].xclbinFileName; 
-
-        if ((ret = xma_initialize(&xclbin_param, 1)) != XMA_SUCCESS)
+        if ((ret = xlnx_xma_initialize(enc_cu_pool_res.cuResources[0].deviceId, 
+                     enc_cu_pool_res.cuResources[0].xclbinFileName)) != 
+                     XMA_SUCCESS)
         {
             xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
                     "XMA Initialization failed\n");
@@ -1702,14 +1984,22 @@ int32_t xlnx_enc_device_init(XlnxEncoderXrmCtx *enc_xrm_ctx,
                 "XMA initialization success \n");
     }
     else {
-        /* xclbin configuration */
-        XmaXclbinParameter xclbin_param;
-        xclbin_param.device_id = enc_xrm_ctx->device_id;
-        xclbin_param.xclbin_name = "/opt/xilinx/xcdr/xclbins/transcode.xclbin"; 
+        /* Before XMA binds the process to a full device, so the open can 
+           still fall back to another one */
+        if(xlnx_xma_get_device() < 0 &&
+           xlnx_placement_available(enc_xrm_ctx->xrm_ctx, &enc_cu_pool_prop,
+                                    enc_xrm_ctx->device_id) <= 0) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                    "No resources available on device %d \n", 
+                    enc_xrm_ctx->device_id);
+            return ENC_APP_FAILURE;
+        }
 
+        /* xclbin configuration */
         xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
             "Device ID %d selected to run encoder \n", enc_xrm_ctx->device_id);
-        if ((ret = xma_initialize(&xclbin_param, 1)) != XMA_SUCCESS)
+        if ((ret = xlnx_xma_initialize(enc_xrm_ctx->device_id, 
+                                       XCLBIN_PARAM_NAME)) != XMA_SUCCESS)
         {
             xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
                     "XMA Initialization failed\n");
@@ -1729,12 +2019,17 @@ int32_t xlnx_enc_device_init(XlnxEncoderXrmCtx *enc_xrm_ctx,
 void xlnx_enc_xrm_deinit(XlnxEncoderXrmCtx *enc_xrm_ctx)
 {
 
+    if(!enc_xrm_ctx->xrm_ctx) {
+        return;
+    }
+
     if(enc_xrm_ctx->enc_res_in_use) {
         xrmCuListRelease(enc_xrm_ctx->xrm_ctx, 
                          &enc_xrm_ctx->encode_cu_list_res);
     }
 
-    if((enc_xrm_ctx->device_id < 0) && (enc_xrm_ctx->enc_res_idx >= 0)) {
+    if((enc_xrm_ctx->device_id < 0) && (enc_xrm_ctx->enc_res_idx >= 0) &&
+       !enc_xrm_ctx->shared_pool) {
         xrmCuPoolRelinquish(enc_xrm_ctx->xrm_ctx, enc_xrm_ctx->enc_res_idx);
     }
 
@@ -1742,7 +2037,9 @@ void xlnx_enc_xrm_deinit(XlnxEncoderXrmCtx *enc_xrm_ctx)
         xrmCuRelease(enc_xrm_ctx->xrm_ctx, &enc_xrm_ctx->lookahead_cu_res);
     }
 
-    xrmDestroyContext(enc_xrm_ctx->xrm_ctx);
+    if(!enc_xrm_ctx->shared_pool) {
+        xrmDestroyContext(enc_xrm_ctx->xrm_ctx);
+    }
     return;
 }
 
@@ -1791,12 +2088,14 @@ static int32_t xlnx_la_allocate_xrm_cu(XlnxLookaheadCtx *la_ctx, XlnxEncoderXrmC
 
     if(enc_xrm_ctx->device_id < 0) {
         lookahead_cu_prop.poolId = enc_xrm_ctx->enc_res_idx;
-        ret = xrmCuAlloc(enc_xrm_ctx->xrm_ctx, &lookahead_cu_prop,
-                         &enc_xrm_ctx->lookahead_cu_res);
+        ret = xlnx_xrm_cu_alloc(enc_xrm_ctx->xrm_ctx, &lookahead_cu_prop,
+                                &enc_xrm_ctx->lookahead_cu_res);
     }
     else {
-        ret = xrmCuAllocFromDev(enc_xrm_ctx->xrm_ctx,  enc_xrm_ctx->device_id,
-                          &lookahead_cu_prop, &enc_xrm_ctx->lookahead_cu_res);
+        ret = xlnx_xrm_cu_alloc_from_dev(enc_xrm_ctx->xrm_ctx, 
+                                         enc_xrm_ctx->device_id,
+                                         &lookahead_cu_prop, 
+                                         &enc_xrm_ctx->lookahead_cu_res);
     }
 
     if (ret != 0) {
@@ -1850,7 +2149,10 @@ int32_t xlnx_la_create(XlnxLookaheadCtx *la_ctx, XlnxEncoderXrmCtx *enc_xrm_ctx,
     xlnx_la_get_xma_props(&la_ctx->la_props, xma_la_props);
 
     enc_xrm_ctx->lookahead_res_inuse = 0;
-    xlnx_la_allocate_xrm_cu(la_ctx, enc_xrm_ctx, xma_la_props);
+    if(xlnx_la_allocate_xrm_cu(la_ctx, enc_xrm_ctx, xma_la_props) != 
+                                                            ENC_APP_SUCCESS) {
+        return ENC_APP_FAILURE;
+    }
 
     /* Create lookahead session based on the requested properties */
     la_ctx->filter_session = xma_filter_session_create(xma_la_props);
@@ -1890,8 +2192,11 @@ int32_t xlnx_enc_la_init(XlnxEncoderCtx *enc_ctx,
     la_props->framerate.numerator = enc_props->fps;
     la_props->framerate.denominator = 1;
 
-    //TODO: Assume 256 aligned for now. Needs to be fixed later
-    la_props->stride = XLNX_ENC_LINE_ALIGN(enc_props->width, VCU_STRIDE_ALIGN);
+    /* LA works on VCU aligned lines wide enough for the input, pooled or 
+       strided, see Encoder_EncodeFrameStrided */
+    la_props->stride = XLNX_ENC_LINE_ALIGN(
+                           max(enc_ctx->in_frame.frame_props.linesize[0], 
+                               enc_ctx->input_stride), VCU_STRIDE_ALIGN);
     la_props->bits_per_pixel = 8;
 
     if (enc_props->gop_size <= 0) {
@@ -1910,7 +2215,7 @@ int32_t xlnx_enc_la_init(XlnxEncoderCtx *enc_ctx,
 
     /* Only NV12 format is supported in this application */
     la_props->xma_fmt_type = XMA_VCU_NV12_FMT_TYPE;
-    la_props->enable_hw_buf = 0;
+    la_props->enable_hw_buf = enc_ctx->zero_copy_input;
 
     switch (enc_props->codec_id) {
         case ENCODER_ID_H264:
@@ -1991,6 +2296,9 @@ static void xlnx_enc_context_init(XlnxEncoderCtx *enc_ctx)
     enc_props->tune_metrics = 0;
 
     enc_ctx->pts = 0;
+    for(int32_t i = 0; i < XLNX_ENC_MAX_INFLIGHT; i++) {
+        enc_ctx->idr_pts[i] = -1;
+    }
     enc_ctx->out_frame_cnt = 0;
     enc_ctx->in_frame_cnt = 0;
     enc_ctx->enc_state = ENC_READ_INPUT;
@@ -2012,44 +2320,26 @@ static int32_t xlnx_enc_update_props(XlnxEncoderCtx *enc_ctx,
         enc_props->custom_rc = 1;
     }
 
-    /* Enable Adaptive Quantization by default, if lookahead is enabled */
-    if (enc_props->lookahead_depth >= 1 && (enc_props->temporal_aq == 1 || 
-                enc_props->spatial_aq == 1) && (enc_props->tune_metrics == 0)) {
-        xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
-                "Setting qp mode to 2, as the lookahead params are set \n");
-        enc_props->qp_mode = 2;
-    }
-    else if ((enc_props->lookahead_depth == 0) || 
-            (enc_props->tune_metrics == 1)) {
-        if (enc_props->temporal_aq)
-            enc_props->temporal_aq = 0;
-
-        if (enc_props->spatial_aq)
-            enc_props->spatial_aq = 0;
-    }
-
-    /* Tunes video quality for objective scores by setting flat scaling-list 
-       and uniform qp-mode */
-    if (enc_props->tune_metrics){
+    /* Tuning for objective scores sets a flat scaling-list and uniform 
+       qp-mode and turns AQ off. Otherwise lookahead enables Adaptive 
+       Quantization by default. */
+    if (enc_props->tune_metrics) {
         enc_props->scaling_list = 0;
         enc_props->qp_mode = 0;
+        enc_props->temporal_aq = 0;
+        enc_props->spatial_aq = 0;
     }
-
-    /* Enable Adaptive Quantization by default, if lookahead is enabled */
-    if (enc_props->lookahead_depth >= 1 && (enc_props->temporal_aq == 1 || 
-        enc_props->spatial_aq == 1)) {
+    else if (enc_props->lookahead_depth >= 1 && 
+             (enc_props->temporal_aq == 1 || enc_props->spatial_aq == 1)) {
         xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
                 "Setting qp mode to 2, as the lookahead params are set \n");
         enc_props->qp_mode = 2;
     }
-    else if (enc_props->lookahead_depth == 0) {
-        if (enc_props->temporal_aq)
-            enc_props->temporal_aq = 0;
-
-        if (enc_props->spatial_aq)
-            enc_props->spatial_aq = 0;
 
-        enc_props->enable_hw_buf = 0;
+    if (enc_props->lookahead_depth == 0) {
+        enc_props->temporal_aq = 0;
+        enc_props->spatial_aq = 0;
+        enc_props->enable_hw_buf = enc_ctx->zero_copy_input;
     }
 
     /* Set IDR period to gop-size, when the user has not specified it on 
@@ -2066,18 +2356,50 @@ static int32_t xlnx_enc_update_props(XlnxEncoderCtx *enc_ctx,
     return xlnx_enc_get_xma_props(enc_props, xma_enc_props);
 }
 
-static void xlnx_enc_frame_init(XlnxEncoderCtx *enc_ctx)
+static int32_t xlnx_enc_frame_init(XlnxEncoderCtx *enc_ctx)
 {
 
-    XmaFrameProperties *frame_props = &(enc_ctx->in_frame.frame_props);
+    XmaFrame *in_frame = &(enc_ctx->in_frame);
+    XmaFrameProperties *frame_props = &(in_frame->frame_props);
+    size_t frame_size_y = enc_ctx->enc_props.width * enc_ctx->enc_props.height;
+
     frame_props->format = XMA_VCU_NV12_FMT_TYPE;
     frame_props->width  = enc_ctx->enc_props.width;
     frame_props->height = enc_ctx->enc_props.height;
-    frame_props->linesize[0] = enc_ctx->enc_props.width;
-    frame_props->linesize[1] = enc_ctx->enc_props.width;
+    /* Device frames come from the decoder or scaler pools, which use VCU
+       aligned lines; host frames are tightly packed */
+    if(enc_ctx->zero_copy_input) {
+        frame_props->linesize[0] = XLNX_ENC_LINE_ALIGN(enc_ctx->enc_props.width,
+                                                       VCU_STRIDE_ALIGN);
+    }
+    else {
+        frame_props->linesize[0] = enc_ctx->enc_props.width;
+    }
+    frame_props->linesize[1] = frame_props->linesize[0];
     frame_props->bits_per_pixel = 8;
+    in_frame->frame_rate.numerator = enc_ctx->enc_props.fps;
+    in_frame->frame_rate.denominator = 1;
 
-    return;
+    if(enc_ctx->zero_copy_input) {
+        return ENC_APP_SUCCESS;
+    }
+
+    /* Host input planes are allocated once per session and reused for every
+       frame; both lookahead and encoder copy them to the device on send */
+    for(int32_t i = 0; i < 2; i++) {
+        in_frame->data[i].refcount = 1;
+        in_frame->data[i].buffer_type = XMA_HOST_BUFFER_TYPE;
+        in_frame->data[i].is_clone = false;
+        in_frame->data[i].buffer = calloc(1, (i == 0) ? frame_size_y :
+                                                        frame_size_y >> 1);
+        if(!in_frame->data[i].buffer) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                    "Out of memory while allocating encoder input frame\n");
+            return ENC_APP_FAILURE;
+        }
+    }
+
+    return ENC_APP_SUCCESS;
 }
 
 static int32_t xlnx_xlnx_enc_cu_alloc_device_id(XlnxEncoderXrmCtx *enc_xrm_ctx, 
@@ -2101,7 +2423,7 @@ static int32_t xlnx_xlnx_enc_cu_alloc_device_id(XlnxEncoderXrmCtx *enc_xrm_ctx,
     encode_cu_sw_prop.devExcl = false;
     encode_cu_sw_prop.requestLoad = XRM_PRECISION_1000000_BIT_MASK(XRM_MAX_CU_LOAD_GRANULARITY_1000000);
 
-    ret = xrmCuAllocFromDev(enc_xrm_ctx->xrm_ctx, enc_xrm_ctx->device_id, 
+    ret = xlnx_xrm_cu_alloc_from_dev(enc_xrm_ctx->xrm_ctx, enc_xrm_ctx->device_id, 
             &encode_cu_hw_prop, &enc_xrm_ctx->encode_cu_list_res.cuResources[0]);
 
     if (ret <= ENC_APP_FAILURE)
@@ -2113,7 +2435,10 @@ static int32_t xlnx_xlnx_enc_cu_alloc_device_id(XlnxEncoderXrmCtx *enc_xrm_ctx,
     }
     else
     {
-        ret = xrmCuAllocFromDev(enc_xrm_ctx->xrm_ctx, enc_xrm_ctx->device_id, 
+        /* Counted as they are allocated so a release frees what was taken */
+        enc_xrm_ctx->encode_cu_list_res.cuNum = 1;
+        enc_xrm_ctx->enc_res_in_use = 1;
+        ret = xlnx_xrm_cu_alloc_from_dev(enc_xrm_ctx->xrm_ctx, enc_xrm_ctx->device_id, 
                 &encode_cu_sw_prop, &enc_xrm_ctx->encode_cu_list_res.cuResources[1]);
         if (ret <= ENC_APP_FAILURE)
         {
@@ -2122,6 +2447,7 @@ static int32_t xlnx_xlnx_enc_cu_alloc_device_id(XlnxEncoderXrmCtx *enc_xrm_ctx,
                     enc_xrm_ctx->device_id);
             return ret;
         }
+        enc_xrm_ctx->encode_cu_list_res.cuNum = 2;
     }
 
     /* Set XMA plugin SO and device index */
@@ -2165,7 +2491,7 @@ static int32_t xlnx_xlnx_enc_cu_alloc_reserve_id(XlnxEncoderXrmCtx *enc_xrm_ctx,
     encode_cu_list_prop.cuProps[1].requestLoad = XRM_PRECISION_1000000_BIT_MASK(XRM_MAX_CU_LOAD_GRANULARITY_1000000);
     encode_cu_list_prop.cuProps[1].poolId = enc_xrm_ctx->enc_res_idx;
 
-    ret = xrmCuListAlloc(enc_xrm_ctx->xrm_ctx, &encode_cu_list_prop, 
+    ret = xlnx_xrm_cu_list_alloc(enc_xrm_ctx->xrm_ctx, &encode_cu_list_prop, 
             &enc_xrm_ctx->encode_cu_list_res);
     if (ret != ENC_APP_SUCCESS) {
         xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
@@ -2206,6 +2532,31 @@ static int32_t xlnx_enc_cu_alloc(XlnxEncoderXrmCtx *enc_xrm_ctx,
     return ret;
 }
 
+/* Largest packet the encoder produces: a raw frame plus headers */
+static size_t xlnx_enc_max_packet_size(const XlnxEncoderProperties *enc_props)
+{
+    return (size_t)enc_props->width * enc_props->height * 3 / 2 + 
+           XLNX_ENC_PACKET_HDR_SIZE;
+}
+
+/* Initial output buffer size. Under CBR/VBR a conforming frame never
+   exceeds the CPB, so that bounds the packet well below a raw frame. The
+   buffer size goes to the plugin as alloc_size; a larger packet comes back
+   in plugin memory and is copied into a grown buffer, and the pool grows 
+   when packets get close to its size. */
+static size_t xlnx_enc_packet_size(const XlnxEncoderProperties *enc_props)
+{
+    size_t max = xlnx_enc_max_packet_size(enc_props);
+    size_t size;
+
+    if(enc_props->control_rate == ENC_RC_CONST_QP_MODE) {
+        return max;
+    }
+    size = (size_t)(enc_props->max_bitrate * 1000 * enc_props->cpb_size / 8);
+    size = min(max(size, (size_t)XLNX_ENC_PACKET_MIN_SIZE), max);
+    return size + XLNX_ENC_PACKET_HDR_SIZE;
+}
+
 int32_t xlnx_enc_create_session(XlnxEncoderCtx *enc_ctx, 
                                 XmaEncoderProperties *xma_enc_props)
 {
@@ -2225,17 +2576,14 @@ int32_t xlnx_enc_create_session(XlnxEncoderCtx *enc_ctx,
         return ENC_APP_FAILURE;
     }
 
-    #ifdef U30V2
-    XmaDataBuffer* output_xma_buffer = &enc_ctx->xma_buffer;
-    /* Allocate enough data to safely recv */
-    output_xma_buffer->alloc_size  = (3 * enc_ctx->enc_props.width *
-                            enc_ctx->enc_props.height) >> 1;
-    output_xma_buffer->data.buffer = malloc(output_xma_buffer->alloc_size);
-    if(!output_xma_buffer->data.buffer) {
-         xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
-                    "Encoder failed to allocate data buffer for recv! \n");
+    enc_ctx->pkt_pool = xlnx_packet_pool_create(
+                            xlnx_enc_packet_size(&enc_ctx->enc_props));
+    enc_ctx->out_capacity = xlnx_enc_max_packet_size(&enc_ctx->enc_props);
+    if(!enc_ctx->pkt_pool) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                   "Encoder failed to allocate output packet pool \n");
+        return ENC_APP_FAILURE;
     }
-    #endif
 
     return ENC_APP_SUCCESS;
 }
@@ -2363,11 +2711,23 @@ void xlnx_enc_deinit(XlnxEncoderCtx *enc_ctx, XmaEncoderProperties *xma_enc_prop
     free(enc_ctx->enc_props.enc_options);
     xlnx_enc_free_xma_props(xma_enc_props);
 
-    #ifdef U30V2
-    if(enc_ctx->xma_buffer.data.buffer) {
-        free(enc_ctx->xma_buffer.data.buffer);
+    for(int32_t i = 0; i < 2; i++) {
+        if(enc_ctx->in_frame.data[i].buffer) {
+            free(enc_ctx->in_frame.data[i].buffer);
+            enc_ctx->in_frame.data[i].buffer = NULL;
+        }
     }
-    #endif
+
+    xlnx_packet_buf_unref(enc_ctx->out_pkt);
+    xlnx_packet_buf_unref(enc_ctx->ready_pkt);
+    enc_ctx->out_pkt = NULL;
+    enc_ctx->ready_pkt = NULL;
+    xlnx_packet_pool_release(enc_ctx->pkt_pool);
+    enc_ctx->pkt_pool = NULL;
+    xlnx_scene_detector_destroy(enc_ctx->scene_det);
+    enc_ctx->scene_det = NULL;
+    xlnx_enc_stats_ring_destroy(enc_ctx->stats_ring);
+    enc_ctx->stats_ring = NULL;
 }
 
 int loadyuv(char *ybuf, char *uvbuf, FILE *hInputYUVFile)
@@ -2381,401 +2741,3788 @@ int loadyuv(char *ybuf, char *uvbuf, FILE *hInputYUVFile)
 	return 0;
 }
 
-XlnxEncoderCtx enc_ctx;
-XmaEncoderProperties xma_enc_props;
-XmaFilterProperties  xma_la_props;
-
-XlnxDecoderCtx ctx;
-
-int Encoder_Init()
+static int32_t xlnx_enc_lookup_value(XlnxEncProfileLookup *table, size_t count,
+                                     const char *key, int32_t *value)
 {
-	int32_t ret = ENC_APP_SUCCESS;
-	
-    memset(&enc_ctx, 0, sizeof(enc_ctx));
-	
-    xlnx_enc_context_init(&enc_ctx);
-	
-	enc_ctx.enc_props.width=1920;
-	enc_ctx.enc_props.height=1080;
-	enc_ctx.enc_props.codec_id = 100;
-
-    if(xlnx_enc_update_props(&enc_ctx, &xma_enc_props) != ENC_APP_SUCCESS)
-        return ENC_APP_FAILURE;
+    char *end = NULL;
+    long num;
 
-    xlnx_enc_frame_init(&enc_ctx);
-
-    if((ret = xlnx_enc_device_init(&enc_ctx.enc_xrm_ctx, &xma_enc_props, enc_ctx.enc_props.lookahead_depth)) != ENC_APP_SUCCESS) 
-	{
-        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
-                "Device Init failed with error %d \n", ret);
-        xlnx_enc_app_close(&enc_ctx, &xma_enc_props, &xma_la_props);
-        return -1;
+    for(size_t i = 0; i < count; i++) {
+        if(strcmp(table[i].key, key) == 0) {
+            *value = table[i].value;
+            return ENC_APP_SUCCESS;
+        }
     }
 
-    /* Lookahead session creation*/
-    if((ret = xlnx_enc_la_init(&enc_ctx, &xma_la_props)) != ENC_APP_SUCCESS) {
-        xlnx_enc_app_close(&enc_ctx, &xma_enc_props, &xma_la_props);
-        return -1;
+    /* Numeric values are accepted for every enumerated option */
+    num = strtol(key, &end, 0);
+    if(end == key || *end != '\0') {
+        return ENC_APP_FAILURE;
     }
+    *value = (int32_t)num;
+    return ENC_APP_SUCCESS;
+}
 
-    if((ret = xlnx_enc_create_session(&enc_ctx, &xma_enc_props)) != 
-                                                            ENC_APP_SUCCESS) {
-        xlnx_enc_app_close(&enc_ctx, &xma_enc_props, &xma_la_props);
-        return -1;
+static int32_t xlnx_enc_parse_int(const char *value, int64_t *out)
+{
+    char *end = NULL;
+    long long num;
+
+    errno = 0;
+    num = strtoll(value, &end, 0);
+    if(errno || end == value || *end != '\0') {
+        return ENC_APP_FAILURE;
     }
-	return ENC_APP_SUCCESS;
+    *out = num;
+    return ENC_APP_SUCCESS;
 }
 
-int Encoder_frame(char* iyBuf,char* iuvBuf,char* outBuf,int* outlen)
+/* Bitrate is given in bits/s, or with a K or M suffix, and stored in kbps */
+static int32_t xlnx_enc_parse_bitrate(const char *value, int64_t *kbps)
 {
-    uint32_t ret = ENC_APP_SUCCESS;
-    uint32_t frame_size_y = (enc_ctx.enc_props.width *enc_ctx.enc_props.height);
-	uint32_t frame_size_uv = frame_size_y /2 ;
-	
-	XmaFrame *xma_frame = &(enc_ctx.in_frame);
-    xma_frame->data[0].refcount = 1;
-    xma_frame->data[0].buffer_type = XMA_HOST_BUFFER_TYPE;
-    xma_frame->data[0].is_clone = false;
-    xma_frame->data[0].buffer = calloc(1, frame_size_y);
-    xma_frame->data[1].refcount = 1;
-    xma_frame->data[1].buffer_type = XMA_HOST_BUFFER_TYPE;
-    xma_frame->data[1].is_clone = false;
-    xma_frame->data[1].buffer = calloc(1, frame_size_uv);
-
-	memcpy((char*)xma_frame->data[0].buffer,iyBuf, frame_size_y);//y
-	memcpy((char*)xma_frame->data[1].buffer, iuvBuf,frame_size_uv);//uv
-		
-	ret = xma_enc_session_send_frame(enc_ctx.enc_session, enc_ctx.enc_in_frame);
-	if (ret == XMA_SUCCESS) {
-		enc_ctx.enc_state = ENC_GET_OUTPUT;
-	}
-	else if(ret == XMA_SEND_MORE_DATA) 
-	{
-		enc_ctx.enc_state = ENC_READ_INPUT;
-	}
-	else 
-	{
-		printf("Encoder send frame failed!!\n");
-		return ENC_APP_DONE;
-	}
-	
-	int32_t recv_size = 0;
-	ret = xma_enc_session_recv_data(enc_ctx.enc_session, &(enc_ctx.xma_buffer), &recv_size);
-	if (ret == XMA_SUCCESS) 
-	{
-		memcpy(outBuf,enc_ctx.xma_buffer.data.buffer,recv_size);
-		*outlen = recv_size;
-	} 
-	else if(ret <= XMA_ERROR) 
-	{
-		return ENC_APP_DONE;
-	}
+    char *end = NULL;
+    double num;
 
+    errno = 0;
+    num = strtod(value, &end);
+    if(errno || end == value || num < 0) {
+        return ENC_APP_FAILURE;
+    }
+    if(*end == 'K' || *end == 'k') {
+        end++;
+    } else if(*end == 'M' || *end == 'm') {
+        num *= 1000;
+        end++;
+    } else {
+        num /= 1000;
+    }
+    if(*end != '\0') {
+        return ENC_APP_FAILURE;
+    }
+    *kbps = (int64_t)num;
     return ENC_APP_SUCCESS;
 }
 
-void Encoder_Release()
+/* Level is given either as "4.1" or as "41" */
+static int32_t xlnx_enc_parse_level(const char *value, int32_t *level)
 {
-	xlnx_enc_app_close(&enc_ctx, &xma_enc_props, &xma_la_props);
+    char *end = NULL;
+    double num;
+
+    num = strtod(value, &end);
+    if(end == value || *end != '\0' || num <= 0) {
+        return ENC_APP_FAILURE;
+    }
+    if(strchr(value, '.') || num < 10) {
+        num *= 10;
+    }
+    *level = (int32_t)(num + 0.5);
+    return ENC_APP_SUCCESS;
 }
 
-void Decoder_Init()
+/* Presets are option strings in Encoder_ConfigParseString syntax */
+typedef struct XlnxEncPreset
 {
-	memset(&ctx, 0, sizeof(ctx));
-    printf("Decoder_Init \n");
-	
-	xlnx_dec_create_context(&ctx);
+    const char *name;
+    const char *options;
+} XlnxEncPreset;
+
+static const XlnxEncPreset xlnx_enc_presets[] = {
+    {"live-1080p-lowlat", "c:v=h264,w=1920,h=1080,fps=60,b:v=6M,g=120,"
+                          "profile=high,low-latency=1"},
+    {"live-1080p",        "c:v=h264,w=1920,h=1080,fps=30,b:v=5M,g=60,"
+                          "profile=high,lookahead-depth=8"},
+    {"live-720p-lowlat",  "c:v=h264,w=1280,h=720,fps=30,b:v=3M,g=60,"
+                          "profile=high,low-latency=1"},
+    {"vod-1080p-quality", "c:v=hevc,w=1920,h=1080,fps=30,b:v=4M,g=120,bf=2,"
+                          "lookahead-depth=20"},
+    {"vod-4k-quality",    "c:v=hevc,w=3840,h=2160,fps=30,b:v=16M,g=120,bf=2,"
+                          "slices=4"}
+};
 
-    printf("xlnx_dec_create_context \n");
-	
-    if(xlnx_dec_fpga_init(&ctx) != DEC_APP_SUCCESS)
-	{
-        printf("xlnx_dec_fpga_init \n");
-        xlnx_dec_cleanup_ctx(&ctx);
-        exit(DEC_APP_ERROR);
-    }
+#define XLNX_ENC_NUM_PRESETS XLNX_ENC_LOOKUP_SIZE(xlnx_enc_presets)
 
-    ctx.xma_dec_session = xma_dec_session_create(&ctx.dec_xma_props);
-    if(!ctx.xma_dec_session)
-	{
-        DECODER_APP_LOG_ERROR("Failed to create decoder session\n");
-        xlnx_dec_cleanup_ctx(&ctx);
-        exit(DEC_APP_ERROR);
+static int32_t xlnx_enc_preset_index(const char *name)
+{
+    for(size_t i = 0; name && i < XLNX_ENC_NUM_PRESETS; i++) {
+        if(strcmp(xlnx_enc_presets[i].name, name) == 0) {
+            return (int32_t)i;
+        }
     }
+    xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+            "Unknown encoder preset %s\n", name ? name : "(null)");
+    return -1;
 }
 
-void Decoder_release()
+static void xlnx_enc_print_help()
 {
-    xlnx_dec_cleanup_ctx(&ctx);
-    printf("Decoder_release\n");
+    printf("Encoder options:\n");
+    for(int32_t i = 0; xlnx_enc_options[i].name != NULL; i++) {
+        printf("  -%s%s\n", xlnx_enc_options[i].name, 
+               xlnx_enc_options[i].has_arg ? " <value>" : "");
+    }
 }
 
-int xvbm_conv_get_plane_size(int32_t width,int32_t height,XmaFormatType format,int32_t plane_id)
+static int32_t xlnx_enc_config_set(XlnxEncoderConfig *cfg, int32_t arg_id,
+                                   const char *value)
 {
-    int p_size;
+    int32_t ret = ENC_APP_SUCCESS;
+    int64_t num = 0;
+    int32_t enum_val = 0;
+    int32_t i = 0;
+
+    switch(arg_id) {
+        case HELP_ARG:
+            xlnx_enc_print_help();
+            return ENC_APP_STOP;
+
+        case INPUT_FILE_ARG:
+            cfg->input_file = value;
+            return ENC_APP_SUCCESS;
+
+        case OUTPUT_FILE_ARG:
+            cfg->output_file = value;
+            return ENC_APP_SUCCESS;
+
+        case ENCODER_ARG:
+            ret = xlnx_enc_lookup_value(xlnx_enc_codec_lookup, 
+                      XLNX_ENC_LOOKUP_SIZE(xlnx_enc_codec_lookup), value, 
+                      &cfg->codec_id);
+            break;
 
-    switch (format) {
-        case XMA_YUV420_FMT_TYPE:
-            switch(plane_id) {
-                case 0:  p_size = width * height;        break;
-                case 1:  p_size = ((width * height)>>2); break;
-                case 2:  p_size = ((width * height)>>2); break;
-                default: p_size = 0;                     break;
-            }
+        case INPUT_PIX_FMT_ARG:
+            ret = xlnx_enc_lookup_value(xlnx_enc_pix_fmt_lookup, 
+                      XLNX_ENC_LOOKUP_SIZE(xlnx_enc_pix_fmt_lookup), value, 
+                      &cfg->pix_fmt);
             break;
 
-        case XMA_YUV422_FMT_TYPE:
-            switch(plane_id) {
-                case 0:  p_size = width * height;        break;
-                case 1:  p_size = ((width * height)>>1); break;
-                case 2:  p_size = ((width * height)>>1); break;
-                default: p_size = 0;                     break;
+        case BITRATE_ARG:
+            ret = xlnx_enc_parse_bitrate(value, &cfg->bit_rate);
+            break;
+
+        case MAX_BITRATE_ARG:
+            ret = xlnx_enc_parse_bitrate(value, &cfg->max_bitrate);
+            break;
+
+        case PROFILE_ARG:
+            if(strlen(value) >= sizeof(cfg->profile)) {
+                ret = ENC_APP_FAILURE;
+                break;
             }
+            strcpy(cfg->profile, value);
             break;
 
-        case XMA_YUV444_FMT_TYPE:
-        case XMA_RGBP_FMT_TYPE:
-            p_size = (width * height);
+        case LEVEL_ARG:
+            ret = xlnx_enc_parse_level(value, &cfg->level);
             break;
 
-        default:
-              printf("xvbm_conv:: Unsupported format...\n");
-              p_size = 0;
-              break;
-    }
-    return(p_size);
-}
+        case CONTROL_RATE_ARG:
+            ret = xlnx_enc_lookup_value(xlnx_enc_control_rate_lookup, 
+                      XLNX_ENC_LOOKUP_SIZE(xlnx_enc_control_rate_lookup), 
+                      value, &cfg->control_rate);
+            break;
 
-int dec_output_data(unsigned char* hostbuf,unsigned char* outbuf)
-{
-	XlnxDecoderCtx* fctx =&ctx;
-    int    stride          = fctx->dec_params.width;
-    int    aligned_width   = ALIGN(fctx->dec_params.width, STRIDE_ALIGN);
-    int    aligned_height  = ALIGN(fctx->dec_params.height, HEIGHT_ALIGN);
-    size_t plane_size      = fctx->dec_params.width * fctx->dec_params.height;
-    size_t buff_plane_size = aligned_width * aligned_height;
-    int offset = 0;
-	int offsetbuf = 0;
-    int bytes_written;
-    int bytes_read;
-    int num_planes = xma_frame_planes_get(&fctx->channel_ctx.xframe->frame_props);
-	
-	//printf("==== %d %d %d %d %d \n",stride,aligned_width,aligned_height,plane_size,buff_plane_size);//1920 2048 1088 2073600 2228224
-    for(int plane_id = 0; plane_id < num_planes; plane_id++) 
-	{
-        bytes_written = 0;
-        bytes_read = 0;
-        if(plane_id > 0) 
-		{
-            buff_plane_size = aligned_width * aligned_width / 2;
-            plane_size = fctx->dec_params.width * fctx->dec_params.height / 2;
+        case QP_MODE_ARG:
+            ret = xlnx_enc_lookup_value(xlnx_enc_qp_mode_lookup, 
+                      XLNX_ENC_LOOKUP_SIZE(xlnx_enc_qp_mode_lookup), value, 
+                      &cfg->qp_mode);
+            break;
+
+        case GOP_MODE_ARG:
+            ret = xlnx_enc_lookup_value(xlnx_enc_gop_mode_lookup, 
+                      XLNX_ENC_LOOKUP_SIZE(xlnx_enc_gop_mode_lookup), value, 
+                      &cfg->gop_mode);
+            break;
+
+        case ASPECT_RATIO_ARG:
+            ret = xlnx_enc_lookup_value(xlnx_enc_aspect_ratio_lookup, 
+                      XLNX_ENC_LOOKUP_SIZE(xlnx_enc_aspect_ratio_lookup), 
+                      value, &cfg->aspect_ratio);
+            break;
+
+        case PRESET_ARG:
+            /* Applied in place, so options given after it override it */
+            ret = Encoder_ConfigPreset(cfg, value);
+            break;
+
+        case SLICE_QP_ARG:
+            if(strcmp(value, "auto") == 0) {
+                cfg->slice_qp = -1;
+                break;
+            }
+            /* fall through */
+        default:
+            ret = xlnx_enc_parse_int(value, &num);
+            if(ret != ENC_APP_SUCCESS) {
+                break;
+            }
+            enum_val = (int32_t)num;
+            switch(arg_id) {
+                case DEVICE_ID_ARG:       cfg->device_id = enum_val; break;
+                case LOOP_COUNT_ARG:      cfg->loop_count = enum_val; break;
+                case INPUT_WIDTH_ARG:     cfg->width = enum_val; break;
+                case INPUT_HEIGHT_ARG:    cfg->height = enum_val; break;
+                case FPS_ARG:             cfg->fps = enum_val; break;
+                case INTRA_PERIOD_ARG:    cfg->gop_size = enum_val; break;
+                case SLICE_QP_ARG:        cfg->slice_qp = enum_val; break;
+                case MIN_QP_ARG:          cfg->min_qp = enum_val; break;
+                case MAX_QP_ARG:          cfg->max_qp = enum_val; break;
+                case NUM_BFRAMES_ARG:     cfg->num_bframes = enum_val; break;
+                case IDR_PERIOD_ARG:      cfg->idr_period = enum_val; break;
+                case NUM_SLICES_ARG:      cfg->num_slices = enum_val; break;
+                case SCALING_LIST_ARG:    cfg->scaling_list = enum_val; break;
+                case LOOKAHEAD_DEPTH_ARG: cfg->lookahead_depth = enum_val; break;
+                case TEMPORAL_AQ_ARG:     cfg->temporal_aq = enum_val; break;
+                case SPATIAL_AQ_ARG:      cfg->spatial_aq = enum_val; break;
+                case SPATIAL_AQ_GAIN_ARG: cfg->spatial_aq_gain = enum_val; break;
+                case NUM_FRAMES_ARG:      cfg->num_frames = num; break;
+                case NUM_CORES_ARG:       cfg->num_cores = enum_val; break;
+                case TUNE_METRICS_ARG:    cfg->tune_metrics = enum_val; break;
+                case LATENCY_LOGGING_ARG: cfg->latency_logging = enum_val; break;
+                case LOW_LATENCY_ARG:     cfg->low_latency = enum_val; break;
+                case SCENE_CUT_ARG:       cfg->scene_cut = enum_val; break;
+                case QP_ARG:
+                    /* Fixed QP implies constant QP rate control */
+                    cfg->slice_qp = enum_val;
+                    cfg->control_rate = ENC_RC_CONST_QP_MODE;
+                    break;
+                default:
+                    ret = ENC_APP_FAILURE;
+                    break;
+            }
+            break;
+    }
+
+    if(ret != ENC_APP_SUCCESS) {
+        /* Options may have aliases, so the table is searched by value */
+        while(xlnx_enc_options[i].name != NULL && 
+              xlnx_enc_options[i].val != arg_id) {
+            i++;
         }
-        while(bytes_read < buff_plane_size) 
-		{
-            if(bytes_written < plane_size) 
-			{
-				memcpy(outbuf+ offsetbuf,hostbuf + offset,stride);
-                bytes_written += stride;
-				offsetbuf += stride;
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid value \"%s\" for option -%s\n", value, 
+                xlnx_enc_options[i].name ? xlnx_enc_options[i].name : "?");
+        return ENC_APP_FAILURE;
+    }
+    return ENC_APP_SUCCESS;
+}
+
+void Encoder_ConfigInit(XlnxEncoderConfig *cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->device_id = UNASSIGNED;
+    cfg->codec_id = UNASSIGNED;
+    cfg->width = UNASSIGNED;
+    cfg->height = UNASSIGNED;
+    cfg->input_stride = UNASSIGNED;
+    cfg->pix_fmt = UNASSIGNED;
+    cfg->bit_rate = UNASSIGNED;
+    cfg->max_bitrate = UNASSIGNED;
+    cfg->fps = UNASSIGNED;
+    cfg->gop_size = UNASSIGNED;
+    cfg->control_rate = UNASSIGNED;
+    cfg->slice_qp = UNASSIGNED;
+    cfg->min_qp = UNASSIGNED;
+    cfg->max_qp = UNASSIGNED;
+    cfg->num_bframes = UNASSIGNED;
+    cfg->idr_period = UNASSIGNED;
+    cfg->level = UNASSIGNED;
+    cfg->num_slices = UNASSIGNED;
+    cfg->qp_mode = UNASSIGNED;
+    cfg->gop_mode = UNASSIGNED;
+    cfg->aspect_ratio = UNASSIGNED;
+    cfg->scaling_list = UNASSIGNED;
+    cfg->lookahead_depth = UNASSIGNED;
+    cfg->temporal_aq = UNASSIGNED;
+    cfg->spatial_aq = UNASSIGNED;
+    cfg->spatial_aq_gain = UNASSIGNED;
+    cfg->num_cores = UNASSIGNED;
+    cfg->tune_metrics = UNASSIGNED;
+    cfg->low_latency = UNASSIGNED;
+    cfg->scene_cut = UNASSIGNED;
+    cfg->latency_logging = UNASSIGNED;
+    cfg->num_frames = UNASSIGNED;
+    cfg->loop_count = UNASSIGNED;
+}
+
+int Encoder_ConfigParseArgs(XlnxEncoderConfig *cfg, int argc, char *argv[])
+{
+    int32_t option_index = 0;
+    int32_t opt;
+    int32_t ret;
+
+    /* getopt keeps global state, restart the scan for every call */
+    optind = 0;
+    opterr = 0;
+    while((opt = getopt_long_only(argc, argv, "", xlnx_enc_options, 
+                                  &option_index)) != -1) {
+        if(opt == '?') {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                    "Unknown option or missing value: %s\n", 
+                    argv[optind - 1]);
+            return ENC_APP_FAILURE;
+        }
+        ret = xlnx_enc_config_set(cfg, opt, optarg);
+        if(ret != ENC_APP_SUCCESS) {
+            return ret;
+        }
+    }
+    return ENC_APP_SUCCESS;
+}
+
+int Encoder_ConfigParseString(XlnxEncoderConfig *cfg, const char *options)
+{
+    const char *delim = ", \t\n";
+    char *save_ptr = NULL;
+    char *copy;
+    char *token;
+    char *value;
+    int32_t ret = ENC_APP_SUCCESS;
+    int32_t i;
+
+    if(!options) {
+        return ENC_APP_SUCCESS;
+    }
+    copy = strdup(options);
+    if(!copy) {
+        return ENC_APP_FAILURE;
+    }
+
+    for(token = strtok_r(copy, delim, &save_ptr); token != NULL;
+        token = strtok_r(NULL, delim, &save_ptr)) {
+        if(*token == '-') {
+            token++;
+        }
+        value = strchr(token, '=');
+        if(value) {
+            *value++ = '\0';
+        }
+        for(i = 0; xlnx_enc_options[i].name != NULL; i++) {
+            if(strcmp(xlnx_enc_options[i].name, token) == 0) {
+                break;
+            }
+        }
+        if(xlnx_enc_options[i].name == NULL || 
+           (xlnx_enc_options[i].has_arg && !value)) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                    "Unknown option or missing value: %s\n", token);
+            ret = ENC_APP_FAILURE;
+            break;
+        }
+        /* File names must outlive the tokenized copy, the caller owns 
+           them */
+        if(xlnx_enc_options[i].val == INPUT_FILE_ARG || 
+           xlnx_enc_options[i].val == OUTPUT_FILE_ARG) {
+            value = strdup(value);
+            if(!value) {
+                ret = ENC_APP_FAILURE;
+                break;
             }
-            offset += aligned_width;
-            bytes_read += aligned_width;
+        }
+        ret = xlnx_enc_config_set(cfg, xlnx_enc_options[i].val, value);
+        if(ret != ENC_APP_SUCCESS) {
+            break;
+        }
+    }
+
+    free(copy);
+    return ret;
+}
+
+int Encoder_ConfigPreset(XlnxEncoderConfig *cfg, const char *preset)
+{
+    int32_t idx = xlnx_enc_preset_index(preset);
+
+    if(idx < 0) {
+        return ENC_APP_FAILURE;
+    }
+    return Encoder_ConfigParseString(cfg, xlnx_enc_presets[idx].options);
+}
+
+/* Multi-core mode for high pixel rates: picks the encoder cores needed
+   for the resolution and frame rate, and one slice per core so the cores
+   work on independent slices. Only fields the config leaves unset are
+   chosen. Lookahead stays a user choice: its kernel takes at most 1080p,
+   and feeding it a scaled copy of 4K input would need a scaler session 
+   plus pairing its QP maps with the full size frames, which is not done,
+   so 4K encodes run without lookahead. */
+static void xlnx_enc_auto_tune(XlnxEncoderCtx *enc_ctx, 
+                               const XlnxEncoderConfig *cfg)
+{
+    XlnxEncoderProperties *enc_props = &enc_ctx->enc_props;
+    int64_t pixel_rate = (int64_t)enc_props->width * enc_props->height * 
+                         enc_props->fps;
+    int32_t cores;
+
+    if(cfg->num_cores == UNASSIGNED) {
+        cores = (pixel_rate + XLNX_ENC_CORE_PIXEL_RATE - 1) / 
+                XLNX_ENC_CORE_PIXEL_RATE;
+        cores = min(max(cores, 1), ENC_SUPPORTED_MAX_NUM_CORES);
+        /* One core is what the firmware default uses anyway */
+        enc_props->num_cores = (cores > 1) ? cores : 0;
+    }
+    if(cfg->num_slices == UNASSIGNED && 
+       enc_props->num_slices < enc_props->num_cores) {
+        enc_props->num_slices = enc_props->num_cores;
+    }
+    if(enc_props->num_cores > 1) {
+        xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+                "%dx%d@%d uses %d encoder cores and %d slices\n", 
+                enc_props->width, enc_props->height, enc_props->fps, 
+                enc_props->num_cores, enc_props->num_slices);
+    }
+}
+
+static int32_t xlnx_enc_apply_config(XlnxEncoderCtx *enc_ctx, 
+                                     const XlnxEncoderConfig *cfg)
+{
+    XlnxEncoderProperties *enc_props = &enc_ctx->enc_props;
+    XlnxEncProfileLookup *profiles;
+    size_t num_profiles;
+
+    enc_ctx->enc_xrm_ctx.device_id = replace_if_unset(cfg->device_id, 
+                                         enc_ctx->enc_xrm_ctx.device_id);
+    enc_props->codec_id = replace_if_unset(cfg->codec_id, ENCODER_ID_H264);
+    /* The low latency preset only changes defaults, so explicit rate
+       control, B frame, lookahead and GOP settings below still apply */
+    if(cfg->low_latency == ENC_OPTION_ENABLE) {
+        enc_props->control_rate = ENC_RC_LOW_LATENCY_MODE;
+        enc_props->num_bframes = 0;
+        enc_props->lookahead_depth = 0;
+        enc_props->gop_mode = ENC_LOW_DELAY_P_MODE;
+    }
+    enc_props->width = replace_if_unset(cfg->width, enc_props->width);
+    enc_props->height = replace_if_unset(cfg->height, enc_props->height);
+    enc_props->pix_fmt = replace_if_unset(cfg->pix_fmt, YUV_NV12_ID);
+    enc_props->bit_rate = replace_if_unset(cfg->bit_rate, enc_props->bit_rate);
+    /* Max bitrate follows the target bitrate unless given explicitly */
+    enc_props->max_bitrate = replace_if_unset(cfg->max_bitrate, 
+                                              enc_props->bit_rate);
+    enc_props->fps = replace_if_unset(cfg->fps, enc_props->fps);
+    enc_props->gop_size = replace_if_unset(cfg->gop_size, enc_props->gop_size);
+    enc_props->control_rate = replace_if_unset(cfg->control_rate, 
+                                               enc_props->control_rate);
+    enc_props->slice_qp = replace_if_unset(cfg->slice_qp, enc_props->slice_qp);
+    enc_props->min_qp = replace_if_unset(cfg->min_qp, enc_props->min_qp);
+    enc_props->max_qp = replace_if_unset(cfg->max_qp, enc_props->max_qp);
+    enc_props->num_bframes = replace_if_unset(cfg->num_bframes, 
+                                              (int32_t)enc_props->num_bframes);
+    enc_props->idr_period = replace_if_unset(cfg->idr_period, 
+                                             (int32_t)enc_props->idr_period);
+    enc_props->level = replace_if_unset(cfg->level, enc_props->level);
+    enc_props->num_slices = replace_if_unset(cfg->num_slices, 
+                                             enc_props->num_slices);
+    enc_props->qp_mode = replace_if_unset(cfg->qp_mode, enc_props->qp_mode);
+    enc_props->gop_mode = replace_if_unset(cfg->gop_mode, enc_props->gop_mode);
+    enc_props->aspect_ratio = replace_if_unset(cfg->aspect_ratio, 
+                                               enc_props->aspect_ratio);
+    enc_props->scaling_list = replace_if_unset(cfg->scaling_list, 
+                                               enc_props->scaling_list);
+    enc_props->lookahead_depth = replace_if_unset(cfg->lookahead_depth, 
+                                                  enc_props->lookahead_depth);
+    enc_props->temporal_aq = replace_if_unset(cfg->temporal_aq, 
+                                              enc_props->temporal_aq);
+    enc_props->spatial_aq = replace_if_unset(cfg->spatial_aq, 
+                                             enc_props->spatial_aq);
+    enc_props->spatial_aq_gain = replace_if_unset(cfg->spatial_aq_gain, 
+                                                  enc_props->spatial_aq_gain);
+    enc_props->num_cores = replace_if_unset(cfg->num_cores, 
+                                            enc_props->num_cores);
+    enc_props->tune_metrics = replace_if_unset(cfg->tune_metrics, 
+                                               enc_props->tune_metrics);
+    enc_props->latency_logging = replace_if_unset(cfg->latency_logging, 
+                                                  enc_props->latency_logging);
+    enc_ctx->scene_cut = replace_if_unset(cfg->scene_cut, 
+                                          enc_ctx->scene_cut);
+    enc_ctx->loop_count = replace_if_unset(cfg->loop_count, 
+                                           enc_ctx->loop_count);
+    enc_ctx->input_stride = replace_if_unset(cfg->input_stride, 0);
+    if(cfg->num_frames != UNASSIGNED) {
+        enc_ctx->num_frames = cfg->num_frames;
+    }
+    xlnx_enc_auto_tune(enc_ctx, cfg);
+
+    /* Profile names depend on the codec, resolve them once it is known */
+    if(enc_props->codec_id == ENCODER_ID_HEVC) {
+        profiles = xlnx_enc_hevc_profile_lookup;
+        num_profiles = XLNX_ENC_LOOKUP_SIZE(xlnx_enc_hevc_profile_lookup);
+        enc_props->profile = ENC_HEVC_MAIN;
+    } else {
+        profiles = xlnx_enc_h264_profile_lookup;
+        num_profiles = XLNX_ENC_LOOKUP_SIZE(xlnx_enc_h264_profile_lookup);
+        enc_props->profile = ENC_H264_HIGH;
+    }
+    if(cfg->profile[0] && xlnx_enc_lookup_value(profiles, num_profiles, 
+                              cfg->profile, &enc_props->profile) != 
+                              ENC_APP_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid profile %s for the selected codec\n", cfg->profile);
+        return ENC_APP_FAILURE;
+    }
+
+    return ENC_APP_SUCCESS;
+}
+
+static int32_t xlnx_enc_validate_props(XlnxEncoderCtx *enc_ctx)
+{
+    XlnxEncoderProperties *enc_props = &enc_ctx->enc_props;
+
+    if(enc_props->codec_id != ENCODER_ID_H264 && 
+       enc_props->codec_id != ENCODER_ID_HEVC) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Unsupported codec id %d\n", enc_props->codec_id);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->pix_fmt != YUV_NV12_ID && enc_props->pix_fmt != YUV_420P_ID) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Unsupported input pixel format %d\n", enc_props->pix_fmt);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->width < ENC_SUPPORTED_MIN_WIDTH || 
+       enc_props->width > ENC_SUPPORTED_MAX_WIDTH ||
+       enc_props->height < ENC_SUPPORTED_MIN_HEIGHT ||
+       enc_props->height > ENC_SUPPORTED_MAX_HEIGHT ||
+       (enc_props->width % 2) || (enc_props->height % 2) ||
+       ((int64_t)enc_props->width * enc_props->height > 
+        ENC_SUPPORTED_MAX_PIXELS)) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Unsupported resolution %dx%d, supported %dx%d to %dx%d\n",
+                enc_props->width, enc_props->height, ENC_SUPPORTED_MIN_WIDTH,
+                ENC_SUPPORTED_MIN_HEIGHT, ENC_SUPPORTED_MAX_WIDTH, 
+                ENC_SUPPORTED_MAX_HEIGHT);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->fps <= 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid frame rate %d\n", enc_props->fps);
+        return ENC_APP_FAILURE;
+    }
+    if((int64_t)enc_props->width * enc_props->height * enc_props->fps > 
+       ENC_SUPPORTED_MAX_PIXEL_RATE) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "%dx%d@%d exceeds the encoder capacity of one device, "
+                "2160p60\n", enc_props->width, enc_props->height, 
+                enc_props->fps);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->bit_rate <= 0 || 
+       enc_props->bit_rate > ENC_SUPPORTED_MAX_BITRATE ||
+       enc_props->max_bitrate < enc_props->bit_rate ||
+       enc_props->max_bitrate > ENC_SUPPORTED_MAX_BITRATE) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid bitrate %" PRId64 " / max bitrate %" PRId64
+                " kbps\n", 
+                enc_props->bit_rate, enc_props->max_bitrate);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->control_rate < ENC_RC_CONST_QP_MODE || 
+       enc_props->control_rate > ENC_RC_LOW_LATENCY_MODE) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid rate control mode %d\n", enc_props->control_rate);
+        return ENC_APP_FAILURE;
+    }
+    if((enc_props->slice_qp != -1 && 
+        (enc_props->slice_qp < ENC_SUPPORTED_MIN_QP || 
+         enc_props->slice_qp > ENC_SUPPORTED_MAX_QP)) ||
+       enc_props->min_qp < ENC_SUPPORTED_MIN_QP || 
+       enc_props->max_qp > ENC_SUPPORTED_MAX_QP ||
+       enc_props->min_qp > enc_props->max_qp) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid QP settings slice %d min %d max %d, supported "
+                "range %d - %d\n", enc_props->slice_qp, enc_props->min_qp, 
+                enc_props->max_qp, ENC_SUPPORTED_MIN_QP, 
+                ENC_SUPPORTED_MAX_QP);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->num_bframes > ENC_SUPPORTED_MAX_NUM_B_FRAMES) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid number of B frames %u, max %d\n", 
+                enc_props->num_bframes, ENC_SUPPORTED_MAX_NUM_B_FRAMES);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->num_slices < 1 || 
+       enc_props->num_slices > ENC_SUPPORTED_MAX_SLICES) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid number of slices %d, supported 1 - %d\n", 
+                enc_props->num_slices, ENC_SUPPORTED_MAX_SLICES);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->num_cores < 0 || 
+       enc_props->num_cores > ENC_SUPPORTED_MAX_NUM_CORES) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid number of cores %d, supported 0 - %d\n", 
+                enc_props->num_cores, ENC_SUPPORTED_MAX_NUM_CORES);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->gop_mode < ENC_DEFAULT_GOP_MODE || 
+       enc_props->gop_mode > ENC_LOW_DELAY_B_MODE ||
+       enc_props->qp_mode < ENC_UNIFORM_QP_MODE || 
+       enc_props->qp_mode > ENC_RELATIVE_LOAD_QP_MODE ||
+       enc_props->aspect_ratio < ENC_ASPECT_RATIO_AUTO || 
+       enc_props->aspect_ratio > ENC_ASPECT_RATIO_NONE) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid gop mode %d, qp mode %d or aspect ratio %d\n",
+                enc_props->gop_mode, enc_props->qp_mode, 
+                enc_props->aspect_ratio);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_ctx->input_stride && enc_ctx->input_stride < enc_props->width) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid input stride %d for width %d\n", 
+                enc_ctx->input_stride, enc_props->width);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_ctx->scene_cut < 0 || enc_ctx->scene_cut > 100) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid scene cut threshold %d, supported 0 - 100\n", 
+                enc_ctx->scene_cut);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->lookahead_depth < ENC_MIN_LOOKAHEAD_DEPTH || 
+       enc_props->lookahead_depth > ENC_MAX_LOOKAHEAD_DEPTH) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid lookahead depth %d, supported %d - %d\n", 
+                enc_props->lookahead_depth, ENC_MIN_LOOKAHEAD_DEPTH, 
+                ENC_MAX_LOOKAHEAD_DEPTH);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->lookahead_depth > 0 && 
+       (int64_t)enc_props->width * enc_props->height > ENC_MAX_LA_PIXELS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Lookahead is supported up to %dx%d\n", 
+                ENC_MAX_LA_INPUT_WIDTH, ENC_MAX_LA_INPUT_HEIGHT);
+        return ENC_APP_FAILURE;
+    }
+    if(enc_props->spatial_aq_gain < 0 || 
+       enc_props->spatial_aq_gain > ENC_MAX_SPAT_AQ_GAIN) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid spatial AQ gain %d, supported 0 - %d\n", 
+                enc_props->spatial_aq_gain, ENC_MAX_SPAT_AQ_GAIN);
+        return ENC_APP_FAILURE;
+    }
+
+    return ENC_APP_SUCCESS;
+}
+
+/* One encoder channel. Every handle owns its XRM context, CU allocations and
+   XMA sessions, so handles can be driven from separate threads. */
+struct XlnxEncoderHandle {
+    XlnxEncoderCtx       enc_ctx;
+    XmaEncoderProperties xma_enc_props;
+    XmaFilterProperties  xma_la_props;
+    int64_t              open_us;
+    /* Preset the handle was opened from, -1 for Encoder_Open */
+    int32_t              preset_idx;
+    /* Free list link while parked in an XlnxEncoderPool */
+    XlnxEncoderHandle    *pool_next;
+};
+
+/* Validated properties of a preset, params and enc_options excepted. The
+   XmaParameter values point into the owning handle, so every handle gets
+   its own params array wired to its own copy. */
+typedef struct XlnxEncPresetCache
+{
+    int32_t               state;
+    XlnxEncoderProperties enc_props;
+    XmaEncoderProperties  xma_enc_props;
+} XlnxEncPresetCache;
+
+#define XLNX_ENC_PRESET_EMPTY   0
+#define XLNX_ENC_PRESET_READY   1
+#define XLNX_ENC_PRESET_INVALID 2
+
+static XlnxEncPresetCache xlnx_enc_preset_cache[XLNX_ENC_NUM_PRESETS];
+static pthread_mutex_t xlnx_enc_preset_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Handle behind the legacy single channel Encoder_* calls */
+static XlnxEncoderHandle *xlnx_enc_default_handle = NULL;
+
+XlnxDecoderCtx ctx;
+
+static int64_t xlnx_enc_now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Builds the handle and its XMA properties without touching the device */
+static XlnxEncoderHandle *xlnx_enc_handle_alloc(const XlnxEncoderConfig *cfg,
+                                                int32_t zero_copy_input)
+{
+    XlnxEncoderConfig default_cfg;
+    XlnxEncoderHandle *handle;
+    XlnxEncoderCtx *enc_ctx;
+
+    if(!cfg) {
+        Encoder_ConfigInit(&default_cfg);
+        cfg = &default_cfg;
+    }
+
+    handle = calloc(1, sizeof(*handle));
+    if(!handle) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Out of memory while allocating encoder handle\n");
+        return NULL;
+    }
+    enc_ctx = &handle->enc_ctx;
+    handle->preset_idx = -1;
+	
+    xlnx_enc_context_init(enc_ctx);
+    enc_ctx->zero_copy_input = zero_copy_input;
+
+    if(xlnx_enc_apply_config(enc_ctx, cfg) != ENC_APP_SUCCESS ||
+       xlnx_enc_validate_props(enc_ctx) != ENC_APP_SUCCESS) {
+        free(handle);
+        return NULL;
+    }
+
+    if(xlnx_enc_update_props(enc_ctx, &handle->xma_enc_props) != 
+                                                            ENC_APP_SUCCESS) {
+        Encoder_Close(handle);
+        return NULL;
+    }
+
+    if(xlnx_enc_frame_init(enc_ctx) != ENC_APP_SUCCESS) {
+        Encoder_Close(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+/* Allocates the CUs from the reserved pool and creates the XMA sessions */
+static int32_t xlnx_enc_handle_start(XlnxEncoderHandle *handle)
+{
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+
+    /* Lookahead session creation*/
+    if(xlnx_enc_la_init(enc_ctx, &handle->xma_la_props) != ENC_APP_SUCCESS) {
+        return ENC_APP_FAILURE;
+    }
+
+    if(xlnx_enc_create_session(enc_ctx, &handle->xma_enc_props) != 
+                                                            ENC_APP_SUCCESS) {
+        return ENC_APP_FAILURE;
+    }
+    xlnx_telemetry_register(&enc_ctx->telemetry, XLNX_TELEMETRY_ENCODER, 
+                            handle->xma_enc_props.dev_index);
+    return ENC_APP_SUCCESS;
+}
+
+/* Runs the full property derivation once for a preset and keeps the 
+   result. Called with xlnx_enc_preset_lock held. */
+static int32_t xlnx_enc_preset_build(int32_t idx)
+{
+    XlnxEncPresetCache *entry = &xlnx_enc_preset_cache[idx];
+    XlnxEncoderConfig cfg;
+    XlnxEncoderHandle *handle;
+
+    if(entry->state != XLNX_ENC_PRESET_EMPTY) {
+        return entry->state == XLNX_ENC_PRESET_READY ? ENC_APP_SUCCESS : 
+                                                       ENC_APP_FAILURE;
+    }
+
+    Encoder_ConfigInit(&cfg);
+    if(Encoder_ConfigParseString(&cfg, xlnx_enc_presets[idx].options) != 
+                                                            ENC_APP_SUCCESS ||
+       (handle = xlnx_enc_handle_alloc(&cfg, 0)) == NULL) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Encoder preset %s is invalid\n", xlnx_enc_presets[idx].name);
+        entry->state = XLNX_ENC_PRESET_INVALID;
+        return ENC_APP_FAILURE;
+    }
+
+    /* The cache takes over enc_options, the rest goes with the handle */
+    entry->enc_props = handle->enc_ctx.enc_props;
+    entry->xma_enc_props = handle->xma_enc_props;
+    entry->xma_enc_props.params = NULL;
+    handle->enc_ctx.enc_props.enc_options = NULL;
+    Encoder_Close(handle);
+
+    entry->state = XLNX_ENC_PRESET_READY;
+    return ENC_APP_SUCCESS;
+}
+
+/* Copies the cached preset properties into a new handle */
+static XlnxEncoderHandle *xlnx_enc_handle_from_preset(
+                              const XlnxEncPresetCache *entry, 
+                              int32_t device_id)
+{
+    XlnxEncoderHandle *handle;
+    XlnxEncoderCtx *enc_ctx;
+    XmaEncoderProperties *xma_enc_props;
+
+    handle = calloc(1, sizeof(*handle));
+    if(!handle) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Out of memory while allocating encoder handle\n");
+        return NULL;
+    }
+    enc_ctx = &handle->enc_ctx;
+    xma_enc_props = &handle->xma_enc_props;
+
+    xlnx_enc_context_init(enc_ctx);
+    enc_ctx->enc_xrm_ctx.device_id = device_id;
+    enc_ctx->enc_props = entry->enc_props;
+    enc_ctx->enc_props.enc_options = strdup(entry->enc_props.enc_options);
+    *xma_enc_props = entry->xma_enc_props;
+    xma_enc_props->params = calloc(xma_enc_props->param_cnt, 
+                                   sizeof(XmaParameter));
+    if(!enc_ctx->enc_props.enc_options || !xma_enc_props->params) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Out of memory while allocating encoder handle\n");
+        Encoder_Close(handle);
+        return NULL;
+    }
+    xlnx_enc_xma_params_update(&enc_ctx->enc_props, xma_enc_props);
+
+    if(xlnx_enc_frame_init(enc_ctx) != ENC_APP_SUCCESS) {
+        Encoder_Close(handle);
+        return NULL;
+    }
+
+    return handle;
+}
+
+/* Reserves the device and starts the sessions of an allocated handle */
+static XlnxEncoderHandle *xlnx_enc_handle_open(XlnxEncoderHandle *handle, 
+                                               int64_t start_us)
+{
+	int32_t ret = ENC_APP_SUCCESS;
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+    int64_t props_us = xlnx_enc_now_us() - start_us;
+
+    if((ret = xlnx_enc_device_init(&enc_ctx->enc_xrm_ctx, 
+                  &handle->xma_enc_props, 
+                  enc_ctx->enc_props.lookahead_depth, 
+                  enc_ctx->enc_props.num_cores)) != ENC_APP_SUCCESS) 
+	{
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Device Init failed with error %d \n", ret);
+        Encoder_Close(handle);
+        return NULL;
+    }
+
+    if(xlnx_enc_handle_start(handle) != ENC_APP_SUCCESS) {
+        Encoder_Close(handle);
+        return NULL;
+    }
+
+    handle->open_us = xlnx_enc_now_us() - start_us;
+    enc_ctx->start_us = start_us;
+    xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+            "Encoder channel opened in %" PRId64 " us, properties %" PRId64
+            " us\n", handle->open_us, props_us);
+	return handle;
+}
+
+/* Fallbacks that would still change the job of a handle */
+static int32_t xlnx_enc_fallbacks(const XlnxEncoderHandle *handle)
+{
+    int32_t fallbacks = 0;
+
+    if(handle->enc_ctx.enc_xrm_ctx.device_id >= 0 && 
+       xlnx_xma_get_device() < 0) {
+        fallbacks |= XLNX_ALLOC_ANY_DEVICE;
+    }
+    if(handle->enc_ctx.enc_props.lookahead_depth > 0) {
+        fallbacks |= XLNX_ALLOC_NO_LOOKAHEAD;
+    }
+    return fallbacks;
+}
+
+static void xlnx_enc_apply_fallback(XlnxEncoderConfig *cfg, int32_t fallback)
+{
+    if(fallback == XLNX_ALLOC_ANY_DEVICE) {
+        cfg->device_id = -1;
+    }
+    else if(fallback == XLNX_ALLOC_NO_LOOKAHEAD) {
+        cfg->lookahead_depth = 0;
+    }
+}
+
+/* Opens a channel under the allocation policy, building a fresh handle 
+   for every attempt. A preset (preset_idx >= 0) opens from its cached 
+   properties until a fallback changes the job, after that from its 
+   options like any configuration. */
+static XlnxEncoderHandle *xlnx_enc_open_with_policy(
+                              const XlnxEncoderConfig *cfg, 
+                              int32_t preset_idx, int32_t device_id,
+                              int64_t start_us)
+{
+    XlnxAllocAttempt attempt;
+    XlnxEncoderConfig try_cfg;
+    XlnxEncoderHandle *handle;
+    int32_t fallbacks;
+    int32_t next;
+
+    if(cfg) {
+        try_cfg = *cfg;
+    }
+    else {
+        Encoder_ConfigInit(&try_cfg);
+    }
+
+    xlnx_alloc_begin(&attempt);
+    while(1) {
+        if(preset_idx >= 0) {
+            /* Ready entries are never written again, no lock needed */
+            handle = xlnx_enc_handle_from_preset(
+                         &xlnx_enc_preset_cache[preset_idx], device_id);
+        }
+        else {
+            handle = xlnx_enc_handle_alloc(&try_cfg, 0);
+        }
+        /* An invalid configuration stays invalid, no retry */
+        if(!handle) {
+            break;
+        }
+        handle->preset_idx = preset_idx;
+        fallbacks = xlnx_enc_fallbacks(handle);
+
+        handle = xlnx_enc_handle_open(handle, start_us);
+        if(handle) {
+            break;
+        }
+        next = xlnx_alloc_next(&attempt, fallbacks);
+        if(next < 0) {
+            break;
+        }
+        if(next != XLNX_ALLOC_RETRY) {
+            if(preset_idx >= 0) {
+                Encoder_ConfigParseString(&try_cfg, 
+                                          xlnx_enc_presets[preset_idx].options);
+                try_cfg.device_id = device_id;
+                preset_idx = -1;
+            }
+            xlnx_enc_apply_fallback(&try_cfg, next);
+        }
+    }
+
+    xlnx_alloc_end(&attempt, handle ? ENC_APP_SUCCESS : ENC_APP_FAILURE,
+                   handle ? handle->xma_enc_props.dev_index : -1);
+    return handle;
+}
+
+int Encoder_GetOptions(const XlnxEncoderConfig *cfg, char *options, int size)
+{
+    XmaEncoderProperties xma_enc_props;
+    XlnxEncoderCtx *enc_ctx;
+    int ret = ENC_APP_FAILURE;
+
+    if(!cfg || (size > 0 && !options)) {
+        return ENC_APP_FAILURE;
+    }
+    enc_ctx = calloc(1, sizeof(*enc_ctx));
+    if(!enc_ctx) {
+        return ENC_APP_FAILURE;
+    }
+    memset(&xma_enc_props, 0, sizeof(xma_enc_props));
+    xlnx_enc_context_init(enc_ctx);
+
+    if(xlnx_enc_apply_config(enc_ctx, cfg) == ENC_APP_SUCCESS &&
+       xlnx_enc_validate_props(enc_ctx) == ENC_APP_SUCCESS &&
+       xlnx_enc_update_props(enc_ctx, &xma_enc_props) == ENC_APP_SUCCESS) {
+        ret = snprintf(options, size, "%s", enc_ctx->enc_props.enc_options);
+    }
+
+    free(enc_ctx->enc_props.enc_options);
+    free(xma_enc_props.params);
+    free(enc_ctx);
+    return ret;
+}
+
+XlnxEncoderHandle *Encoder_Open(const XlnxEncoderConfig *cfg)
+{
+    return xlnx_enc_open_with_policy(cfg, -1, -1, xlnx_enc_now_us());
+}
+
+XlnxEncoderHandle *Encoder_OpenPreset(const char *preset, int device_id)
+{
+    int64_t start_us = xlnx_enc_now_us();
+    int32_t idx = xlnx_enc_preset_index(preset);
+    int32_t ret;
+
+    if(idx < 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&xlnx_enc_preset_lock);
+    ret = xlnx_enc_preset_build(idx);
+    pthread_mutex_unlock(&xlnx_enc_preset_lock);
+    if(ret != ENC_APP_SUCCESS) {
+        return NULL;
+    }
+
+    return xlnx_enc_open_with_policy(NULL, idx, device_id, start_us);
+}
+
+int64_t Encoder_GetOpenTimeUs(const XlnxEncoderHandle *handle)
+{
+    return handle ? handle->open_us : 0;
+}
+
+int64_t Encoder_GetFirstPacketUs(const XlnxEncoderHandle *handle)
+{
+    return handle ? handle->enc_ctx.first_pkt_us : 0;
+}
+
+int Encoder_GetMaxPacketSize(const XlnxEncoderHandle *handle)
+{
+    if(!handle) {
+        return -1;
+    }
+    return (int)xlnx_enc_max_packet_size(&handle->enc_ctx.enc_props);
+}
+
+int Encoder_SetOutputCapacity(XlnxEncoderHandle *handle, int capacity)
+{
+    if(!handle || capacity <= 0) {
+        return -1;
+    }
+    handle->enc_ctx.out_capacity = capacity;
+    return 0;
+}
+
+/* Returns an open handle to the state right after opening it with props. 
+   The XRM allocations stay. A session that took frames holds references 
+   and may have seen end of stream, so its XMA sessions are recreated on 
+   the CUs it already owns. */
+static int32_t xlnx_enc_handle_reset(XlnxEncoderHandle *handle, 
+                                     const XlnxEncoderProperties *props)
+{
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+    XlnxLookaheadCtx *la_ctx = &enc_ctx->la_ctx;
+    char *enc_options = enc_ctx->enc_props.enc_options;
+    int32_t used = enc_ctx->in_frame_cnt > 0 || 
+                   enc_ctx->enc_state != ENC_READ_INPUT;
+
+    /* Packets still held by the previous user keep the pool alive */
+    xlnx_packet_buf_unref(enc_ctx->out_pkt);
+    xlnx_packet_buf_unref(enc_ctx->ready_pkt);
+    enc_ctx->out_pkt = NULL;
+    enc_ctx->ready_pkt = NULL;
+    enc_ctx->out_capacity = xlnx_enc_max_packet_size(props);
+    enc_ctx->out_too_small = 0;
+    xlnx_scene_detector_destroy(enc_ctx->scene_det);
+    enc_ctx->scene_det = NULL;
+    xlnx_enc_stats_ring_destroy(enc_ctx->stats_ring);
+    enc_ctx->stats_ring = NULL;
+    enc_ctx->nal_cb = NULL;
+    enc_ctx->nal_opaque = NULL;
+    /* A lookahead frame still with the encoder goes back to the LA */
+    if(!la_ctx->bypass && !la_ctx->xma_la_frame && 
+       enc_ctx->enc_in_frame != &enc_ctx->in_frame) {
+        xlnx_la_release_frame(la_ctx, enc_ctx->enc_in_frame);
+    }
+
+    /* Undo Encoder_Reconfigure, enc_options is never changed by it */
+    enc_ctx->enc_props = *props;
+    enc_ctx->enc_props.enc_options = enc_options;
+    enc_ctx->in_frame.frame_rate.numerator = props->fps;
+    enc_ctx->in_frame.frame_rate.denominator = 1;
+    enc_ctx->in_frame.is_last_frame = 0;
+    enc_ctx->in_frame.pts = 0;
+    enc_ctx->la_in_frame = &enc_ctx->in_frame;
+    enc_ctx->enc_in_frame = &enc_ctx->in_frame;
+    memset(&enc_ctx->dyn_params, 0, sizeof(enc_ctx->dyn_params));
+    enc_ctx->dyn_params_pending = 0;
+    enc_ctx->force_idr = 0;
+    for(int32_t i = 0; i < XLNX_ENC_MAX_INFLIGHT; i++) {
+        enc_ctx->idr_pts[i] = -1;
+    }
+    memset(enc_ctx->la_stats, 0, sizeof(enc_ctx->la_stats));
+    memset(&enc_ctx->stats_parser, 0, sizeof(enc_ctx->stats_parser));
+    memset(&enc_ctx->last_stats, 0, sizeof(enc_ctx->last_stats));
+    /* Released handles have no reader left, so the histograms restart */
+    memset(&enc_ctx->latency, 0, sizeof(enc_ctx->latency));
+    enc_ctx->pts = 0;
+    enc_ctx->in_frame_cnt = 0;
+    enc_ctx->out_frame_cnt = 0;
+    enc_ctx->enc_state = ENC_READ_INPUT;
+    enc_ctx->first_pkt_us = 0;
+
+    if(!used) {
+        return ENC_APP_SUCCESS;
+    }
+
+    if(!la_ctx->bypass && la_ctx->filter_session) {
+        xma_filter_session_destroy(la_ctx->filter_session);
+        la_ctx->filter_session = xma_filter_session_create(
+                                     &handle->xma_la_props);
+        if(!la_ctx->filter_session) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                    "Failed to recreate lookahead session\n");
+            return ENC_APP_FAILURE;
+        }
+    }
+
+    xma_enc_session_destroy(enc_ctx->enc_session);
+    enc_ctx->enc_session = xma_enc_session_create(&handle->xma_enc_props);
+    if(!enc_ctx->enc_session) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Failed to recreate encoder session\n");
+        return ENC_APP_FAILURE;
+    }
+
+    return ENC_APP_SUCCESS;
+}
+
+struct XlnxEncoderPool {
+    pthread_mutex_t   lock;
+    int32_t           device_id;
+    /* Parked handles per preset, linked through pool_next */
+    XlnxEncoderHandle *free_list[XLNX_ENC_NUM_PRESETS];
+};
+
+XlnxEncoderPool *Encoder_PoolCreate(const char *const *presets, 
+                                    int num_presets, int sessions_per_preset,
+                                    int device_id)
+{
+    XlnxEncoderPool *pool;
+    XlnxEncoderHandle *handle;
+    int32_t idx;
+
+    pool = calloc(1, sizeof(*pool));
+    if(!pool) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Out of memory while allocating encoder pool\n");
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->device_id = device_id;
+
+    for(int32_t i = 0; i < num_presets; i++) {
+        idx = xlnx_enc_preset_index(presets[i]);
+        if(idx < 0) {
+            Encoder_PoolDestroy(pool);
+            return NULL;
+        }
+        for(int32_t n = 0; n < sessions_per_preset; n++) {
+            handle = Encoder_OpenPreset(presets[i], device_id);
+            /* An allocation fallback opens a different job, which Acquire
+               would hand out as the preset */
+            if(handle && handle->preset_idx != idx) {
+                xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                        "Encoder pool %s channel only opened with an "
+                        "allocation fallback\n", presets[i]);
+                Encoder_Close(handle);
+                handle = NULL;
+            }
+            if(!handle) {
+                xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                        "Encoder pool could only open %d %s channels\n", 
+                        n, presets[i]);
+                Encoder_PoolDestroy(pool);
+                return NULL;
+            }
+            handle->pool_next = pool->free_list[idx];
+            pool->free_list[idx] = handle;
+        }
+    }
+
+    return pool;
+}
+
+XlnxEncoderHandle *Encoder_PoolAcquire(XlnxEncoderPool *pool, 
+                                       const char *preset)
+{
+    int64_t start_us = xlnx_enc_now_us();
+    int32_t idx = xlnx_enc_preset_index(preset);
+    XlnxEncoderHandle *handle;
+
+    if(idx < 0) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    handle = pool->free_list[idx];
+    if(handle) {
+        pool->free_list[idx] = handle->pool_next;
+        handle->pool_next = NULL;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if(!handle) {
+        xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+                "Encoder pool has no free %s channel, opening one\n", 
+                preset);
+        return Encoder_OpenPreset(preset, pool->device_id);
+    }
+    handle->enc_ctx.start_us = start_us;
+    return handle;
+}
+
+void Encoder_PoolRelease(XlnxEncoderPool *pool, XlnxEncoderHandle *handle)
+{
+    int32_t idx;
+
+    if(!handle) {
+        return;
+    }
+    idx = handle->preset_idx;
+    /* The preset entry is ready, the handle was opened from it */
+    if(idx < 0 || 
+       xlnx_enc_handle_reset(handle, &xlnx_enc_preset_cache[idx].enc_props) 
+                                                        != ENC_APP_SUCCESS) {
+        Encoder_Close(handle);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    handle->pool_next = pool->free_list[idx];
+    pool->free_list[idx] = handle;
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void Encoder_PoolDestroy(XlnxEncoderPool *pool)
+{
+    XlnxEncoderHandle *handle;
+
+    if(!pool) {
+        return;
+    }
+    for(int32_t i = 0; i < XLNX_ENC_NUM_PRESETS; i++) {
+        while(pool->free_list[i]) {
+            handle = pool->free_list[i];
+            pool->free_list[i] = handle->pool_next;
+            Encoder_Close(handle);
+        }
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/* Channels started from a single XRM CU pool reservation. Their CU lists 
+   are concatenated into one list, so XRM either finds room for all of 
+   them on one device or reserves nothing. */
+struct XlnxEncoderGroup {
+    xrmContext        *xrm_ctx;
+    int32_t           pool_id;
+    int32_t           num_channels;
+    int64_t           open_us;
+    XlnxEncoderHandle *channels[XLNX_ENC_GROUP_MAX_CHANNELS];
+};
+
+void EncoderGroup_Close(XlnxEncoderGroup *group)
+{
+    if(!group) {
+        return;
+    }
+    /* Channels give their CUs back to the pool before it is relinquished */
+    for(int32_t i = 0; i < group->num_channels; i++) {
+        Encoder_Close(group->channels[i]);
+    }
+    if(group->xrm_ctx) {
+        if(group->pool_id) {
+            xrmCuPoolRelinquish(group->xrm_ctx, group->pool_id);
+        }
+        xrmDestroyContext(group->xrm_ctx);
+    }
+    free(group);
+}
+
+static int32_t xlnx_enc_group_fill_pool_props(XlnxEncoderGroup *group, 
+                                              xrmCuPoolProperty *cu_pool_prop)
+{
+    XlnxEncoderHandle *handle;
+
+    memset(cu_pool_prop, 0, sizeof(*cu_pool_prop));
+    for(int32_t i = 0; i < group->num_channels; i++) {
+        /* A channel adds at most an encoder, a lookahead and a soft kernel
+           per core */
+        if(cu_pool_prop->cuListProp.cuNum > 
+           XRM_MAX_LIST_CU_NUM - 2 - ENC_SUPPORTED_MAX_NUM_CORES) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                    "Encoder group CU list is full after %d channels\n", i);
+            return ENC_APP_FAILURE;
+        }
+        handle = group->channels[i];
+        if(xlnx_enc_load_calc(&handle->enc_ctx.enc_xrm_ctx, 
+                              &handle->xma_enc_props, 
+                              handle->enc_ctx.enc_props.lookahead_depth,
+                              handle->enc_ctx.enc_props.num_cores,
+                              cu_pool_prop) != ENC_APP_SUCCESS) {
+            return ENC_APP_FAILURE;
+        }
+    }
+    return ENC_APP_SUCCESS;
+}
+
+static int32_t xlnx_enc_group_reserve(XlnxEncoderGroup *group)
+{
+    xrmCuPoolProperty cu_pool_prop;
+    xrmCuPoolResource cu_pool_res;
+
+    if(xlnx_enc_group_fill_pool_props(group, &cu_pool_prop) != 
+                                                        ENC_APP_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Encoder group load calculation failed\n");
+        return ENC_APP_FAILURE;
+    }
+
+    group->pool_id = xlnx_xrm_pool_reserve(group->xrm_ctx, &cu_pool_prop);
+    if(group->pool_id == 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "No room to reserve %d encoder channels at once\n", 
+                group->num_channels);
+        return ENC_APP_FAILURE;
+    }
+
+    memset(&cu_pool_res, 0, sizeof(cu_pool_res));
+    if(xrmReservationQuery(group->xrm_ctx, group->pool_id, &cu_pool_res) 
+                                                                    != 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Failed to query reserved cu list\n");
+        return ENC_APP_FAILURE;
+    }
+
+    if(xlnx_xma_initialize(cu_pool_res.cuResources[0].deviceId, 
+                           cu_pool_res.cuResources[0].xclbinFileName) != 
+                                                                XMA_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "XMA Initialization failed\n");
+        return ENC_APP_FAILURE;
+    }
+    xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+            "Encoder group reserved pool %d on device %d\n", group->pool_id,
+            cu_pool_res.cuResources[0].deviceId);
+
+    return ENC_APP_SUCCESS;
+}
+
+/* Builds the handles of every channel, nothing is reserved yet */
+static XlnxEncoderGroup *xlnx_enc_group_alloc(const XlnxEncoderConfig *cfgs,
+                                              int32_t num_channels)
+{
+    XlnxEncoderGroup *group;
+    XlnxEncoderHandle *handle;
+
+    group = calloc(1, sizeof(*group));
+    if(!group) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Out of memory while allocating encoder group\n");
+        return NULL;
+    }
+
+    group->xrm_ctx = (xrmContext *)xrmCreateContext(XRM_API_VERSION_1);
+    if(!group->xrm_ctx) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "create local XRM context failed\n");
+        EncoderGroup_Close(group);
+        return NULL;
+    }
+
+    for(int32_t i = 0; i < num_channels; i++) {
+        if(cfgs[i].device_id >= 0) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                    "Channel %d of an encoder group asks for device %d, "
+                    "the group reservation picks the device\n", i, 
+                    cfgs[i].device_id);
+            EncoderGroup_Close(group);
+            return NULL;
+        }
+        handle = xlnx_enc_handle_alloc(&cfgs[i], 0);
+        if(!handle) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                    "Invalid configuration for group channel %d\n", i);
+            EncoderGroup_Close(group);
+            return NULL;
+        }
+        handle->enc_ctx.enc_xrm_ctx.xrm_ctx = group->xrm_ctx;
+        handle->enc_ctx.enc_xrm_ctx.shared_pool = 1;
+        group->channels[group->num_channels++] = handle;
+    }
+
+    return group;
+}
+
+/* Reserves the pool and starts every channel, closes the group on 
+   failure */
+static int32_t xlnx_enc_group_start(XlnxEncoderGroup *group, 
+                                    int64_t start_us)
+{
+    XlnxEncoderHandle *handle;
+    int64_t reserve_us;
+
+    if(xlnx_enc_group_reserve(group) != ENC_APP_SUCCESS) {
+        EncoderGroup_Close(group);
+        return ENC_APP_FAILURE;
+    }
+    reserve_us = xlnx_enc_now_us() - start_us;
+
+    for(int32_t i = 0; i < group->num_channels; i++) {
+        handle = group->channels[i];
+        handle->enc_ctx.enc_xrm_ctx.enc_res_idx = group->pool_id;
+        if(xlnx_enc_handle_start(handle) != ENC_APP_SUCCESS) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                    "Encoder group channel %d failed to start\n", i);
+            EncoderGroup_Close(group);
+            return ENC_APP_FAILURE;
+        }
+        handle->enc_ctx.start_us = start_us;
+    }
+
+    group->open_us = xlnx_enc_now_us() - start_us;
+    for(int32_t i = 0; i < group->num_channels; i++) {
+        group->channels[i]->open_us = group->open_us;
+    }
+    xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+            "Encoder group of %d channels opened in %" PRId64 " us, "
+            "reservation %" PRId64 " us\n", group->num_channels, group->open_us,
+            reserve_us);
+    return ENC_APP_SUCCESS;
+}
+
+XlnxEncoderGroup *EncoderGroup_Open(const XlnxEncoderConfig *cfgs, 
+                                    int num_channels)
+{
+    int64_t start_us = xlnx_enc_now_us();
+    XlnxEncoderConfig try_cfgs[XLNX_ENC_GROUP_MAX_CHANNELS];
+    XlnxAllocAttempt attempt;
+    XlnxEncoderGroup *group;
+    int32_t fallbacks;
+    int32_t next;
+
+    if(num_channels < 1 || num_channels > XLNX_ENC_GROUP_MAX_CHANNELS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Encoder group supports 1 to %d channels, got %d\n", 
+                XLNX_ENC_GROUP_MAX_CHANNELS, num_channels);
+        return NULL;
+    }
+    memcpy(try_cfgs, cfgs, num_channels * sizeof(*cfgs));
+
+    /* The group reservation picks the device, so dropping lookahead on 
+       every channel is the only fallback */
+    xlnx_alloc_begin(&attempt);
+    while(1) {
+        group = xlnx_enc_group_alloc(try_cfgs, num_channels);
+        if(!group) {
+            break;
+        }
+        fallbacks = 0;
+        for(int32_t i = 0; i < num_channels; i++) {
+            if(group->channels[i]->enc_ctx.enc_props.lookahead_depth > 0) {
+                fallbacks = XLNX_ALLOC_NO_LOOKAHEAD;
+            }
+        }
+        if(xlnx_enc_group_start(group, start_us) == ENC_APP_SUCCESS) {
+            break;
+        }
+        group = NULL;
+        next = xlnx_alloc_next(&attempt, fallbacks);
+        if(next < 0) {
+            break;
+        }
+        if(next == XLNX_ALLOC_NO_LOOKAHEAD) {
+            for(int32_t i = 0; i < num_channels; i++) {
+                try_cfgs[i].lookahead_depth = 0;
+            }
+        }
+    }
+
+    xlnx_alloc_end(&attempt, group ? ENC_APP_SUCCESS : ENC_APP_FAILURE, 
+                   group ? group->channels[0]->xma_enc_props.dev_index : -1);
+    return group;
+}
+
+XlnxEncoderHandle *EncoderGroup_GetChannel(XlnxEncoderGroup *group, 
+                                           int channel)
+{
+    if(!group || channel < 0 || channel >= group->num_channels) {
+        return NULL;
+    }
+    return group->channels[channel];
+}
+
+int64_t EncoderGroup_GetOpenTimeUs(const XlnxEncoderGroup *group)
+{
+    return group ? group->open_us : 0;
+}
+
+void Encoder_Close(XlnxEncoderHandle *handle)
+{
+    if(!handle) {
+        return;
+    }
+    xlnx_telemetry_unregister(&handle->enc_ctx.telemetry);
+    xlnx_enc_app_close(&handle->enc_ctx, &handle->xma_enc_props, 
+                       &handle->xma_la_props);
+    free(handle);
+}
+
+int Encoder_InitWithConfig(const XlnxEncoderConfig *cfg)
+{
+    if(xlnx_enc_default_handle) {
+        Encoder_Release();
+    }
+    xlnx_enc_default_handle = Encoder_Open(cfg);
+    return xlnx_enc_default_handle ? ENC_APP_SUCCESS : ENC_APP_FAILURE;
+}
+
+int Encoder_Init()
+{
+    XlnxEncoderConfig cfg;
+
+    /* Legacy entry point: 1080p H264 baseline with library defaults */
+    Encoder_ConfigInit(&cfg);
+    cfg.codec_id = ENCODER_ID_H264;
+    cfg.width = ENC_DEFAULT_WIDTH;
+    cfg.height = ENC_DEFAULT_HEIGHT;
+    strcpy(cfg.profile, "baseline");
+
+    return Encoder_InitWithConfig(&cfg);
+}
+
+/* Attaches pending runtime changes to the frame about to be encoded */
+static int32_t xlnx_enc_apply_dyn_params(XlnxEncoderCtx *enc_ctx, 
+                                         XmaFrame *frame)
+{
+    XmaSideDataHandle side_data;
+    int64_t *idr_pts;
+
+    /* Forced IDRs are keyed by pts, frames may leave the lookahead later */
+    if(frame->pts >= 0) {
+        idr_pts = &enc_ctx->idr_pts[frame->pts % XLNX_ENC_MAX_INFLIGHT];
+        if(*idr_pts == frame->pts) {
+            frame->is_idr = 1;
+            *idr_pts = -1;
+        }
+    }
+
+    if(!enc_ctx->dyn_params_pending) {
+        return ENC_APP_SUCCESS;
+    }
+
+    side_data = xma_side_data_alloc(&enc_ctx->dyn_params, 
+                                    XMA_FRAME_DYNAMIC_PARAMS, 
+                                    sizeof(enc_ctx->dyn_params), 0);
+    if(!side_data) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Failed to allocate dynamic params side data\n");
+        return ENC_APP_FAILURE;
+    }
+    xma_frame_add_side_data(frame, side_data);
+    /* The frame holds its own reference */
+    xma_side_data_dec_ref(side_data);
+
+    memset(&enc_ctx->dyn_params, 0, sizeof(enc_ctx->dyn_params));
+    enc_ctx->dyn_params_pending = 0;
+
+    return ENC_APP_SUCCESS;
+}
+
+/* Keeps a summary of the lookahead QP map until the frame is encoded */
+static void xlnx_enc_record_la_stats(XlnxEncoderCtx *enc_ctx, XmaFrame *frame)
+{
+    XlnxEncLaStats *la_stats;
+    XmaSideDataHandle qp_map;
+    const int8_t *qp;
+    size_t size;
+    int64_t sum = 0;
+
+    if(enc_ctx->la_bypass || frame->pts < 0) {
+        return;
+    }
+    la_stats = &enc_ctx->la_stats[frame->pts % XLNX_ENC_MAX_INFLIGHT];
+    la_stats->valid = 0;
+    qp_map = xma_frame_get_side_data(frame, XMA_FRAME_QP_MAP);
+    if(!qp_map) {
+        return;
+    }
+    qp = (const int8_t *)xma_side_data_get_payload(qp_map);
+    size = xma_side_data_get_size(qp_map);
+    if(!qp || !size) {
+        return;
+    }
+    for(size_t i = 0; i < size; i++) {
+        sum += qp[i];
+    }
+    la_stats->valid = 1;
+    la_stats->qp_map_size = (int32_t)size;
+    la_stats->qp_offset = (float)sum / size;
+}
+
+/* Sends enc_ctx->enc_in_frame and releases it to the lookahead. On 
+   XMA_TRY_AGAIN the frame is kept, with its side data, for a resend. */
+static int32_t xlnx_enc_send_frame(XlnxEncoderCtx *enc_ctx)
+{
+    int32_t ret;
+    int64_t start_ns = xlnx_latency_now_ns();
+
+    ret = xma_enc_session_send_frame(enc_ctx->enc_session, 
+                                     enc_ctx->enc_in_frame);
+    xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_SEND, start_ns);
+    if(ret == XMA_TRY_AGAIN) {
+        return ret;
+    }
+
+    /* Dynamic params and forced IDR apply to this frame only */
+    enc_ctx->enc_in_frame->is_idr = 0;
+    if(xma_frame_get_side_data(enc_ctx->enc_in_frame, 
+                               XMA_FRAME_DYNAMIC_PARAMS)) {
+        xma_frame_remove_side_data_type(enc_ctx->enc_in_frame, 
+                                        XMA_FRAME_DYNAMIC_PARAMS);
+    }
+    if(xlnx_la_release_frame(&enc_ctx->la_ctx, enc_ctx->enc_in_frame) != 
+                                                            ENC_APP_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Failed to release lookahead frame \n");
+        return XMA_ERROR;
+    }
+
+    return ret;
+}
+
+static int32_t xlnx_enc_process_frame(XlnxEncoderCtx *enc_ctx)
+{
+
+    int32_t ret;
+    int64_t start_ns = xlnx_latency_now_ns();
+    int64_t pts;
+
+    /* Lookahead holds back lookahead_depth frames before it returns the first
+       one (XMA_SEND_MORE_DATA), and reports XMA_EOS once a flush drained it.
+       In bypass mode the input frame is handed straight back. */
+    ret = xlnx_la_process_frame(&enc_ctx->la_ctx, enc_ctx->la_in_frame, 
+                                &enc_ctx->enc_in_frame);
+    if(!enc_ctx->la_bypass) {
+        start_ns = xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_LA, 
+                                             start_ns);
+    }
+    if(ret != XMA_SUCCESS) {
+        return ret;
+    }
+    pts = enc_ctx->enc_in_frame->pts;
+    if(!enc_ctx->la_bypass && pts >= 0) {
+        /* Same monotonic clock as submit_us */
+        xlnx_latency_record(&enc_ctx->latency, XLNX_LAT_LA_OUT, start_ns - 
+                enc_ctx->submit_us[pts % XLNX_ENC_MAX_INFLIGHT] * 1000);
+    }
+
+    if(xlnx_enc_apply_dyn_params(enc_ctx, enc_ctx->enc_in_frame) != 
+                                                            ENC_APP_SUCCESS) {
+        return XMA_ERROR;
+    }
+    xlnx_enc_record_la_stats(enc_ctx, enc_ctx->enc_in_frame);
+    if(enc_ctx->enc_in_frame->data[0].buffer_type == XMA_DEVICE_BUFFER_TYPE) {
+        xlnx_telemetry_pool(&enc_ctx->telemetry, 
+                            enc_ctx->enc_in_frame->data[0].buffer);
+    }
+
+    /* The LA output frame carries the QP map and FSFA side data consumed by
+       custom RC and AQ, so it is sent as is and only released afterwards */
+    return xlnx_enc_send_frame(enc_ctx);
+}
+
+const char* AVCFindStartCode(const char *p, const char *end);
+
+/* Splits one access unit on its start codes and hands every NAL to the
+   callback straight from the XMA output buffer. recv_data only returns 
+   complete access units, so slices cannot go out before the frame ends. */
+static void xlnx_enc_deliver_nals(XlnxEncoderCtx *enc_ctx, const char *buf, 
+                                  int32_t size)
+{
+    const char *end = buf + size;
+    const char *nal_start = AVCFindStartCode(buf, end);
+    const char *nal_end;
+    const char *hdr;
+    XlnxEncoderNal nal;
+    int64_t pts = enc_ctx->xma_buffer.pts;
+
+    nal.pts = pts;
+    nal.latency_us = 0;
+    if(pts >= 0) {
+        nal.latency_us = xlnx_enc_now_us() - 
+                         enc_ctx->submit_us[pts % XLNX_ENC_MAX_INFLIGHT];
+    }
+
+    while(nal_start < end) {
+        nal_end = AVCFindStartCode(nal_start + 3, end);
+        /* Skip the 3 or 4 byte start code to reach the NAL header */
+        hdr = nal_start;
+        while(hdr < nal_end && *hdr == 0) {
+            hdr++;
+        }
+        hdr++;
+        nal.nal_type = 0;
+        if(hdr < nal_end) {
+            if(enc_ctx->enc_props.codec_id == ENCODER_ID_HEVC) {
+                nal.nal_type = ((uint8_t)*hdr >> 1) & 0x3f;
+            } else {
+                nal.nal_type = (uint8_t)*hdr & 0x1f;
+            }
+        }
+        nal.data = nal_start;
+        nal.size = (int32_t)(nal_end - nal_start);
+        nal.last_in_frame = (nal_end == end);
+        enc_ctx->nal_cb(enc_ctx->nal_opaque, &nal);
+        nal_start = nal_end;
+    }
+}
+
+/* Frames a packet's decode time trails its output index by. Reordering
+   with B frames goes one level deep, pyramidal GOPs one per layer. */
+static int32_t xlnx_enc_dts_delay(const XlnxEncoderProperties *enc_props)
+{
+    int32_t delay = 0;
+
+    if(enc_props->num_bframes == 0) {
+        return 0;
+    }
+    if(enc_props->gop_mode != ENC_PYRAMIDAL_GOP_MODE) {
+        return 1;
+    }
+    while((1u << delay) < enc_props->num_bframes + 1) {
+        delay++;
+    }
+    return delay;
+}
+
+static void xlnx_enc_update_stats(XlnxEncoderCtx *enc_ctx, 
+                                  XlnxPacketBuf *pkt)
+{
+    XlnxEncoderFrameStats *stats = &enc_ctx->last_stats;
+    int64_t pts = pkt->pkt.pts;
+    XlnxEncLaStats *la_stats;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->frame_num = enc_ctx->out_frame_cnt;
+    stats->pts = pts;
+    stats->dts = stats->frame_num - 
+                 xlnx_enc_dts_delay(&enc_ctx->enc_props);
+    stats->size = pkt->pkt.size;
+    xlnx_enc_stats_parse_au(&enc_ctx->stats_parser, 
+                            enc_ctx->enc_props.codec_id, 
+                            (const uint8_t *)pkt->buffer, pkt->pkt.size, 
+                            stats);
+    if(pts >= 0) {
+        stats->latency_us = xlnx_enc_now_us() - 
+                            enc_ctx->submit_us[pts % XLNX_ENC_MAX_INFLIGHT];
+        xlnx_latency_record(&enc_ctx->latency, XLNX_LAT_ENCODE_OUT, 
+                            stats->latency_us * 1000);
+        la_stats = &enc_ctx->la_stats[pts % XLNX_ENC_MAX_INFLIGHT];
+        if(la_stats->valid) {
+            stats->la_valid = 1;
+            stats->la_qp_map_size = la_stats->qp_map_size;
+            stats->la_qp_offset = la_stats->qp_offset;
+        }
+    }
+
+    pkt->pkt.stats = *stats;
+    if(enc_ctx->stats_ring) {
+        xlnx_enc_stats_ring_push(enc_ctx->stats_ring, stats);
+    }
+}
+
+static int32_t xlnx_enc_recv_data(XlnxEncoderCtx *enc_ctx, char *outBuf, 
+                                  int *outlen)
+{
+
+    int32_t recv_size = 0;
+    XlnxPacketBuf *pkt;
+    int32_t ret;
+    int64_t start_ns;
+
+    if(!enc_ctx->out_pkt) {
+        enc_ctx->out_pkt = xlnx_packet_pool_get(enc_ctx->pkt_pool);
+        if(!enc_ctx->out_pkt) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                       "Encoder failed to allocate output packet \n");
+            return XMA_ERROR;
+        }
+    }
+    pkt = enc_ctx->out_pkt;
+    enc_ctx->xma_buffer.data.buffer = pkt->buffer;
+    enc_ctx->xma_buffer.alloc_size = pkt->capacity;
+
+    start_ns = xlnx_latency_now_ns();
+    ret = xma_enc_session_recv_data(enc_ctx->enc_session, 
+                                    &(enc_ctx->xma_buffer), &recv_size);
+    if(ret == XMA_SUCCESS) {
+        xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_RECV, start_ns);
+        if(enc_ctx->xma_buffer.data.buffer != pkt->buffer) {
+            /* Plugins that return their own memory get copied once */
+            if(xlnx_packet_buf_reserve(pkt, recv_size) != 0) {
+                xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                           "Encoder failed to grow output packet \n");
+                return XMA_ERROR;
+            }
+            memcpy(pkt->buffer, enc_ctx->xma_buffer.data.buffer, recv_size);
+        } else if((size_t)recv_size > pkt->capacity) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                       "Encoded packet of %d bytes overflows %zu byte buffer\n",
+                       recv_size, pkt->capacity);
+            return XMA_ERROR;
+        }
+        /* Keep headroom: packets close to the buffer size grow the ones
+           handed out next */
+        if((size_t)recv_size > pkt->capacity / 4 * 3) {
+            xlnx_packet_pool_grow(enc_ctx->pkt_pool, 2 * pkt->capacity);
+        }
+        pkt->pkt.data = pkt->buffer;
+        pkt->pkt.size = recv_size;
+        pkt->pkt.pts = enc_ctx->xma_buffer.pts;
+        *outlen = recv_size;
+        xlnx_enc_update_stats(enc_ctx, pkt);
+        if(enc_ctx->out_frame_cnt == 0 && enc_ctx->start_us) {
+            enc_ctx->first_pkt_us = xlnx_enc_now_us() - enc_ctx->start_us;
+            xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+                    "First packet %" PRId64 " us after channel start\n", 
+                    enc_ctx->first_pkt_us);
+        }
+
+        start_ns = xlnx_latency_now_ns();
+        if(enc_ctx->nal_cb) {
+            xlnx_enc_deliver_nals(enc_ctx, pkt->buffer, recv_size);
+            xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_COPY_OUT, 
+                                      start_ns);
+            *outlen = 0;
+        } else if(outBuf && (size_t)recv_size <= enc_ctx->out_capacity) {
+            memcpy(outBuf, pkt->buffer, recv_size);
+            xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_COPY_OUT, 
+                                      start_ns);
+        } else {
+            /* Handed out by reference, the next recv takes a fresh buffer.
+               A packet too large for outBuf waits here as well. */
+            if(outBuf) {
+                xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE,
+                           "Packet of %d bytes does not fit %zu byte output "
+                           "buffer, kept for Encoder_ReceivePacket\n", 
+                           recv_size, enc_ctx->out_capacity);
+                enc_ctx->out_too_small = 1;
+            }
+            if(enc_ctx->ready_pkt) {
+                xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                           "Dropping packet not taken by the caller \n");
+                xlnx_packet_buf_unref(enc_ctx->ready_pkt);
+            }
+            enc_ctx->ready_pkt = pkt;
+            enc_ctx->out_pkt = NULL;
+        }
+        enc_ctx->out_frame_cnt++;
+        xlnx_telemetry_count(&enc_ctx->telemetry, enc_ctx->in_frame_cnt, 
+                             enc_ctx->out_frame_cnt);
+    }
+    else if(ret == XMA_EOS) {
+        enc_ctx->enc_state = ENC_DONE;
+    }
+
+    return ret;
+}
+
+/* The encoder had no room for enc_ctx->enc_in_frame: takes a packet off
+   its output, then resends the held frame until it is accepted. Only one
+   packet fits the caller's buffer, so after that it waits for the device.
+   got_pkt reports whether outBuf was filled. */
+static int32_t xlnx_enc_resend_frame(XlnxEncoderCtx *enc_ctx, char *outBuf, 
+                                     int *outlen, int32_t *got_pkt)
+{
+    int32_t retries = 0;
+    int32_t ret;
+
+    *got_pkt = 0;
+    do {
+        if(++retries > XLNX_ENC_SEND_RETRIES) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                    "Encoder stopped taking input\n");
+            return XMA_ERROR;
+        }
+        ret = XMA_TRY_AGAIN;
+        if(!*got_pkt) {
+            ret = xlnx_enc_recv_data(enc_ctx, outBuf, outlen);
+            if(ret <= XMA_ERROR) {
+                return ret;
+            }
+            *got_pkt = (ret == XMA_SUCCESS);
+        }
+        if(ret != XMA_SUCCESS) {
+            usleep(XLNX_ENC_SEND_RETRY_US);
+        }
+        ret = xlnx_enc_send_frame(enc_ctx);
+    } while(ret == XMA_TRY_AGAIN);
+
+    return ret;
+}
+
+/* Runs the scene change detector on a host input frame */
+static int32_t xlnx_enc_detect_scene_cut(XlnxEncoderCtx *enc_ctx, 
+                                         const XmaFrame *frame)
+{
+    if(!enc_ctx->scene_cut || enc_ctx->zero_copy_input) {
+        return 0;
+    }
+    if(!enc_ctx->scene_det) {
+        enc_ctx->scene_det = xlnx_scene_detector_create(
+                                 enc_ctx->enc_props.width, 
+                                 enc_ctx->enc_props.height, 
+                                 enc_ctx->scene_cut);
+        if(!enc_ctx->scene_det) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                    "Scene change detection disabled, out of memory\n");
+            enc_ctx->scene_cut = 0;
+            return 0;
+        }
+    }
+    if(!xlnx_scene_detector_process(enc_ctx->scene_det, 
+                                    (const uint8_t *)frame->data[0].buffer,
+                                    frame->frame_props.linesize[0])) {
+        return 0;
+    }
+    xma_logmsg(XMA_DEBUG_LOG, XLNX_ENC_APP_MODULE,
+            "Scene change at frame %d, score %.1f\n", enc_ctx->pts, 
+            xlnx_scene_detector_score(enc_ctx->scene_det));
+    return 1;
+}
+
+/* Encodes enc_ctx->la_in_frame and returns at most one packet. force_idr
+   codes this frame as IDR. */
+static int32_t xlnx_enc_encode_frame(XlnxEncoderCtx *enc_ctx, 
+                                     int32_t force_idr, char *outBuf, 
+                                     int *outlen)
+{
+    int32_t ret = ENC_APP_SUCCESS;
+    int32_t got_pkt = 0;
+
+	*outlen = 0;
+	if(xlnx_enc_detect_scene_cut(enc_ctx, enc_ctx->la_in_frame) || 
+	   force_idr || enc_ctx->force_idr) {
+		enc_ctx->idr_pts[enc_ctx->pts % XLNX_ENC_MAX_INFLIGHT] = enc_ctx->pts;
+		enc_ctx->force_idr = 0;
+	}
+	enc_ctx->submit_us[enc_ctx->pts % XLNX_ENC_MAX_INFLIGHT] = 
+	                                                xlnx_enc_now_us();
+	enc_ctx->la_in_frame->pts = enc_ctx->pts++;
+	enc_ctx->in_frame_cnt++;
+	xlnx_telemetry_count(&enc_ctx->telemetry, enc_ctx->in_frame_cnt, 
+	                     enc_ctx->out_frame_cnt);
+
+	ret = xlnx_enc_process_frame(enc_ctx);
+	if(ret == XMA_TRY_AGAIN) {
+		ret = xlnx_enc_resend_frame(enc_ctx, outBuf, outlen, &got_pkt);
+		if(got_pkt && ret > XMA_ERROR) {
+			/* The packet for this frame is taken by the next call */
+			enc_ctx->enc_state = ENC_READ_INPUT;
+			return ENC_APP_SUCCESS;
+		}
+	}
+	if (ret == XMA_SUCCESS) {
+		enc_ctx->enc_state = ENC_GET_OUTPUT;
+	}
+	else if(ret == XMA_SEND_MORE_DATA) 
+	{
+		/* Lookahead or encoder is still filling its pipeline */
+		enc_ctx->enc_state = ENC_READ_INPUT;
+		return ENC_APP_SUCCESS;
+	}
+	else 
+	{
+		xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+		        "Encoder send frame failed, status %d\n", ret);
+		return ENC_APP_DONE;
+	}
+	
+	ret = xlnx_enc_recv_data(enc_ctx, outBuf, outlen);
+	if(ret <= XMA_ERROR) 
+	{
+		return ENC_APP_DONE;
+	}
+	enc_ctx->enc_state = ENC_READ_INPUT;
+
+    return ENC_APP_SUCCESS;
+}
+
+/* A packet that did not fit outBuf turns a successful call into 
+   XLNX_ENC_NEED_SPACE, the packet waits for Encoder_ReceivePacket */
+static int32_t xlnx_enc_out_status(XlnxEncoderCtx *enc_ctx, int32_t ret)
+{
+    if(enc_ctx->out_too_small) {
+        enc_ctx->out_too_small = 0;
+        if(ret == ENC_APP_SUCCESS) {
+            return XLNX_ENC_NEED_SPACE;
+        }
+    }
+    return ret;
+}
+
+int Encoder_EncodeFrame(XlnxEncoderHandle *handle, char* iyBuf, char* iuvBuf, 
+                        char* outBuf, int* outlen)
+{
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+    uint32_t frame_size_y = (enc_ctx->enc_props.width *enc_ctx->enc_props.height);
+	uint32_t frame_size_uv = frame_size_y /2 ;
+	
+	XmaFrame *xma_frame = enc_ctx->la_in_frame;
+	int32_t width = enc_ctx->enc_props.width;
+	int32_t height = enc_ctx->enc_props.height;
+	int64_t start_ns = xlnx_latency_now_ns();
+
+	memcpy((char*)xma_frame->data[0].buffer,iyBuf, frame_size_y);//y
+	if(enc_ctx->enc_props.pix_fmt == YUV_420P_ID) {
+		/* iuvBuf holds the U plane followed by the V plane */
+		if(xlnx_yuv_i420_to_nv12_uv((uint8_t *)iuvBuf, 
+		       (uint8_t *)iuvBuf + frame_size_uv / 2, width / 2, 
+		       (uint8_t *)xma_frame->data[1].buffer, 
+		       xma_frame->frame_props.linesize[1], width, height) != 0) {
+			return ENC_APP_DONE;
+		}
+	}
+	else {
+		memcpy((char*)xma_frame->data[1].buffer, iuvBuf,frame_size_uv);//uv
+	}
+	xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_INPUT, start_ns);
+
+	return xlnx_enc_out_status(enc_ctx, 
+	                           xlnx_enc_encode_frame(enc_ctx, 0, outBuf, outlen));
+}
+
+/* Checks that every plane of a strided frame fits its buffer, does not 
+   overlap another plane and has lines the lookahead can take */
+static int32_t xlnx_enc_check_frame(XlnxEncoderCtx *enc_ctx, 
+                                    const XlnxEncoderFrame *frame)
+{
+    int32_t width = enc_ctx->enc_props.width;
+    int32_t height = enc_ctx->enc_props.height;
+    int32_t is_i420 = (enc_ctx->enc_props.pix_fmt == YUV_420P_ID);
+    int32_t num_planes = is_i420 ? 3 : 2;
+    int64_t start[3];
+    int64_t end[3];
+    int64_t line;
+    int32_t rows;
+
+    if(!frame->buffer) {
+        return ENC_APP_FAILURE;
+    }
+    /* The chroma converter reads U and V with one stride */
+    if(is_i420 && frame->stride[2] != frame->stride[1]) {
+        return ENC_APP_FAILURE;
+    }
+    for(int32_t i = 0; i < num_planes; i++) {
+        line = (i == 0 || !is_i420) ? width : (width + 1) / 2;
+        rows = (i == 0) ? height : (height + 1) / 2;
+        if(frame->offset[i] < 0 || frame->stride[i] < line) {
+            return ENC_APP_FAILURE;
+        }
+        if(!enc_ctx->la_bypass && 
+           frame->stride[i] > enc_ctx->la_ctx.la_props.stride) {
+            return ENC_APP_FAILURE;
+        }
+        start[i] = frame->offset[i];
+        end[i] = start[i] + (int64_t)frame->stride[i] * (rows - 1) + line;
+        if((uint64_t)end[i] > frame->size) {
+            return ENC_APP_FAILURE;
+        }
+        for(int32_t j = 0; j < i; j++) {
+            if(start[i] < end[j] && start[j] < end[i]) {
+                return ENC_APP_FAILURE;
+            }
+        }
+    }
+    return ENC_APP_SUCCESS;
+}
+
+int Encoder_EncodeFrameStrided(XlnxEncoderHandle *handle, 
+                               const XlnxEncoderFrame *frame, char *outBuf, 
+                               int *outlen)
+{
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+    XmaFrame *ext_frame = &enc_ctx->ext_frame;
+    int32_t width = enc_ctx->enc_props.width;
+    int32_t height = enc_ctx->enc_props.height;
+    int32_t is_i420 = (enc_ctx->enc_props.pix_fmt == YUV_420P_ID);
+    int64_t start_ns = xlnx_latency_now_ns();
+    int32_t ret;
+
+    *outlen = 0;
+    if(xlnx_enc_check_frame(enc_ctx, frame) != ENC_APP_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Invalid input frame layout, offsets %d/%d/%d strides "
+                "%d/%d/%d in %zu bytes for %dx%d\n", frame->offset[0], 
+                frame->offset[1], frame->offset[2], frame->stride[0], 
+                frame->stride[1], frame->stride[2], frame->size, width, 
+                height);
+        return ENC_APP_DONE;
+    }
+
+    /* Planes are handed to XMA in place with their own line stride; the
+       plugin uploads them on send, so no repacking copy is needed */
+    *ext_frame = enc_ctx->in_frame;
+    ext_frame->data[0].buffer = frame->buffer + frame->offset[0];
+    ext_frame->data[0].is_clone = true;
+    ext_frame->frame_props.linesize[0] = frame->stride[0];
+
+    if(is_i420) {
+        /* Chroma is interleaved into the pooled NV12 plane */
+        if(xlnx_yuv_i420_to_nv12_uv((uint8_t *)frame->buffer + frame->offset[1],
+               (uint8_t *)frame->buffer + frame->offset[2], frame->stride[1], 
+               (uint8_t *)enc_ctx->in_frame.data[1].buffer, 
+               enc_ctx->in_frame.frame_props.linesize[1], width, 
+               height) != 0) {
+            return ENC_APP_DONE;
+        }
+    }
+    else {
+        ext_frame->data[1].buffer = frame->buffer + frame->offset[1];
+        ext_frame->data[1].is_clone = true;
+        ext_frame->frame_props.linesize[1] = frame->stride[1];
+    }
+    xlnx_latency_record_since(&enc_ctx->latency, XLNX_LAT_INPUT, start_ns);
+
+    enc_ctx->la_in_frame = ext_frame;
+    ret = xlnx_enc_encode_frame(enc_ctx, frame->force_idr, outBuf, outlen);
+    enc_ctx->la_in_frame = &enc_ctx->in_frame;
+
+    return xlnx_enc_out_status(enc_ctx, ret);
+}
+
+static int32_t xlnx_enc_flush_frame(XlnxEncoderCtx *enc_ctx, char *outBuf, 
+                                    int *outlen)
+{
+    int32_t ret;
+    int32_t got_pkt;
+    XmaFrame eos_frame;
+
+    *outlen = 0;
+    if(enc_ctx->enc_state != ENC_LA_FLUSH && enc_ctx->enc_state != ENC_FLUSH &&
+       enc_ctx->enc_state != ENC_EOF && enc_ctx->enc_state != ENC_DONE) {
+        enc_ctx->enc_state = enc_ctx->la_bypass ? ENC_FLUSH : ENC_LA_FLUSH;
+    }
+
+    while(enc_ctx->enc_state != ENC_DONE) {
+        switch(enc_ctx->enc_state) {
+            case ENC_LA_FLUSH:
+                /* Drain the frames still held in the lookahead window */
+                enc_ctx->la_in_frame->is_last_frame = 1;
+                enc_ctx->la_in_frame->pts = -1;
+                ret = xlnx_enc_process_frame(enc_ctx);
+                if(ret == XMA_TRY_AGAIN) {
+                    ret = xlnx_enc_resend_frame(enc_ctx, outBuf, outlen, 
+                                                &got_pkt);
+                    if(got_pkt && ret > XMA_ERROR) {
+                        return ENC_APP_SUCCESS;
+                    }
+                }
+                if(ret == XMA_EOS) {
+                    enc_ctx->enc_state = ENC_FLUSH;
+                }
+                else if(ret == XMA_SUCCESS) {
+                    ret = xlnx_enc_recv_data(enc_ctx, outBuf, outlen);
+                    if(ret == XMA_SUCCESS) {
+                        return ENC_APP_SUCCESS;
+                    }
+                }
+                if(ret <= XMA_ERROR) {
+                    return ENC_APP_DONE;
+                }
+                break;
+
+            case ENC_FLUSH:
+                /* Signal end of stream to the encoder */
+                memset(&eos_frame, 0, sizeof(eos_frame));
+                eos_frame.frame_props = enc_ctx->in_frame.frame_props;
+                eos_frame.is_last_frame = 1;
+                eos_frame.pts = -1;
+                ret = xma_enc_session_send_frame(enc_ctx->enc_session, 
+                                                 &eos_frame);
+                if(ret <= XMA_ERROR) {
+                    return ENC_APP_DONE;
+                }
+                enc_ctx->enc_state = ENC_EOF;
+                break;
+
+            case ENC_EOF:
+                ret = xlnx_enc_recv_data(enc_ctx, outBuf, outlen);
+                if(ret == XMA_SUCCESS) {
+                    return ENC_APP_SUCCESS;
+                }
+                if(ret <= XMA_ERROR) {
+                    return ENC_APP_DONE;
+                }
+                /* The device is still encoding the tail, wait as the send
+                   path does instead of polling */
+                if(ret == XMA_TRY_AGAIN) {
+                    usleep(XLNX_ENC_SEND_RETRY_US);
+                }
+                break;
+
+            default:
+                enc_ctx->enc_state = ENC_DONE;
+                break;
+        }
+    }
+
+    return ENC_APP_DONE;
+}
+
+int Encoder_FlushFrame(XlnxEncoderHandle *handle, char* outBuf, int* outlen)
+{
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+
+    return xlnx_enc_out_status(enc_ctx, 
+                               xlnx_enc_flush_frame(enc_ctx, outBuf, outlen));
+}
+
+int Encoder_Reconfigure(XlnxEncoderHandle *handle, 
+                        const XlnxEncoderDynParams *params)
+{
+    XlnxEncoderCtx *enc_ctx = &handle->enc_ctx;
+    XlnxEncoderProperties *enc_props = &enc_ctx->enc_props;
+    XlnxEncDynParams *dyn = &enc_ctx->dyn_params;
+    int64_t bit_rate = enc_props->bit_rate;
+    int64_t max_bitrate = enc_props->max_bitrate;
+
+    if(params->bit_rate > 0) {
+        bit_rate = params->bit_rate;
+        /* Keep CBR max bitrate tied to the target, as at session creation */
+        if(enc_props->control_rate != ENC_RC_VBR_MODE) {
+            max_bitrate = bit_rate;
+        }
+    }
+
+    /* EncDynParams has no change flag for the frame rate or the VBR 
+       ceiling, the plugin keeps the values the session was created with */
+    if(params->fps > 0 && params->fps != enc_props->fps) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Frame rate cannot be changed on a live encoder, reopen it "
+                "at %d fps\n", params->fps);
+        return ENC_APP_FAILURE;
+    }
+    if(params->max_bitrate > 0 && params->max_bitrate != max_bitrate) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Max bitrate cannot be changed on a live encoder, reopen it "
+                "with %" PRId64 " kbps\n", params->max_bitrate);
+        return ENC_APP_FAILURE;
+    }
+
+    if(bit_rate != enc_props->bit_rate && 
+       enc_props->control_rate == ENC_RC_CONST_QP_MODE) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Bitrate cannot be changed in const-qp mode\n");
+        return ENC_APP_FAILURE;
+    }
+    if(bit_rate > ENC_SUPPORTED_MAX_BITRATE || max_bitrate < bit_rate ||
+       max_bitrate > ENC_SUPPORTED_MAX_BITRATE) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE,
+                "Invalid bitrate %" PRId64 " / max bitrate %" PRId64
+                " kbps\n", 
+                bit_rate, max_bitrate);
+        return ENC_APP_FAILURE;
+    }
+
+    if(bit_rate != enc_props->bit_rate) {
+        dyn->is_bitrate_changed = true;
+        dyn->bit_rate = (uint32_t)bit_rate;
+        dyn->width = enc_props->width;
+        dyn->height = enc_props->height;
+        dyn->frame_rate = enc_props->fps;
+        dyn->rc_mode = enc_props->control_rate;
+        enc_ctx->dyn_params_pending = 1;
+    }
+
+    enc_props->bit_rate = bit_rate;
+    enc_props->max_bitrate = max_bitrate;
+    if(params->force_idr) {
+        enc_ctx->force_idr = 1;
+    }
+
+    return ENC_APP_SUCCESS;
+}
+
+XlnxEncoderPacket *Encoder_ReceivePacket(XlnxEncoderHandle *handle)
+{
+    XlnxPacketBuf *pkt;
+
+    if(!handle || !handle->enc_ctx.ready_pkt) {
+        return NULL;
+    }
+    pkt = handle->enc_ctx.ready_pkt;
+    handle->enc_ctx.ready_pkt = NULL;
+    return &pkt->pkt;
+}
+
+int Encoder_SetNalCallback(XlnxEncoderHandle *handle, 
+                           XlnxEncoderNalCallback callback, void *opaque)
+{
+    if(!handle) {
+        return ENC_APP_FAILURE;
+    }
+    handle->enc_ctx.nal_cb = callback;
+    handle->enc_ctx.nal_opaque = opaque;
+
+    return ENC_APP_SUCCESS;
+}
+
+int Encoder_GetFrameStats(XlnxEncoderHandle *handle, 
+                          XlnxEncoderFrameStats *stats)
+{
+    if(!handle || !stats || !handle->enc_ctx.out_frame_cnt) {
+        return ENC_APP_FAILURE;
+    }
+    *stats = handle->enc_ctx.last_stats;
+
+    return ENC_APP_SUCCESS;
+}
+
+int Encoder_EnableStatsRing(XlnxEncoderHandle *handle, int capacity)
+{
+    if(!handle || capacity <= 0 || handle->enc_ctx.stats_ring) {
+        return ENC_APP_FAILURE;
+    }
+    handle->enc_ctx.stats_ring = xlnx_enc_stats_ring_create(capacity);
+    if(!handle->enc_ctx.stats_ring) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                "Out of memory while allocating stats ring\n");
+        return ENC_APP_FAILURE;
+    }
+
+    return ENC_APP_SUCCESS;
+}
+
+int Encoder_PollStats(XlnxEncoderHandle *handle, XlnxEncoderFrameStats *stats)
+{
+    if(!handle || !handle->enc_ctx.stats_ring) {
+        return 0;
+    }
+    return xlnx_enc_stats_ring_pop(handle->enc_ctx.stats_ring, stats);
+}
+
+int Encoder_GetLatencyStats(XlnxEncoderHandle *handle, 
+                            XlnxLatencyStats *stats, int reset)
+{
+    if(!handle || !stats) {
+        return ENC_APP_FAILURE;
+    }
+    xlnx_latency_snapshot(&handle->enc_ctx.latency, stats, reset);
+    return ENC_APP_SUCCESS;
+}
+
+int Encoder_frame(char* iyBuf,char* iuvBuf,char* outBuf,int* outlen)
+{
+    if(!xlnx_enc_default_handle) {
+        return ENC_APP_FAILURE;
+    }
+    return Encoder_EncodeFrame(xlnx_enc_default_handle, iyBuf, iuvBuf, outBuf, 
+                               outlen);
+}
+
+int Encoder_flush(char* outBuf,int* outlen)
+{
+    if(!xlnx_enc_default_handle) {
+        return ENC_APP_FAILURE;
+    }
+    return Encoder_FlushFrame(xlnx_enc_default_handle, outBuf, outlen);
+}
+
+int Encoder_reconfigure(const XlnxEncoderDynParams *params)
+{
+    if(!xlnx_enc_default_handle) {
+        return ENC_APP_FAILURE;
+    }
+    return Encoder_Reconfigure(xlnx_enc_default_handle, params);
+}
+
+void Encoder_Release()
+{
+	Encoder_Close(xlnx_enc_default_handle);
+	xlnx_enc_default_handle = NULL;
+}
+
+/* One allocation attempt of the legacy decoder, cleans up on failure */
+static int32_t xlnx_dec_init_once()
+{
+	memset(&ctx, 0, sizeof(ctx));
+	xlnx_dec_set_default_params(&ctx.dec_params);
+	xlnx_dec_create_context(&ctx);
+
+    if(xlnx_dec_fpga_init(&ctx) != DEC_APP_SUCCESS) {
+        DECODER_APP_LOG_ERROR("Decoder device initialization failed\n");
+        xlnx_dec_cleanup_ctx(&ctx);
+        free(ctx.channel_ctx.xframe);
+        ctx.channel_ctx.xframe = NULL;
+        return DEC_APP_ERROR;
+    }
+
+    ctx.xma_dec_session = xma_dec_session_create(&ctx.dec_xma_props);
+    if(!ctx.xma_dec_session) {
+        DECODER_APP_LOG_ERROR("Failed to create decoder session\n");
+        xlnx_dec_cleanup_ctx(&ctx);
+        free(ctx.channel_ctx.xframe);
+        ctx.channel_ctx.xframe = NULL;
+        return DEC_APP_ERROR;
+    }
+    return DEC_APP_SUCCESS;
+}
+
+int Decoder_Init()
+{
+    XlnxAllocAttempt attempt;
+    int32_t ret;
+
+    /* The decoder always lets XRM pick the device and has no lesser job to
+       fall back to, so only retries apply */
+    xlnx_alloc_begin(&attempt);
+    while((ret = xlnx_dec_init_once()) != DEC_APP_SUCCESS && 
+          xlnx_alloc_next(&attempt, 0) == XLNX_ALLOC_RETRY) {
+    }
+    xlnx_alloc_end(&attempt, ret == DEC_APP_SUCCESS ? 0 : -1, 
+                   ret == DEC_APP_SUCCESS ? ctx.dec_xma_props.dev_index : -1);
+    return ret;
+}
+
+void Decoder_release()
+{
+    xlnx_dec_cleanup_ctx(&ctx);
+    free(ctx.channel_ctx.xframe);
+    ctx.channel_ctx.xframe = NULL;
+    for(int32_t i = 0; i < ctx.held_cap; i++) {
+        free(ctx.held_frames[i]);
+    }
+    free(ctx.held_frames);
+    ctx.held_frames = NULL;
+    ctx.num_held = 0;
+    ctx.held_cap = 0;
+    printf("Decoder_release\n");
+}
+
+int xvbm_conv_get_plane_size(int32_t width,int32_t height,XmaFormatType format,int32_t plane_id)
+{
+    int p_size;
+
+    switch (format) {
+        case XMA_YUV420_FMT_TYPE:
+            switch(plane_id) {
+                case 0:  p_size = width * height;        break;
+                case 1:  p_size = ((width * height)>>2); break;
+                case 2:  p_size = ((width * height)>>2); break;
+                default: p_size = 0;                     break;
+            }
+            break;
+
+        case XMA_YUV422_FMT_TYPE:
+            switch(plane_id) {
+                case 0:  p_size = width * height;        break;
+                case 1:  p_size = ((width * height)>>1); break;
+                case 2:  p_size = ((width * height)>>1); break;
+                default: p_size = 0;                     break;
+            }
+            break;
+
+        case XMA_YUV444_FMT_TYPE:
+        case XMA_RGBP_FMT_TYPE:
+            p_size = (width * height);
+            break;
+
+        default:
+              printf("xvbm_conv:: Unsupported format...\n");
+              p_size = 0;
+              break;
+    }
+    return(p_size);
+}
+
+/* The device frame is NV12 with planes padded to the VCU alignment */
+int dec_output_data(unsigned char* hostbuf,unsigned char* outbuf)
+{
+	XlnxDecoderCtx* fctx =&ctx;
+
+    xlnx_yuv_nv12_unpad(hostbuf, ALIGN(fctx->dec_params.width, STRIDE_ALIGN),
+                        ALIGN(fctx->dec_params.height, HEIGHT_ALIGN),
+                        fctx->dec_params.width, fctx->dec_params.height, 
+                        outbuf);
+    return DEC_APP_SUCCESS;
+}
+
+/* Takes one decoded frame into outbuffer when the decoder has one */
+static int32_t xlnx_dec_receive(XlnxDecoderCtx *dec_ctx, 
+                                unsigned char *outbuffer)
+{
+    size_t buffer_size = 0;
+    unsigned char *hbuf;
+    int32_t ret;
+
+    ret = xma_dec_session_recv_frame(dec_ctx->xma_dec_session, 
+                                     dec_ctx->channel_ctx.xframe);
+    if(ret != XMA_SUCCESS) {
+        return ret;
+    }
+    hbuf = xlnx_dec_get_buffer_from_fpga(dec_ctx, &buffer_size);
+    if(!hbuf) {
+        return DEC_APP_ERROR;
+    }
+    dec_ctx->num_frames_decoded++;
+    dec_output_data(hbuf, outbuffer);
+    return XMA_SUCCESS;
+}
+
+/* Returns the buffer the next held frame goes to, NULL when out of memory */
+static unsigned char *xlnx_dec_held_slot(XlnxDecoderCtx *dec_ctx)
+{
+    size_t frame_size = (size_t)dec_ctx->dec_params.width * 
+                        dec_ctx->dec_params.height * 3 / 2;
+    unsigned char **grown;
+
+    if(dec_ctx->num_held == dec_ctx->held_cap) {
+        grown = realloc(dec_ctx->held_frames, 
+                        (dec_ctx->held_cap + 1) * sizeof(*grown));
+        if(!grown) {
+            return NULL;
+        }
+        dec_ctx->held_frames = grown;
+        grown[dec_ctx->held_cap] = malloc(frame_size);
+        if(!grown[dec_ctx->held_cap]) {
+            return NULL;
+        }
+        dec_ctx->held_cap++;
+    }
+    return dec_ctx->held_frames[dec_ctx->num_held];
+}
+
+/* Moves the oldest held frame to outbuffer and recycles its buffer */
+static void xlnx_dec_pop_held(XlnxDecoderCtx *dec_ctx, 
+                              unsigned char *outbuffer)
+{
+    unsigned char *frame = dec_ctx->held_frames[0];
+
+    memcpy(outbuffer, frame, (size_t)dec_ctx->dec_params.width * 
+                             dec_ctx->dec_params.height * 3 / 2);
+    dec_ctx->num_held--;
+    memmove(dec_ctx->held_frames, dec_ctx->held_frames + 1, 
+            dec_ctx->num_held * sizeof(*dec_ctx->held_frames));
+    dec_ctx->held_frames[dec_ctx->num_held] = frame;
+}
+
+/* Sends one access unit and returns XMA_SUCCESS with a frame in outbuffer,
+   or the receive status when no frame was ready. Frames come out in decode
+   order, one per call: a held frame goes out before anything new. */
+int Decoder_frame(unsigned char* inbuffer,unsigned char* outbuffer,int insize)
+{
+    int ret = XMA_TRY_AGAIN;
+	int data_used = 0;
+	int rc        = XMA_ERROR;
+	XlnxDecoderCtx* dec_ctx = &ctx;
+    int pts       = dec_ctx->pts;
+    int offset    = 0;
+    int got_frame = 0;
+    int retries   = 0;
+    unsigned char *held;
+    XmaDataBuffer xbuffer;
+
+    if(!dec_ctx->xma_dec_session) {
+        return DEC_APP_ERROR;
+    }
+    if(dec_ctx->num_held) {
+        xlnx_dec_pop_held(dec_ctx, outbuffer);
+        got_frame = 1;
+    }
+    memset(&xbuffer, 0, sizeof(xbuffer));
+	xbuffer.is_eof 	 = 0;
+	xbuffer.pts		 = pts;
+
+    while(offset < insize){
+        xbuffer.data.buffer = inbuffer + offset;
+        xbuffer.alloc_size  = insize - offset;
+        data_used = 0;
+        rc = xma_dec_session_send_data(dec_ctx->xma_dec_session, &xbuffer, &data_used);
+        if(rc <= XMA_ERROR) 
+        {
+            DECODER_APP_LOG_ERROR("Error sending data to decoder. Data %zu\n", dec_ctx->num_frames_sent);
+            return DEC_APP_ERROR;
+        }
+        offset += data_used;
+        if(rc != XMA_TRY_AGAIN) 
+        {
+            retries = 0;
+            continue;
+        }
+
+        /* The output pool is full: take a frame to free a buffer, then
+           resend the rest of the access unit. Once outbuffer holds a frame
+           further ones are held for the next calls. */
+        if(++retries > XLNX_DEC_SEND_RETRIES) 
+        {
+            DECODER_APP_LOG_ERROR("Decoder stopped taking input\n");
+            return DEC_APP_ERROR;
+        }
+        held = got_frame ? xlnx_dec_held_slot(dec_ctx) : outbuffer;
+        if(!held) 
+        {
+            DECODER_APP_LOG_ERROR("Out of memory holding a decoded frame\n");
+            return DEC_APP_ERROR;
+        }
+        ret = xlnx_dec_receive(dec_ctx, held);
+        if(ret == XMA_SUCCESS) 
+        {
+            dec_ctx->num_held += got_frame;
+            got_frame = 1;
+        }
+        else if(ret <= XMA_ERROR) 
+        {
+            return DEC_APP_ERROR;
+        }
+        else 
+        {
+            usleep(XLNX_DEC_SEND_RETRY_US);
+        }
+    }
+    dec_ctx->pts++;
+    dec_ctx->num_frames_sent++;
+
+    if(got_frame) 
+    {
+        return XMA_SUCCESS;
+    }
+    ret = xlnx_dec_receive(dec_ctx, outbuffer);
+    if(ret != XMA_SUCCESS && ret > XMA_ERROR) 
+	{
+        usleep(5);
+    }
+
+    return ret;
+}
+
+int dec_write_host_buffer_to_file(unsigned char* hostbuf,FILE* file)
+{
+	XlnxDecoderCtx* fctx =&ctx;
+    int32_t ret;
+
+    ret = xlnx_yuv_nv12_write_unpadded(hostbuf, 
+                  ALIGN(fctx->dec_params.width, STRIDE_ALIGN),
+                  ALIGN(fctx->dec_params.height, HEIGHT_ALIGN),
+                  fctx->dec_params.width, fctx->dec_params.height, file);
+    fflush(file);
+    return ret == 0 ? DEC_APP_SUCCESS : DEC_APP_ERROR;
+}
+
+char* filebuf_;
+const char* pbuf_;
+int filesize_;
+unsigned char is_stop_;
+const char* AVCFindStartCodeInternal(const char *p, const char *end)
+{
+	const char *a = p + 4 - ((ptrdiff_t)p & 3);
+	for (end -= 3; p < a && p < end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+	for (end -= 3; p < end; p += 4) {
+		unsigned int x = *(const unsigned int*)p;
+		//      if ((x - 0x01000100) & (~x) & 0x80008000) // little endian
+		//      if ((x - 0x00010001) & (~x) & 0x00800080) // big endian
+		if ((x - 0x01010101) & (~x) & 0x80808080) { // generic
+			if (p[1] == 0) {
+				if (p[0] == 0 && p[2] == 1)
+					return p;
+				if (p[2] == 0 && p[3] == 1)
+					return p + 1;
+			}
+			if (p[3] == 0) {
+				if (p[2] == 0 && p[4] == 1)
+					return p + 2;
+				if (p[4] == 0 && p[5] == 1)
+					return p + 3;
+			}
+		}
+	}
+	for (end += 3; p < end; p++) {
+		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
+			return p;
+	}
+	return end + 3;
+}
+
+const char* AVCFindStartCode(const char *p, const char *end)
+{
+	const char *out = AVCFindStartCodeInternal(p, end);
+	if (p<out && out<end && !out[-1]) out--;
+	return out;
+}
+
+int H264FrameReader_Init(const char* filename)
+{
+	FILE* fp = fopen(filename, "rb");
+	filebuf_ = 0;
+	filesize_ = 0;
+	int retval =0;
+	if (fp)
+	{
+		fseek(fp, 0, SEEK_END);
+		filesize_ = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		filebuf_ = (char*)malloc(filesize_);
+		retval = fread(filebuf_, 1, filesize_, fp);
+		fclose(fp);
+	}
+	pbuf_ = filebuf_;
+	
+	return retval;
+}
+
+void H264FrameReader_Free()
+{
+	free(filebuf_);
+}
+
+int H264FrameReader_ReadFrame(unsigned char* outBuf, int* outBufSize)
+{
+	unsigned char* pbufout = 0;
+	const unsigned char *p = 0;
+	const unsigned char *end = 0;
+	const unsigned char *nal_start, *nal_end;
+	unsigned char startcodebuf[] = { 0x00, 0x00, 0x00, 0x01 };
+	if (pbuf_ >= filebuf_ + filesize_)
+	{
+		return 0;
+	}
+
+	pbufout = outBuf;
+	p = pbuf_;
+	end = filebuf_ + filesize_;
+
+	nal_start = AVCFindStartCode(p, end);
+	while (nal_start < end)
+	{
+		unsigned int nal_size = 0;
+		unsigned char nal_type = 0;
+
+		while (!*(nal_start++));
+
+		nal_end = AVCFindStartCode(nal_start, end);
+
+		nal_size = nal_end - nal_start;
+		nal_type = nal_start[0] & 0x1f;
+
+		memcpy(pbufout, startcodebuf, 4);
+		pbufout += 4;
+		memcpy(pbufout, nal_start, nal_size);
+		pbufout += nal_size;
+
+		nal_start = nal_end;
+		break;
+	}
+
+	*outBufSize = pbufout - outBuf;
+	pbuf_ = nal_start;
+
+	return 1;
+}
+
+#define XLNX_SCAL_APP_MODULE       "xlnx_scaler"
+#define XLNX_SCAL_NUM_PARAMS       2
+#define XLNX_ABR_DEFAULT_FPS       60
+
+static const struct {
+    int32_t width;
+    int32_t height;
+    int64_t bit_rate;
+} xlnx_abr_default_ladder[] = {
+    {1920, 1080, 6000},
+    {1280,  720, 3000},
+    { 848,  480, 1500},
+    { 640,  360,  800},
+};
+
+/* Multiscaler: one input, up to MAX_SCALER_OUTPUTS renditions per frame */
+typedef struct {
+    XmaScalerSession      *session;
+    XmaScalerProperties   props;
+    XmaParameter          params[XLNX_SCAL_NUM_PARAMS];
+    uint32_t              enable_pipeline;
+    uint32_t              latency_logging;
+    xrmCuResource         cu_res;
+    int32_t               load;
+    int32_t               res_in_use;
+    XmaFrame              *out_frames[MAX_SCALER_OUTPUTS];
+} XlnxScalerCtx;
+
+/* Decode once, scale on device and encode every rendition. All CUs of the
+   ladder come from a single XRM CU pool and frames never leave xvbm device
+   buffers between the decoder, scaler, lookahead and encoders. */
+struct XlnxAbrLadder {
+    xrmContext*          xrm_ctx;
+    int32_t              pool_id;
+    int32_t              num_renditions;
+    int32_t              dec_eos;
+    XlnxDecoderCtx       dec_ctx;
+    XlnxScalerCtx        scal_ctx;
+    XlnxEncoderHandle    *renditions[XLNX_ABR_MAX_RENDITIONS];
+    /* Index of each rendition in the configuration, which packets are 
+       reported with after renditions were dropped */
+    int32_t              rendition_ids[XLNX_ABR_MAX_RENDITIONS];
+    XlnxTelemetryChannel telemetry;
+};
+
+static int32_t xlnx_scal_create_xma_props(XlnxAbrLadder *ladder, 
+                                          const XlnxAbrLadderConfig *cfg)
+{
+    XlnxScalerCtx *scal_ctx = &ladder->scal_ctx;
+    XmaScalerProperties *props = &scal_ctx->props;
+    XmaScalerInOutProperties *output;
+    XlnxEncoderProperties *enc_props;
+
+    props->hwscaler_type = XMA_POLYPHASE_SCALER_TYPE;
+    strcpy(props->hwvendor_string, "Xilinx");
+    props->num_outputs = ladder->num_renditions;
+
+    props->input.format = XMA_VCU_NV12_FMT_TYPE;
+    props->input.bits_per_pixel = 8;
+    props->input.width = cfg->width;
+    props->input.height = cfg->height;
+    props->input.stride = ALIGN(cfg->width, STRIDE_ALIGN);
+    props->input.framerate.numerator = cfg->fps;
+    props->input.framerate.denominator = 1;
+
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        enc_props = &ladder->renditions[i]->enc_ctx.enc_props;
+        output = &props->output[i];
+        output->format = XMA_VCU_NV12_FMT_TYPE;
+        output->bits_per_pixel = 8;
+        output->width = enc_props->width;
+        output->height = enc_props->height;
+        output->stride = ALIGN(output->width, STRIDE_ALIGN);
+        output->framerate = props->input.framerate;
+
+        /* Output buffers are taken from the scaler's own xvbm pool */
+        scal_ctx->out_frames[i] = calloc(1, sizeof(XmaFrame));
+        if(!scal_ctx->out_frames[i]) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_SCAL_APP_MODULE, 
+                       "Out of memory while allocating scaler frames\n");
+            return ENC_APP_FAILURE;
+        }
+        scal_ctx->out_frames[i]->frame_props.format = output->format;
+        scal_ctx->out_frames[i]->frame_props.width = output->width;
+        scal_ctx->out_frames[i]->frame_props.height = output->height;
+        scal_ctx->out_frames[i]->frame_props.bits_per_pixel = 8;
+        scal_ctx->out_frames[i]->frame_rate = output->framerate;
+        scal_ctx->out_frames[i]->data[0].buffer_type = XMA_DEVICE_BUFFER_TYPE;
+        scal_ctx->out_frames[i]->data[0].refcount = 1;
+        scal_ctx->out_frames[i]->data[0].is_clone = true;
+    }
+
+    /* Every rendition is produced for every input frame, so the scaler is
+       kept synchronous and never holds frames back at flush time */
+    scal_ctx->enable_pipeline = 0;
+    scal_ctx->latency_logging = 0;
+
+    scal_ctx->params[0].name   = "enable_pipeline";
+    scal_ctx->params[0].type   = XMA_UINT32;
+    scal_ctx->params[0].length = sizeof(scal_ctx->enable_pipeline);
+    scal_ctx->params[0].value  = &scal_ctx->enable_pipeline;
+
+    scal_ctx->params[1].name   = "latency_logging";
+    scal_ctx->params[1].type   = XMA_UINT32;
+    scal_ctx->params[1].length = sizeof(scal_ctx->latency_logging);
+    scal_ctx->params[1].value  = &scal_ctx->latency_logging;
+
+    props->params = scal_ctx->params;
+    props->param_cnt = XLNX_SCAL_NUM_PARAMS;
+
+    return ENC_APP_SUCCESS;
+}
+
+static int32_t xlnx_scal_load_calc(xrmContext *xrm_ctx, 
+                                   XmaScalerProperties *props, int32_t *load)
+{
+    XlnxXrmLoad xrm_load;
+
+    if(xlnx_xrm_load_query(xrm_ctx, "xrmU30ScalPlugin", "SCALER", props, 
+                           &xrm_load) != XRM_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SCAL_APP_MODULE, 
+                   "XRM scaler plugin failed \n");
+        return ENC_APP_FAILURE;
+    }
+    *load = xrm_load.values[0];
+
+    return ENC_APP_SUCCESS;
+}
+
+static void xlnx_scal_fill_pool_props(xrmCuPoolProperty *cu_pool_prop, 
+                                      int32_t scal_load)
+{
+    int32_t cu_num = cu_pool_prop->cuListProp.cuNum;
+
+    strcpy(cu_pool_prop->cuListProp.cuProps[cu_num].kernelName, "scaler");
+    strcpy(cu_pool_prop->cuListProp.cuProps[cu_num].kernelAlias, 
+           "SCALER_MPSOC");
+    cu_pool_prop->cuListProp.cuProps[cu_num].devExcl = false;
+    cu_pool_prop->cuListProp.cuProps[cu_num].requestLoad = 
+                                    XRM_PRECISION_1000000_BIT_MASK(scal_load);
+    cu_pool_prop->cuListProp.cuNum = cu_num + 1;
+}
+
+static int32_t xlnx_scal_allocate_xrm_cu(XlnxScalerCtx *scal_ctx, 
+                                         xrmContext *xrm_ctx, int32_t pool_id)
+{
+    xrmCuProperty scal_cu_prop;
+
+    memset(&scal_cu_prop, 0, sizeof(xrmCuProperty));
+    memset(&scal_ctx->cu_res, 0, sizeof(xrmCuResource));
+
+    strcpy(scal_cu_prop.kernelName, "scaler");
+    strcpy(scal_cu_prop.kernelAlias, "SCALER_MPSOC");
+    scal_cu_prop.devExcl = false;
+    scal_cu_prop.requestLoad = XRM_PRECISION_1000000_BIT_MASK(scal_ctx->load);
+    scal_cu_prop.poolId = pool_id;
+
+    if(xlnx_xrm_cu_alloc(xrm_ctx, &scal_cu_prop, &scal_ctx->cu_res) != 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SCAL_APP_MODULE, 
+                   "xrm_allocation: fail to allocate scaler cu from reserve "
+                   "id %d\n", pool_id);
+        return ENC_APP_FAILURE;
+    }
+    scal_ctx->res_in_use = 1;
+
+    /* Set XMA plugin SO and device index */
+    scal_ctx->props.plugin_lib = scal_ctx->cu_res.kernelPluginFileName;
+    scal_ctx->props.dev_index = scal_ctx->cu_res.deviceId;
+    /* XMA to select the ddr bank based on xclbin meta data */
+    scal_ctx->props.ddr_bank_index = -1;
+    scal_ctx->props.cu_index = scal_ctx->cu_res.cuId;
+    scal_ctx->props.channel_id = scal_ctx->cu_res.channelId;
+
+    return ENC_APP_SUCCESS;
+}
+
+static void xlnx_scal_deinit(XlnxScalerCtx *scal_ctx, xrmContext *xrm_ctx)
+{
+    if(scal_ctx->session) {
+        xma_scaler_session_destroy(scal_ctx->session);
+        scal_ctx->session = NULL;
+    }
+    if(scal_ctx->res_in_use) {
+        xrmCuRelease(xrm_ctx, &scal_ctx->cu_res);
+        scal_ctx->res_in_use = 0;
+    }
+    for(int32_t i = 0; i < MAX_SCALER_OUTPUTS; i++) {
+        free(scal_ctx->out_frames[i]);
+        scal_ctx->out_frames[i] = NULL;
+    }
+}
+
+void AbrLadder_ConfigInit(XlnxAbrLadderConfig *cfg)
+{
+    int32_t num = XLNX_ENC_LOOKUP_SIZE(xlnx_abr_default_ladder);
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->codec_id = ENCODER_ID_H264;
+    cfg->width = ENC_DEFAULT_WIDTH;
+    cfg->height = ENC_DEFAULT_HEIGHT;
+    cfg->fps = XLNX_ABR_DEFAULT_FPS;
+    cfg->num_renditions = num;
+
+    for(int32_t i = 0; i < num; i++) {
+        Encoder_ConfigInit(&cfg->renditions[i]);
+        cfg->renditions[i].codec_id = ENCODER_ID_H264;
+        cfg->renditions[i].width = xlnx_abr_default_ladder[i].width;
+        cfg->renditions[i].height = xlnx_abr_default_ladder[i].height;
+        cfg->renditions[i].bit_rate = xlnx_abr_default_ladder[i].bit_rate;
+    }
+}
+
+void AbrLadder_Close(XlnxAbrLadder *ladder)
+{
+    if(!ladder) {
+        return;
+    }
+    xlnx_telemetry_unregister(&ladder->telemetry);
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        Encoder_Close(ladder->renditions[i]);
+    }
+    xlnx_scal_deinit(&ladder->scal_ctx, ladder->xrm_ctx);
+    xlnx_dec_cleanup_ctx(&ladder->dec_ctx);
+    free(ladder->dec_ctx.channel_ctx.xframe);
+
+    if(ladder->xrm_ctx) {
+        if(ladder->pool_id) {
+            xrmCuPoolRelinquish(ladder->xrm_ctx, ladder->pool_id);
+        }
+        xrmDestroyContext(ladder->xrm_ctx);
+    }
+    free(ladder);
+}
+
+/* Creates every stage of the ladder and its XMA properties, no CU is 
+   reserved yet */
+static XlnxAbrLadder *xlnx_abr_ladder_alloc(const XlnxAbrLadderConfig *cfg)
+{
+    XlnxAbrLadder *ladder;
+    XlnxDecoderProperties *dec_params;
+    XlnxEncoderConfig enc_cfg;
+
+    if(cfg->num_renditions < 1 || 
+       cfg->num_renditions > XLNX_ABR_MAX_RENDITIONS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "ABR ladder supports 1 to %d renditions, got %d\n", 
+                   XLNX_ABR_MAX_RENDITIONS, cfg->num_renditions);
+        return NULL;
+    }
+    if(cfg->codec_id != ENCODER_ID_H264 && cfg->codec_id != ENCODER_ID_HEVC) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Invalid ABR ladder input codec %d\n", cfg->codec_id);
+        return NULL;
+    }
+
+    ladder = calloc(1, sizeof(*ladder));
+    if(!ladder) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Out of memory while allocating ABR ladder\n");
+        return NULL;
+    }
+
+    ladder->xrm_ctx = (xrmContext *)xrmCreateContext(XRM_API_VERSION_1);
+    if(!ladder->xrm_ctx) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "create local XRM context failed\n");
+        AbrLadder_Close(ladder);
+        return NULL;
+    }
+
+    /* Decoder */
+    dec_params = &ladder->dec_ctx.dec_params;
+    xlnx_dec_set_default_params(dec_params);
+    dec_params->codec_type = (cfg->codec_id == ENCODER_ID_HEVC) ? 
+                             HEVC_CODEC_TYPE : H264_CODEC_TYPE;
+    dec_params->profile_idc = (cfg->codec_id == ENCODER_ID_HEVC) ? 1 : 100;
+    dec_params->width = cfg->width;
+    dec_params->height = cfg->height;
+    dec_params->fps = cfg->fps;
+    xlnx_dec_create_context(&ladder->dec_ctx);
+    ladder->dec_ctx.dec_xrm_ctx.xrm_ctx = ladder->xrm_ctx;
+    ladder->dec_ctx.dec_xrm_ctx.shared_pool = 1;
+
+    /* One encoder per rendition, fed straight from the scaler outputs */
+    for(int32_t i = 0; i < cfg->num_renditions; i++) {
+        enc_cfg = cfg->renditions[i];
+        enc_cfg.fps = replace_if_unset(enc_cfg.fps, cfg->fps);
+        ladder->renditions[i] = xlnx_enc_handle_alloc(&enc_cfg, 1);
+        if(!ladder->renditions[i]) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                       "Invalid configuration for rendition %d\n", i);
+            AbrLadder_Close(ladder);
+            return NULL;
+        }
+        ladder->rendition_ids[i] = i;
+        ladder->num_renditions++;
+        ladder->renditions[i]->enc_ctx.enc_xrm_ctx.xrm_ctx = ladder->xrm_ctx;
+        ladder->renditions[i]->enc_ctx.enc_xrm_ctx.shared_pool = 1;
+    }
+
+    /* Scaler */
+    if(xlnx_scal_create_xma_props(ladder, cfg) != ENC_APP_SUCCESS) {
+        AbrLadder_Close(ladder);
+        return NULL;
+    }
+
+    return ladder;
+}
+
+/* Lists decoder, scaler, encoder and lookahead CUs of the whole ladder in
+   one CU list so XRM places them on the same device */
+static int32_t xlnx_abr_fill_pool_props(XlnxAbrLadder *ladder, 
+                                        xrmCuPoolProperty *cu_pool_prop)
+{
+    XlnxDecoderXrmCtx *dec_xrm_ctx = &ladder->dec_ctx.dec_xrm_ctx;
+    XlnxEncoderHandle *handle;
+    int dec_load;
+
+    memset(cu_pool_prop, 0, sizeof(*cu_pool_prop));
+
+    if(dec_load_calc(dec_xrm_ctx, &ladder->dec_ctx.dec_xma_props, &dec_load) 
+                                                        != DEC_APP_SUCCESS) {
+        return ENC_APP_FAILURE;
+    }
+    dec_xrm_ctx->dec_load = dec_load;
+    dec_fill_pool_props(cu_pool_prop, dec_load);
+
+    if(xlnx_scal_load_calc(ladder->xrm_ctx, &ladder->scal_ctx.props, 
+                           &ladder->scal_ctx.load) != ENC_APP_SUCCESS) {
+        return ENC_APP_FAILURE;
+    }
+    xlnx_scal_fill_pool_props(cu_pool_prop, ladder->scal_ctx.load);
+
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        handle = ladder->renditions[i];
+        if(xlnx_enc_load_calc(&handle->enc_ctx.enc_xrm_ctx, 
+                              &handle->xma_enc_props, 
+                              handle->enc_ctx.enc_props.lookahead_depth,
+                              handle->enc_ctx.enc_props.num_cores,
+                              cu_pool_prop) != ENC_APP_SUCCESS) {
+            return ENC_APP_FAILURE;
+        }
+    }
+
+    return ENC_APP_SUCCESS;
+}
+
+int AbrLadder_QueryCapacity(const XlnxAbrLadderConfig *cfg)
+{
+    xrmCuPoolProperty cu_pool_prop;
+    XlnxAbrLadder *ladder;
+    int32_t num_cu_pool = ENC_APP_FAILURE;
+
+    ladder = xlnx_abr_ladder_alloc(cfg);
+    if(!ladder) {
+        return ENC_APP_FAILURE;
+    }
+    if(xlnx_abr_fill_pool_props(ladder, &cu_pool_prop) == ENC_APP_SUCCESS) {
+        num_cu_pool = xrmCheckCuPoolAvailableNum(ladder->xrm_ctx, 
+                                                 &cu_pool_prop);
+    }
+    AbrLadder_Close(ladder);
+
+    return num_cu_pool;
+}
+
+static int32_t xlnx_abr_reserve(XlnxAbrLadder *ladder)
+{
+    xrmCuPoolProperty cu_pool_prop;
+    xrmCuPoolResource cu_pool_res;
+
+    if(xlnx_abr_fill_pool_props(ladder, &cu_pool_prop) != ENC_APP_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "ABR ladder load calculation failed\n");
+        return ENC_APP_FAILURE;
+    }
+
+    if(xrmCheckCuPoolAvailableNum(ladder->xrm_ctx, &cu_pool_prop) <= 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "No resources available for the ABR ladder\n");
+        return ENC_APP_FAILURE;
+    }
+
+    ladder->pool_id = xlnx_xrm_pool_reserve(ladder->xrm_ctx, &cu_pool_prop);
+    if(ladder->pool_id == 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Failed to reserve ABR ladder cu pool\n");
+        return ENC_APP_FAILURE;
+    }
+
+    memset(&cu_pool_res, 0, sizeof(cu_pool_res));
+    if(xrmReservationQuery(ladder->xrm_ctx, ladder->pool_id, &cu_pool_res) 
+                                                                    != 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Failed to query reserved cu list\n");
+        return ENC_APP_FAILURE;
+    }
+
+    if(xlnx_xma_initialize(cu_pool_res.cuResources[0].deviceId, 
+                           cu_pool_res.cuResources[0].xclbinFileName) != 
+                                                                XMA_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "XMA Initialization failed\n");
+        return ENC_APP_FAILURE;
+    }
+    xma_logmsg(XMA_INFO_LOG, XLNX_ENC_APP_MODULE, 
+               "ABR ladder reserved pool %d on device %d\n", ladder->pool_id,
+               cu_pool_res.cuResources[0].deviceId);
+
+    return ENC_APP_SUCCESS;
+}
+
+/* Reserves the pool and starts every stage, closes the ladder on 
+   failure */
+static int32_t xlnx_abr_ladder_start(XlnxAbrLadder *ladder)
+{
+    XlnxDecoderCtx *dec_ctx = &ladder->dec_ctx;
+    XlnxScalerCtx *scal_ctx = &ladder->scal_ctx;
+
+    if(xlnx_abr_reserve(ladder) != ENC_APP_SUCCESS) {
+        AbrLadder_Close(ladder);
+        return ENC_APP_FAILURE;
+    }
+
+    dec_ctx->dec_xrm_ctx.xrm_reserve_id = ladder->pool_id;
+    if(xlnx_dec_allocate_xrm_dec_cu(&dec_ctx->dec_xrm_ctx, 
+                                    &dec_ctx->dec_xma_props) != 
+                                                          DEC_APP_SUCCESS) {
+        AbrLadder_Close(ladder);
+        return ENC_APP_FAILURE;
+    }
+    dec_ctx->xma_dec_session = xma_dec_session_create(&dec_ctx->dec_xma_props);
+    if(!dec_ctx->xma_dec_session) {
+        DECODER_APP_LOG_ERROR("Failed to create decoder session\n");
+        AbrLadder_Close(ladder);
+        return ENC_APP_FAILURE;
+    }
+
+    if(xlnx_scal_allocate_xrm_cu(scal_ctx, ladder->xrm_ctx, ladder->pool_id) 
+                                                        != ENC_APP_SUCCESS) {
+        AbrLadder_Close(ladder);
+        return ENC_APP_FAILURE;
+    }
+    scal_ctx->session = xma_scaler_session_create(&scal_ctx->props);
+    if(!scal_ctx->session) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SCAL_APP_MODULE, 
+                   "Failed to create scaler session\n");
+        AbrLadder_Close(ladder);
+        return ENC_APP_FAILURE;
+    }
+
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        ladder->renditions[i]->enc_ctx.enc_xrm_ctx.enc_res_idx = 
+                                                            ladder->pool_id;
+        if(xlnx_enc_handle_start(ladder->renditions[i]) != ENC_APP_SUCCESS) {
+            AbrLadder_Close(ladder);
+            return ENC_APP_FAILURE;
         }
     }
-    return DEC_APP_SUCCESS;
+    xlnx_telemetry_register(&ladder->telemetry, XLNX_TELEMETRY_ABR, 
+                            dec_ctx->dec_xma_props.dev_index);
+
+    return ENC_APP_SUCCESS;
 }
 
-int Decoder_frame(unsigned char* inbuffer,unsigned char* outbuffer,int insize)
+/* Fallbacks that would still change the job of a ladder, and the 
+   rendition with the most pixels for XLNX_ALLOC_DROP_RENDITION */
+static int32_t xlnx_abr_fallbacks(const XlnxAbrLadder *ladder, 
+                                  int32_t *largest)
 {
-    int ret;
-	int data_used = 0;
-	int rc        = XMA_ERROR;
-	XlnxDecoderCtx* dec_ctx = &ctx;
-    int pts       = dec_ctx->pts;
-    XmaDataBuffer* xbuffer = (XmaDataBuffer*)malloc(3840*2160*3);
-	xbuffer->data.buffer = inbuffer;
-	xbuffer->alloc_size  = insize;
-	xbuffer->is_eof 	 = 0;
-	xbuffer->pts		 = pts;
-
-    while(1){
-        rc = xma_dec_session_send_data(dec_ctx->xma_dec_session, xbuffer, &data_used);
-        if(rc == XMA_ERROR) 
-        {
-            DECODER_APP_LOG_ERROR("Error sending data to decoder. Data %d\n", dec_ctx->num_frames_sent);
-            exit(DEC_APP_ERROR);
+    const XlnxEncoderProperties *enc_props;
+    int64_t pixels = -1;
+    int32_t fallbacks = 0;
+
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        enc_props = &ladder->renditions[i]->enc_ctx.enc_props;
+        if(enc_props->lookahead_depth > 0) {
+            fallbacks |= XLNX_ALLOC_NO_LOOKAHEAD;
         }
+        if((int64_t)enc_props->width * enc_props->height > pixels) {
+            pixels = (int64_t)enc_props->width * enc_props->height;
+            *largest = i;
+        }
+    }
+    if(ladder->num_renditions > 1) {
+        fallbacks |= XLNX_ALLOC_DROP_RENDITION;
+    }
+    return fallbacks;
+}
 
-        if(rc == XMA_TRY_AGAIN) 
-        {
-            printf("==========XMA_TRY_AGAIN============\n");
+XlnxAbrLadder *AbrLadder_Open(const XlnxAbrLadderConfig *cfg)
+{
+    XlnxAbrLadderConfig try_cfg = *cfg;
+    int32_t ids[XLNX_ABR_MAX_RENDITIONS];
+    XlnxAllocAttempt attempt;
+    XlnxAbrLadder *ladder;
+    int32_t fallbacks;
+    int32_t largest = 0;
+    int32_t next;
+
+    for(int32_t i = 0; i < XLNX_ABR_MAX_RENDITIONS; i++) {
+        ids[i] = i;
+    }
+
+    xlnx_alloc_begin(&attempt);
+    while(1) {
+        ladder = xlnx_abr_ladder_alloc(&try_cfg);
+        if(!ladder) {
+            break;
+        }
+        memcpy(ladder->rendition_ids, ids, sizeof(ids));
+        fallbacks = xlnx_abr_fallbacks(ladder, &largest);
+        if(xlnx_abr_ladder_start(ladder) == ENC_APP_SUCCESS) {
+            break;
+        }
+        ladder = NULL;
+        next = xlnx_alloc_next(&attempt, fallbacks);
+        if(next < 0) {
+            break;
+        }
+        if(next == XLNX_ALLOC_NO_LOOKAHEAD) {
+            for(int32_t i = 0; i < try_cfg.num_renditions; i++) {
+                try_cfg.renditions[i].lookahead_depth = 0;
+            }
+        }
+        else if(next == XLNX_ALLOC_DROP_RENDITION) {
+            attempt.outcome.dropped_renditions |= 1 << ids[largest];
+            try_cfg.num_renditions--;
+            for(int32_t i = largest; i < try_cfg.num_renditions; i++) {
+                try_cfg.renditions[i] = try_cfg.renditions[i + 1];
+                ids[i] = ids[i + 1];
+            }
         }
+    }
+
+    xlnx_alloc_end(&attempt, ladder ? ENC_APP_SUCCESS : ENC_APP_FAILURE, 
+                   ladder ? ladder->dec_ctx.dec_xma_props.dev_index : -1);
+    return ladder;
+}
 
-        if(rc == XMA_SUCCESS){}
+/* Passes the packet a rendition just produced to the callback, by reference */
+static void xlnx_abr_emit_packet(XlnxAbrLadder *ladder, int32_t rendition, 
+                                 XlnxAbrPacketCallback cb, void *opaque)
+{
+    XlnxEncoderPacket *pkt = Encoder_ReceivePacket(
+                                 ladder->renditions[rendition]);
+
+    if(pkt) {
+        cb(opaque, ladder->rendition_ids[rendition], pkt->data, pkt->size);
+        Encoder_PacketUnref(pkt);
     }
-	
-	
-    ret = xma_dec_session_recv_frame(dec_ctx->xma_dec_session, dec_ctx->channel_ctx.xframe);
-    if(ret == XMA_SUCCESS)
-	{
-		size_t buffer_size =0;
-		// int size = 1920*1080;
-		unsigned char* hbuf = xlnx_dec_get_buffer_from_fpga(dec_ctx, &buffer_size);
-		dec_output_data(hbuf,outbuffer);
+}
+
+/* Scales one decoded frame into all renditions and encodes each of them.
+   Every stage drops its own reference on the xvbm buffer it consumed. */
+static int32_t xlnx_abr_process_frame(XlnxAbrLadder *ladder, 
+                                      XmaFrame *dec_frame,
+                                      XlnxAbrPacketCallback cb, void *opaque)
+{
+    XlnxScalerCtx *scal_ctx = &ladder->scal_ctx;
+    XlnxEncoderCtx *enc_ctx;
+    XmaFrame *frame;
+    int32_t ret;
+    int32_t status = ENC_APP_SUCCESS;
+    int outlen;
+
+    ret = xma_scaler_session_send_frame(scal_ctx->session, dec_frame);
+    if(ret == XMA_SUCCESS) {
+        ret = xma_scaler_session_recv_frame_list(scal_ctx->session, 
+                                                 scal_ctx->out_frames);
     }
-	else 
-	{
-        usleep(5);
+    xvbm_buffer_pool_entry_free(dec_frame->data[0].buffer);
+    dec_frame->data[0].buffer = NULL;
+
+    if(ret == XMA_SEND_MORE_DATA) {
+        return ENC_APP_SUCCESS;
+    }
+    if(ret != XMA_SUCCESS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SCAL_APP_MODULE, 
+                   "Scaler failed with error %d\n", ret);
+        return ENC_APP_FAILURE;
     }
 
-    return ret;
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        frame = scal_ctx->out_frames[i];
+        enc_ctx = &ladder->renditions[i]->enc_ctx;
+        if(status == ENC_APP_SUCCESS) {
+            enc_ctx->la_in_frame = frame;
+            if(xlnx_enc_encode_frame(enc_ctx, 0, NULL, &outlen) != 
+                                                            ENC_APP_SUCCESS) {
+                status = ENC_APP_FAILURE;
+            }
+            else {
+                xlnx_abr_emit_packet(ladder, i, cb, opaque);
+            }
+            enc_ctx->la_in_frame = &enc_ctx->in_frame;
+        }
+        xvbm_buffer_pool_entry_free(frame->data[0].buffer);
+        frame->data[0].buffer = NULL;
+    }
+
+    return status;
 }
 
-int dec_write_host_buffer_to_file(unsigned char* hostbuf,FILE* file)
+/* Pushes every frame the decoder has ready through the ladder */
+static int32_t xlnx_abr_recv_frames(XlnxAbrLadder *ladder, 
+                                    XlnxAbrPacketCallback cb, void *opaque)
 {
-	XlnxDecoderCtx* fctx =&ctx;
-    int    stride          = fctx->dec_params.width;
-    int    aligned_width   = ALIGN(fctx->dec_params.width, STRIDE_ALIGN);
-    int    aligned_height  = ALIGN(fctx->dec_params.height, HEIGHT_ALIGN);
-    size_t plane_size      = fctx->dec_params.width * fctx->dec_params.height;
-    size_t buff_plane_size = aligned_width * aligned_height;
-    int offset = 0;
-    int bytes_written;
-    int bytes_read;
-    int num_planes = xma_frame_planes_get(&fctx->channel_ctx.xframe->frame_props);
-    for(int plane_id = 0; plane_id < num_planes; plane_id++) 
-	{
-        bytes_written = 0;
-        bytes_read = 0;
-        if(plane_id > 0) 
-		{
-            buff_plane_size = aligned_width * aligned_width / 2;
-            plane_size = fctx->dec_params.width * fctx->dec_params.height / 2;
-        }
-        while(bytes_read < buff_plane_size) 
-		{
-            if(bytes_written < plane_size) 
-			{
-                fwrite(hostbuf + offset, 1, stride, file);
-                bytes_written += stride;
+    XlnxDecoderCtx *dec_ctx = &ladder->dec_ctx;
+    XmaFrame *dec_frame = dec_ctx->channel_ctx.xframe;
+    int32_t ret;
+
+    while(1) {
+        ret = xma_dec_session_recv_frame(dec_ctx->xma_dec_session, dec_frame);
+        if(ret == XMA_SUCCESS) {
+            dec_ctx->num_frames_decoded++;
+            xlnx_telemetry_count(&ladder->telemetry, dec_ctx->num_frames_sent, 
+                                 dec_ctx->num_frames_decoded);
+            xlnx_telemetry_pool(&ladder->telemetry, dec_frame->data[0].buffer);
+            if(xlnx_abr_process_frame(ladder, dec_frame, cb, opaque) != 
+                                                            ENC_APP_SUCCESS) {
+                return ENC_APP_FAILURE;
             }
-            offset += aligned_width;
-            bytes_read += aligned_width;
+        }
+        else if(ret == XMA_EOS) {
+            ladder->dec_eos = 1;
+            return ENC_APP_SUCCESS;
+        }
+        else if(ret <= XMA_ERROR) {
+            DECODER_APP_LOG_ERROR("Decoder failed with error %d\n", ret);
+            return ENC_APP_FAILURE;
+        }
+        else {
+            /* XMA_TRY_AGAIN: the decoder needs more input */
+            return ENC_APP_SUCCESS;
         }
     }
-    fflush(file);
-    return DEC_APP_SUCCESS;
 }
 
-char* filebuf_;
-const char* pbuf_;
-int filesize_;
-unsigned char is_stop_;
-const char* AVCFindStartCodeInternal(const char *p, const char *end)
+int AbrLadder_SendData(XlnxAbrLadder *ladder, unsigned char *inBuf, 
+                       int inSize, XlnxAbrPacketCallback cb, void *opaque)
 {
-	const char *a = p + 4 - ((ptrdiff_t)p & 3);
-	for (end -= 3; p < a && p < end; p++) {
-		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-			return p;
-	}
-	for (end -= 3; p < end; p += 4) {
-		unsigned int x = *(const unsigned int*)p;
-		//      if ((x - 0x01000100) & (~x) & 0x80008000) // little endian
-		//      if ((x - 0x00010001) & (~x) & 0x00800080) // big endian
-		if ((x - 0x01010101) & (~x) & 0x80808080) { // generic
-			if (p[1] == 0) {
-				if (p[0] == 0 && p[2] == 1)
-					return p;
-				if (p[2] == 0 && p[3] == 1)
-					return p + 1;
-			}
-			if (p[3] == 0) {
-				if (p[2] == 0 && p[4] == 1)
-					return p + 2;
-				if (p[4] == 0 && p[5] == 1)
-					return p + 3;
-			}
-		}
-	}
-	for (end += 3; p < end; p++) {
-		if (p[0] == 0 && p[1] == 0 && p[2] == 1)
-			return p;
-	}
-	return end + 3;
+    XlnxDecoderCtx *dec_ctx = &ladder->dec_ctx;
+    XmaDataBuffer xbuffer;
+    int32_t offset = 0;
+    int32_t data_used;
+    int32_t ret;
+
+    memset(&xbuffer, 0, sizeof(xbuffer));
+    while(offset < inSize) {
+        xbuffer.data.buffer = inBuf + offset;
+        xbuffer.alloc_size = inSize - offset;
+        xbuffer.is_eof = 0;
+        xbuffer.pts = dec_ctx->pts;
+        data_used = 0;
+
+        ret = xma_dec_session_send_data(dec_ctx->xma_dec_session, &xbuffer, 
+                                        &data_used);
+        if(ret <= XMA_ERROR) {
+            DECODER_APP_LOG_ERROR("Error sending data to decoder. Data %zu\n",
+                                  dec_ctx->num_frames_sent);
+            return ENC_APP_FAILURE;
+        }
+        offset += data_used;
+
+        /* Draining after every send keeps the decoder output pool free, 
+           which is what XMA_TRY_AGAIN waits for */
+        if(xlnx_abr_recv_frames(ladder, cb, opaque) != ENC_APP_SUCCESS) {
+            return ENC_APP_FAILURE;
+        }
+        /* Nothing taken and nothing left to drain: the decoder is busy, 
+           wait as the encoder send path does instead of polling */
+        if(data_used == 0) {
+            usleep(XLNX_ENC_SEND_RETRY_US);
+        }
+    }
+    dec_ctx->pts++;
+    dec_ctx->num_frames_sent++;
+    xlnx_telemetry_count(&ladder->telemetry, dec_ctx->num_frames_sent, 
+                         dec_ctx->num_frames_decoded);
+
+    return ENC_APP_SUCCESS;
 }
 
-const char* AVCFindStartCode(const char *p, const char *end)
+int AbrLadder_Flush(XlnxAbrLadder *ladder, XlnxAbrPacketCallback cb, 
+                    void *opaque)
 {
-	const char *out = AVCFindStartCodeInternal(p, end);
-	if (p<out && out<end && !out[-1]) out--;
-	return out;
+    XlnxDecoderCtx *dec_ctx = &ladder->dec_ctx;
+    XmaDataBuffer xbuffer;
+    int32_t data_used;
+    int outlen;
+
+    /* Signal end of stream to the decoder and drain it through the ladder */
+    if(!dec_ctx->is_flush_sent) {
+        memset(&xbuffer, 0, sizeof(xbuffer));
+        xbuffer.is_eof = 1;
+        xbuffer.pts = -1;
+        if(xma_dec_session_send_data(dec_ctx->xma_dec_session, &xbuffer, 
+                                     &data_used) <= XMA_ERROR) {
+            DECODER_APP_LOG_ERROR("Failed to send EOS to decoder\n");
+            return ENC_APP_FAILURE;
+        }
+        dec_ctx->is_flush_sent = true;
+    }
+    while(!ladder->dec_eos) {
+        if(xlnx_abr_recv_frames(ladder, cb, opaque) != ENC_APP_SUCCESS) {
+            return ENC_APP_FAILURE;
+        }
+        /* The decoder is still working on the tail */
+        if(!ladder->dec_eos) {
+            usleep(XLNX_ENC_SEND_RETRY_US);
+        }
+    }
+
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        while(Encoder_FlushFrame(ladder->renditions[i], NULL, &outlen) == 
+                                                            ENC_APP_SUCCESS) {
+            xlnx_abr_emit_packet(ladder, i, cb, opaque);
+        }
+    }
+
+    return ENC_APP_SUCCESS;
 }
 
-int H264FrameReader_Init(const char* filename)
+#define XLNX_CAP_LA_DEPTH 20
+
+static const char *xlnx_cap_type_names[] = {"decode", "encode", "abr"};
+
+int Capacity_ParseJob(const char *spec, XlnxCapacityJob *job)
 {
-	FILE* fp = fopen(filename, "rb");
-	filebuf_ = 0;
-	filesize_ = 0;
-	int retval =0;
-	if (fp)
-	{
-		fseek(fp, 0, SEEK_END);
-		filesize_ = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		filebuf_ = (char*)malloc(filesize_);
-		retval = fread(filebuf_, 1, filesize_, fp);
-		fclose(fp);
-	}
-	pbuf_ = filebuf_;
-	
-	return retval;
+    char type[16], codec[16];
+    int32_t width, height, fps, len = 0, depth;
+    int32_t num = 0;
+    XlnxAbrLadderConfig *ladder = &job->ladder;
+
+    memset(job, 0, sizeof(*job));
+    if(sscanf(spec, "%15[^:]:%15[^:]:%dx%d@%d%n", type, codec, &width, 
+              &height, &fps, &len) != 5 || width <= 0 || height <= 0 || 
+       fps <= 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Invalid job %s\n", spec);
+        return ENC_APP_FAILURE;
+    }
+    job->type = -1;
+    for(int32_t i = 0; i < (int32_t)XLNX_ENC_LOOKUP_SIZE(xlnx_cap_type_names);
+        i++) {
+        if(strcmp(type, xlnx_cap_type_names[i]) == 0) {
+            job->type = i;
+        }
+    }
+    if(job->type < 0 || 
+       (strcmp(codec, "h264") != 0 && strcmp(codec, "hevc") != 0)) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Invalid job %s\n", spec);
+        return ENC_APP_FAILURE;
+    }
+    snprintf(job->name, sizeof(job->name), "%s", spec);
+
+    AbrLadder_ConfigInit(ladder);
+    ladder->codec_id = strcmp(codec, "hevc") == 0 ? ENCODER_ID_HEVC : 
+                                                    ENCODER_ID_H264;
+    ladder->width = width;
+    ladder->height = height;
+    ladder->fps = fps;
+    /* Renditions above the input resolution would only upscale */
+    for(int32_t i = 0; i < ladder->num_renditions; i++) {
+        if(ladder->renditions[i].height <= height) {
+            ladder->renditions[num++] = ladder->renditions[i];
+        }
+    }
+    ladder->num_renditions = num;
+
+    Encoder_ConfigInit(&job->encode);
+    job->encode.codec_id = ladder->codec_id;
+    job->encode.width = width;
+    job->encode.height = height;
+    job->encode.fps = fps;
+    if(spec[len] == '\0') {
+        return ENC_APP_SUCCESS;
+    }
+    if(job->type == XLNX_CAPACITY_ENCODE && strcmp(spec + len, ":la") == 0) {
+        job->encode.lookahead_depth = XLNX_CAP_LA_DEPTH;
+        return ENC_APP_SUCCESS;
+    }
+    if(job->type == XLNX_CAPACITY_ENCODE && 
+       sscanf(spec + len, ":la=%d%n", &depth, &num) == 1 && 
+       spec[len + num] == '\0') {
+        job->encode.lookahead_depth = depth;
+        return ENC_APP_SUCCESS;
+    }
+    xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+               "Invalid job option %s\n", spec + len);
+    return ENC_APP_FAILURE;
 }
 
-void H264FrameReader_Free()
+/* CU list one stream of the job needs, sized by the XRM load plugins */
+static int32_t xlnx_cap_fill_pool_props(xrmContext *xrm_ctx, 
+                                        const XlnxCapacityJob *job,
+                                        xrmCuPoolProperty *cu_pool_prop)
 {
-	free(filebuf_);
+    XlnxEncoderHandle *handle;
+    XlnxAbrLadder *ladder;
+    XlnxDecoderCtx *dec_ctx;
+    int32_t ret = ENC_APP_FAILURE;
+    int dec_load;
+
+    memset(cu_pool_prop, 0, sizeof(*cu_pool_prop));
+    switch(job->type) {
+        case XLNX_CAPACITY_ENCODE:
+            handle = xlnx_enc_handle_alloc(&job->encode, 0);
+            if(!handle) {
+                break;
+            }
+            handle->enc_ctx.enc_xrm_ctx.xrm_ctx = xrm_ctx;
+            handle->enc_ctx.enc_xrm_ctx.shared_pool = 1;
+            ret = xlnx_enc_load_calc(&handle->enc_ctx.enc_xrm_ctx, 
+                                     &handle->xma_enc_props, 
+                                     handle->enc_ctx.enc_props.lookahead_depth,
+                                     handle->enc_ctx.enc_props.num_cores,
+                                     cu_pool_prop);
+            Encoder_Close(handle);
+            break;
+
+        case XLNX_CAPACITY_DECODE:
+            dec_ctx = calloc(1, sizeof(*dec_ctx));
+            if(!dec_ctx) {
+                break;
+            }
+            xlnx_dec_set_default_params(&dec_ctx->dec_params);
+            dec_ctx->dec_params.codec_type = 
+                (job->ladder.codec_id == ENCODER_ID_HEVC) ? HEVC_CODEC_TYPE : 
+                                                            H264_CODEC_TYPE;
+            dec_ctx->dec_params.profile_idc = 
+                (job->ladder.codec_id == ENCODER_ID_HEVC) ? 1 : 100;
+            dec_ctx->dec_params.width = job->ladder.width;
+            dec_ctx->dec_params.height = job->ladder.height;
+            dec_ctx->dec_params.fps = job->ladder.fps;
+            xlnx_dec_create_context(dec_ctx);
+            dec_ctx->dec_xrm_ctx.xrm_ctx = xrm_ctx;
+            dec_ctx->dec_xrm_ctx.shared_pool = 1;
+            if(dec_load_calc(&dec_ctx->dec_xrm_ctx, &dec_ctx->dec_xma_props, 
+                             &dec_load) == DEC_APP_SUCCESS) {
+                dec_fill_pool_props(cu_pool_prop, dec_load);
+                ret = ENC_APP_SUCCESS;
+            }
+            xlnx_dec_cleanup_ctx(dec_ctx);
+            free(dec_ctx->channel_ctx.xframe);
+            free(dec_ctx);
+            break;
+
+        case XLNX_CAPACITY_ABR:
+            ladder = xlnx_abr_ladder_alloc(&job->ladder);
+            if(!ladder) {
+                break;
+            }
+            ret = xlnx_abr_fill_pool_props(ladder, cu_pool_prop);
+            AbrLadder_Close(ladder);
+            break;
+    }
+
+    return ret;
 }
 
-int H264FrameReader_ReadFrame(unsigned char* outBuf, int* outBufSize)
+typedef struct XlnxCapBuf
 {
-	unsigned char* pbufout = 0;
-	const unsigned char *p = 0;
-	const unsigned char *end = 0;
-	const unsigned char *nal_start, *nal_end;
-	unsigned char startcodebuf[] = { 0x00, 0x00, 0x00, 0x01 };
-	if (pbuf_ >= filebuf_ + filesize_)
-	{
-		return 0;
-	}
-
-	pbufout = outBuf;
-	p = pbuf_;
-	end = filebuf_ + filesize_;
+    char   *data;
+    size_t len;
+    size_t size;
+    int32_t failed;
+} XlnxCapBuf;
 
-	nal_start = AVCFindStartCode(p, end);
-	while (nal_start < end)
-	{
-		unsigned int nal_size = 0;
-		unsigned char nal_type = 0;
+static void xlnx_cap_printf(XlnxCapBuf *buf, const char *fmt, ...)
+{
+    va_list args;
+    int32_t len;
+    char *grown;
 
-		while (!*(nal_start++));
+    if(buf->failed) {
+        return;
+    }
+    va_start(args, fmt);
+    len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, args);
+    va_end(args);
+    if(len >= 0 && buf->len + len < buf->size) {
+        buf->len += len;
+        return;
+    }
+    grown = realloc(buf->data, 2 * buf->size + len);
+    if(len < 0 || !grown) {
+        buf->failed = 1;
+        return;
+    }
+    buf->data = grown;
+    buf->size = 2 * buf->size + len;
+    va_start(args, fmt);
+    buf->len += vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, 
+                          args);
+    va_end(args);
+}
 
-		nal_end = AVCFindStartCode(nal_start, end);
+static void xlnx_cap_print_counts(XlnxCapBuf *buf, xrmContext *xrm_ctx, 
+                                  const xrmCuPoolProperty *cu_pool_prop,
+                                  const int32_t *devices, int32_t num_devices)
+{
+    int32_t num;
 
-		nal_size = nal_end - nal_start;
-		nal_type = nal_start[0] & 0x1f;
+    xlnx_cap_printf(buf, "\"per_device\": [");
+    for(int32_t d = 0; d < num_devices; d++) {
+        num = xlnx_placement_available(xrm_ctx, cu_pool_prop, devices[d]);
+        xlnx_cap_printf(buf, "%s%d", d ? ", " : "", max(num, 0));
+    }
+    num = xlnx_placement_available(xrm_ctx, cu_pool_prop, -1);
+    xlnx_cap_printf(buf, "], \"total\": %d", max(num, 0));
+}
 
-		memcpy(pbufout, startcodebuf, 4);
-		pbufout += 4;
-		memcpy(pbufout, nal_start, nal_size);
-		pbufout += nal_size;
+char *Capacity_PlanJson(const XlnxCapacityJob *jobs, int num_jobs, 
+                        int max_devices)
+{
+    XlnxCapBuf buf = {NULL, 0, 4096, 0};
+    xrmContext *xrm_ctx;
+    xrmCuPoolProperty *pool_props, *mix;
+    int32_t *job_ok;
+    int32_t devices[XLNX_CAPACITY_MAX_DEVICES];
+    int32_t num_devices = 0, mix_ok = 1;
+    xrmCuListProperty *list;
+
+    max_devices = min(max_devices, XLNX_CAPACITY_MAX_DEVICES);
+    xrm_ctx = (xrmContext *)xrmCreateContext(XRM_API_VERSION_1);
+    if(!xrm_ctx) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "create local XRM context failed\n");
+        return NULL;
+    }
+    pool_props = calloc(num_jobs + 1, sizeof(xrmCuPoolProperty));
+    job_ok = calloc(num_jobs + 1, sizeof(int32_t));
+    buf.data = malloc(buf.size);
+    if(!pool_props || !job_ok || !buf.data) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_ENC_APP_MODULE, 
+                   "Out of memory while planning capacity\n");
+        buf.failed = 1;
+        goto out;
+    }
 
-		nal_start = nal_end;
-		break;
-	}
+    /* Every stream of the mix shares one CU list, so a set lands on one
+       device like an ABR ladder does */
+    mix = &pool_props[num_jobs];
+    for(int32_t i = 0; i < num_jobs; i++) {
+        job_ok[i] = xlnx_cap_fill_pool_props(xrm_ctx, &jobs[i], 
+                                             &pool_props[i]) == 
+                                                            ENC_APP_SUCCESS;
+        list = &pool_props[i].cuListProp;
+        if(!job_ok[i] || 
+           mix->cuListProp.cuNum + list->cuNum > XRM_MAX_LIST_CU_NUM) {
+            mix_ok = 0;
+            continue;
+        }
+        memcpy(&mix->cuListProp.cuProps[mix->cuListProp.cuNum], 
+               list->cuProps, list->cuNum * sizeof(xrmCuProperty));
+        mix->cuListProp.cuNum += list->cuNum;
+        mix->cuListProp.sameDevice = true;
+        mix->cuListNum = 1;
+    }
+    mix_ok = mix_ok && num_jobs > 0;
+
+    /* A device is there when XRM accepts a request constrained to it */
+    for(int32_t d = 0; d < max_devices; d++) {
+        for(int32_t i = 0; i < num_jobs; i++) {
+            if(job_ok[i] && 
+               xlnx_placement_available(xrm_ctx, &pool_props[i], d) >= 0) {
+                devices[num_devices++] = d;
+                break;
+            }
+        }
+    }
 
-	*outBufSize = pbufout - outBuf;
-	pbuf_ = nal_start;
+    xlnx_cap_printf(&buf, "{\"devices\": [");
+    for(int32_t d = 0; d < num_devices; d++) {
+        xlnx_cap_printf(&buf, "%s%d", d ? ", " : "", devices[d]);
+    }
+    xlnx_cap_printf(&buf, "],\n \"jobs\": [");
+    for(int32_t i = 0; i < num_jobs; i++) {
+        xlnx_cap_printf(&buf, "%s\n  {\"name\": \"", i ? "," : "");
+        for(const char *p = jobs[i].name; *p; p++) {
+            xlnx_cap_printf(&buf, (*p == '"' || *p == '\\') ? "\\%c" : 
+                            ((uint8_t)*p < 0x20) ? "\\u%04x" : "%c", *p);
+        }
+        xlnx_cap_printf(&buf, "\", \"type\": \"%s\", ", 
+                        (jobs[i].type >= 0 && jobs[i].type <= 
+                         XLNX_CAPACITY_ABR) ? 
+                        xlnx_cap_type_names[jobs[i].type] : "unknown");
+        if(!job_ok[i]) {
+            xlnx_cap_printf(&buf, "\"error\": \"load calculation failed\"}");
+            continue;
+        }
+        xlnx_cap_print_counts(&buf, xrm_ctx, &pool_props[i], devices, 
+                              num_devices);
+        xlnx_cap_printf(&buf, "}");
+    }
+    xlnx_cap_printf(&buf, "],\n \"mix\": ");
+    if(mix_ok) {
+        xlnx_cap_printf(&buf, "{");
+        xlnx_cap_print_counts(&buf, xrm_ctx, mix, devices, num_devices);
+        xlnx_cap_printf(&buf, "}}\n");
+    }
+    else {
+        xlnx_cap_printf(&buf, "null}\n");
+    }
 
-	return 1;
-}
\ No newline at end of file
+out:
+    xrmDestroyContext(xrm_ctx);
+    free(pool_props);
+    free(job_ok);
+    if(buf.failed) {
+        free(buf.data);
+        return NULL;
+    }
+    return buf.data;
+}
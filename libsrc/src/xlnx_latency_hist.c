@@ -0,0 +1,134 @@
+#include "xlnx_latency_hist.h"
+
+#include <string.h>
+#include <time.h>
+
+#define XLNX_LAT_SUB_COUNT (1 << XLNX_LAT_SUB_BITS)
+#define XLNX_LAT_MAX_VALUE \
+            ((INT64_C(1) << (XLNX_LAT_MAX_SHIFT + XLNX_LAT_SUB_BITS + 1)) - 1)
+
+static uint32_t xlnx_latency_bucket(int64_t value_ns)
+{
+    uint64_t v;
+    uint32_t shift;
+
+    if(value_ns < XLNX_LAT_SUB_COUNT) {
+        return value_ns < 0 ? 0 : (uint32_t)value_ns;
+    }
+    v = value_ns > XLNX_LAT_MAX_VALUE ? XLNX_LAT_MAX_VALUE : value_ns;
+    /* Position of the top bit above the linear sub-bucket bits */
+    shift = 63 - __builtin_clzll(v) - XLNX_LAT_SUB_BITS;
+    return (shift << XLNX_LAT_SUB_BITS) + (uint32_t)(v >> shift);
+}
+
+/* Highest value that lands in the bucket */
+static int64_t xlnx_latency_bucket_max(uint32_t idx)
+{
+    uint32_t shift;
+
+    if(idx < XLNX_LAT_SUB_COUNT) {
+        return idx;
+    }
+    shift = (idx >> XLNX_LAT_SUB_BITS) - 1;
+    return ((int64_t)(XLNX_LAT_SUB_COUNT + 
+                      (idx & (XLNX_LAT_SUB_COUNT - 1))) << shift) + 
+           (INT64_C(1) << shift) - 1;
+}
+
+int64_t xlnx_latency_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void xlnx_latency_record(XlnxLatencyHistSet *set, int32_t stage, 
+                         int64_t value_ns)
+{
+    XlnxLatencyHist *hist = &set->hist[stage];
+    uint32_t *count = &hist->counts[xlnx_latency_bucket(value_ns)];
+
+    /* Single writer: plain increments published with relaxed stores keep 
+       readers from seeing torn values */
+    __atomic_store_n(count, *count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&hist->sum_ns, 
+                     hist->sum_ns + (value_ns > 0 ? value_ns : 0), 
+                     __ATOMIC_RELAXED);
+}
+
+int64_t xlnx_latency_record_since(XlnxLatencyHistSet *set, int32_t stage, 
+                                  int64_t start_ns)
+{
+    int64_t now = xlnx_latency_now_ns();
+
+    xlnx_latency_record(set, stage, now - start_ns);
+    return now;
+}
+
+static int64_t xlnx_latency_percentile(const uint32_t *counts, 
+                                       uint64_t total, uint32_t permille)
+{
+    /* Rank of the sample at the percentile, rounded up */
+    uint64_t rank = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+    uint32_t i;
+
+    if(rank == 0) {
+        rank = 1;
+    }
+    for(i = 0; i < XLNX_LAT_NUM_BUCKETS; i++) {
+        seen += counts[i];
+        if(seen >= rank) {
+            return xlnx_latency_bucket_max(i);
+        }
+    }
+    return 0;
+}
+
+void xlnx_latency_snapshot(XlnxLatencyHistSet *set, XlnxLatencyStats *stats,
+                           int32_t reset)
+{
+    uint32_t counts[XLNX_LAT_NUM_BUCKETS];
+    XlnxLatencyHist *hist;
+    XlnxLatencyHist *base;
+    XlnxLatencyStats *out;
+    uint64_t total;
+    uint64_t sum;
+    uint32_t now;
+    int32_t stage;
+    uint32_t i;
+
+    for(stage = 0; stage < XLNX_LAT_NUM_STAGES; stage++) {
+        hist = &set->hist[stage];
+        base = &set->base[stage];
+        out = &stats[stage];
+        memset(out, 0, sizeof(*out));
+        total = 0;
+        for(i = 0; i < XLNX_LAT_NUM_BUCKETS; i++) {
+            now = __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+            /* Unsigned wrap keeps the difference right past 2^32 frames */
+            counts[i] = now - base->counts[i];
+            total += counts[i];
+            if(reset) {
+                base->counts[i] = now;
+            }
+        }
+        sum = __atomic_load_n(&hist->sum_ns, __ATOMIC_RELAXED);
+        if(total) {
+            out->count = total;
+            out->mean_ns = (sum - base->sum_ns) / total;
+            for(i = 0; !counts[i]; i++);
+            out->min_ns = xlnx_latency_bucket_max(i);
+            for(i = XLNX_LAT_NUM_BUCKETS - 1; !counts[i]; i--);
+            out->max_ns = xlnx_latency_bucket_max(i);
+            out->p50_ns = xlnx_latency_percentile(counts, total, 500);
+            out->p90_ns = xlnx_latency_percentile(counts, total, 900);
+            out->p99_ns = xlnx_latency_percentile(counts, total, 990);
+            out->p999_ns = xlnx_latency_percentile(counts, total, 999);
+        }
+        if(reset) {
+            base->sum_ns = sum;
+        }
+    }
+}
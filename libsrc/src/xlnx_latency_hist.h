@@ -0,0 +1,43 @@
+#ifndef _XLNX_LATENCY_HIST_H_
+#define _XLNX_LATENCY_HIST_H_
+
+#include "xilinx_encoder.h"
+
+#include <stdint.h>
+
+/* Log-linear buckets: values below 2^SUB_BITS ns are exact, above that 
+   every power of two is split into 2^SUB_BITS linear steps, so a bucket is
+   never wider than 1/32 of its value. Values are clamped at 2^35 ns. */
+#define XLNX_LAT_SUB_BITS    5
+#define XLNX_LAT_MAX_SHIFT   29
+#define XLNX_LAT_NUM_BUCKETS ((XLNX_LAT_MAX_SHIFT + 2) << XLNX_LAT_SUB_BITS)
+
+/* Written by the one thread that drives the channel. Readers never write 
+   it, a reset only moves the reader's baseline, so recording needs no 
+   lock and no atomic read-modify-write. */
+typedef struct XlnxLatencyHist {
+    uint32_t counts[XLNX_LAT_NUM_BUCKETS];
+    uint64_t sum_ns;
+} XlnxLatencyHist;
+
+typedef struct XlnxLatencyHistSet {
+    XlnxLatencyHist hist[XLNX_LAT_NUM_STAGES];
+    /* Reader side: totals at the last reset */
+    XlnxLatencyHist base[XLNX_LAT_NUM_STAGES];
+} XlnxLatencyHistSet;
+
+int64_t xlnx_latency_now_ns(void);
+
+void xlnx_latency_record(XlnxLatencyHistSet *set, int32_t stage, 
+                         int64_t value_ns);
+
+/* Records the time since start_ns and returns the current time */
+int64_t xlnx_latency_record_since(XlnxLatencyHistSet *set, int32_t stage, 
+                                  int64_t start_ns);
+
+/* Fills one entry per stage with the values recorded since the last reset.
+   Only one thread may read a set at a time. */
+void xlnx_latency_snapshot(XlnxLatencyHistSet *set, XlnxLatencyStats *stats,
+                           int32_t reset);
+
+#endif
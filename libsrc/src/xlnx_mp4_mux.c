@@ -0,0 +1,646 @@
+#include "xilinx_encoder.h"
+#include "xlnx_mux_io.h"
+
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+
+#define XLNX_MP4_TIMESCALE      90000
+#define XLNX_MP4_TRACK_ID       1
+/* styp + moof + mdat header of one single sample fragment */
+#define XLNX_MP4_STYP_SIZE      28
+#define XLNX_MP4_MOOF_SIZE      104
+#define XLNX_MP4_FRAG_HDR_SIZE  (XLNX_MP4_STYP_SIZE + XLNX_MP4_MOOF_SIZE + 8)
+#define XLNX_MP4_INIT_SIZE      1024
+#define XLNX_MP4_SAMPLE_SYNC    0x02000000
+#define XLNX_MP4_SAMPLE_NONSYNC 0x01010000
+
+typedef struct {
+    uint8_t *buf;
+    size_t  pos;
+} XlnxMp4Writer;
+
+typedef struct {
+    const uint8_t *data;
+    int32_t       size;
+} XlnxMp4ParamSet;
+
+typedef struct {
+    int32_t pos;                /* offset of the start code */
+    int32_t sc_len;
+    int32_t size;               /* NAL size without start code */
+    int32_t type;
+} XlnxMp4Nal;
+
+struct XlnxMp4Mux {
+    int32_t         fd;
+    int32_t         codec_id;
+    int32_t         width;
+    int32_t         height;
+    int32_t         fps;
+    bool            init_written;
+    int64_t         first_dts;
+    uint32_t        sequence;
+    uint8_t         hdr[XLNX_MP4_FRAG_HDR_SIZE];
+    /* Grown to the largest NAL count seen, reused for every packet */
+    XlnxMp4Nal      *nals;
+    int32_t         max_nals;
+    /* The last packet, length prefixed, waits for the next dts to give it
+       its duration */
+    uint8_t         *sample;
+    size_t          sample_size;
+    size_t          sample_capacity;
+    int64_t         sample_pts;
+    int64_t         sample_dts;
+    bool            sample_key;
+    bool            held;
+    int64_t         last_duration;
+    XlnxMp4MuxStats stats;
+};
+
+static void xlnx_mp4_put8(XlnxMp4Writer *w, uint32_t v)
+{
+    w->buf[w->pos++] = v;
+}
+
+static void xlnx_mp4_put16(XlnxMp4Writer *w, uint32_t v)
+{
+    xlnx_mp4_put8(w, v >> 8);
+    xlnx_mp4_put8(w, v);
+}
+
+static void xlnx_mp4_put32(XlnxMp4Writer *w, uint32_t v)
+{
+    xlnx_mp4_put16(w, v >> 16);
+    xlnx_mp4_put16(w, v);
+}
+
+static void xlnx_mp4_put64(XlnxMp4Writer *w, uint64_t v)
+{
+    xlnx_mp4_put32(w, v >> 32);
+    xlnx_mp4_put32(w, v);
+}
+
+static void xlnx_mp4_put_bytes(XlnxMp4Writer *w, const void *data, size_t len)
+{
+    memcpy(w->buf + w->pos, data, len);
+    w->pos += len;
+}
+
+static void xlnx_mp4_put_zero(XlnxMp4Writer *w, size_t len)
+{
+    memset(w->buf + w->pos, 0, len);
+    w->pos += len;
+}
+
+/* Opens a box; the size is patched by xlnx_mp4_end_box */
+static size_t xlnx_mp4_start_box(XlnxMp4Writer *w, const char *type)
+{
+    size_t start = w->pos;
+
+    xlnx_mp4_put32(w, 0);
+    xlnx_mp4_put_bytes(w, type, 4);
+    return start;
+}
+
+static size_t xlnx_mp4_start_full_box(XlnxMp4Writer *w, const char *type,
+                                      uint32_t version, uint32_t flags)
+{
+    size_t start = xlnx_mp4_start_box(w, type);
+
+    xlnx_mp4_put32(w, (version << 24) | flags);
+    return start;
+}
+
+static void xlnx_mp4_end_box(XlnxMp4Writer *w, size_t start)
+{
+    uint32_t size = w->pos - start;
+
+    w->buf[start]     = size >> 24;
+    w->buf[start + 1] = size >> 16;
+    w->buf[start + 2] = size >> 8;
+    w->buf[start + 3] = size;
+}
+
+static void xlnx_mp4_put_matrix(XlnxMp4Writer *w)
+{
+    static const uint32_t unity[9] = {
+        0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+    };
+
+    for(int32_t i = 0; i < 9; i++) {
+        xlnx_mp4_put32(w, unity[i]);
+    }
+}
+
+static int32_t xlnx_mp4_nal_type(int32_t codec_id, const uint8_t *nal)
+{
+    return codec_id == ENCODER_ID_HEVC ? (nal[0] >> 1) & 0x3f : nal[0] & 0x1f;
+}
+
+static bool xlnx_mp4_is_key(int32_t codec_id, int32_t type)
+{
+    return codec_id == ENCODER_ID_HEVC ? (type >= 16 && type <= 21) : 
+                                        type == 5;
+}
+
+/* Parameter sets and access unit delimiters live in the sample entry, not
+   in the samples */
+static bool xlnx_mp4_is_header_nal(int32_t codec_id, int32_t type)
+{
+    return codec_id == ENCODER_ID_HEVC ? (type >= 32 && type <= 35) :
+                                         (type >= 7 && type <= 9);
+}
+
+/* Finds the next Annex-B start code at or after pos. Returns the offset of
+   the start code or size, with its length (3 or 4) in sc_len. */
+static int32_t xlnx_mp4_find_start_code(const uint8_t *data, int32_t size,
+                                        int32_t pos, int32_t *sc_len)
+{
+    const uint8_t *one;
+    int32_t i;
+
+    /* 0x01 bytes are rare in slice data, so let memchr do the scanning */
+    for(i = pos + 2; i < size; i++) {
+        one = memchr(data + i, 1, size - i);
+        if(!one) {
+            break;
+        }
+        i = one - data;
+        if(data[i - 1] == 0 && data[i - 2] == 0) {
+            if(i - 3 >= pos && data[i - 3] == 0) {
+                *sc_len = 4;
+                return i - 3;
+            }
+            *sc_len = 3;
+            return i - 2;
+        }
+    }
+    *sc_len = 0;
+    return size;
+}
+
+/* The profile, tier and level bytes are copied from the SPS as is, after
+   removing emulation prevention bytes from its head */
+static int32_t xlnx_mp4_unescape(const uint8_t *src, int32_t size,
+                                 uint8_t *dst, int32_t max)
+{
+    int32_t n = 0;
+    int32_t zeros = 0;
+
+    for(int32_t i = 0; i < size && n < max; i++) {
+        if(zeros >= 2 && src[i] == 3) {
+            zeros = 0;
+            continue;
+        }
+        zeros = src[i] == 0 ? zeros + 1 : 0;
+        dst[n++] = src[i];
+    }
+    return n;
+}
+
+static void xlnx_mp4_put_param_array(XlnxMp4Writer *w, int32_t type,
+                                     const XlnxMp4ParamSet *ps)
+{
+    xlnx_mp4_put8(w, 0x80 | type);      /* array_completeness */
+    xlnx_mp4_put16(w, 1);
+    xlnx_mp4_put16(w, ps->size);
+    xlnx_mp4_put_bytes(w, ps->data, ps->size);
+}
+
+static int32_t xlnx_mp4_put_hvcc(XlnxMp4Writer *w, const XlnxMp4ParamSet *ps)
+{
+    uint8_t sps[16];
+    size_t box;
+
+    /* NAL header (2), sub layer info (1), general PTL (12) */
+    if(xlnx_mp4_unescape(ps[1].data, ps[1].size, sps, sizeof(sps)) < 15) {
+        return -1;
+    }
+    box = xlnx_mp4_start_box(w, "hvcC");
+    xlnx_mp4_put8(w, 1);
+    /* profile_space, tier, profile_idc, compatibility flags, constraint
+       flags and level_idc */
+    xlnx_mp4_put_bytes(w, sps + 3, 12);
+    xlnx_mp4_put16(w, 0xf000);          /* min_spatial_segmentation */
+    xlnx_mp4_put8(w, 0xfc);             /* parallelismType */
+    xlnx_mp4_put8(w, 0xfc | 1);         /* 4:2:0 */
+    xlnx_mp4_put8(w, 0xf8);             /* 8 bit luma */
+    xlnx_mp4_put8(w, 0xf8);             /* 8 bit chroma */
+    xlnx_mp4_put16(w, 0);               /* avgFrameRate */
+    /* numTemporalLayers, temporalIdNested, 4 byte NAL lengths */
+    xlnx_mp4_put8(w, ((((sps[2] >> 1) & 0x7) + 1) << 3) |
+                     ((sps[2] & 0x1) << 2) | 3);
+    xlnx_mp4_put8(w, 3);
+    xlnx_mp4_put_param_array(w, 32, &ps[0]);
+    xlnx_mp4_put_param_array(w, 33, &ps[1]);
+    xlnx_mp4_put_param_array(w, 34, &ps[2]);
+    xlnx_mp4_end_box(w, box);
+    return 0;
+}
+
+static int32_t xlnx_mp4_put_avcc(XlnxMp4Writer *w, const XlnxMp4ParamSet *ps)
+{
+    const uint8_t *sps = ps[0].data;
+    size_t box;
+
+    if(ps[0].size < 4) {
+        return -1;
+    }
+    box = xlnx_mp4_start_box(w, "avcC");
+    xlnx_mp4_put8(w, 1);
+    xlnx_mp4_put8(w, sps[1]);           /* profile_idc */
+    xlnx_mp4_put8(w, sps[2]);           /* constraint flags */
+    xlnx_mp4_put8(w, sps[3]);           /* level_idc */
+    xlnx_mp4_put8(w, 0xff);             /* 4 byte NAL lengths */
+    xlnx_mp4_put8(w, 0xe1);
+    xlnx_mp4_put16(w, ps[0].size);
+    xlnx_mp4_put_bytes(w, ps[0].data, ps[0].size);
+    xlnx_mp4_put8(w, 1);
+    xlnx_mp4_put16(w, ps[1].size);
+    xlnx_mp4_put_bytes(w, ps[1].data, ps[1].size);
+    if(sps[1] == 100 || sps[1] == 110 || sps[1] == 122 || sps[1] == 244) {
+        xlnx_mp4_put8(w, 0xfc | 1);     /* 4:2:0 */
+        xlnx_mp4_put8(w, 0xf8);
+        xlnx_mp4_put8(w, 0xf8);
+        xlnx_mp4_put8(w, 0);
+    }
+    xlnx_mp4_end_box(w, box);
+    return 0;
+}
+
+/* ftyp + moov describing one video track with an empty sample table */
+static int32_t xlnx_mp4_write_init(XlnxMp4Mux *mux, const XlnxMp4ParamSet *ps,
+                                   int32_t num_ps)
+{
+    XlnxMp4Writer w;
+    size_t moov, trak, mdia, minf, dinf, dref, stbl, stsd, entry, mvex, box;
+    size_t ps_size = 0;
+    struct iovec iov;
+    int32_t ret = -1;
+
+    for(int32_t i = 0; i < num_ps; i++) {
+        if(!ps[i].data) {
+            return -1;
+        }
+        ps_size += ps[i].size;
+    }
+    w.buf = malloc(XLNX_MP4_INIT_SIZE + ps_size);
+    w.pos = 0;
+    if(!w.buf) {
+        return -1;
+    }
+
+    box = xlnx_mp4_start_box(&w, "ftyp");
+    xlnx_mp4_put_bytes(&w, "cmfc", 4);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_put_bytes(&w, "cmfciso6dash", 12);
+    xlnx_mp4_end_box(&w, box);
+
+    moov = xlnx_mp4_start_box(&w, "moov");
+    box = xlnx_mp4_start_full_box(&w, "mvhd", 0, 0);
+    xlnx_mp4_put_zero(&w, 8);           /* creation, modification time */
+    xlnx_mp4_put32(&w, XLNX_MP4_TIMESCALE);
+    xlnx_mp4_put32(&w, 0);              /* duration lives in fragments */
+    xlnx_mp4_put32(&w, 0x00010000);     /* rate */
+    xlnx_mp4_put16(&w, 0x0100);         /* volume */
+    xlnx_mp4_put_zero(&w, 10);
+    xlnx_mp4_put_matrix(&w);
+    xlnx_mp4_put_zero(&w, 24);
+    xlnx_mp4_put32(&w, XLNX_MP4_TRACK_ID + 1);
+    xlnx_mp4_end_box(&w, box);
+
+    trak = xlnx_mp4_start_box(&w, "trak");
+    box = xlnx_mp4_start_full_box(&w, "tkhd", 0, 0x3);
+    xlnx_mp4_put_zero(&w, 8);
+    xlnx_mp4_put32(&w, XLNX_MP4_TRACK_ID);
+    xlnx_mp4_put_zero(&w, 8);           /* reserved, duration */
+    xlnx_mp4_put_zero(&w, 16);          /* reserved, layer, group, volume */
+    xlnx_mp4_put_matrix(&w);
+    xlnx_mp4_put32(&w, mux->width << 16);
+    xlnx_mp4_put32(&w, mux->height << 16);
+    xlnx_mp4_end_box(&w, box);
+
+    mdia = xlnx_mp4_start_box(&w, "mdia");
+    box = xlnx_mp4_start_full_box(&w, "mdhd", 0, 0);
+    xlnx_mp4_put_zero(&w, 8);
+    xlnx_mp4_put32(&w, XLNX_MP4_TIMESCALE);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_put16(&w, 0x55c4);         /* "und" */
+    xlnx_mp4_put16(&w, 0);
+    xlnx_mp4_end_box(&w, box);
+
+    box = xlnx_mp4_start_full_box(&w, "hdlr", 0, 0);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_put_bytes(&w, "vide", 4);
+    xlnx_mp4_put_zero(&w, 12);
+    xlnx_mp4_put_bytes(&w, "VideoHandler", 13);
+    xlnx_mp4_end_box(&w, box);
+
+    minf = xlnx_mp4_start_box(&w, "minf");
+    box = xlnx_mp4_start_full_box(&w, "vmhd", 0, 0x1);
+    xlnx_mp4_put_zero(&w, 8);
+    xlnx_mp4_end_box(&w, box);
+    dinf = xlnx_mp4_start_box(&w, "dinf");
+    dref = xlnx_mp4_start_full_box(&w, "dref", 0, 0);
+    xlnx_mp4_put32(&w, 1);
+    box = xlnx_mp4_start_full_box(&w, "url ", 0, 0x1);
+    xlnx_mp4_end_box(&w, box);
+    xlnx_mp4_end_box(&w, dref);
+    xlnx_mp4_end_box(&w, dinf);
+
+    stbl = xlnx_mp4_start_box(&w, "stbl");
+    stsd = xlnx_mp4_start_full_box(&w, "stsd", 0, 0);
+    xlnx_mp4_put32(&w, 1);
+    entry = xlnx_mp4_start_box(&w, mux->codec_id == ENCODER_ID_HEVC ? "hvc1" :
+                                                                  "avc1");
+    xlnx_mp4_put_zero(&w, 6);
+    xlnx_mp4_put16(&w, 1);              /* data_reference_index */
+    xlnx_mp4_put_zero(&w, 16);
+    xlnx_mp4_put16(&w, mux->width);
+    xlnx_mp4_put16(&w, mux->height);
+    xlnx_mp4_put32(&w, 0x00480000);     /* 72 dpi */
+    xlnx_mp4_put32(&w, 0x00480000);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_put16(&w, 1);              /* frame_count */
+    xlnx_mp4_put_zero(&w, 32);          /* compressorname */
+    xlnx_mp4_put16(&w, 0x0018);         /* depth */
+    xlnx_mp4_put16(&w, 0xffff);
+    if(mux->codec_id == ENCODER_ID_HEVC) {
+        ret = xlnx_mp4_put_hvcc(&w, ps);
+    } else {
+        ret = xlnx_mp4_put_avcc(&w, ps);
+    }
+    if(ret != 0) {
+        free(w.buf);
+        return -1;
+    }
+    xlnx_mp4_end_box(&w, entry);
+    xlnx_mp4_end_box(&w, stsd);
+    box = xlnx_mp4_start_full_box(&w, "stts", 0, 0);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_end_box(&w, box);
+    box = xlnx_mp4_start_full_box(&w, "stsc", 0, 0);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_end_box(&w, box);
+    box = xlnx_mp4_start_full_box(&w, "stsz", 0, 0);
+    xlnx_mp4_put_zero(&w, 8);
+    xlnx_mp4_end_box(&w, box);
+    box = xlnx_mp4_start_full_box(&w, "stco", 0, 0);
+    xlnx_mp4_put32(&w, 0);
+    xlnx_mp4_end_box(&w, box);
+    xlnx_mp4_end_box(&w, stbl);
+    xlnx_mp4_end_box(&w, minf);
+    xlnx_mp4_end_box(&w, mdia);
+    xlnx_mp4_end_box(&w, trak);
+
+    mvex = xlnx_mp4_start_box(&w, "mvex");
+    box = xlnx_mp4_start_full_box(&w, "trex", 0, 0);
+    xlnx_mp4_put32(&w, XLNX_MP4_TRACK_ID);
+    xlnx_mp4_put32(&w, 1);              /* sample description index */
+    xlnx_mp4_put_zero(&w, 12);
+    xlnx_mp4_end_box(&w, box);
+    xlnx_mp4_end_box(&w, mvex);
+    xlnx_mp4_end_box(&w, moov);
+
+    iov.iov_base = w.buf;
+    iov.iov_len = w.pos;
+    ret = xlnx_mux_writev(mux->fd, &iov, 1);
+    mux->stats.bytes_written += w.pos;
+    free(w.buf);
+    return ret;
+}
+
+static int32_t xlnx_mp4_reserve_nals(XlnxMp4Mux *mux, int32_t num_nals)
+{
+    XlnxMp4Nal *nals;
+
+    if(num_nals <= mux->max_nals) {
+        return 0;
+    }
+    num_nals = num_nals < 2 * mux->max_nals ? 2 * mux->max_nals : num_nals;
+    nals = realloc(mux->nals, num_nals * sizeof(XlnxMp4Nal));
+    if(!nals) {
+        return -1;
+    }
+    mux->nals = nals;
+    mux->max_nals = num_nals;
+    return 0;
+}
+
+static int64_t xlnx_mp4_cpu_time_ns()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Writes the held sample as one CMAF chunk (moof + mdat with one sample);
+   a new segment (styp) starts at every IDR, i.e. on the encoder's
+   gop_size / periodicity-idr cadence. Muxing time up to the write is
+   charged from *start_ns, which restarts after it. */
+static int32_t xlnx_mp4_write_sample(XlnxMp4Mux *mux, int64_t duration,
+                                     int64_t *start_ns)
+{
+    struct iovec iov[2];
+    XlnxMp4Writer w;
+    size_t moof, traf, box;
+    int32_t ret;
+
+    w.buf = mux->hdr;
+    w.pos = 0;
+    if(mux->sample_key) {
+        box = xlnx_mp4_start_box(&w, "styp");
+        xlnx_mp4_put_bytes(&w, "cmfs", 4);
+        xlnx_mp4_put32(&w, 0);
+        xlnx_mp4_put_bytes(&w, "cmfsmsdh", 8);
+        xlnx_mp4_end_box(&w, box);
+    }
+    moof = xlnx_mp4_start_box(&w, "moof");
+    box = xlnx_mp4_start_full_box(&w, "mfhd", 0, 0);
+    xlnx_mp4_put32(&w, ++mux->sequence);
+    xlnx_mp4_end_box(&w, box);
+    traf = xlnx_mp4_start_box(&w, "traf");
+    /* default-base-is-moof */
+    box = xlnx_mp4_start_full_box(&w, "tfhd", 0, 0x020000);
+    xlnx_mp4_put32(&w, XLNX_MP4_TRACK_ID);
+    xlnx_mp4_end_box(&w, box);
+    box = xlnx_mp4_start_full_box(&w, "tfdt", 1, 0);
+    xlnx_mp4_put64(&w, mux->sample_dts - mux->first_dts);
+    xlnx_mp4_end_box(&w, box);
+    /* data offset, duration, size, flags and signed composition offset */
+    box = xlnx_mp4_start_full_box(&w, "trun", 1, 0x000f01);
+    xlnx_mp4_put32(&w, 1);
+    xlnx_mp4_put32(&w, XLNX_MP4_MOOF_SIZE + 8);
+    xlnx_mp4_put32(&w, (uint32_t)duration);
+    xlnx_mp4_put32(&w, mux->sample_size);
+    xlnx_mp4_put32(&w, mux->sample_key ? XLNX_MP4_SAMPLE_SYNC : 
+                                         XLNX_MP4_SAMPLE_NONSYNC);
+    xlnx_mp4_put32(&w, (uint32_t)(mux->sample_pts - mux->sample_dts));
+    xlnx_mp4_end_box(&w, box);
+    xlnx_mp4_end_box(&w, traf);
+    xlnx_mp4_end_box(&w, moof);
+    xlnx_mp4_put32(&w, 8 + mux->sample_size);
+    xlnx_mp4_put_bytes(&w, "mdat", 4);
+
+    iov[0].iov_base = mux->hdr;
+    iov[0].iov_len = w.pos;
+    iov[1].iov_base = mux->sample;
+    iov[1].iov_len = mux->sample_size;
+    mux->stats.bytes_written += w.pos + mux->sample_size;
+    mux->stats.num_fragments++;
+    mux->stats.num_segments += mux->sample_key;
+    mux->stats.mux_time_ns += xlnx_mp4_cpu_time_ns() - *start_ns;
+    mux->held = false;
+    mux->last_duration = duration;
+
+    ret = xlnx_mux_writev(mux->fd, iov, 2);
+    *start_ns = xlnx_mp4_cpu_time_ns();
+    return ret;
+}
+
+XlnxMp4Mux *Mp4Mux_Open(int fd, int codec_id, int width, int height, int fps)
+{
+    XlnxMp4Mux *mux;
+
+    if(fd < 0 || width <= 0 || height <= 0 || fps <= 0) {
+        return NULL;
+    }
+    mux = calloc(1, sizeof(XlnxMp4Mux));
+    if(!mux) {
+        return NULL;
+    }
+    mux->fd = fd;
+    mux->codec_id = codec_id;
+    mux->width = width;
+    mux->height = height;
+    mux->fps = fps;
+    return mux;
+}
+
+int Mp4Mux_WritePacket(XlnxMp4Mux *mux, const char *data, int size, 
+                       int64_t pts, int64_t dts)
+{
+    const uint8_t *au = (const uint8_t *)data;
+    int64_t start_ns = xlnx_mp4_cpu_time_ns();
+    XlnxMp4ParamSet ps[3];
+    int32_t num_nals = 0;
+    int32_t num_ps = mux->codec_id == ENCODER_ID_HEVC ? 3 : 2;
+    int32_t pos, next, sc_len, next_sc_len, type;
+    size_t sample_size = 0;
+    XlnxMp4Nal *nal;
+    uint8_t *sample;
+    uint8_t *p;
+    bool key = false;
+
+    /* Index the NALs once: classify the access unit and pick up the
+       parameter sets for the init segment */
+    memset(ps, 0, sizeof(ps));
+    pos = xlnx_mp4_find_start_code(au, size, 0, &sc_len);
+    while(pos < size) {
+        next = xlnx_mp4_find_start_code(au, size, pos + sc_len, &next_sc_len);
+        if(pos + sc_len < next) {
+            if(xlnx_mp4_reserve_nals(mux, num_nals + 1) != 0) {
+                return -1;
+            }
+            nal = &mux->nals[num_nals++];
+            nal->pos = pos;
+            nal->sc_len = sc_len;
+            nal->size = next - pos - sc_len;
+            nal->type = xlnx_mp4_nal_type(mux->codec_id, au + pos + sc_len);
+            key |= xlnx_mp4_is_key(mux->codec_id, nal->type);
+            type = mux->codec_id == ENCODER_ID_HEVC ? nal->type - 32 : 
+                                                      nal->type - 7;
+            if(type >= 0 && type < num_ps && !ps[type].data) {
+                ps[type].data = au + pos + sc_len;
+                ps[type].size = nal->size;
+            }
+            if(!xlnx_mp4_is_header_nal(mux->codec_id, nal->type)) {
+                sample_size += 4 + nal->size;
+            }
+        }
+        pos = next;
+        sc_len = next_sc_len;
+    }
+
+    if(!mux->init_written) {
+        /* The stream has to open on an IDR carrying its parameter sets */
+        if(!key || xlnx_mp4_write_init(mux, ps, num_ps) != 0) {
+            return -1;
+        }
+        mux->init_written = true;
+        mux->first_dts = dts;
+    }
+
+    /* The held sample lasts until this one is decoded */
+    if(mux->held) {
+        if(dts <= mux->sample_dts || 
+           xlnx_mp4_write_sample(mux, dts - mux->sample_dts, 
+                                 &start_ns) != 0) {
+            return -1;
+        }
+    }
+
+    /* Start codes become 4 byte lengths as the sample is copied out of
+       data, which the caller gets back unchanged */
+    if(sample_size > mux->sample_capacity) {
+        sample = realloc(mux->sample, sample_size);
+        if(!sample) {
+            return -1;
+        }
+        mux->sample = sample;
+        mux->sample_capacity = sample_size;
+    }
+    p = mux->sample;
+    for(int32_t i = 0; i < num_nals; i++) {
+        nal = &mux->nals[i];
+        if(xlnx_mp4_is_header_nal(mux->codec_id, nal->type)) {
+            continue;
+        }
+        p[0] = nal->size >> 24;
+        p[1] = nal->size >> 16;
+        p[2] = nal->size >> 8;
+        p[3] = nal->size;
+        memcpy(p + 4, au + nal->pos + nal->sc_len, nal->size);
+        p += 4 + nal->size;
+    }
+    mux->sample_size = sample_size;
+    mux->sample_pts = pts;
+    mux->sample_dts = dts;
+    mux->sample_key = key;
+    mux->held = true;
+    mux->stats.mux_time_ns += xlnx_mp4_cpu_time_ns() - start_ns;
+    return 0;
+}
+
+int Mp4Mux_Flush(XlnxMp4Mux *mux)
+{
+    int64_t start_ns = xlnx_mp4_cpu_time_ns();
+
+    if(!mux->held) {
+        return 0;
+    }
+    /* Nothing follows the last sample, it lasts as long as the one before
+       it, or one frame interval when it is the only one */
+    return xlnx_mp4_write_sample(mux, mux->last_duration > 0 ? 
+                                      mux->last_duration : 
+                                      XLNX_MP4_TIMESCALE / mux->fps, 
+                                 &start_ns);
+}
+
+void Mp4Mux_GetStats(const XlnxMp4Mux *mux, XlnxMp4MuxStats *stats)
+{
+    *stats = mux->stats;
+}
+
+void Mp4Mux_Close(XlnxMp4Mux *mux)
+{
+    if(!mux) {
+        return;
+    }
+    Mp4Mux_Flush(mux);
+    free(mux->nals);
+    free(mux->sample);
+    free(mux);
+}
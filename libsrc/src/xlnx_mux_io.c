@@ -0,0 +1,30 @@
+#include "xlnx_mux_io.h"
+
+#include <errno.h>
+#include <unistd.h>
+
+int32_t xlnx_mux_writev(int32_t fd, struct iovec *iov, int32_t iovcnt)
+{
+    ssize_t written;
+
+    while(iovcnt > 0) {
+        written = writev(fd, iov, iovcnt);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        /* Partial write, skip what went out and retry the rest */
+        while(iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef _XLNX_MUX_IO_H_
+#define _XLNX_MUX_IO_H_
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Writes every iovec to fd, retrying on EINTR and partial writes. The iov
+   array is consumed in the process. Returns 0 on success, -1 on error. */
+int32_t xlnx_mux_writev(int32_t fd, struct iovec *iov, int32_t iovcnt);
+
+#endif
@@ -0,0 +1,153 @@
+#include "xlnx_packet_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+struct XlnxPacketPool {
+    pthread_mutex_t lock;
+    XlnxPacketBuf   *free_list;
+    size_t          buf_size;
+    /* One for the owning channel plus one per packet in flight */
+    int32_t         refs;
+};
+
+static void xlnx_packet_pool_destroy(XlnxPacketPool *pool)
+{
+    XlnxPacketBuf *buf;
+
+    while(pool->free_list) {
+        buf = pool->free_list;
+        pool->free_list = buf->next;
+        free(buf->buffer);
+        free(buf);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+XlnxPacketPool *xlnx_packet_pool_create(size_t buf_size)
+{
+    XlnxPacketPool *pool = calloc(1, sizeof(XlnxPacketPool));
+
+    if(!pool) {
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->buf_size = buf_size;
+    pool->refs = 1;
+    return pool;
+}
+
+void xlnx_packet_pool_release(XlnxPacketPool *pool)
+{
+    int32_t last;
+
+    if(!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    last = --pool->refs == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if(last) {
+        xlnx_packet_pool_destroy(pool);
+    }
+}
+
+void xlnx_packet_pool_grow(XlnxPacketPool *pool, size_t buf_size)
+{
+    pthread_mutex_lock(&pool->lock);
+    if(buf_size > pool->buf_size) {
+        pool->buf_size = buf_size;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+XlnxPacketBuf *xlnx_packet_pool_get(XlnxPacketPool *pool)
+{
+    XlnxPacketBuf *buf;
+    size_t buf_size;
+
+    pthread_mutex_lock(&pool->lock);
+    buf = pool->free_list;
+    if(buf) {
+        pool->free_list = buf->next;
+    }
+    buf_size = pool->buf_size;
+    pool->refs++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if(!buf) {
+        buf = calloc(1, sizeof(XlnxPacketBuf));
+        if(!buf) {
+            xlnx_packet_pool_release(pool);
+            return NULL;
+        }
+        buf->pool = pool;
+    }
+    /* Buffers recycled from before a grow are enlarged on their way out */
+    if(buf->capacity < buf_size) {
+        free(buf->buffer);
+        buf->buffer = malloc(buf_size);
+        buf->capacity = buf->buffer ? buf_size : 0;
+        if(!buf->buffer) {
+            free(buf);
+            xlnx_packet_pool_release(pool);
+            return NULL;
+        }
+    }
+    buf->refs = 1;
+    buf->next = NULL;
+    buf->pkt.data = buf->buffer;
+    buf->pkt.size = 0;
+    buf->pkt.pts = 0;
+    return buf;
+}
+
+int32_t xlnx_packet_buf_reserve(XlnxPacketBuf *buf, size_t size)
+{
+    char *grown;
+
+    if(size <= buf->capacity) {
+        return 0;
+    }
+    grown = realloc(buf->buffer, size);
+    if(!grown) {
+        return -1;
+    }
+    buf->buffer = grown;
+    buf->capacity = size;
+    buf->pkt.data = grown;
+    return 0;
+}
+
+void xlnx_packet_buf_unref(XlnxPacketBuf *buf)
+{
+    XlnxPacketPool *pool;
+    int32_t last;
+
+    if(!buf || __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    pool = buf->pool;
+    pthread_mutex_lock(&pool->lock);
+    buf->next = pool->free_list;
+    pool->free_list = buf;
+    last = --pool->refs == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if(last) {
+        xlnx_packet_pool_destroy(pool);
+    }
+}
+
+XlnxEncoderPacket *Encoder_PacketRef(XlnxEncoderPacket *pkt)
+{
+    if(pkt) {
+        __atomic_add_fetch(&((XlnxPacketBuf *)pkt)->refs, 1, __ATOMIC_RELAXED);
+    }
+    return pkt;
+}
+
+void Encoder_PacketUnref(XlnxEncoderPacket *pkt)
+{
+    xlnx_packet_buf_unref((XlnxPacketBuf *)pkt);
+}
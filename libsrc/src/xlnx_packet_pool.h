@@ -0,0 +1,40 @@
+#ifndef _XLNX_PACKET_POOL_H_
+#define _XLNX_PACKET_POOL_H_
+
+#include "xilinx_encoder.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct XlnxPacketPool XlnxPacketPool;
+
+/* Refcounted bitstream buffer. pkt comes first so the XlnxEncoderPacket
+   handed to callers converts back to its buffer. */
+typedef struct XlnxPacketBuf {
+    XlnxEncoderPacket     pkt;
+    char                  *buffer;
+    size_t                capacity;
+    int32_t               refs;
+    XlnxPacketPool        *pool;
+    struct XlnxPacketBuf  *next;
+} XlnxPacketBuf;
+
+/* Pool of buffers of at least buf_size bytes. The pool stays alive until
+   it was released and every packet taken from it was unreferenced, so
+   packets may outlive their channel. */
+XlnxPacketPool *xlnx_packet_pool_create(size_t buf_size);
+
+void xlnx_packet_pool_release(XlnxPacketPool *pool);
+
+/* Raises the size of buffers handed out from now on */
+void xlnx_packet_pool_grow(XlnxPacketPool *pool, size_t buf_size);
+
+/* Free buffer with one reference, recycled when available */
+XlnxPacketBuf *xlnx_packet_pool_get(XlnxPacketPool *pool);
+
+/* Makes room for size bytes, keeping the contents. 0 on success. */
+int32_t xlnx_packet_buf_reserve(XlnxPacketBuf *buf, size_t size);
+
+void xlnx_packet_buf_unref(XlnxPacketBuf *buf);
+
+#endif
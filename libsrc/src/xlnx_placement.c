@@ -0,0 +1,96 @@
+#include "xlnx_placement.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int32_t xlnx_placement_policy = XLNX_PLACEMENT_XRM;
+
+int Encoder_SetPlacementPolicy(int policy)
+{
+    if(policy < XLNX_PLACEMENT_XRM || policy > XLNX_PLACEMENT_WORST_FIT) {
+        return -1;
+    }
+    __atomic_store_n(&xlnx_placement_policy, policy, __ATOMIC_RELAXED);
+    return 0;
+}
+
+/* Same CU list restricted to one device, or to none for device_id -1 */
+static void xlnx_placement_props_v2(const xrmCuPoolProperty *cu_pool_prop, 
+                                    int32_t device_id, 
+                                    xrmCuPoolPropertyV2 *cu_pool_prop_v2)
+{
+    const xrmCuListProperty *list = &cu_pool_prop->cuListProp;
+    xrmCuPropertyV2 *cu;
+
+    memset(cu_pool_prop_v2, 0, sizeof(*cu_pool_prop_v2));
+    cu_pool_prop_v2->cuListNum = cu_pool_prop->cuListNum;
+    cu_pool_prop_v2->cuListProp.sameDevice = list->sameDevice;
+    cu_pool_prop_v2->cuListProp.cuNum = list->cuNum;
+    for(int32_t i = 0; i < list->cuNum; i++) {
+        cu = &cu_pool_prop_v2->cuListProp.cuProps[i];
+        strcpy(cu->kernelName, list->cuProps[i].kernelName);
+        strcpy(cu->kernelAlias, list->cuProps[i].kernelAlias);
+        cu->requestLoad = list->cuProps[i].requestLoad;
+        if(device_id >= 0) {
+            cu->deviceInfo = 
+                ((uint64_t)device_id << XRM_DEVICE_INFO_DEVICE_INDEX_SHIFT) |
+                ((uint64_t)XRM_DEVICE_INFO_CONSTRAINT_TYPE_HARDWARE_DEVICE_INDEX
+                 << XRM_DEVICE_INFO_CONSTRAINT_TYPE_SHIFT);
+        }
+    }
+}
+
+int32_t xlnx_placement_available(xrmContext *xrm_ctx, 
+                                 const xrmCuPoolProperty *cu_pool_prop, 
+                                 int32_t device_id)
+{
+    xrmCuPoolPropertyV2 *cu_pool_prop_v2;
+    int32_t num;
+
+    cu_pool_prop_v2 = malloc(sizeof(*cu_pool_prop_v2));
+    if(!cu_pool_prop_v2) {
+        return -1;
+    }
+    xlnx_placement_props_v2(cu_pool_prop, device_id, cu_pool_prop_v2);
+    num = xrmCheckCuPoolAvailableNumV2(xrm_ctx, cu_pool_prop_v2);
+    free(cu_pool_prop_v2);
+    return num;
+}
+
+/* Best fit goes to the device with the fewest copies left, so partly used
+   devices fill up and empty ones stay whole for large jobs. Worst fit 
+   goes to the one with the most, spreading the load. Ties go to the lower
+   device index. */
+int32_t xlnx_placement_pick(int32_t policy, const int32_t *fit, 
+                            int32_t num_devices)
+{
+    int32_t best = -1;
+
+    for(int32_t d = 0; d < num_devices; d++) {
+        if(fit[d] <= 0) {
+            continue;
+        }
+        if(best < 0 || 
+           (policy == XLNX_PLACEMENT_BEST_FIT && fit[d] < fit[best]) ||
+           (policy == XLNX_PLACEMENT_WORST_FIT && fit[d] > fit[best])) {
+            best = d;
+        }
+    }
+    return best;
+}
+
+int32_t xlnx_placement_select(xrmContext *xrm_ctx, 
+                              const xrmCuPoolProperty *cu_pool_prop)
+{
+    int32_t policy = __atomic_load_n(&xlnx_placement_policy, 
+                                     __ATOMIC_RELAXED);
+    int32_t fit[XLNX_CAPACITY_MAX_DEVICES];
+
+    if(policy == XLNX_PLACEMENT_XRM) {
+        return -1;
+    }
+    for(int32_t d = 0; d < XLNX_CAPACITY_MAX_DEVICES; d++) {
+        fit[d] = xlnx_placement_available(xrm_ctx, cu_pool_prop, d);
+    }
+    return xlnx_placement_pick(policy, fit, XLNX_CAPACITY_MAX_DEVICES);
+}
@@ -0,0 +1,26 @@
+#ifndef _XLNX_PLACEMENT_H_
+#define _XLNX_PLACEMENT_H_
+
+#include "xilinx_encoder.h"
+
+#include <stdint.h>
+#include <xrm.h>
+
+/* Copies of the CU list that still fit on device_id, or on any device for
+   -1, without reserving them. Negative when XRM rejects the request, e.g.
+   for a device that is not there. */
+int32_t xlnx_placement_available(xrmContext *xrm_ctx, 
+                                 const xrmCuPoolProperty *cu_pool_prop, 
+                                 int32_t device_id);
+
+/* Index into fit, the copies of a CU list each device still takes, chosen
+   by policy; -1 when no device takes one */
+int32_t xlnx_placement_pick(int32_t policy, const int32_t *fit, 
+                            int32_t num_devices);
+
+/* Device for a new CU list under the process policy, -1 when XRM is to 
+   pick or no device takes it */
+int32_t xlnx_placement_select(xrmContext *xrm_ctx, 
+                              const xrmCuPoolProperty *cu_pool_prop);
+
+#endif
@@ -0,0 +1,306 @@
+#include "xlnx_scene_detect.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XLNX_SCENE_HAVE_X86 1
+#endif
+
+struct XlnxSceneDetector {
+    int32_t width;
+    int32_t height;
+    int32_t blocks_w;
+    int32_t blocks_h;
+    double  threshold;
+    /* Block means of the current and the previous frame */
+    uint8_t *cur;
+    uint8_t *prev;
+    int32_t have_prev;
+    double  prev_mafd;
+    double  score;
+};
+
+typedef void (*XlnxSceneDownscaleFunc)(const uint8_t *luma, int32_t stride,
+                                       int32_t blocks_w, int32_t blocks_h, 
+                                       uint8_t *dst);
+typedef uint64_t (*XlnxSceneSadFunc)(const uint8_t *a, const uint8_t *b, 
+                                     size_t count);
+
+static XlnxSceneDownscaleFunc xlnx_scene_downscale_func = 
+                                                   xlnx_scene_downscale_c;
+static XlnxSceneSadFunc xlnx_scene_sad_func = xlnx_scene_sad_c;
+static const char *xlnx_scene_kernel_name = "c";
+static pthread_once_t xlnx_scene_dispatch_once = PTHREAD_ONCE_INIT;
+
+void xlnx_scene_downscale_c(const uint8_t *luma, int32_t stride, 
+                            int32_t blocks_w, int32_t blocks_h, uint8_t *dst)
+{
+    for(int32_t by = 0; by < blocks_h; by++) {
+        const uint8_t *row = luma + (size_t)by * XLNX_SCENE_BLOCK_SIZE * stride;
+        for(int32_t bx = 0; bx < blocks_w; bx++) {
+            const uint8_t *blk = row + bx * XLNX_SCENE_BLOCK_SIZE;
+            uint32_t sum = 0;
+            for(int32_t y = 0; y < XLNX_SCENE_BLOCK_SIZE; y++) {
+                for(int32_t x = 0; x < XLNX_SCENE_BLOCK_SIZE; x++) {
+                    sum += blk[(size_t)y * stride + x];
+                }
+            }
+            dst[(size_t)by * blocks_w + bx] = (uint8_t)((sum + 32) >> 6);
+        }
+    }
+}
+
+uint64_t xlnx_scene_sad_c(const uint8_t *a, const uint8_t *b, size_t count)
+{
+    uint64_t sad = 0;
+
+    for(size_t i = 0; i < count; i++) {
+        sad += (a[i] > b[i]) ? a[i] - b[i] : b[i] - a[i];
+    }
+    return sad;
+}
+
+#ifdef XLNX_SCENE_HAVE_X86
+/* psadbw against zero sums 8 bytes at a time, which is one block row */
+__attribute__((target("sse2")))
+static void xlnx_scene_downscale_sse2(const uint8_t *luma, int32_t stride,
+                                      int32_t blocks_w, int32_t blocks_h, 
+                                      uint8_t *dst)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi64x(32);
+
+    for(int32_t by = 0; by < blocks_h; by++) {
+        const uint8_t *row = luma + (size_t)by * XLNX_SCENE_BLOCK_SIZE * stride;
+        uint8_t *out = dst + (size_t)by * blocks_w;
+        int32_t bx = 0;
+
+        for(; bx + 2 <= blocks_w; bx += 2) {
+            const uint8_t *p = row + bx * XLNX_SCENE_BLOCK_SIZE;
+            __m128i sum = round;
+            for(int32_t y = 0; y < XLNX_SCENE_BLOCK_SIZE; y++) {
+                sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_loadu_si128(
+                                  (const __m128i *)(p + (size_t)y * stride)), 
+                                  zero));
+            }
+            sum = _mm_srli_epi64(sum, 6);
+            out[bx] = (uint8_t)_mm_cvtsi128_si32(sum);
+            out[bx + 1] = (uint8_t)_mm_extract_epi16(sum, 4);
+        }
+        if(bx < blocks_w) {
+            xlnx_scene_downscale_c(row + bx * XLNX_SCENE_BLOCK_SIZE, stride, 
+                                   blocks_w - bx, 1, out + bx);
+        }
+    }
+}
+
+__attribute__((target("sse2")))
+static uint64_t xlnx_scene_sad_sse2(const uint8_t *a, const uint8_t *b, 
+                                    size_t count)
+{
+    __m128i acc = _mm_setzero_si128();
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16) {
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(
+                  _mm_loadu_si128((const __m128i *)(a + i)),
+                  _mm_loadu_si128((const __m128i *)(b + i))));
+    }
+    return (uint64_t)_mm_cvtsi128_si64(acc) + 
+           (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc, acc)) +
+           xlnx_scene_sad_c(a + i, b + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void xlnx_scene_downscale_avx2(const uint8_t *luma, int32_t stride,
+                                      int32_t blocks_w, int32_t blocks_h, 
+                                      uint8_t *dst)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i round = _mm256_set1_epi64x(32);
+    uint64_t sums[4];
+
+    for(int32_t by = 0; by < blocks_h; by++) {
+        const uint8_t *row = luma + (size_t)by * XLNX_SCENE_BLOCK_SIZE * stride;
+        uint8_t *out = dst + (size_t)by * blocks_w;
+        int32_t bx = 0;
+
+        for(; bx + 4 <= blocks_w; bx += 4) {
+            const uint8_t *p = row + bx * XLNX_SCENE_BLOCK_SIZE;
+            __m256i sum = round;
+            for(int32_t y = 0; y < XLNX_SCENE_BLOCK_SIZE; y++) {
+                sum = _mm256_add_epi64(sum, _mm256_sad_epu8(
+                          _mm256_loadu_si256((const __m256i *)
+                                             (p + (size_t)y * stride)), 
+                          zero));
+            }
+            _mm256_storeu_si256((__m256i *)sums, _mm256_srli_epi64(sum, 6));
+            out[bx] = (uint8_t)sums[0];
+            out[bx + 1] = (uint8_t)sums[1];
+            out[bx + 2] = (uint8_t)sums[2];
+            out[bx + 3] = (uint8_t)sums[3];
+        }
+        if(bx < blocks_w) {
+            xlnx_scene_downscale_sse2(row + bx * XLNX_SCENE_BLOCK_SIZE, stride,
+                                      blocks_w - bx, 1, out + bx);
+        }
+    }
+}
+
+__attribute__((target("avx2")))
+static uint64_t xlnx_scene_sad_avx2(const uint8_t *a, const uint8_t *b, 
+                                    size_t count)
+{
+    __m256i acc = _mm256_setzero_si256();
+    uint64_t sums[4];
+    size_t i = 0;
+
+    for(; i + 32 <= count; i += 32) {
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(
+                  _mm256_loadu_si256((const __m256i *)(a + i)),
+                  _mm256_loadu_si256((const __m256i *)(b + i))));
+    }
+    _mm256_storeu_si256((__m256i *)sums, acc);
+    return sums[0] + sums[1] + sums[2] + sums[3] + 
+           xlnx_scene_sad_sse2(a + i, b + i, count - i);
+}
+#endif
+
+static void xlnx_scene_dispatch_init()
+{
+#ifdef XLNX_SCENE_HAVE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")) {
+        xlnx_scene_downscale_func = xlnx_scene_downscale_avx2;
+        xlnx_scene_sad_func = xlnx_scene_sad_avx2;
+        xlnx_scene_kernel_name = "avx2";
+    }
+    else if(__builtin_cpu_supports("sse2")) {
+        xlnx_scene_downscale_func = xlnx_scene_downscale_sse2;
+        xlnx_scene_sad_func = xlnx_scene_sad_sse2;
+        xlnx_scene_kernel_name = "sse2";
+    }
+#endif
+}
+
+void xlnx_scene_downscale(const uint8_t *luma, int32_t stride, 
+                          int32_t blocks_w, int32_t blocks_h, uint8_t *dst)
+{
+    pthread_once(&xlnx_scene_dispatch_once, xlnx_scene_dispatch_init);
+    xlnx_scene_downscale_func(luma, stride, blocks_w, blocks_h, dst);
+}
+
+uint64_t xlnx_scene_sad(const uint8_t *a, const uint8_t *b, size_t count)
+{
+    pthread_once(&xlnx_scene_dispatch_once, xlnx_scene_dispatch_init);
+    return xlnx_scene_sad_func(a, b, count);
+}
+
+const char *xlnx_scene_detect_kernel_name()
+{
+    pthread_once(&xlnx_scene_dispatch_once, xlnx_scene_dispatch_init);
+    return xlnx_scene_kernel_name;
+}
+
+int32_t xlnx_scene_detect_set_kernel(const char *name)
+{
+    pthread_once(&xlnx_scene_dispatch_once, xlnx_scene_dispatch_init);
+    if(strcmp(name, "c") == 0) {
+        xlnx_scene_downscale_func = xlnx_scene_downscale_c;
+        xlnx_scene_sad_func = xlnx_scene_sad_c;
+    }
+#ifdef XLNX_SCENE_HAVE_X86
+    else if(strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        xlnx_scene_downscale_func = xlnx_scene_downscale_sse2;
+        xlnx_scene_sad_func = xlnx_scene_sad_sse2;
+    }
+    else if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        xlnx_scene_downscale_func = xlnx_scene_downscale_avx2;
+        xlnx_scene_sad_func = xlnx_scene_sad_avx2;
+    }
+#endif
+    else {
+        return -1;
+    }
+    xlnx_scene_kernel_name = name;
+    return 0;
+}
+
+XlnxSceneDetector *xlnx_scene_detector_create(int32_t width, int32_t height,
+                                              int32_t threshold)
+{
+    XlnxSceneDetector *det;
+    size_t num_blocks;
+
+    if(width < XLNX_SCENE_BLOCK_SIZE || height < XLNX_SCENE_BLOCK_SIZE || 
+       threshold <= 0 || threshold > 100) {
+        return NULL;
+    }
+    det = calloc(1, sizeof(XlnxSceneDetector));
+    if(!det) {
+        return NULL;
+    }
+    det->width = width;
+    det->height = height;
+    det->blocks_w = width / XLNX_SCENE_BLOCK_SIZE;
+    det->blocks_h = height / XLNX_SCENE_BLOCK_SIZE;
+    det->threshold = threshold;
+    num_blocks = (size_t)det->blocks_w * det->blocks_h;
+    det->cur = malloc(num_blocks);
+    det->prev = malloc(num_blocks);
+    if(!det->cur || !det->prev) {
+        xlnx_scene_detector_destroy(det);
+        return NULL;
+    }
+    return det;
+}
+
+void xlnx_scene_detector_destroy(XlnxSceneDetector *det)
+{
+    if(!det) {
+        return;
+    }
+    free(det->cur);
+    free(det->prev);
+    free(det);
+}
+
+/* Same decision as the scdet filter: the mean absolute frame difference, in
+   percent, has to be high and also jump against the previous difference. 
+   Steady motion keeps a high but flat difference and does not trigger, 
+   and a single flash frame only triggers on the way in. */
+int32_t xlnx_scene_detector_process(XlnxSceneDetector *det, 
+                                    const uint8_t *luma, int32_t stride)
+{
+    size_t num_blocks = (size_t)det->blocks_w * det->blocks_h;
+    uint8_t *tmp;
+    double mafd;
+    double diff;
+
+    xlnx_scene_downscale(luma, stride, det->blocks_w, det->blocks_h, det->cur);
+
+    det->score = 0;
+    if(det->have_prev) {
+        mafd = (double)xlnx_scene_sad(det->cur, det->prev, num_blocks) * 
+               100.0 / (num_blocks * 255.0);
+        diff = mafd > det->prev_mafd ? mafd - det->prev_mafd : 
+                                       det->prev_mafd - mafd;
+        det->score = mafd < diff ? mafd : diff;
+        det->prev_mafd = mafd;
+    }
+
+    tmp = det->prev;
+    det->prev = det->cur;
+    det->cur = tmp;
+    det->have_prev = 1;
+
+    return det->score >= det->threshold;
+}
+
+double xlnx_scene_detector_score(const XlnxSceneDetector *det)
+{
+    return det->score;
+}
@@ -0,0 +1,47 @@
+#ifndef _XLNX_SCENE_DETECT_H_
+#define _XLNX_SCENE_DETECT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Luma is reduced to one mean per block before frames are compared */
+#define XLNX_SCENE_BLOCK_SIZE 8
+
+typedef struct XlnxSceneDetector XlnxSceneDetector;
+
+/* threshold is the score, 1 - 100, from which a frame starts a new scene */
+XlnxSceneDetector *xlnx_scene_detector_create(int32_t width, int32_t height,
+                                              int32_t threshold);
+
+void xlnx_scene_detector_destroy(XlnxSceneDetector *det);
+
+/* Compares the luma plane with the previous frame's. Returns 1 when the
+   frame starts a new scene, 0 otherwise. */
+int32_t xlnx_scene_detector_process(XlnxSceneDetector *det, 
+                                    const uint8_t *luma, int32_t stride);
+
+/* Score of the last processed frame, 0 - 100 */
+double xlnx_scene_detector_score(const XlnxSceneDetector *det);
+
+/* Block means of a blocks_w x blocks_h grid of 8x8 luma blocks */
+void xlnx_scene_downscale(const uint8_t *luma, int32_t stride, 
+                          int32_t blocks_w, int32_t blocks_h, uint8_t *dst);
+
+/* Portable reference kernel */
+void xlnx_scene_downscale_c(const uint8_t *luma, int32_t stride, 
+                            int32_t blocks_w, int32_t blocks_h, uint8_t *dst);
+
+/* Sum of absolute differences of two count byte arrays */
+uint64_t xlnx_scene_sad(const uint8_t *a, const uint8_t *b, size_t count);
+
+/* Portable reference kernel */
+uint64_t xlnx_scene_sad_c(const uint8_t *a, const uint8_t *b, size_t count);
+
+/* Kernel picked for this CPU: "avx2", "sse2" or "c" */
+const char *xlnx_scene_detect_kernel_name();
+
+/* Forces one of the kernel names above for tests, -1 when the CPU lacks 
+   it. Must not race with running detectors. */
+int32_t xlnx_scene_detect_set_kernel(const char *name);
+
+#endif
@@ -0,0 +1,423 @@
+#include "xlnx_telemetry.h"
+#include "xlnx_placement.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <xma.h>
+
+#define XLNX_TELEMETRY_MODULE "xlnx_telemetry"
+
+/* Hard CU headroom is counted in copies of a 1% request */
+#define XLNX_TELEMETRY_PCT_LOAD (XRM_MAX_CU_LOAD_GRANULARITY_1000000 / 100)
+#define XLNX_TELEMETRY_LOAD_MASK(load) ((load) << 8)
+
+#define xlnx_telemetry_max(a,b) (((a) > (b)) ? (a) : (b))
+
+static const char *xlnx_telemetry_cu_names[XLNX_TELEMETRY_NUM_CUS][2] = {
+    [XLNX_TELEMETRY_CU_DECODER]   = {"decoder", "DECODER_MPSOC"},
+    [XLNX_TELEMETRY_CU_SCALER]    = {"scaler", "SCALER_MPSOC"},
+    [XLNX_TELEMETRY_CU_LOOKAHEAD] = {"lookahead", "LOOKAHEAD_MPSOC"},
+    [XLNX_TELEMETRY_CU_ENCODER]   = {"encoder", "ENCODER_MPSOC"}
+};
+
+/* Registered channels, only touched on open, close and by the sampler */
+static pthread_mutex_t xlnx_telemetry_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static XlnxTelemetryChannel *xlnx_telemetry_channels = NULL;
+static int32_t xlnx_telemetry_next_id = 0;
+
+static XlnxXrmLatency xlnx_telemetry_xrm[XLNX_TELEMETRY_XRM_NUM];
+
+/* The sampler is the only writer. Odd sequence numbers mark an update in
+   progress, readers copy and retry until they see the same even number 
+   before and after. */
+static XlnxTelemetrySnapshot xlnx_telemetry_snap;
+static uint64_t xlnx_telemetry_seq = 0;
+
+typedef struct XlnxTelemetrySampler {
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int32_t         running;
+    int32_t         stop;
+    int32_t         period_ms;
+    int32_t         num_devices;
+    int32_t         devices[XLNX_CAPACITY_MAX_DEVICES];
+    xrmContext      *xrm_ctx;
+} XlnxTelemetrySampler;
+
+static XlnxTelemetrySampler xlnx_telemetry_sampler = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER
+};
+
+static int64_t xlnx_telemetry_now_us()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void xlnx_telemetry_register(XlnxTelemetryChannel *chan, int32_t kind, 
+                             int32_t device_id)
+{
+    pthread_mutex_lock(&xlnx_telemetry_reg_lock);
+    if(!chan->registered) {
+        chan->id = xlnx_telemetry_next_id++;
+        chan->kind = kind;
+        chan->device_id = device_id;
+        chan->registered = 1;
+        chan->next = xlnx_telemetry_channels;
+        xlnx_telemetry_channels = chan;
+    }
+    pthread_mutex_unlock(&xlnx_telemetry_reg_lock);
+}
+
+void xlnx_telemetry_unregister(XlnxTelemetryChannel *chan)
+{
+    XlnxTelemetryChannel **link;
+
+    pthread_mutex_lock(&xlnx_telemetry_reg_lock);
+    for(link = &xlnx_telemetry_channels; *link; link = &(*link)->next) {
+        if(*link == chan) {
+            *link = chan->next;
+            break;
+        }
+    }
+    chan->registered = 0;
+    chan->next = NULL;
+    pthread_mutex_unlock(&xlnx_telemetry_reg_lock);
+}
+
+void xlnx_telemetry_count(XlnxTelemetryChannel *chan, int64_t frames_in, 
+                          int64_t frames_out)
+{
+    __atomic_store_n(&chan->frames_in, frames_in, __ATOMIC_RELAXED);
+    __atomic_store_n(&chan->frames_out, frames_out, __ATOMIC_RELAXED);
+}
+
+void xlnx_telemetry_pool(XlnxTelemetryChannel *chan, XvbmBufferHandle buffer)
+{
+    XvbmPoolHandle pool;
+
+    if(!buffer || !__atomic_load_n(&chan->pool_due, __ATOMIC_RELAXED)) {
+        return;
+    }
+    /* The buffer in hand keeps its pool alive for these two calls */
+    pool = xvbm_get_pool_handle(buffer);
+    __atomic_store_n(&chan->pool_free, 
+                     (int32_t)xvbm_get_freelist_count(pool), __ATOMIC_RELAXED);
+    __atomic_store_n(&chan->pool_size, 
+                     (int32_t)xvbm_buffer_pool_num_buffers_get(buffer), 
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&chan->pool_due, 0, __ATOMIC_RELAXED);
+}
+
+static void xlnx_telemetry_record_xrm(int32_t op, int64_t start_us, 
+                                      int32_t ok)
+{
+    XlnxXrmLatency *lat = &xlnx_telemetry_xrm[op];
+    int64_t us = xlnx_telemetry_now_us() - start_us;
+    int64_t max_us = __atomic_load_n(&lat->max_us, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&lat->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&lat->total_us, us, __ATOMIC_RELAXED);
+    if(!ok) {
+        __atomic_add_fetch(&lat->failed, 1, __ATOMIC_RELAXED);
+    }
+    while(us > max_us && 
+          !__atomic_compare_exchange_n(&lat->max_us, &max_us, us, 1, 
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+uint64_t xlnx_xrm_pool_reserve(xrmContext *xrm_ctx, 
+                               xrmCuPoolProperty *cu_pool_prop)
+{
+    int64_t start_us = xlnx_telemetry_now_us();
+    uint64_t pool_id = xrmCuPoolReserve(xrm_ctx, cu_pool_prop);
+
+    xlnx_telemetry_record_xrm(XLNX_TELEMETRY_XRM_RESERVE, start_us, 
+                              pool_id != 0);
+    return pool_id;
+}
+
+int32_t xlnx_xrm_cu_alloc(xrmContext *xrm_ctx, xrmCuProperty *cu_prop, 
+                          xrmCuResource *cu_res)
+{
+    int64_t start_us = xlnx_telemetry_now_us();
+    int32_t ret = xrmCuAlloc(xrm_ctx, cu_prop, cu_res);
+
+    xlnx_telemetry_record_xrm(XLNX_TELEMETRY_XRM_ALLOC, start_us, 
+                              ret == XRM_SUCCESS);
+    return ret;
+}
+
+int32_t xlnx_xrm_cu_alloc_from_dev(xrmContext *xrm_ctx, int32_t device_id,
+                                   xrmCuProperty *cu_prop, 
+                                   xrmCuResource *cu_res)
+{
+    int64_t start_us = xlnx_telemetry_now_us();
+    int32_t ret = xrmCuAllocFromDev(xrm_ctx, device_id, cu_prop, cu_res);
+
+    xlnx_telemetry_record_xrm(XLNX_TELEMETRY_XRM_ALLOC, start_us, 
+                              ret == XRM_SUCCESS);
+    return ret;
+}
+
+int32_t xlnx_xrm_cu_list_alloc(xrmContext *xrm_ctx, 
+                               xrmCuListProperty *cu_list_prop, 
+                               xrmCuListResource *cu_list_res)
+{
+    int64_t start_us = xlnx_telemetry_now_us();
+    int32_t ret = xrmCuListAlloc(xrm_ctx, cu_list_prop, cu_list_res);
+
+    xlnx_telemetry_record_xrm(XLNX_TELEMETRY_XRM_ALLOC, start_us, 
+                              ret == XRM_SUCCESS);
+    return ret;
+}
+
+/* Copies of a one CU list that fit on device */
+static int32_t xlnx_telemetry_fit(xrmContext *xrm_ctx, 
+                                  xrmCuPoolProperty *cu_pool_prop, 
+                                  const char *name, const char *alias, 
+                                  int32_t load, int32_t device_id)
+{
+    xrmCuProperty *cu = &cu_pool_prop->cuListProp.cuProps[0];
+
+    memset(cu_pool_prop, 0, sizeof(*cu_pool_prop));
+    cu_pool_prop->cuListNum = 1;
+    cu_pool_prop->cuListProp.cuNum = 1;
+    cu_pool_prop->cuListProp.sameDevice = true;
+    strcpy(cu->kernelName, name);
+    strcpy(cu->kernelAlias, alias);
+    cu->requestLoad = XLNX_TELEMETRY_LOAD_MASK(load);
+    return xlnx_placement_available(xrm_ctx, cu_pool_prop, device_id);
+}
+
+static void xlnx_telemetry_sample_device(XlnxTelemetrySampler *sampler, 
+                                         xrmCuPoolProperty *cu_pool_prop,
+                                         int32_t device_id, 
+                                         XlnxDeviceTelemetry *dev)
+{
+    int32_t fit;
+
+    dev->device_id = device_id;
+    for(int32_t k = 0; k < XLNX_TELEMETRY_NUM_CUS; k++) {
+        fit = xlnx_telemetry_fit(sampler->xrm_ctx, cu_pool_prop, 
+                                 xlnx_telemetry_cu_names[k][0], 
+                                 xlnx_telemetry_cu_names[k][1], 
+                                 XLNX_TELEMETRY_PCT_LOAD, device_id);
+        dev->cu_free_pct[k] = xlnx_telemetry_max(fit, 0);
+    }
+    fit = xlnx_telemetry_fit(sampler->xrm_ctx, cu_pool_prop, 
+                             "kernel_vcu_decoder", "", 
+                             XRM_MAX_CU_LOAD_GRANULARITY_1000000, device_id);
+    dev->free_dec_channels = xlnx_telemetry_max(fit, 0);
+    fit = xlnx_telemetry_fit(sampler->xrm_ctx, cu_pool_prop, 
+                             "kernel_vcu_encoder", "", 
+                             XRM_MAX_CU_LOAD_GRANULARITY_1000000, device_id);
+    dev->free_enc_channels = xlnx_telemetry_max(fit, 0);
+}
+
+/* Builds the next snapshot in next, off the published one */
+static void xlnx_telemetry_sample(XlnxTelemetrySampler *sampler, 
+                                  xrmCuPoolProperty *cu_pool_prop, 
+                                  XlnxTelemetrySnapshot *next)
+{
+    XlnxTelemetryChannel *chan;
+    XlnxChannelTelemetry *out;
+    int64_t start_us = xlnx_telemetry_now_us();
+    int32_t n = 0;
+
+    memset(next, 0, sizeof(*next));
+    next->num_devices = sampler->num_devices;
+    for(int32_t d = 0; d < sampler->num_devices; d++) {
+        xlnx_telemetry_sample_device(sampler, cu_pool_prop, 
+                                     sampler->devices[d], &next->devices[d]);
+    }
+
+    pthread_mutex_lock(&xlnx_telemetry_reg_lock);
+    for(chan = xlnx_telemetry_channels; chan; chan = chan->next, n++) {
+        for(int32_t d = 0; d < next->num_devices; d++) {
+            if(next->devices[d].device_id == chan->device_id) {
+                next->devices[d].num_channels++;
+            }
+        }
+        /* Ask for a fresh pool reading with the channel's next frame */
+        __atomic_store_n(&chan->pool_due, 1, __ATOMIC_RELAXED);
+        if(n >= XLNX_TELEMETRY_MAX_CHANNELS) {
+            continue;
+        }
+        out = &next->channels[n];
+        out->id = chan->id;
+        out->kind = chan->kind;
+        out->device_id = chan->device_id;
+        out->frames_in = __atomic_load_n(&chan->frames_in, __ATOMIC_RELAXED);
+        out->frames_out = __atomic_load_n(&chan->frames_out, 
+                                          __ATOMIC_RELAXED);
+        out->queue_depth = (int32_t)xlnx_telemetry_max(out->frames_in - 
+                                                       out->frames_out, 0);
+        out->pool_free = __atomic_load_n(&chan->pool_free, __ATOMIC_RELAXED);
+        out->pool_size = __atomic_load_n(&chan->pool_size, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&xlnx_telemetry_reg_lock);
+    next->num_channels = n;
+
+    for(int32_t i = 0; i < XLNX_TELEMETRY_XRM_NUM; i++) {
+        next->xrm[i].count = __atomic_load_n(&xlnx_telemetry_xrm[i].count, 
+                                             __ATOMIC_RELAXED);
+        next->xrm[i].failed = __atomic_load_n(&xlnx_telemetry_xrm[i].failed,
+                                              __ATOMIC_RELAXED);
+        next->xrm[i].total_us = __atomic_load_n(
+                                    &xlnx_telemetry_xrm[i].total_us, 
+                                    __ATOMIC_RELAXED);
+        next->xrm[i].max_us = __atomic_load_n(&xlnx_telemetry_xrm[i].max_us,
+                                              __ATOMIC_RELAXED);
+    }
+    next->sample_us = xlnx_telemetry_now_us();
+    next->sample_cost_us = next->sample_us - start_us;
+}
+
+static void xlnx_telemetry_publish(const XlnxTelemetrySnapshot *next)
+{
+    int64_t sample_num = xlnx_telemetry_snap.sample_num + 1;
+
+    __atomic_add_fetch(&xlnx_telemetry_seq, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&xlnx_telemetry_snap, next, sizeof(*next));
+    xlnx_telemetry_snap.sample_num = sample_num;
+    __atomic_add_fetch(&xlnx_telemetry_seq, 1, __ATOMIC_RELEASE);
+}
+
+static void *xlnx_telemetry_thread(void *arg)
+{
+    XlnxTelemetrySampler *sampler = arg;
+    xrmCuPoolProperty cu_pool_prop;
+    XlnxTelemetrySnapshot next;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&sampler->lock);
+    while(!sampler->stop) {
+        pthread_mutex_unlock(&sampler->lock);
+        xlnx_telemetry_sample(sampler, &cu_pool_prop, &next);
+        xlnx_telemetry_publish(&next);
+
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += sampler->period_ms / 1000;
+        deadline.tv_nsec += (sampler->period_ms % 1000) * 1000000L;
+        if(deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        pthread_mutex_lock(&sampler->lock);
+        while(!sampler->stop && 
+              pthread_cond_timedwait(&sampler->cond, &sampler->lock, 
+                                     &deadline) != ETIMEDOUT) {
+        }
+    }
+    pthread_mutex_unlock(&sampler->lock);
+    return NULL;
+}
+
+int Telemetry_Start(int period_ms)
+{
+    XlnxTelemetrySampler *sampler = &xlnx_telemetry_sampler;
+    xrmCuPoolProperty cu_pool_prop;
+    pthread_condattr_t attr;
+
+    if(period_ms <= 0) {
+        return -1;
+    }
+    pthread_mutex_lock(&sampler->lock);
+    if(sampler->running) {
+        pthread_mutex_unlock(&sampler->lock);
+        return -1;
+    }
+    sampler->xrm_ctx = (xrmContext *)xrmCreateContext(XRM_API_VERSION_1);
+    if(!sampler->xrm_ctx) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_TELEMETRY_MODULE, 
+                   "create local XRM context failed\n");
+        pthread_mutex_unlock(&sampler->lock);
+        return -1;
+    }
+
+    /* A device is there when XRM accepts a request constrained to it */
+    sampler->num_devices = 0;
+    for(int32_t d = 0; d < XLNX_CAPACITY_MAX_DEVICES; d++) {
+        if(xlnx_telemetry_fit(sampler->xrm_ctx, &cu_pool_prop, 
+                              "kernel_vcu_encoder", "", 
+                              XRM_MAX_CU_LOAD_GRANULARITY_1000000, d) >= 0) {
+            sampler->devices[sampler->num_devices++] = d;
+        }
+    }
+
+    /* The period is measured on the monotonic clock */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_destroy(&sampler->cond);
+    pthread_cond_init(&sampler->cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    sampler->period_ms = period_ms;
+    sampler->stop = 0;
+    if(pthread_create(&sampler->thread, NULL, xlnx_telemetry_thread, 
+                      sampler) != 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_TELEMETRY_MODULE, 
+                   "Failed to start the telemetry sampler\n");
+        xrmDestroyContext(sampler->xrm_ctx);
+        sampler->xrm_ctx = NULL;
+        pthread_mutex_unlock(&sampler->lock);
+        return -1;
+    }
+    sampler->running = 1;
+    pthread_mutex_unlock(&sampler->lock);
+
+    xma_logmsg(XMA_INFO_LOG, XLNX_TELEMETRY_MODULE, 
+               "Sampling %d devices every %d ms\n", sampler->num_devices, 
+               period_ms);
+    return 0;
+}
+
+void Telemetry_Stop()
+{
+    XlnxTelemetrySampler *sampler = &xlnx_telemetry_sampler;
+
+    pthread_mutex_lock(&sampler->lock);
+    if(!sampler->running) {
+        pthread_mutex_unlock(&sampler->lock);
+        return;
+    }
+    sampler->stop = 1;
+    pthread_cond_signal(&sampler->cond);
+    pthread_mutex_unlock(&sampler->lock);
+
+    pthread_join(sampler->thread, NULL);
+    xrmDestroyContext(sampler->xrm_ctx);
+    sampler->xrm_ctx = NULL;
+    pthread_mutex_lock(&sampler->lock);
+    sampler->running = 0;
+    pthread_mutex_unlock(&sampler->lock);
+}
+
+int Telemetry_GetSnapshot(XlnxTelemetrySnapshot *snapshot)
+{
+    uint64_t seq;
+
+    if(!snapshot) {
+        return -1;
+    }
+    do {
+        seq = __atomic_load_n(&xlnx_telemetry_seq, __ATOMIC_ACQUIRE);
+        if(seq & 1) {
+            continue;
+        }
+        memcpy(snapshot, &xlnx_telemetry_snap, sizeof(*snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while((seq & 1) || 
+            __atomic_load_n(&xlnx_telemetry_seq, __ATOMIC_RELAXED) != seq);
+
+    return snapshot->sample_num > 0 ? 0 : -1;
+}
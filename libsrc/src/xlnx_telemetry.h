@@ -0,0 +1,58 @@
+#ifndef _XLNX_TELEMETRY_H_
+#define _XLNX_TELEMETRY_H_
+
+#include "xilinx_encoder.h"
+
+#include <stdint.h>
+#include <xrm.h>
+#include <xvbm.h>
+
+/* Numbers a channel publishes for the sampler. The owning thread stores
+   them with relaxed atomics, the sampler loads them the same way, so 
+   neither side ever waits. */
+typedef struct XlnxTelemetryChannel {
+    int32_t  id;
+    int32_t  kind;
+    int32_t  device_id;
+    int32_t  registered;
+    int64_t  frames_in;
+    int64_t  frames_out;
+    int32_t  pool_free;
+    int32_t  pool_size;
+    /* Raised by the sampler each period, the channel answers by reading 
+       its pool occupancy once */
+    int32_t  pool_due;
+    struct XlnxTelemetryChannel *next;
+} XlnxTelemetryChannel;
+
+/* Adds an open channel to the sampler's list, and removes it before the
+   channel's sessions go away. Only called on open and close. */
+void xlnx_telemetry_register(XlnxTelemetryChannel *chan, int32_t kind, 
+                             int32_t device_id);
+
+void xlnx_telemetry_unregister(XlnxTelemetryChannel *chan);
+
+/* Called once per frame with the channel's running totals */
+void xlnx_telemetry_count(XlnxTelemetryChannel *chan, int64_t frames_in, 
+                          int64_t frames_out);
+
+/* Reads the occupancy of buffer's pool when the sampler asked for it, 
+   otherwise costs one load */
+void xlnx_telemetry_pool(XlnxTelemetryChannel *chan, XvbmBufferHandle buffer);
+
+/* XRM calls timed into the process wide latency counters */
+uint64_t xlnx_xrm_pool_reserve(xrmContext *xrm_ctx, 
+                               xrmCuPoolProperty *cu_pool_prop);
+
+int32_t xlnx_xrm_cu_alloc(xrmContext *xrm_ctx, xrmCuProperty *cu_prop, 
+                          xrmCuResource *cu_res);
+
+int32_t xlnx_xrm_cu_alloc_from_dev(xrmContext *xrm_ctx, int32_t device_id,
+                                   xrmCuProperty *cu_prop, 
+                                   xrmCuResource *cu_res);
+
+int32_t xlnx_xrm_cu_list_alloc(xrmContext *xrm_ctx, 
+                               xrmCuListProperty *cu_list_prop, 
+                               xrmCuListResource *cu_list_res);
+
+#endif
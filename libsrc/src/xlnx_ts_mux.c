@@ -0,0 +1,321 @@
+#include "xilinx_encoder.h"
+#include "xlnx_mux_io.h"
+
+#include <stdbool.h>
+
+#define XLNX_TS_PACKET_SIZE    188
+#define XLNX_TS_PAYLOAD_SIZE   184
+/* Packets gathered before one writev; two iovecs per packet stay well below
+   IOV_MAX */
+#define XLNX_TS_BATCH_PKTS     256
+#define XLNX_TS_PAT_PID        0x0000
+#define XLNX_TS_PMT_PID        0x1000
+#define XLNX_TS_VIDEO_PID      0x0100
+#define XLNX_TS_PROGRAM_NUMBER 1
+#define XLNX_TS_VIDEO_STREAM   0xe0
+#define XLNX_TS_TYPE_H264      0x1b
+#define XLNX_TS_TYPE_HEVC      0x24
+#define XLNX_TS_PES_HDR_MAX    19
+/* Timestamps are shifted by 1.4 s and PCR runs 0.7 s ahead of DTS, which
+   leaves room for B frame reordering and the decoder buffer */
+#define XLNX_TS_TS_OFFSET      126000
+#define XLNX_TS_PCR_DELAY      63000
+
+struct XlnxTsMux {
+    int32_t         fd;
+    int32_t         codec_id;
+    uint8_t         pat[XLNX_TS_PACKET_SIZE];
+    uint8_t         pmt[XLNX_TS_PACKET_SIZE];
+    uint8_t         cc_pat;
+    uint8_t         cc_pmt;
+    uint8_t         cc_video;
+    int64_t         num_pes;
+    /* Preallocated batch: packet i builds its header, adaptation field and
+       PES header in hdr[i]; payload is referenced from the caller's data */
+    uint8_t         (*hdr)[XLNX_TS_PACKET_SIZE];
+    int32_t         num_batch_pkts;
+    struct iovec    iov[2 * XLNX_TS_BATCH_PKTS];
+    int32_t         iovcnt;
+};
+
+static uint32_t xlnx_ts_crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+
+    for(size_t i = 0; i < len; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for(int32_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+/* Wraps one PSI section into a stuffed TS packet. The continuity counter
+   in byte 3 is patched every time the packet is sent. */
+static void xlnx_ts_build_psi(uint8_t *pkt, int32_t pid, const uint8_t *sect,
+                              int32_t sect_len)
+{
+    uint32_t crc = xlnx_ts_crc32(sect, sect_len);
+
+    memset(pkt, 0xff, XLNX_TS_PACKET_SIZE);
+    pkt[0] = 0x47;
+    pkt[1] = 0x40 | (pid >> 8);
+    pkt[2] = pid & 0xff;
+    pkt[3] = 0x10;
+    pkt[4] = 0;                     /* pointer_field */
+    memcpy(pkt + 5, sect, sect_len);
+    pkt[5 + sect_len]     = crc >> 24;
+    pkt[5 + sect_len + 1] = crc >> 16;
+    pkt[5 + sect_len + 2] = crc >> 8;
+    pkt[5 + sect_len + 3] = crc;
+}
+
+static void xlnx_ts_build_tables(XlnxTsMux *mux)
+{
+    uint8_t pat[] = {
+        0x00,                                   /* table_id */
+        0xb0, 13,                               /* section_length */
+        0x00, 0x01,                             /* transport_stream_id */
+        0xc1, 0x00, 0x00,                       /* version, section numbers */
+        0x00, XLNX_TS_PROGRAM_NUMBER,
+        0xe0 | (XLNX_TS_PMT_PID >> 8), XLNX_TS_PMT_PID & 0xff
+    };
+    uint8_t pmt[] = {
+        0x02,                                   /* table_id */
+        0xb0, 18,                               /* section_length */
+        0x00, XLNX_TS_PROGRAM_NUMBER,
+        0xc1, 0x00, 0x00,
+        0xe0 | (XLNX_TS_VIDEO_PID >> 8), XLNX_TS_VIDEO_PID & 0xff, /* PCR */
+        0xf0, 0x00,                             /* program_info_length */
+        mux->codec_id == ENCODER_ID_HEVC ? XLNX_TS_TYPE_HEVC : 
+                                           XLNX_TS_TYPE_H264,
+        0xe0 | (XLNX_TS_VIDEO_PID >> 8), XLNX_TS_VIDEO_PID & 0xff,
+        0xf0, 0x00                              /* ES_info_length */
+    };
+
+    xlnx_ts_build_psi(mux->pat, XLNX_TS_PAT_PID, pat, sizeof(pat));
+    xlnx_ts_build_psi(mux->pmt, XLNX_TS_PMT_PID, pmt, sizeof(pmt));
+}
+
+static int32_t xlnx_ts_flush(XlnxTsMux *mux)
+{
+    int32_t ret = 0;
+
+    if(mux->iovcnt > 0) {
+        ret = xlnx_mux_writev(mux->fd, mux->iov, mux->iovcnt);
+    }
+    mux->iovcnt = 0;
+    mux->num_batch_pkts = 0;
+    return ret;
+}
+
+/* Next free packet slot of the batch, flushing a full batch first */
+static uint8_t *xlnx_ts_next_slot(XlnxTsMux *mux)
+{
+    if(mux->num_batch_pkts == XLNX_TS_BATCH_PKTS && xlnx_ts_flush(mux) != 0) {
+        return NULL;
+    }
+    return mux->hdr[mux->num_batch_pkts++];
+}
+
+static void xlnx_ts_add_iov(XlnxTsMux *mux, const void *base, size_t len)
+{
+    mux->iov[mux->iovcnt].iov_base = (void *)base;
+    mux->iov[mux->iovcnt].iov_len = len;
+    mux->iovcnt++;
+}
+
+static int32_t xlnx_ts_put_psi(XlnxTsMux *mux, const uint8_t *psi,
+                               uint8_t *cc)
+{
+    uint8_t *pkt = xlnx_ts_next_slot(mux);
+
+    if(!pkt) {
+        return -1;
+    }
+    memcpy(pkt, psi, XLNX_TS_PACKET_SIZE);
+    pkt[3] |= *cc;
+    *cc = (*cc + 1) & 0xf;
+    xlnx_ts_add_iov(mux, pkt, XLNX_TS_PACKET_SIZE);
+    return 0;
+}
+
+/* IDR for H264, IRAP for HEVC */
+static bool xlnx_ts_is_key_frame(int32_t codec_id, const uint8_t *data,
+                                 int32_t size)
+{
+    int32_t type;
+
+    for(int32_t i = 0; i + 3 < size; i++) {
+        if(data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            continue;
+        }
+        if(codec_id == ENCODER_ID_HEVC) {
+            type = (data[i + 3] >> 1) & 0x3f;
+            if(type >= 16 && type <= 21) {
+                return true;
+            }
+        } else {
+            type = data[i + 3] & 0x1f;
+            if(type == 5) {
+                return true;
+            }
+        }
+        i += 2;
+    }
+    return false;
+}
+
+static void xlnx_ts_put_timestamp(uint8_t *p, int32_t marker, int64_t ts)
+{
+    p[0] = (marker << 4) | ((ts >> 29) & 0x0e) | 1;
+    p[1] = ts >> 22;
+    p[2] = ((ts >> 14) & 0xfe) | 1;
+    p[3] = ts >> 7;
+    p[4] = ((ts << 1) & 0xfe) | 1;
+}
+
+static int32_t xlnx_ts_build_pes_header(uint8_t *p, int64_t pts, int64_t dts)
+{
+    int32_t len = 9;
+
+    p[0] = 0x00;
+    p[1] = 0x00;
+    p[2] = 0x01;
+    p[3] = XLNX_TS_VIDEO_STREAM;
+    p[4] = 0x00;                    /* unbounded video PES */
+    p[5] = 0x00;
+    p[6] = 0x84;                    /* data_alignment_indicator */
+    if(pts != dts) {
+        p[7] = 0xc0;
+        p[8] = 10;
+        xlnx_ts_put_timestamp(p + 9, 3, pts);
+        xlnx_ts_put_timestamp(p + 14, 1, dts);
+        len += 10;
+    } else {
+        p[7] = 0x80;
+        p[8] = 5;
+        xlnx_ts_put_timestamp(p + 9, 2, pts);
+        len += 5;
+    }
+    return len;
+}
+
+XlnxTsMux *TsMux_Open(int fd, int codec_id)
+{
+    XlnxTsMux *mux = calloc(1, sizeof(XlnxTsMux));
+
+    if(!mux) {
+        return NULL;
+    }
+    mux->hdr = malloc(XLNX_TS_BATCH_PKTS * XLNX_TS_PACKET_SIZE);
+    if(!mux->hdr) {
+        free(mux);
+        return NULL;
+    }
+    mux->fd = fd;
+    mux->codec_id = codec_id;
+    xlnx_ts_build_tables(mux);
+    return mux;
+}
+
+int TsMux_WritePacket(XlnxTsMux *mux, const char *data, int size,
+                      int64_t pts, int64_t dts)
+{
+    bool key = xlnx_ts_is_key_frame(mux->codec_id, (const uint8_t *)data,
+                                    size);
+    uint8_t pes[XLNX_TS_PES_HDR_MAX];
+    int32_t pes_len;
+    int32_t pes_off = 0;
+    int32_t data_off = 0;
+    int32_t af_len, room, left, n;
+    int64_t pcr;
+    uint8_t *pkt;
+    bool first = true;
+
+    if(size <= 0) {
+        return -1;
+    }
+
+    /* Tables lead every random access point so a joining receiver can
+       start decoding there */
+    if(key || mux->num_pes == 0) {
+        if(xlnx_ts_put_psi(mux, mux->pat, &mux->cc_pat) != 0 ||
+           xlnx_ts_put_psi(mux, mux->pmt, &mux->cc_pmt) != 0) {
+            return -1;
+        }
+    }
+
+    pts += XLNX_TS_TS_OFFSET;
+    dts += XLNX_TS_TS_OFFSET;
+    pcr = dts - XLNX_TS_PCR_DELAY;
+    pes_len = xlnx_ts_build_pes_header(pes, pts, dts);
+
+    while(pes_off < pes_len || data_off < size) {
+        pkt = xlnx_ts_next_slot(mux);
+        if(!pkt) {
+            return -1;
+        }
+        pkt[0] = 0x47;
+        pkt[1] = (first ? 0x40 : 0) | (XLNX_TS_VIDEO_PID >> 8);
+        pkt[2] = XLNX_TS_VIDEO_PID & 0xff;
+        pkt[3] = 0x10 | mux->cc_video;
+        mux->cc_video = (mux->cc_video + 1) & 0xf;
+
+        /* PCR rides on the first packet of every PES; the last packet is
+           padded with adaptation field stuffing */
+        af_len = first ? 8 : 0;
+        left = (pes_len - pes_off) + (size - data_off);
+        if(left < XLNX_TS_PAYLOAD_SIZE - af_len) {
+            af_len = XLNX_TS_PAYLOAD_SIZE - left;
+        }
+        if(af_len > 0) {
+            pkt[3] |= 0x20;
+            pkt[4] = af_len - 1;
+            if(af_len > 1) {
+                memset(pkt + 5, 0xff, af_len - 1);
+                pkt[5] = 0x00;
+                if(first) {
+                    pkt[5] = 0x10 | (key ? 0x40 : 0);
+                    pkt[6] = pcr >> 25;
+                    pkt[7] = pcr >> 17;
+                    pkt[8] = pcr >> 9;
+                    pkt[9] = pcr >> 1;
+                    pkt[10] = ((pcr & 1) << 7) | 0x7e;
+                    pkt[11] = 0x00;
+                }
+            }
+        }
+
+        room = XLNX_TS_PAYLOAD_SIZE - af_len;
+        n = pes_len - pes_off;
+        if(n > room) {
+            n = room;
+        }
+        memcpy(pkt + 4 + af_len, pes + pes_off, n);
+        pes_off += n;
+        room -= n;
+        xlnx_ts_add_iov(mux, pkt, 4 + af_len + n);
+        if(room > 0) {
+            xlnx_ts_add_iov(mux, data + data_off, room);
+            data_off += room;
+        }
+        first = false;
+    }
+
+    mux->num_pes++;
+    /* Payload iovecs point into data, so everything goes out before the
+       caller gets the buffer back */
+    return xlnx_ts_flush(mux);
+}
+
+void TsMux_Close(XlnxTsMux *mux)
+{
+    if(!mux) {
+        return;
+    }
+    xlnx_ts_flush(mux);
+    free(mux->hdr);
+    free(mux);
+}
@@ -0,0 +1,158 @@
+#include "xlnx_xrm_load.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xma.h>
+
+#define XLNX_XRM_LOAD_MODULE "xlnx_xrm_load"
+
+/* Distinct channel configurations a process is expected to use. Beyond 
+   that results are still correct, just no longer remembered. */
+#define XLNX_XRM_LOAD_CACHE_SIZE 256
+
+typedef void (*XlnxPropsToJsonFunc)(void *props, char *func_name, 
+                                    char *json_job);
+
+typedef struct XlnxXrmLoadEntry {
+    uint64_t    hash;
+    char        plugin_name[XRM_MAX_NAME_LEN];
+    char        *input;
+    XlnxXrmLoad load;
+} XlnxXrmLoadEntry;
+
+static pthread_once_t xlnx_xrm_load_once = PTHREAD_ONCE_INIT;
+static XlnxPropsToJsonFunc xlnx_props_to_json = NULL;
+
+static pthread_rwlock_t xlnx_xrm_load_lock = PTHREAD_RWLOCK_INITIALIZER;
+static XlnxXrmLoadEntry xlnx_xrm_load_cache[XLNX_XRM_LOAD_CACHE_SIZE];
+static int32_t xlnx_xrm_load_count = 0;
+
+/* The library stays loaded for the life of the process */
+static void xlnx_xrm_load_open_plugin()
+{
+    void *handle = dlopen(XMA_PROPS_TO_JSON_SO, RTLD_NOW);
+
+    if(!handle) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_XRM_LOAD_MODULE, 
+                   "Failed to load %s: %s\n", XMA_PROPS_TO_JSON_SO, dlerror());
+        return;
+    }
+    xlnx_props_to_json = (XlnxPropsToJsonFunc)dlsym(handle, 
+                                                    "convertXmaPropsToJson");
+    if(!xlnx_props_to_json) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_XRM_LOAD_MODULE, 
+                   "convertXmaPropsToJson missing in %s\n", 
+                   XMA_PROPS_TO_JSON_SO);
+        dlclose(handle);
+    }
+}
+
+/* FNV-1a over plugin name and input */
+static uint64_t xlnx_xrm_load_hash(const char *plugin_name, const char *input)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const char *strs[2] = {plugin_name, input};
+
+    for(int32_t i = 0; i < 2; i++) {
+        for(const char *p = strs[i]; *p; p++) {
+            hash = (hash ^ (uint8_t)*p) * 1099511628211ULL;
+        }
+        hash = (hash ^ 0xff) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Called with xlnx_xrm_load_lock held */
+static const XlnxXrmLoadEntry *xlnx_xrm_load_find(uint64_t hash, 
+                                                  const char *plugin_name, 
+                                                  const char *input)
+{
+    const XlnxXrmLoadEntry *entry;
+
+    for(int32_t i = 0; i < xlnx_xrm_load_count; i++) {
+        entry = &xlnx_xrm_load_cache[i];
+        if(entry->hash == hash && 
+           strcmp(entry->plugin_name, plugin_name) == 0 &&
+           strcmp(entry->input, input) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void xlnx_xrm_load_parse(char *output, XlnxXrmLoad *load)
+{
+    char *save = NULL;
+    char *token = strtok_r(output, " ", &save);
+
+    memset(load, 0, sizeof(*load));
+    while(token && load->num_values < XLNX_XRM_LOAD_MAX_VALUES) {
+        load->values[load->num_values++] = atoi(token);
+        token = strtok_r(NULL, " ", &save);
+    }
+}
+
+int32_t xlnx_xrm_load_query(xrmContext *xrm_ctx, const char *plugin_name, 
+                            const char *kind, void *props, XlnxXrmLoad *load)
+{
+    xrmPluginFuncParam *plg_param;
+    const XlnxXrmLoadEntry *entry;
+    XlnxXrmLoadEntry *slot;
+    char *input;
+    uint64_t hash;
+    int32_t ret;
+
+    pthread_once(&xlnx_xrm_load_once, xlnx_xrm_load_open_plugin);
+    if(!xlnx_props_to_json) {
+        return -1;
+    }
+
+    /* Two 16K strings, too large for the callers' stacks to carry twice */
+    plg_param = calloc(1, sizeof(*plg_param));
+    if(!plg_param) {
+        return -1;
+    }
+    xlnx_props_to_json(props, (char *)kind, plg_param->input);
+    hash = xlnx_xrm_load_hash(plugin_name, plg_param->input);
+
+    pthread_rwlock_rdlock(&xlnx_xrm_load_lock);
+    entry = xlnx_xrm_load_find(hash, plugin_name, plg_param->input);
+    if(entry) {
+        *load = entry->load;
+    }
+    pthread_rwlock_unlock(&xlnx_xrm_load_lock);
+    if(entry) {
+        free(plg_param);
+        return 0;
+    }
+
+    /* Concurrent misses on one configuration may both ask XRM, the plugin
+       answers alike and only the first result is kept */
+    input = strdup(plg_param->input);
+    ret = xrmExecPluginFunc(xrm_ctx, (char *)plugin_name, 0, plg_param);
+    if(ret != XRM_SUCCESS) {
+        free(input);
+        free(plg_param);
+        return ret;
+    }
+    xlnx_xrm_load_parse(plg_param->output, load);
+    free(plg_param);
+
+    pthread_rwlock_wrlock(&xlnx_xrm_load_lock);
+    if(input && !xlnx_xrm_load_find(hash, plugin_name, input) &&
+       xlnx_xrm_load_count < XLNX_XRM_LOAD_CACHE_SIZE) {
+        slot = &xlnx_xrm_load_cache[xlnx_xrm_load_count];
+        slot->hash = hash;
+        strncpy(slot->plugin_name, plugin_name, XRM_MAX_NAME_LEN - 1);
+        slot->input = input;
+        slot->load = *load;
+        xlnx_xrm_load_count++;
+        input = NULL;
+    }
+    pthread_rwlock_unlock(&xlnx_xrm_load_lock);
+
+    free(input);
+    return 0;
+}
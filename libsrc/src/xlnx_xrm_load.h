@@ -0,0 +1,30 @@
+#ifndef _XLNX_XRM_LOAD_H_
+#define _XLNX_XRM_LOAD_H_
+
+#include <stdint.h>
+#include <xrm.h>
+
+/* Overridden when building against the simulator */
+#ifndef XMA_PROPS_TO_JSON_SO
+#define XMA_PROPS_TO_JSON_SO "/opt/xilinx/xrm/plugin/libxmaPropsTOjson.so"
+#endif
+
+/* Numbers printed by an XRM load plugin, e.g. load, instance count and
+   lookahead load for xrmU30EncPlugin */
+#define XLNX_XRM_LOAD_MAX_VALUES 4
+
+typedef struct XlnxXrmLoad {
+    int32_t values[XLNX_XRM_LOAD_MAX_VALUES];
+    int32_t num_values;
+} XlnxXrmLoad;
+
+/* Converts props for the IP named by kind ("ENCODER", "LOOKAHEAD", 
+   "SCALER" or "DECODER") and runs load function 0 of plugin_name on them.
+   The props to JSON library is loaded once per process, and results are 
+   kept per plugin and JSON input, so a configuration seen before costs no
+   XRM round trip. Safe to call from concurrent channel setups. Returns 0 
+   on success, otherwise the XRM error or -1. */
+int32_t xlnx_xrm_load_query(xrmContext *xrm_ctx, const char *plugin_name, 
+                            const char *kind, void *props, XlnxXrmLoad *load);
+
+#endif
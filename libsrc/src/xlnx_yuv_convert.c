@@ -0,0 +1,212 @@
+#include "xlnx_yuv_convert.h"
+
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define XLNX_YUV_HAVE_X86 1
+#endif
+
+typedef void (*XlnxInterleaveFunc)(const uint8_t *u, const uint8_t *v, 
+                                   uint8_t *uv, size_t count);
+
+static XlnxInterleaveFunc xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_c;
+static const char *xlnx_yuv_kernel_name = "c";
+static pthread_once_t xlnx_yuv_dispatch_once = PTHREAD_ONCE_INIT;
+
+void xlnx_yuv_interleave_uv_c(const uint8_t *u, const uint8_t *v, 
+                              uint8_t *uv, size_t count)
+{
+    for(size_t i = 0; i < count; i++) {
+        uv[2 * i]     = u[i];
+        uv[2 * i + 1] = v[i];
+    }
+}
+
+#ifdef XLNX_YUV_HAVE_X86
+__attribute__((target("sse2")))
+static void xlnx_yuv_interleave_uv_sse2(const uint8_t *u, const uint8_t *v, 
+                                        uint8_t *uv, size_t count)
+{
+    size_t i = 0;
+
+    for(; i + 16 <= count; i += 16) {
+        __m128i u16 = _mm_loadu_si128((const __m128i *)(u + i));
+        __m128i v16 = _mm_loadu_si128((const __m128i *)(v + i));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(u16, v16));
+        _mm_storeu_si128((__m128i *)(uv + 2 * i + 16), 
+                         _mm_unpackhi_epi8(u16, v16));
+    }
+    xlnx_yuv_interleave_uv_c(u + i, v + i, uv + 2 * i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void xlnx_yuv_interleave_uv_avx2(const uint8_t *u, const uint8_t *v, 
+                                        uint8_t *uv, size_t count)
+{
+    size_t i = 0;
+
+    for(; i + 32 <= count; i += 32) {
+        __m256i u32 = _mm256_loadu_si256((const __m256i *)(u + i));
+        __m256i v32 = _mm256_loadu_si256((const __m256i *)(v + i));
+        /* unpack works per 128 bit lane, so the lanes are swapped back */
+        __m256i lo = _mm256_unpacklo_epi8(u32, v32);
+        __m256i hi = _mm256_unpackhi_epi8(u32, v32);
+        _mm256_storeu_si256((__m256i *)(uv + 2 * i), 
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(uv + 2 * i + 32), 
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    xlnx_yuv_interleave_uv_sse2(u + i, v + i, uv + 2 * i, count - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void xlnx_yuv_interleave_uv_avx512(const uint8_t *u, const uint8_t *v,
+                                          uint8_t *uv, size_t count)
+{
+    const __m512i first = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+    const __m512i second = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+    size_t i = 0;
+
+    for(; i + 64 <= count; i += 64) {
+        __m512i u64 = _mm512_loadu_si512((const void *)(u + i));
+        __m512i v64 = _mm512_loadu_si512((const void *)(v + i));
+        /* unpack works per 128 bit lane, so the lanes are put back in 
+           order across both results */
+        __m512i lo = _mm512_unpacklo_epi8(u64, v64);
+        __m512i hi = _mm512_unpackhi_epi8(u64, v64);
+        _mm512_storeu_si512((void *)(uv + 2 * i), 
+                            _mm512_permutex2var_epi64(lo, first, hi));
+        _mm512_storeu_si512((void *)(uv + 2 * i + 64), 
+                            _mm512_permutex2var_epi64(lo, second, hi));
+    }
+    xlnx_yuv_interleave_uv_avx2(u + i, v + i, uv + 2 * i, count - i);
+}
+#endif
+
+static void xlnx_yuv_dispatch_init()
+{
+#ifdef XLNX_YUV_HAVE_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512bw")) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_avx512;
+        xlnx_yuv_kernel_name = "avx512bw";
+    }
+    else if(__builtin_cpu_supports("avx2")) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_avx2;
+        xlnx_yuv_kernel_name = "avx2";
+    }
+    else if(__builtin_cpu_supports("sse2")) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_sse2;
+        xlnx_yuv_kernel_name = "sse2";
+    }
+#endif
+}
+
+void xlnx_yuv_interleave_uv(const uint8_t *u, const uint8_t *v, uint8_t *uv,
+                            size_t count)
+{
+    pthread_once(&xlnx_yuv_dispatch_once, xlnx_yuv_dispatch_init);
+    xlnx_yuv_interleave_func(u, v, uv, count);
+}
+
+const char *xlnx_yuv_convert_kernel_name()
+{
+    pthread_once(&xlnx_yuv_dispatch_once, xlnx_yuv_dispatch_init);
+    return xlnx_yuv_kernel_name;
+}
+
+int32_t xlnx_yuv_convert_set_kernel(const char *name)
+{
+    pthread_once(&xlnx_yuv_dispatch_once, xlnx_yuv_dispatch_init);
+    if(strcmp(name, "c") == 0) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_c;
+    }
+#ifdef XLNX_YUV_HAVE_X86
+    else if(strcmp(name, "sse2") == 0 && __builtin_cpu_supports("sse2")) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_sse2;
+    }
+    else if(strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_avx2;
+    }
+    else if(strcmp(name, "avx512bw") == 0 && 
+            __builtin_cpu_supports("avx512bw")) {
+        xlnx_yuv_interleave_func = xlnx_yuv_interleave_uv_avx512;
+    }
+#endif
+    else {
+        return -1;
+    }
+    xlnx_yuv_kernel_name = name;
+    return 0;
+}
+
+int32_t xlnx_yuv_i420_to_nv12_uv(const uint8_t *u, const uint8_t *v, 
+                                 int32_t src_stride, uint8_t *uv, 
+                                 int32_t dst_stride, int32_t width, 
+                                 int32_t height)
+{
+    int32_t chroma_width = (width + 1) / 2;
+    int32_t chroma_height = (height + 1) / 2;
+
+    if(!u || !v || !uv || src_stride < chroma_width || 
+       dst_stride < 2 * chroma_width) {
+        return -1;
+    }
+    pthread_once(&xlnx_yuv_dispatch_once, xlnx_yuv_dispatch_init);
+
+    /* Tightly packed planes convert as a single run */
+    if(src_stride == chroma_width && dst_stride == 2 * chroma_width) {
+        xlnx_yuv_interleave_func(u, v, uv, 
+                                 (size_t)chroma_width * chroma_height);
+        return 0;
+    }
+    for(int32_t row = 0; row < chroma_height; row++) {
+        xlnx_yuv_interleave_func(u + (size_t)row * src_stride, 
+                                 v + (size_t)row * src_stride,
+                                 uv + (size_t)row * dst_stride, 
+                                 chroma_width);
+    }
+    return 0;
+}
+
+size_t xlnx_yuv_nv12_unpad(const uint8_t *src, int32_t aligned_width, 
+                           int32_t aligned_height, int32_t width, 
+                           int32_t height, uint8_t *dst)
+{
+    const uint8_t *uv = src + (size_t)aligned_width * aligned_height;
+    uint8_t *out = dst;
+    int32_t row;
+
+    for(row = 0; row < height; row++, out += width) {
+        memcpy(out, src + (size_t)row * aligned_width, width);
+    }
+    for(row = 0; row < (height + 1) / 2; row++, out += width) {
+        memcpy(out, uv + (size_t)row * aligned_width, width);
+    }
+    return out - dst;
+}
+
+int32_t xlnx_yuv_nv12_write_unpadded(const uint8_t *src, 
+                                     int32_t aligned_width, 
+                                     int32_t aligned_height, int32_t width, 
+                                     int32_t height, FILE *file)
+{
+    const uint8_t *uv = src + (size_t)aligned_width * aligned_height;
+    int32_t row;
+
+    for(row = 0; row < height; row++) {
+        if(fwrite(src + (size_t)row * aligned_width, 1, width, file) != 
+                                                            (size_t)width) {
+            return -1;
+        }
+    }
+    for(row = 0; row < (height + 1) / 2; row++) {
+        if(fwrite(uv + (size_t)row * aligned_width, 1, width, file) != 
+                                                            (size_t)width) {
+            return -1;
+        }
+    }
+    return 0;
+}
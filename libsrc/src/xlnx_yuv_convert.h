@@ -0,0 +1,45 @@
+#ifndef _XLNX_YUV_CONVERT_H_
+#define _XLNX_YUV_CONVERT_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Interleaves count U and V samples into one NV12 UV row. Uses the widest
+   kernel the CPU supports (AVX-512BW, AVX2, SSE2), picked on first use. */
+void xlnx_yuv_interleave_uv(const uint8_t *u, const uint8_t *v, uint8_t *uv,
+                            size_t count);
+
+/* Portable reference kernel */
+void xlnx_yuv_interleave_uv_c(const uint8_t *u, const uint8_t *v, 
+                              uint8_t *uv, size_t count);
+
+/* Converts the chroma planes of a width x height I420 frame into an NV12 UV
+   plane in one pass on the calling thread. Strides are in bytes. */
+int32_t xlnx_yuv_i420_to_nv12_uv(const uint8_t *u, const uint8_t *v, 
+                                 int32_t src_stride, uint8_t *uv, 
+                                 int32_t dst_stride, int32_t width, 
+                                 int32_t height);
+
+/* Kernel picked for this CPU: "avx512bw", "avx2", "sse2" or "c" */
+const char *xlnx_yuv_convert_kernel_name();
+
+/* Forces one of the kernel names above for tests, -1 when the CPU lacks 
+   it. Must not race with running conversions. */
+int32_t xlnx_yuv_convert_set_kernel(const char *name);
+
+/* Copies the visible width x height area of an NV12 frame whose planes are
+   padded to aligned_width x aligned_height into a packed NV12 frame. 
+   Returns the bytes written to dst. */
+size_t xlnx_yuv_nv12_unpad(const uint8_t *src, int32_t aligned_width, 
+                           int32_t aligned_height, int32_t width, 
+                           int32_t height, uint8_t *dst);
+
+/* Same walk as xlnx_yuv_nv12_unpad, written to a file. 0 on success, -1 
+   when a write fails. */
+int32_t xlnx_yuv_nv12_write_unpadded(const uint8_t *src, 
+                                     int32_t aligned_width, 
+                                     int32_t aligned_height, int32_t width, 
+                                     int32_t height, FILE *file);
+
+#endif
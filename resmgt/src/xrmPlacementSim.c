@@ -0,0 +1,329 @@
+/* Placement simulation: replays a synthetic arrival trace of transcode
+   channels against a model of U30 devices and reports rejection rate and
+   utilization per placement policy. The library placement code runs
+   unchanged; this program stands in for xrmCheckCuPoolAvailableNumV2.
+
+   gcc -std=gnu99 -O2 -I../../include -I../../libsrc/src \
+       -o xrmPlacementSim xrmPlacementSim.c ../../libsrc/src/xlnx_placement.c
+
+   xrmPlacementSim [-n devices] [-a arrivals] [-l offered_load] [-s seed] */
+#include "xlnx_placement.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#define SIM_MAX_ACTIVE   4096
+#define SIM_FULL_LOAD    1000000
+/* Soft kernel channels per device and kernel */
+#define SIM_SOFT_SLOTS   32
+
+enum { SIM_DECODER, SIM_SCALER, SIM_LOOKAHEAD, SIM_ENCODER,
+       SIM_DEC_SOFT, SIM_ENC_SOFT, SIM_NUM_KERNELS };
+
+static const char *sim_kernel_names[SIM_NUM_KERNELS] = {
+    "decoder", "scaler", "lookahead", "encoder",
+    "kernel_vcu_decoder", "kernel_vcu_encoder"
+};
+
+typedef struct SimShape {
+    const char *name;
+    int32_t    width;
+    int32_t    height;
+    int32_t    fps;
+    int32_t    lookahead;
+    double     share;
+} SimShape;
+
+/* Channel mix of a live transcoding service */
+static const SimShape sim_shapes[] = {
+    {"720p30",    1280,  720, 30, 0, 0.50},
+    {"1080p30",   1920, 1080, 30, 0, 0.25},
+    {"1080p60la", 1920, 1080, 60, 1, 0.15},
+    {"2160p60",   3840, 2160, 60, 0, 0.10},
+};
+#define SIM_NUM_SHAPES (int32_t)(sizeof(sim_shapes) / sizeof(sim_shapes[0]))
+
+typedef struct SimJob {
+    double  end;
+    int32_t device;
+    int32_t load[SIM_NUM_KERNELS];
+} SimJob;
+
+typedef struct SimState {
+    int32_t num_devices;
+    int64_t used[XLNX_CAPACITY_MAX_DEVICES][SIM_NUM_KERNELS];
+    SimJob  active[SIM_MAX_ACTIVE];
+    int32_t num_active;
+    double  now;
+    double  enc_load_time;
+} SimState;
+
+static SimState sim;
+
+/* Loads follow the pixel rate, one device encodes 2160p60 or four 1080p60 */
+static int32_t sim_load(const SimShape *shape)
+{
+    double rate = (double)shape->width * shape->height * shape->fps;
+    int32_t load = (int32_t)(rate * SIM_FULL_LOAD / (3840.0 * 2160 * 60));
+
+    return load < SIM_FULL_LOAD ? load : SIM_FULL_LOAD;
+}
+
+static int32_t sim_kernel(const char *name)
+{
+    for(int32_t k = 0; k < SIM_NUM_KERNELS; k++) {
+        if(strcmp(name, sim_kernel_names[k]) == 0) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+static void sim_add_cu(xrmCuPoolProperty *prop, int32_t kernel, int32_t load)
+{
+    xrmCuProperty *cu = &prop->cuListProp.cuProps[prop->cuListProp.cuNum++];
+
+    strcpy(cu->kernelName, sim_kernel_names[kernel]);
+    cu->requestLoad = load << 8;
+}
+
+/* The CU list a decode + encode channel of shape asks XRM for */
+static void sim_cu_list(const SimShape *shape, xrmCuPoolProperty *prop)
+{
+    int32_t load = sim_load(shape);
+
+    memset(prop, 0, sizeof(*prop));
+    prop->cuListNum = 1;
+    prop->cuListProp.sameDevice = true;
+    sim_add_cu(prop, SIM_DECODER, load);
+    sim_add_cu(prop, SIM_DEC_SOFT, SIM_FULL_LOAD);
+    sim_add_cu(prop, SIM_ENCODER, load);
+    sim_add_cu(prop, SIM_ENC_SOFT, SIM_FULL_LOAD);
+    if(shape->lookahead) {
+        sim_add_cu(prop, SIM_LOOKAHEAD, load);
+    }
+}
+
+static void sim_request(const xrmCuListPropertyV2 *list, int64_t *req)
+{
+    int32_t k;
+
+    memset(req, 0, SIM_NUM_KERNELS * sizeof(*req));
+    for(int32_t i = 0; i < list->cuNum; i++) {
+        k = sim_kernel(list->cuProps[i].kernelName);
+        if(k < 0) {
+            continue;
+        }
+        /* Soft kernels are whole channels */
+        req[k] += (k >= SIM_DEC_SOFT) ? 1 : list->cuProps[i].requestLoad >> 8;
+    }
+}
+
+static int32_t sim_fit(int32_t device, const int64_t *req)
+{
+    int64_t fit = -1, cap, left;
+
+    for(int32_t k = 0; k < SIM_NUM_KERNELS; k++) {
+        if(!req[k]) {
+            continue;
+        }
+        cap = (k >= SIM_DEC_SOFT) ? SIM_SOFT_SLOTS : SIM_FULL_LOAD;
+        left = (cap - sim.used[device][k]) / req[k];
+        if(fit < 0 || left < fit) {
+            fit = left;
+        }
+    }
+    return (int32_t)(fit < 0 ? 0 : fit);
+}
+
+int32_t xrmCheckCuPoolAvailableNumV2(xrmContext context,
+                                     xrmCuPoolPropertyV2 *cuPoolProp)
+{
+    const xrmCuListPropertyV2 *list = &cuPoolProp->cuListProp;
+    int64_t req[SIM_NUM_KERNELS];
+    int32_t device = -1, total = 0;
+
+    (void)context;
+    if(list->cuNum > 0 && list->cuProps[0].deviceInfo) {
+        device = (list->cuProps[0].deviceInfo >>
+                  XRM_DEVICE_INFO_DEVICE_INDEX_SHIFT) & 0xff;
+        if(device >= sim.num_devices) {
+            return -1;
+        }
+    }
+    sim_request(list, req);
+    if(device >= 0) {
+        return sim_fit(device, req);
+    }
+    for(int32_t d = 0; d < sim.num_devices; d++) {
+        total += sim_fit(d, req);
+    }
+    return total;
+}
+
+/* Moves the clock to t, releasing channels that ended on the way */
+static void sim_advance(double t)
+{
+    int32_t next;
+    double end;
+
+    for(;;) {
+        next = -1;
+        for(int32_t i = 0; i < sim.num_active; i++) {
+            if(sim.active[i].end <= t &&
+               (next < 0 || sim.active[i].end < sim.active[next].end)) {
+                next = i;
+            }
+        }
+        end = (next >= 0) ? sim.active[next].end : t;
+        for(int32_t d = 0; d < sim.num_devices; d++) {
+            sim.enc_load_time += (double)sim.used[d][SIM_ENCODER] *
+                                 (end - sim.now);
+        }
+        sim.now = end;
+        if(next < 0) {
+            return;
+        }
+        for(int32_t k = 0; k < SIM_NUM_KERNELS; k++) {
+            sim.used[sim.active[next].device][k] -= sim.active[next].load[k];
+        }
+        sim.active[next] = sim.active[--sim.num_active];
+    }
+}
+
+static double sim_rand(uint64_t *state)
+{
+    /* xorshift64*, 53 random bits */
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return ((*state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* Policy -1 stands for XRM's own choice, taken as first fit */
+static void sim_run(int32_t policy, const char *policy_name, int32_t arrivals,
+                    double offered_load, uint64_t seed)
+{
+    static xrmCuPoolProperty props[SIM_NUM_SHAPES];
+    int64_t req[SIM_NUM_SHAPES][SIM_NUM_KERNELS];
+    xrmCuPoolPropertyV2 v2;
+    int32_t fit[XLNX_CAPACITY_MAX_DEVICES];
+    int64_t offered[SIM_NUM_SHAPES] = {0}, rejected[SIM_NUM_SHAPES] = {0};
+    int64_t total_rejected = 0;
+    double mean_enc_load = 0, rate, t = 0, pick;
+    int32_t shape, device;
+    SimJob *job;
+
+    memset(&sim.used, 0, sizeof(sim.used));
+    sim.num_active = 0;
+    sim.now = 0;
+    sim.enc_load_time = 0;
+    Encoder_SetPlacementPolicy(policy < 0 ? XLNX_PLACEMENT_XRM : policy);
+
+    for(int32_t s = 0; s < SIM_NUM_SHAPES; s++) {
+        sim_cu_list(&sim_shapes[s], &props[s]);
+        memset(&v2, 0, sizeof(v2));
+        v2.cuListProp.cuNum = props[s].cuListProp.cuNum;
+        for(int32_t i = 0; i < v2.cuListProp.cuNum; i++) {
+            strcpy(v2.cuListProp.cuProps[i].kernelName,
+                   props[s].cuListProp.cuProps[i].kernelName);
+            v2.cuListProp.cuProps[i].requestLoad =
+                props[s].cuListProp.cuProps[i].requestLoad;
+        }
+        sim_request(&v2.cuListProp, req[s]);
+        mean_enc_load += sim_shapes[s].share * sim_load(&sim_shapes[s]);
+    }
+    /* Mean holding time 1, so the arrival rate sets the offered load */
+    rate = offered_load * sim.num_devices * SIM_FULL_LOAD / mean_enc_load;
+
+    for(int32_t n = 0; n < arrivals; n++) {
+        t += -log(1.0 - sim_rand(&seed)) / rate;
+        sim_advance(t);
+
+        pick = sim_rand(&seed);
+        for(shape = 0; shape < SIM_NUM_SHAPES - 1; shape++) {
+            pick -= sim_shapes[shape].share;
+            if(pick < 0) {
+                break;
+            }
+        }
+        offered[shape]++;
+
+        if(policy < 0) {
+            for(int32_t d = 0; d < sim.num_devices; d++) {
+                fit[d] = sim_fit(d, req[shape]);
+            }
+            device = -1;
+            for(int32_t d = 0; d < sim.num_devices && device < 0; d++) {
+                device = fit[d] > 0 ? d : -1;
+            }
+        }
+        else {
+            device = xlnx_placement_select(NULL, &props[shape]);
+        }
+        if(device < 0 || sim.num_active == SIM_MAX_ACTIVE) {
+            rejected[shape]++;
+            total_rejected++;
+            continue;
+        }
+
+        job = &sim.active[sim.num_active++];
+        job->end = t - log(1.0 - sim_rand(&seed));
+        job->device = device;
+        for(int32_t k = 0; k < SIM_NUM_KERNELS; k++) {
+            job->load[k] = (int32_t)req[shape][k];
+            sim.used[device][k] += req[shape][k];
+        }
+    }
+
+    printf("  {\"policy\": \"%s\", \"rejected\": %.4f, \"utilization\": %.4f, "
+           "\"rejected_by_shape\": {", policy_name,
+           (double)total_rejected / arrivals,
+           sim.enc_load_time / (sim.now * sim.num_devices * SIM_FULL_LOAD));
+    for(int32_t s = 0; s < SIM_NUM_SHAPES; s++) {
+        printf("%s\"%s\": %.4f", s ? ", " : "", sim_shapes[s].name,
+               offered[s] ? (double)rejected[s] / offered[s] : 0.0);
+    }
+    printf("}}");
+}
+
+int main(int argc, char *argv[])
+{
+    int32_t arrivals = 200000;
+    double offered_load = 0.85;
+    uint64_t seed = 1;
+    int opt;
+
+    sim.num_devices = 8;
+    while((opt = getopt(argc, argv, "n:a:l:s:")) != -1) {
+        switch(opt) {
+            case 'n': sim.num_devices = atoi(optarg); break;
+            case 'a': arrivals = atoi(optarg); break;
+            case 'l': offered_load = atof(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 0); break;
+            default:
+                printf("Usage: %s [-n devices] [-a arrivals] "
+                       "[-l offered_load] [-s seed]\n", argv[0]);
+                return 1;
+        }
+    }
+    if(sim.num_devices < 1 || sim.num_devices > XLNX_CAPACITY_MAX_DEVICES ||
+       arrivals < 1 || offered_load <= 0 || !seed) {
+        printf("Invalid arguments\n");
+        return 1;
+    }
+
+    printf("{\"devices\": %d, \"arrivals\": %d, \"offered_load\": %.2f, "
+           "\"results\": [\n", sim.num_devices, arrivals, offered_load);
+    sim_run(-1, "xrm-first-fit", arrivals, offered_load, seed);
+    printf(",\n");
+    sim_run(XLNX_PLACEMENT_BEST_FIT, "best-fit", arrivals, offered_load, seed);
+    printf(",\n");
+    sim_run(XLNX_PLACEMENT_WORST_FIT, "worst-fit", arrivals, offered_load,
+            seed);
+    printf("]}\n");
+    return 0;
+}
@@ -0,0 +1,320 @@
+/* Subset of the XMA API used by libu30_xma_codec, implemented by the 
+   libxlnx_sim simulator. Names and values follow the Xilinx video SDK; 
+   only the fields the codec library and the simulator touch are kept. */
+#ifndef _XMA_H_
+#define _XMA_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define XMA_SUCCESS            (0)
+#define XMA_ERROR              (-1)
+#define XMA_ERROR_INVALID      (-2)
+#define XMA_ERROR_NO_KERNEL    (-3)
+#define XMA_ERROR_NO_CHAN      (-4)
+#define XMA_ERROR_NO_DEV       (-5)
+#define XMA_ERROR_TIMEOUT      (-6)
+#define XMA_ERROR_NO_CHAN_CAP  (-7)
+#define XMA_EOS                (1)
+#define XMA_SEND_MORE_DATA     (2)
+#define XMA_TRY_AGAIN          (3)
+#define XMA_END_OF_FILE        (4)
+#define XMA_RESEND_AND_RECV    (5)
+#define XMA_FLUSH_AGAIN        (6)
+
+#define XMA_MAX_PLANES         3
+#define MAX_VENDOR_NAME        64
+#define MAX_SCALER_OUTPUTS     8
+
+typedef enum XmaLogLevelType {
+    XMA_CRITICAL_LOG = 0,
+    XMA_ERROR_LOG,
+    XMA_WARNING_LOG,
+    XMA_NOTICE_LOG,
+    XMA_INFO_LOG,
+    XMA_DEBUG_LOG
+} XmaLogLevelType;
+
+void xma_logmsg(XmaLogLevelType level, const char *name, const char *msg, 
+                ...);
+
+typedef struct XmaXclbinParameter {
+    char    *xclbin_name;
+    int32_t device_id;
+} XmaXclbinParameter;
+
+int32_t xma_initialize(XmaXclbinParameter *devXclbins, int32_t num_parms);
+
+typedef enum XmaFormatType {
+    XMA_NONE_FMT_TYPE = 0,
+    XMA_YUV420_FMT_TYPE,
+    XMA_YUV422_FMT_TYPE,
+    XMA_YUV444_FMT_TYPE,
+    XMA_RGB888_FMT_TYPE,
+    XMA_RGBP_FMT_TYPE,
+    XMA_VCU_NV12_FMT_TYPE,
+    XMA_VCU_NV12_10LE32_FMT_TYPE
+} XmaFormatType;
+
+typedef struct XmaFraction {
+    int32_t numerator;
+    int32_t denominator;
+} XmaFraction;
+
+typedef enum XmaBufferType {
+    XMA_HOST_BUFFER_TYPE = 1,
+    XMA_DEVICE_BUFFER_TYPE,
+    XMA_DEVICE_ONLY_BUFFER_TYPE,
+    XMA_NO_BUFFER_TYPE
+} XmaBufferType;
+
+/* buffer is host memory, or an XvbmBufferHandle for device buffers */
+typedef struct XmaBufferRef {
+    int32_t       refcount;
+    XmaBufferType buffer_type;
+    void          *buffer;
+    bool          is_clone;
+} XmaBufferRef;
+
+typedef struct XmaFrameProperties {
+    XmaFormatType format;
+    int32_t       width;
+    int32_t       height;
+    int32_t       linesize[XMA_MAX_PLANES];
+    int32_t       bits_per_pixel;
+} XmaFrameProperties;
+
+typedef void *XmaSideDataHandle;
+
+typedef enum XmaFrameSideDataType {
+    XMA_FRAME_QP_MAP = 0,
+    XMA_FRAME_RC_FSFA,
+    XMA_FRAME_HDR,
+    XMA_FRAME_DYNAMIC_PARAMS,
+    XMA_FRAME_SIDE_DATA_MAX_COUNT
+} XmaFrameSideDataType;
+
+typedef struct XmaFrame {
+    XmaBufferRef       data[XMA_MAX_PLANES];
+    XmaSideDataHandle  *side_data;
+    XmaFrameProperties frame_props;
+    XmaFraction        frame_rate;
+    uint64_t           pts;
+    int32_t            do_not_encode;
+    int32_t            is_idr;
+    int32_t            is_last_frame;
+} XmaFrame;
+
+typedef struct XmaDataBuffer {
+    XmaBufferRef data;
+    int32_t      alloc_size;
+    bool         is_eof;
+    int64_t      pts;
+} XmaDataBuffer;
+
+int32_t xma_frame_planes_get(XmaFrameProperties *frame_props);
+
+void xma_frame_clear_all_side_data(XmaFrame *frame);
+
+XmaSideDataHandle xma_frame_get_side_data(XmaFrame *frame, 
+                                          XmaFrameSideDataType type);
+
+int32_t xma_frame_add_side_data(XmaFrame *frame, XmaSideDataHandle side_data);
+
+int32_t xma_frame_remove_side_data_type(XmaFrame *frame, 
+                                        XmaFrameSideDataType type);
+
+XmaSideDataHandle xma_side_data_alloc(void *side_data, 
+                                      XmaFrameSideDataType type, size_t size,
+                                      int32_t use_buffer);
+
+void *xma_side_data_get_payload(XmaSideDataHandle side_data);
+
+size_t xma_side_data_get_size(XmaSideDataHandle side_data);
+
+int32_t xma_side_data_dec_ref(XmaSideDataHandle side_data);
+
+typedef enum XmaDataType {
+    XMA_STRING = 0,
+    XMA_INT32,
+    XMA_UINT32,
+    XMA_INT64,
+    XMA_UINT64
+} XmaDataType;
+
+typedef struct XmaParameter {
+    char        *name;
+    uint32_t    user_type;
+    XmaDataType type;
+    size_t      length;
+    void        *value;
+} XmaParameter;
+
+/* Encoder */
+typedef enum XmaEncoderType {
+    XMA_H264_ENCODER_TYPE = 1,
+    XMA_HEVC_ENCODER_TYPE,
+    XMA_MULTI_ENCODER_TYPE
+} XmaEncoderType;
+
+typedef struct XmaEncoderProperties {
+    XmaEncoderType hwencoder_type;
+    char           hwvendor_string[MAX_VENDOR_NAME];
+    XmaFormatType  format;
+    int32_t        bits_per_pixel;
+    int32_t        width;
+    int32_t        height;
+    XmaFraction    framerate;
+    int32_t        bitrate;
+    int32_t        qp;
+    int32_t        gop_size;
+    int32_t        idr_interval;
+    int32_t        lookahead_depth;
+    int32_t        rc_mode;
+    XmaParameter   *params;
+    uint32_t       param_cnt;
+    int32_t        dev_index;
+    int32_t        cu_index;
+    char           *cu_name;
+    int32_t        ddr_bank_index;
+    int32_t        channel_id;
+    char           *plugin_lib;
+} XmaEncoderProperties;
+
+typedef struct XmaEncoderSession XmaEncoderSession;
+
+XmaEncoderSession *xma_enc_session_create(XmaEncoderProperties *props);
+
+int32_t xma_enc_session_destroy(XmaEncoderSession *session);
+
+int32_t xma_enc_session_send_frame(XmaEncoderSession *session, 
+                                   XmaFrame *frame);
+
+int32_t xma_enc_session_recv_data(XmaEncoderSession *session, 
+                                  XmaDataBuffer *data, int32_t *data_size);
+
+/* Decoder */
+typedef enum XmaDecoderType {
+    XMA_H264_DECODER_TYPE = 1,
+    XMA_H265_DECODER_TYPE,
+    XMA_MULTI_DECODER_TYPE
+} XmaDecoderType;
+
+typedef struct XmaDecoderProperties {
+    XmaDecoderType hwdecoder_type;
+    char           hwvendor_string[MAX_VENDOR_NAME];
+    int32_t        intraonly;
+    int32_t        width;
+    int32_t        height;
+    int32_t        bits_per_pixel;
+    XmaFraction    framerate;
+    XmaParameter   *params;
+    uint32_t       param_cnt;
+    int32_t        dev_index;
+    int32_t        cu_index;
+    char           *cu_name;
+    int32_t        ddr_bank_index;
+    int32_t        channel_id;
+    char           *plugin_lib;
+} XmaDecoderProperties;
+
+typedef struct XmaDecoderSession XmaDecoderSession;
+
+XmaDecoderSession *xma_dec_session_create(XmaDecoderProperties *props);
+
+int32_t xma_dec_session_destroy(XmaDecoderSession *session);
+
+int32_t xma_dec_session_send_data(XmaDecoderSession *session, 
+                                  XmaDataBuffer *data, int32_t *data_used);
+
+int32_t xma_dec_session_recv_frame(XmaDecoderSession *session, 
+                                   XmaFrame *frame);
+
+/* Filter, used for the lookahead */
+typedef enum XmaFilterType {
+    XMA_2D_FILTER_TYPE = 1
+} XmaFilterType;
+
+typedef struct XmaFilterPortProperties {
+    XmaFormatType format;
+    int32_t       bits_per_pixel;
+    int32_t       width;
+    int32_t       height;
+    int32_t       stride;
+    XmaFraction   framerate;
+} XmaFilterPortProperties;
+
+typedef struct XmaFilterProperties {
+    XmaFilterType           hwfilter_type;
+    char                    hwvendor_string[MAX_VENDOR_NAME];
+    XmaFilterPortProperties input;
+    XmaFilterPortProperties output;
+    XmaParameter            *params;
+    uint32_t                param_cnt;
+    int32_t                 dev_index;
+    int32_t                 cu_index;
+    char                    *cu_name;
+    int32_t                 ddr_bank_index;
+    int32_t                 channel_id;
+    char                    *plugin_lib;
+} XmaFilterProperties;
+
+typedef struct XmaFilterSession XmaFilterSession;
+
+XmaFilterSession *xma_filter_session_create(XmaFilterProperties *props);
+
+int32_t xma_filter_session_destroy(XmaFilterSession *session);
+
+int32_t xma_filter_session_send_frame(XmaFilterSession *session, 
+                                      XmaFrame *frame);
+
+int32_t xma_filter_session_recv_frame(XmaFilterSession *session, 
+                                      XmaFrame *frame);
+
+/* Scaler */
+typedef enum XmaScalerType {
+    XMA_POLYPHASE_SCALER_TYPE = 1,
+    XMA_BILINEAR_SCALER_TYPE,
+    XMA_BICUBIC_SCALER_TYPE
+} XmaScalerType;
+
+typedef struct XmaScalerInOutProperties {
+    XmaFormatType format;
+    int32_t       bits_per_pixel;
+    int32_t       width;
+    int32_t       height;
+    int32_t       stride;
+    XmaFraction   framerate;
+    int32_t       flags;
+} XmaScalerInOutProperties;
+
+typedef struct XmaScalerProperties {
+    XmaScalerType            hwscaler_type;
+    char                     hwvendor_string[MAX_VENDOR_NAME];
+    int32_t                  num_outputs;
+    XmaScalerInOutProperties input;
+    XmaScalerInOutProperties output[MAX_SCALER_OUTPUTS];
+    XmaParameter             *params;
+    uint32_t                 param_cnt;
+    int32_t                  dev_index;
+    int32_t                  cu_index;
+    char                     *cu_name;
+    int32_t                  ddr_bank_index;
+    int32_t                  channel_id;
+    char                     *plugin_lib;
+} XmaScalerProperties;
+
+typedef struct XmaScalerSession XmaScalerSession;
+
+XmaScalerSession *xma_scaler_session_create(XmaScalerProperties *props);
+
+int32_t xma_scaler_session_destroy(XmaScalerSession *session);
+
+int32_t xma_scaler_session_send_frame(XmaScalerSession *session, 
+                                      XmaFrame *frame);
+
+int32_t xma_scaler_session_recv_frame_list(XmaScalerSession *session, 
+                                           XmaFrame **frame_list);
+
+#endif
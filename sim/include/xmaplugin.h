@@ -0,0 +1,8 @@
+/* The codec library includes the plugin header for the property types 
+   only, which the simulator keeps in xma.h */
+#ifndef _XMAPLUGIN_H_
+#define _XMAPLUGIN_H_
+
+#include "xma.h"
+
+#endif
@@ -0,0 +1,143 @@
+/* Subset of the XRM API used by libu30_xma_codec, implemented by the 
+   libxlnx_sim simulator against a model of U30 devices. */
+#ifndef _XRM_H_
+#define _XRM_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define XRM_SUCCESS                          (0)
+#define XRM_ERROR                            (-1)
+#define XRM_ERROR_INVALID                    (-2)
+#define XRM_ERROR_NO_KERNEL                  (-3)
+
+#define XRM_API_VERSION_1                    1
+#define XRM_MAX_NAME_LEN                     256
+#define XRM_MAX_PATH_NAME_LEN                512
+#define XRM_MAX_LIST_CU_NUM                  64
+#define XRM_MAX_POOL_CU_NUM                  128
+#define XRM_MAX_PLUGIN_FUNC_PARAM_LEN        16384
+#define XRM_MAX_CU_LOAD_GRANULARITY_1000000  1000000
+
+#define XRM_DEVICE_INFO_DEVICE_INDEX_SHIFT                    0
+#define XRM_DEVICE_INFO_CONSTRAINT_TYPE_SHIFT                 8
+#define XRM_DEVICE_INFO_CONSTRAINT_TYPE_HARDWARE_DEVICE_INDEX 0x1
+
+typedef void *xrmContext;
+
+typedef enum xrmCuType {
+    XRM_CU_NULL = 0,
+    XRM_CU_IPKERNEL,
+    XRM_CU_SOFTKERNEL
+} xrmCuType;
+
+typedef struct xrmCuProperty {
+    char     kernelName[XRM_MAX_NAME_LEN];
+    char     kernelAlias[XRM_MAX_NAME_LEN];
+    bool     devExcl;
+    int32_t  requestLoad;
+    uint64_t poolId;
+} xrmCuProperty;
+
+typedef struct xrmCuPropertyV2 {
+    char     kernelName[XRM_MAX_NAME_LEN];
+    char     kernelAlias[XRM_MAX_NAME_LEN];
+    uint64_t deviceInfo;
+    uint64_t memoryInfo;
+    uint64_t policyInfo;
+    int32_t  requestLoad;
+    uint64_t poolId;
+} xrmCuPropertyV2;
+
+typedef struct xrmCuResource {
+    char      xclbinFileName[XRM_MAX_PATH_NAME_LEN];
+    char      kernelPluginFileName[XRM_MAX_PATH_NAME_LEN];
+    char      kernelName[XRM_MAX_NAME_LEN];
+    char      kernelAlias[XRM_MAX_NAME_LEN];
+    char      instanceName[XRM_MAX_NAME_LEN];
+    char      cuName[XRM_MAX_NAME_LEN];
+    int32_t   deviceId;
+    int32_t   cuId;
+    int32_t   channelId;
+    xrmCuType cuType;
+    uint64_t  baseAddr;
+    uint32_t  membankId;
+    uint64_t  allocServiceId;
+    int32_t   channelLoad;
+    uint64_t  poolId;
+} xrmCuResource;
+
+typedef struct xrmCuListProperty {
+    xrmCuProperty cuProps[XRM_MAX_LIST_CU_NUM];
+    int32_t       cuNum;
+    bool          sameDevice;
+} xrmCuListProperty;
+
+typedef struct xrmCuListPropertyV2 {
+    xrmCuPropertyV2 cuProps[XRM_MAX_LIST_CU_NUM];
+    int32_t         cuNum;
+    bool            sameDevice;
+} xrmCuListPropertyV2;
+
+typedef struct xrmCuListResource {
+    xrmCuResource cuResources[XRM_MAX_LIST_CU_NUM];
+    int32_t       cuNum;
+} xrmCuListResource;
+
+typedef struct xrmCuPoolProperty {
+    xrmCuListProperty cuListProp;
+    int32_t           cuListNum;
+    int32_t           xclbinNum;
+} xrmCuPoolProperty;
+
+typedef struct xrmCuPoolPropertyV2 {
+    xrmCuListPropertyV2 cuListProp;
+    int32_t             cuListNum;
+    int32_t             xclbinNum;
+    uint64_t            deviceIdMask;
+} xrmCuPoolPropertyV2;
+
+typedef struct xrmCuPoolResource {
+    xrmCuResource cuResources[XRM_MAX_POOL_CU_NUM];
+    int32_t       cuNum;
+} xrmCuPoolResource;
+
+typedef struct xrmPluginFuncParam {
+    char input[XRM_MAX_PLUGIN_FUNC_PARAM_LEN];
+    char output[XRM_MAX_PLUGIN_FUNC_PARAM_LEN];
+} xrmPluginFuncParam;
+
+xrmContext xrmCreateContext(uint32_t xrmApiVersion);
+
+int32_t xrmDestroyContext(xrmContext context);
+
+int32_t xrmCuAlloc(xrmContext context, xrmCuProperty *cuProp, 
+                   xrmCuResource *cuRes);
+
+int32_t xrmCuAllocFromDev(xrmContext context, int32_t deviceId, 
+                          xrmCuProperty *cuProp, xrmCuResource *cuRes);
+
+int32_t xrmCuListAlloc(xrmContext context, xrmCuListProperty *cuListProp, 
+                       xrmCuListResource *cuListRes);
+
+bool xrmCuRelease(xrmContext context, xrmCuResource *cuRes);
+
+bool xrmCuListRelease(xrmContext context, xrmCuListResource *cuListRes);
+
+uint64_t xrmCuPoolReserve(xrmContext context, xrmCuPoolProperty *cuPoolProp);
+
+bool xrmCuPoolRelinquish(xrmContext context, uint64_t poolId);
+
+int32_t xrmReservationQuery(xrmContext context, uint64_t poolId, 
+                            xrmCuPoolResource *cuPoolRes);
+
+int32_t xrmCheckCuPoolAvailableNum(xrmContext context, 
+                                   xrmCuPoolProperty *cuPoolProp);
+
+int32_t xrmCheckCuPoolAvailableNumV2(xrmContext context, 
+                                     xrmCuPoolPropertyV2 *cuPoolProp);
+
+int32_t xrmExecPluginFunc(xrmContext context, char *xrmPluginName, 
+                          uint32_t funcId, xrmPluginFuncParam *param);
+
+#endif
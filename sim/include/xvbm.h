@@ -0,0 +1,31 @@
+/* Subset of the xvbm device buffer API used by libu30_xma_codec. In the
+   simulator a device buffer is host memory owned by a session pool. */
+#ifndef _XVBM_H_
+#define _XVBM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void *XvbmBufferHandle;
+typedef void *XvbmPoolHandle;
+
+void *xvbm_buffer_get_host_ptr(XvbmBufferHandle b_handle);
+
+int32_t xvbm_buffer_read(XvbmBufferHandle b_handle, void *dst, size_t size, 
+                         size_t offset);
+
+int32_t xvbm_buffer_write(XvbmBufferHandle b_handle, const void *src, 
+                          size_t size, size_t offset);
+
+/* Drops a reference, the buffer goes back to its pool with the last one */
+void xvbm_buffer_pool_entry_free(XvbmBufferHandle b_handle);
+
+void xvbm_buffer_refcnt_inc(XvbmBufferHandle b_handle);
+
+XvbmPoolHandle xvbm_get_pool_handle(XvbmBufferHandle b_handle);
+
+uint32_t xvbm_get_freelist_count(XvbmPoolHandle p_handle);
+
+uint32_t xvbm_buffer_pool_num_buffers_get(XvbmBufferHandle b_handle);
+
+#endif
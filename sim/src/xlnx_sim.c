@@ -0,0 +1,227 @@
+#include "xlnx_sim.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static XlnxSimConfig xlnx_sim_cfg;
+static pthread_once_t xlnx_sim_cfg_once = PTHREAD_ONCE_INIT;
+
+/* Completion time of the last job booked on every CU */
+static int64_t xlnx_sim_cu_busy[XLNX_SIM_MAX_DEVICES][XLNX_SIM_NUM_KERNELS];
+static pthread_mutex_t xlnx_sim_cu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* xma_logmsg would reenter the config while it is being loaded */
+static void xlnx_sim_config_warn(const char *msg, ...)
+{
+    va_list ap;
+
+    if(xlnx_sim_cfg.log_level < XMA_WARNING_LOG) {
+        return;
+    }
+    fprintf(stderr, "%s WARNING: ", XLNX_SIM_MODULE);
+    va_start(ap, msg);
+    vfprintf(stderr, msg, ap);
+    va_end(ap);
+}
+
+static int64_t xlnx_sim_env_int(const char *name, int64_t def, int64_t min,
+                                int64_t max)
+{
+    const char *val = getenv(name);
+    char *end;
+    long long num;
+
+    if(!val || !*val) {
+        return def;
+    }
+    num = strtoll(val, &end, 10);
+    if(*end || num < min || num > max) {
+        xlnx_sim_config_warn("Ignoring %s=%s, expected %lld to %lld\n", 
+                             name, val, (long long)min, (long long)max);
+        return def;
+    }
+    return num;
+}
+
+static void xlnx_sim_config_load(void)
+{
+    XlnxSimConfig *cfg = &xlnx_sim_cfg;
+    const char *val;
+
+    /* Logging comes first so the other warnings honour it */
+    cfg->log_level = XMA_ERROR_LOG;
+    cfg->log_level = xlnx_sim_env_int("XLNX_SIM_LOG_LEVEL", XMA_ERROR_LOG, 
+                                      XMA_CRITICAL_LOG, XMA_DEBUG_LOG);
+    cfg->num_devices = xlnx_sim_env_int("XLNX_SIM_DEVICES", 2, 1, 
+                                        XLNX_SIM_MAX_DEVICES);
+    cfg->latency_ns = xlnx_sim_env_int("XLNX_SIM_LATENCY_US", 0, 0, 
+                                       10000000) * 1000;
+    cfg->xrm_ns = xlnx_sim_env_int("XLNX_SIM_XRM_US", 0, 0, 10000000) * 1000;
+    cfg->queue_depth = xlnx_sim_env_int("XLNX_SIM_QUEUE_DEPTH", 8, 1, 256);
+    cfg->enc_delay = xlnx_sim_env_int("XLNX_SIM_ENC_DELAY", 2, 0, 64);
+
+    cfg->speed = 1.0;
+    val = getenv("XLNX_SIM_SPEED");
+    if(val && *val) {
+        cfg->speed = atof(val);
+        if(cfg->speed < 0) {
+            cfg->speed = 1.0;
+        }
+    }
+
+    val = getenv("XLNX_SIM_BITSTREAM");
+    cfg->passthrough = val && strcmp(val, "passthrough") == 0;
+    if(val && !cfg->passthrough && strcmp(val, "dummy") != 0) {
+        xlnx_sim_config_warn("Unknown XLNX_SIM_BITSTREAM %s, using dummy\n",
+                             val);
+    }
+}
+
+const XlnxSimConfig *xlnx_sim_config(void)
+{
+    pthread_once(&xlnx_sim_cfg_once, xlnx_sim_config_load);
+    return &xlnx_sim_cfg;
+}
+
+int64_t xlnx_sim_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void xlnx_sim_wait_until(int64_t t_ns)
+{
+    struct timespec ts;
+
+    if(xlnx_sim_config()->speed == 0 || t_ns <= xlnx_sim_now_ns()) {
+        return;
+    }
+    ts.tv_sec = t_ns / 1000000000LL;
+    ts.tv_nsec = t_ns % 1000000000LL;
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == 
+                                                                    EINTR) {
+    }
+}
+
+int64_t xlnx_sim_cu_schedule(int32_t device, XlnxSimKernel kind, 
+                             int64_t pixels)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    int64_t now = xlnx_sim_now_ns();
+    int64_t *busy;
+    int64_t done;
+
+    if(cfg->speed == 0) {
+        return now;
+    }
+    if(device < 0 || device >= XLNX_SIM_MAX_DEVICES) {
+        device = 0;
+    }
+    busy = &xlnx_sim_cu_busy[device][kind];
+
+    pthread_mutex_lock(&xlnx_sim_cu_lock);
+    done = (*busy > now ? *busy : now) + 
+           (int64_t)(pixels * 1e9 / (XLNX_SIM_CU_PIXEL_RATE * cfg->speed));
+    *busy = done;
+    pthread_mutex_unlock(&xlnx_sim_cu_lock);
+
+    return done + cfg->latency_ns;
+}
+
+size_t xlnx_sim_payload_put(uint8_t *plane, size_t capacity, 
+                            const uint8_t *data, size_t size)
+{
+    uint32_t hdr[2] = {XLNX_SIM_PAYLOAD_MAGIC, 0};
+
+    if(capacity < sizeof(hdr)) {
+        return 0;
+    }
+    if(size > capacity - sizeof(hdr)) {
+        size = capacity - sizeof(hdr);
+    }
+    hdr[1] = (uint32_t)size;
+    memcpy(plane, hdr, sizeof(hdr));
+    memcpy(plane + sizeof(hdr), data, size);
+    return size + sizeof(hdr);
+}
+
+size_t xlnx_sim_payload_size(const uint8_t *plane, size_t capacity)
+{
+    uint32_t hdr[2];
+
+    if(!plane || capacity < sizeof(hdr)) {
+        return 0;
+    }
+    memcpy(hdr, plane, sizeof(hdr));
+    if(hdr[0] != XLNX_SIM_PAYLOAD_MAGIC || 
+       hdr[1] > capacity - sizeof(hdr)) {
+        return 0;
+    }
+    return hdr[1];
+}
+
+size_t xlnx_sim_nv12_size(int32_t width, int32_t height)
+{
+    size_t luma = (size_t)XLNX_SIM_ALIGN(width, XLNX_SIM_STRIDE_ALIGN) * 
+                  XLNX_SIM_ALIGN(height, XLNX_SIM_HEIGHT_ALIGN);
+
+    return luma + luma / 2;
+}
+
+uint8_t *xlnx_sim_frame_plane(const XmaFrame *frame, int32_t plane)
+{
+    uint8_t *base;
+
+    if(frame->data[0].buffer_type != XMA_DEVICE_BUFFER_TYPE) {
+        return (uint8_t *)frame->data[plane].buffer;
+    }
+    if(!frame->data[0].buffer) {
+        return NULL;
+    }
+    base = (uint8_t *)xvbm_buffer_get_host_ptr(frame->data[0].buffer);
+    if(plane == 0) {
+        return base;
+    }
+    return base + (size_t)frame->frame_props.linesize[0] * 
+                  XLNX_SIM_ALIGN(frame->frame_props.height, 
+                                 XLNX_SIM_HEIGHT_ALIGN);
+}
+
+void xlnx_sim_frame_set_device(XmaFrame *frame, XvbmBufferHandle buffer, 
+                               int32_t width, int32_t height, int64_t pts)
+{
+    int32_t stride = XLNX_SIM_ALIGN(width, XLNX_SIM_STRIDE_ALIGN);
+
+    frame->data[0].buffer = buffer;
+    frame->data[0].buffer_type = XMA_DEVICE_BUFFER_TYPE;
+    frame->data[0].refcount = 1;
+    frame->data[0].is_clone = true;
+    frame->data[1].buffer = NULL;
+    frame->data[1].buffer_type = XMA_DEVICE_BUFFER_TYPE;
+    frame->frame_props.format = XMA_VCU_NV12_FMT_TYPE;
+    frame->frame_props.width = width;
+    frame->frame_props.height = height;
+    frame->frame_props.bits_per_pixel = 8;
+    frame->frame_props.linesize[0] = stride;
+    frame->frame_props.linesize[1] = stride;
+    frame->pts = pts;
+    frame->is_last_frame = 0;
+    frame->do_not_encode = 0;
+}
+
+const XmaParameter *xlnx_sim_param_find(const XmaParameter *params, 
+                                        uint32_t num, const char *name)
+{
+    for(uint32_t i = 0; params && i < num; i++) {
+        if(params[i].name && strcmp(params[i].name, name) == 0) {
+            return &params[i];
+        }
+    }
+    return NULL;
+}
@@ -0,0 +1,113 @@
+#ifndef _XLNX_SIM_H_
+#define _XLNX_SIM_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <xma.h>
+#include <xrm.h>
+#include <xvbm.h>
+
+#define XLNX_SIM_MODULE          "xlnx_sim"
+#define XLNX_SIM_MAX_DEVICES     16
+#define XLNX_SIM_XCLBIN          "/opt/xilinx/xcdr/xclbins/transcode.xclbin"
+#define XLNX_SIM_PLUGIN          "libxlnx_sim.so"
+
+/* Full load of a hard CU, 4K60 worth of pixels for every kind */
+#define XLNX_SIM_FULL_LOAD       XRM_MAX_CU_LOAD_GRANULARITY_1000000
+#define XLNX_SIM_CU_PIXEL_RATE   (3840LL * 2160 * 60)
+/* Channels of each soft kernel per device */
+#define XLNX_SIM_SOFT_CHANNELS   32
+
+/* Marks a pass through payload at the start of the luma plane */
+#define XLNX_SIM_PAYLOAD_MAGIC   0x4d495358 /* "XSIM" */
+
+typedef enum XlnxSimKernel {
+    XLNX_SIM_DECODER = 0,
+    XLNX_SIM_SCALER,
+    XLNX_SIM_LOOKAHEAD,
+    XLNX_SIM_ENCODER,
+    XLNX_SIM_DEC_SOFT,
+    XLNX_SIM_ENC_SOFT,
+    XLNX_SIM_NUM_KERNELS
+} XlnxSimKernel;
+
+/* Read once from the environment:
+   XLNX_SIM_DEVICES      devices to model, default 2 (one U30 card)
+   XLNX_SIM_SPEED        CU speed relative to a U30, default 1. 0 takes no
+                         time at all, for functional tests.
+   XLNX_SIM_LATENCY_US   fixed pipeline latency per frame, default 0
+   XLNX_SIM_XRM_US       xrmd round trip every XRM call waits, default 0
+   XLNX_SIM_QUEUE_DEPTH  output buffers of every decoder, scaler output and
+                         lookahead, default 8
+   XLNX_SIM_ENC_DELAY    frames an encoder holds before its first packet, 
+                         default 2
+   XLNX_SIM_BITSTREAM    "dummy" for synthetic NAL units sized by bit rate, 
+                         "passthrough" to carry decoder input through the 
+                         pipeline and out of the encoder unchanged
+   XLNX_SIM_LOG_LEVEL    most verbose xma_logmsg level printed, default 1 */
+typedef struct XlnxSimConfig {
+    int32_t num_devices;
+    double  speed;
+    int64_t latency_ns;
+    int64_t xrm_ns;
+    int32_t queue_depth;
+    int32_t enc_delay;
+    int32_t passthrough;
+    int32_t log_level;
+} XlnxSimConfig;
+
+const XlnxSimConfig *xlnx_sim_config(void);
+
+int64_t xlnx_sim_now_ns(void);
+
+/* Blocks until the monotonic clock reaches t_ns, unless time is off */
+void xlnx_sim_wait_until(int64_t t_ns);
+
+/* Books a job of pixels on the CU of kind on device and returns when it 
+   completes. Jobs on one CU run one after the other, so sessions sharing 
+   a device slow each other down like they do on hardware. */
+int64_t xlnx_sim_cu_schedule(int32_t device, XlnxSimKernel kind, 
+                             int64_t pixels);
+
+/* Session parameter called name, NULL when absent */
+const XmaParameter *xlnx_sim_param_find(const XmaParameter *params, 
+                                        uint32_t num, const char *name);
+
+/* Session creation checks XMA was initialized on device */
+int32_t xlnx_sim_device_ready(int32_t device);
+
+/* Device buffer pools. A pool lives until it was released and every 
+   buffer taken from it came back. */
+typedef struct XlnxSimPool XlnxSimPool;
+
+XlnxSimPool *xlnx_sim_pool_create(int32_t num_buffers, size_t size);
+
+void xlnx_sim_pool_release(XlnxSimPool *pool);
+
+/* Free buffer with one reference, NULL when all are in use */
+XvbmBufferHandle xlnx_sim_pool_get(XlnxSimPool *pool);
+
+size_t xlnx_sim_buffer_size(XvbmBufferHandle buffer);
+
+/* Pass through payloads: [magic][size][bytes] at the start of a plane */
+size_t xlnx_sim_payload_put(uint8_t *plane, size_t capacity, 
+                            const uint8_t *data, size_t size);
+
+/* Payload size, 0 when the plane carries none */
+size_t xlnx_sim_payload_size(const uint8_t *plane, size_t capacity);
+
+/* Frame helpers shared by the sessions */
+uint8_t *xlnx_sim_frame_plane(const XmaFrame *frame, int32_t plane);
+
+void xlnx_sim_frame_set_device(XmaFrame *frame, XvbmBufferHandle buffer, 
+                               int32_t width, int32_t height, int64_t pts);
+
+#define XLNX_SIM_ALIGN(x, a)   (((x) + (a) - 1) & ~((a) - 1))
+#define XLNX_SIM_STRIDE_ALIGN  256
+#define XLNX_SIM_HEIGHT_ALIGN  64
+
+/* NV12 device frame, planes at the decoder's alignment */
+size_t xlnx_sim_nv12_size(int32_t width, int32_t height);
+
+#endif
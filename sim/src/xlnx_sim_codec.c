@@ -0,0 +1,476 @@
+#include "xlnx_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Frames an encoder accepts ahead of the packets taken out of it */
+#define XLNX_SIM_ENC_MAX_QUEUE  128
+
+/* Picture kinds of the synthetic bitstream */
+#define XLNX_SIM_PIC_IDR  0
+#define XLNX_SIM_PIC_I    1
+#define XLNX_SIM_PIC_P    2
+
+/* Frame or packet in flight through a session */
+typedef struct XlnxSimJob {
+    int64_t          done_ns;
+    int64_t          pts;
+    int32_t          pic;
+    XvbmBufferHandle buffer;
+    uint8_t          *payload;
+    size_t           payload_size;
+} XlnxSimJob;
+
+struct XmaEncoderSession {
+    int32_t       device;
+    int32_t       hevc;
+    int32_t       width;
+    int32_t       height;
+    int64_t       bitrate_kbps;
+    int32_t       gop_length;
+    int32_t       freq_idr;
+    XmaFraction   fps;
+    int64_t       frame_num;
+    int32_t       flushing;
+    XlnxSimJob queue[XLNX_SIM_ENC_MAX_QUEUE];
+    int32_t       head;
+    int32_t       count;
+    uint8_t       *out;
+    size_t        out_size;
+};
+
+struct XmaDecoderSession {
+    int32_t          device;
+    int32_t          width;
+    int32_t          height;
+    int32_t          eof;
+    int32_t          luma;
+    XlnxSimPool      *pool;
+    XlnxSimJob    *queue;
+    int32_t          queue_size;
+    int32_t          head;
+    int32_t          count;
+};
+
+/* Reads "key = value" from the encoder's option text */
+static int64_t xlnx_sim_option_int(const char *options, const char *key, 
+                                   int64_t def)
+{
+    const char *p = options ? strstr(options, key) : NULL;
+
+    return p ? strtoll(p + strlen(key), NULL, 10) : def;
+}
+
+XmaEncoderSession *xma_enc_session_create(XmaEncoderProperties *props)
+{
+    XmaEncoderSession *session;
+    const XmaParameter *param;
+    const char *options = NULL;
+
+    if(!props || props->width <= 0 || props->height <= 0 || 
+       props->framerate.numerator <= 0 || props->framerate.denominator <= 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Invalid encoder properties\n");
+        return NULL;
+    }
+    if(!xlnx_sim_device_ready(props->dev_index)) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Encoder on device %d before xma_initialize\n", 
+                   props->dev_index);
+        return NULL;
+    }
+    session = calloc(1, sizeof(XmaEncoderSession));
+    if(!session) {
+        return NULL;
+    }
+    param = xlnx_sim_param_find(props->params, props->param_cnt, 
+                                "enc_options");
+    if(param && param->value) {
+        options = *(char **)param->value;
+    }
+    session->device = props->dev_index;
+    session->width = props->width;
+    session->height = props->height;
+    session->fps = props->framerate;
+    session->hevc = options && strstr(options, "Profile = HEVC") != NULL;
+    session->bitrate_kbps = xlnx_sim_option_int(options, "BitRate = ", 
+                                                props->bitrate > 0 ? 
+                                                props->bitrate : 5000);
+    session->gop_length = xlnx_sim_option_int(options, "Gop.Length = ", 
+                                              props->gop_size);
+    session->freq_idr = xlnx_sim_option_int(options, "Gop.FreqIDR = ", -1);
+    return session;
+}
+
+static void xlnx_sim_job_clear(XlnxSimJob *job)
+{
+    if(job->buffer) {
+        xvbm_buffer_pool_entry_free(job->buffer);
+    }
+    free(job->payload);
+    memset(job, 0, sizeof(*job));
+}
+
+int32_t xma_enc_session_destroy(XmaEncoderSession *session)
+{
+    if(!session) {
+        return XMA_ERROR_INVALID;
+    }
+    while(session->count > 0) {
+        xlnx_sim_job_clear(&session->queue[session->head]);
+        session->head = (session->head + 1) % XLNX_SIM_ENC_MAX_QUEUE;
+        session->count--;
+    }
+    free(session->out);
+    free(session);
+    return XMA_SUCCESS;
+}
+
+static int32_t xlnx_sim_enc_pic(XmaEncoderSession *session, 
+                                const XmaFrame *frame)
+{
+    int64_t n = session->frame_num++;
+
+    if(n == 0 || frame->is_idr || 
+       (session->freq_idr > 0 && n % session->freq_idr == 0)) {
+        return XLNX_SIM_PIC_IDR;
+    }
+    if(session->gop_length > 0 && n % session->gop_length == 0) {
+        return XLNX_SIM_PIC_I;
+    }
+    return XLNX_SIM_PIC_P;
+}
+
+/* Keeps a copy of a pass through payload, it must survive the caller 
+   reusing its frame */
+static int32_t xlnx_sim_enc_take_payload(XlnxSimJob *job, 
+                                         const XmaFrame *frame)
+{
+    const uint8_t *plane = xlnx_sim_frame_plane(frame, 0);
+    size_t capacity;
+
+    if(!plane) {
+        return 0;
+    }
+    if(frame->data[0].buffer_type == XMA_DEVICE_BUFFER_TYPE) {
+        capacity = xlnx_sim_buffer_size(frame->data[0].buffer);
+    }
+    else {
+        capacity = (size_t)frame->frame_props.linesize[0] * 
+                   frame->frame_props.height;
+    }
+    job->payload_size = xlnx_sim_payload_size(plane, capacity);
+    if(!job->payload_size) {
+        return 0;
+    }
+    job->payload = malloc(job->payload_size);
+    if(!job->payload) {
+        return -1;
+    }
+    memcpy(job->payload, plane + 2 * sizeof(uint32_t), job->payload_size);
+    return 0;
+}
+
+int32_t xma_enc_session_send_frame(XmaEncoderSession *session, 
+                                   XmaFrame *frame)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    XlnxSimJob *job;
+
+    if(!session || !frame) {
+        return XMA_ERROR_INVALID;
+    }
+    if(frame->is_last_frame) {
+        session->flushing = 1;
+        return XMA_SUCCESS;
+    }
+    if(frame->do_not_encode) {
+        return XMA_SEND_MORE_DATA;
+    }
+    if(session->flushing) {
+        return XMA_ERROR;
+    }
+    if(session->count == XLNX_SIM_ENC_MAX_QUEUE) {
+        return XMA_TRY_AGAIN;
+    }
+
+    job = &session->queue[(session->head + session->count) % 
+                          XLNX_SIM_ENC_MAX_QUEUE];
+    memset(job, 0, sizeof(*job));
+    if(cfg->passthrough && xlnx_sim_enc_take_payload(job, frame) != 0) {
+        return XMA_ERROR;
+    }
+    /* Device frames stay referenced until encoded, like on the card */
+    if(frame->data[0].buffer_type == XMA_DEVICE_BUFFER_TYPE && 
+       frame->data[0].buffer) {
+        job->buffer = frame->data[0].buffer;
+        xvbm_buffer_refcnt_inc(job->buffer);
+    }
+    job->pts = frame->pts;
+    job->pic = xlnx_sim_enc_pic(session, frame);
+    job->done_ns = xlnx_sim_cu_schedule(session->device, XLNX_SIM_ENCODER, 
+                                        (int64_t)session->width * 
+                                        session->height);
+    session->count++;
+
+    /* The first packet comes once the encoder's reorder delay is filled */
+    return session->count > cfg->enc_delay ? XMA_SUCCESS : XMA_SEND_MORE_DATA;
+}
+
+/* Emulation free filler, never forms a start code */
+static void xlnx_sim_fill(uint8_t *dst, size_t size, int64_t seed)
+{
+    for(size_t i = 0; i < size; i++) {
+        dst[i] = 0x80 | ((seed + i * 7) & 0x7f);
+    }
+}
+
+static size_t xlnx_sim_put_nal(uint8_t *dst, const uint8_t *hdr, 
+                               size_t hdr_size)
+{
+    static const uint8_t start_code[4] = {0, 0, 0, 1};
+
+    memcpy(dst, start_code, sizeof(start_code));
+    memcpy(dst + sizeof(start_code), hdr, hdr_size);
+    return sizeof(start_code) + hdr_size;
+}
+
+/* Access unit of size bytes whose NAL and slice headers parse as pic: 
+   parameter sets ahead of IDRs and one slice whose slice_type reads I or 
+   P. The rest is filler. */
+static size_t xlnx_sim_make_au(const XmaEncoderSession *session, 
+                               const XlnxSimJob *job, uint8_t *dst, 
+                               size_t size)
+{
+    static const uint8_t h264_sps[] = {0x67, 0x64, 0x00, 0x28, 0xac};
+    static const uint8_t h264_pps[] = {0x68, 0xee, 0x3c, 0x80};
+    static const uint8_t h264_slices[3][2] = {
+        {0x65, 0x88}, {0x41, 0x88}, {0x41, 0x9a}
+    };
+    static const uint8_t hevc_vps[] = {0x40, 0x01, 0x0c, 0x01, 0xff};
+    /* Main, level 4, with the whole profile_tier_level so an hvcC can be
+       built from it, emulation prevention bytes included */
+    static const uint8_t hevc_sps[] = {
+        0x42, 0x01, 0x01, 0x01, 0x60, 0x00, 0x00, 0x03, 0x00, 0x90, 0x00,
+        0x00, 0x03, 0x00, 0x00, 0x03, 0x00, 0x78, 0xa0
+    };
+    static const uint8_t hevc_pps[] = {0x44, 0x01, 0xc1, 0x72, 0xb4};
+    static const uint8_t hevc_slices[3][3] = {
+        {0x26, 0x01, 0xae}, {0x02, 0x01, 0xd8}, {0x02, 0x01, 0xd4}
+    };
+    size_t len = 0;
+
+    if(job->pic == XLNX_SIM_PIC_IDR) {
+        if(session->hevc) {
+            len += xlnx_sim_put_nal(dst + len, hevc_vps, sizeof(hevc_vps));
+            len += xlnx_sim_put_nal(dst + len, hevc_sps, sizeof(hevc_sps));
+            len += xlnx_sim_put_nal(dst + len, hevc_pps, sizeof(hevc_pps));
+        }
+        else {
+            len += xlnx_sim_put_nal(dst + len, h264_sps, sizeof(h264_sps));
+            len += xlnx_sim_put_nal(dst + len, h264_pps, sizeof(h264_pps));
+        }
+    }
+    if(session->hevc) {
+        len += xlnx_sim_put_nal(dst + len, hevc_slices[job->pic], 3);
+    }
+    else {
+        len += xlnx_sim_put_nal(dst + len, h264_slices[job->pic], 2);
+    }
+    if(size > len) {
+        xlnx_sim_fill(dst + len, size - len, job->pts);
+        len = size;
+    }
+    return len;
+}
+
+static size_t xlnx_sim_au_size(const XmaEncoderSession *session, 
+                               const XlnxSimJob *job)
+{
+    size_t size = session->bitrate_kbps * 1000 / 8 * session->fps.denominator
+                  / session->fps.numerator;
+
+    if(job->pic != XLNX_SIM_PIC_P) {
+        size *= 4;
+    }
+    return size > 64 ? size : 64;
+}
+
+int32_t xma_enc_session_recv_data(XmaEncoderSession *session, 
+                                  XmaDataBuffer *data, int32_t *data_size)
+{
+    XlnxSimJob *job;
+    uint8_t *dst;
+    size_t size;
+    uint8_t *grown;
+
+    if(!session || !data || !data_size) {
+        return XMA_ERROR_INVALID;
+    }
+    *data_size = 0;
+    if(session->count == 0) {
+        return session->flushing ? XMA_EOS : XMA_TRY_AGAIN;
+    }
+    if(!session->flushing && session->count <= xlnx_sim_config()->enc_delay) {
+        return XMA_TRY_AGAIN;
+    }
+
+    job = &session->queue[session->head];
+    xlnx_sim_wait_until(job->done_ns);
+    size = job->payload ? job->payload_size : xlnx_sim_au_size(session, job);
+
+    /* Written straight to the caller's buffer when it is large enough */
+    dst = data->data.buffer;
+    if(!dst || data->alloc_size < 0 || (size_t)data->alloc_size < size) {
+        if(session->out_size < size) {
+            grown = realloc(session->out, size);
+            if(!grown) {
+                return XMA_ERROR;
+            }
+            session->out = grown;
+            session->out_size = size;
+        }
+        dst = session->out;
+        data->data.buffer = dst;
+    }
+    if(job->payload) {
+        memcpy(dst, job->payload, size);
+    }
+    else {
+        size = xlnx_sim_make_au(session, job, dst, size);
+    }
+    *data_size = (int32_t)size;
+    data->pts = job->pts;
+    data->is_eof = 0;
+
+    xlnx_sim_job_clear(job);
+    session->head = (session->head + 1) % XLNX_SIM_ENC_MAX_QUEUE;
+    session->count--;
+    return XMA_SUCCESS;
+}
+
+XmaDecoderSession *xma_dec_session_create(XmaDecoderProperties *props)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    XmaDecoderSession *session;
+
+    if(!props || props->width <= 0 || props->height <= 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Invalid decoder properties\n");
+        return NULL;
+    }
+    if(!xlnx_sim_device_ready(props->dev_index)) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Decoder on device %d before xma_initialize\n", 
+                   props->dev_index);
+        return NULL;
+    }
+    session = calloc(1, sizeof(XmaDecoderSession));
+    if(!session) {
+        return NULL;
+    }
+    session->device = props->dev_index;
+    session->width = props->width;
+    session->height = props->height;
+    session->queue_size = cfg->queue_depth;
+    session->queue = calloc(session->queue_size, sizeof(XlnxSimJob));
+    session->pool = xlnx_sim_pool_create(session->queue_size, 
+                                         xlnx_sim_nv12_size(props->width, 
+                                                            props->height));
+    if(!session->queue || !session->pool) {
+        xma_dec_session_destroy(session);
+        return NULL;
+    }
+    return session;
+}
+
+int32_t xma_dec_session_destroy(XmaDecoderSession *session)
+{
+    if(!session) {
+        return XMA_ERROR_INVALID;
+    }
+    while(session->count > 0) {
+        xlnx_sim_job_clear(&session->queue[session->head]);
+        session->head = (session->head + 1) % session->queue_size;
+        session->count--;
+    }
+    xlnx_sim_pool_release(session->pool);
+    free(session->queue);
+    free(session);
+    return XMA_SUCCESS;
+}
+
+int32_t xma_dec_session_send_data(XmaDecoderSession *session, 
+                                  XmaDataBuffer *data, int32_t *data_used)
+{
+    XlnxSimJob *job;
+    XvbmBufferHandle buffer;
+    uint8_t *plane;
+    size_t luma_size;
+    size_t capacity;
+
+    if(!session || !data || !data_used) {
+        return XMA_ERROR_INVALID;
+    }
+    *data_used = 0;
+    if(data->is_eof) {
+        session->eof = 1;
+        return XMA_SUCCESS;
+    }
+    if(!data->data.buffer || data->alloc_size <= 0) {
+        return XMA_ERROR_INVALID;
+    }
+    /* Out of output buffers until the caller frees decoded frames */
+    if(session->count == session->queue_size || 
+       !(buffer = xlnx_sim_pool_get(session->pool))) {
+        return XMA_TRY_AGAIN;
+    }
+
+    /* Every send is one access unit and decodes to one frame */
+    plane = xvbm_buffer_get_host_ptr(buffer);
+    capacity = xlnx_sim_buffer_size(buffer);
+    luma_size = capacity / 3 * 2;
+    if(xlnx_sim_config()->passthrough) {
+        xlnx_sim_payload_put(plane, luma_size, data->data.buffer, 
+                             data->alloc_size);
+    }
+    else {
+        session->luma = (session->luma + 1) % 200;
+        memset(plane, 16 + session->luma, luma_size);
+        memset(plane + luma_size, 128, capacity - luma_size);
+    }
+
+    job = &session->queue[(session->head + session->count) % 
+                          session->queue_size];
+    job->buffer = buffer;
+    job->pts = data->pts;
+    job->done_ns = xlnx_sim_cu_schedule(session->device, XLNX_SIM_DECODER, 
+                                        (int64_t)session->width * 
+                                        session->height);
+    session->count++;
+    *data_used = data->alloc_size;
+    return XMA_SUCCESS;
+}
+
+int32_t xma_dec_session_recv_frame(XmaDecoderSession *session, 
+                                   XmaFrame *frame)
+{
+    XlnxSimJob *job;
+
+    if(!session || !frame) {
+        return XMA_ERROR_INVALID;
+    }
+    if(session->count == 0) {
+        return session->eof ? XMA_EOS : XMA_TRY_AGAIN;
+    }
+    job = &session->queue[session->head];
+    xlnx_sim_wait_until(job->done_ns);
+
+    /* The caller owns the buffer now and frees it back to the pool */
+    xlnx_sim_frame_set_device(frame, job->buffer, session->width, 
+                              session->height, job->pts);
+    memset(job, 0, sizeof(*job));
+    session->head = (session->head + 1) % session->queue_size;
+    session->count--;
+    return XMA_SUCCESS;
+}
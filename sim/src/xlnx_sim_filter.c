@@ -0,0 +1,341 @@
+#include "xlnx_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Lookahead QP maps carry one byte per 16x16 block */
+#define XLNX_SIM_QP_BLOCK 16
+
+typedef struct XlnxSimLaJob {
+    int64_t          done_ns;
+    int64_t          pts;
+    XvbmBufferHandle buffer;
+} XlnxSimLaJob;
+
+struct XmaFilterSession {
+    int32_t          device;
+    int32_t          width;
+    int32_t          height;
+    int32_t          depth;
+    int32_t          flushing;
+    XlnxSimPool      *pool;
+    XlnxSimLaJob     *queue;
+    int32_t          queue_size;
+    int32_t          head;
+    int32_t          count;
+    /* Output handed out last, its reference is dropped on the next call */
+    XvbmBufferHandle last_out;
+};
+
+struct XmaScalerSession {
+    int32_t          device;
+    int32_t          num_outputs;
+    int32_t          width[MAX_SCALER_OUTPUTS];
+    int32_t          height[MAX_SCALER_OUTPUTS];
+    XlnxSimPool      *pools[MAX_SCALER_OUTPUTS];
+    XvbmBufferHandle pending[MAX_SCALER_OUTPUTS];
+    int64_t          pending_pts;
+    int64_t          done_ns;
+    int64_t          out_pixels;
+};
+
+XmaFilterSession *xma_filter_session_create(XmaFilterProperties *props)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    XmaFilterSession *session;
+    const XmaParameter *param;
+
+    if(!props || props->input.width <= 0 || props->input.height <= 0) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Invalid lookahead properties\n");
+        return NULL;
+    }
+    if(!xlnx_sim_device_ready(props->dev_index)) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Lookahead on device %d before xma_initialize\n", 
+                   props->dev_index);
+        return NULL;
+    }
+    session = calloc(1, sizeof(XmaFilterSession));
+    if(!session) {
+        return NULL;
+    }
+    param = xlnx_sim_param_find(props->params, props->param_cnt, 
+                                "lookahead_depth");
+    session->depth = param && param->value ? *(int32_t *)param->value : 0;
+    if(session->depth < 0) {
+        session->depth = 0;
+    }
+    session->device = props->dev_index;
+    session->width = props->input.width;
+    session->height = props->input.height;
+
+    session->queue_size = session->depth + 1;
+    session->queue = calloc(session->queue_size, sizeof(XlnxSimLaJob));
+    /* Buffers for the window plus the outputs the encoder still holds */
+    session->pool = xlnx_sim_pool_create(session->queue_size + 
+                                         cfg->queue_depth + cfg->enc_delay,
+                                         xlnx_sim_nv12_size(session->width, 
+                                                            session->height));
+    if(!session->queue || !session->pool) {
+        xma_filter_session_destroy(session);
+        return NULL;
+    }
+    return session;
+}
+
+int32_t xma_filter_session_destroy(XmaFilterSession *session)
+{
+    if(!session) {
+        return XMA_ERROR_INVALID;
+    }
+    while(session->count > 0) {
+        xvbm_buffer_pool_entry_free(session->queue[session->head].buffer);
+        session->head = (session->head + 1) % session->queue_size;
+        session->count--;
+    }
+    xvbm_buffer_pool_entry_free(session->last_out);
+    xlnx_sim_pool_release(session->pool);
+    free(session->queue);
+    free(session);
+    return XMA_SUCCESS;
+}
+
+/* Copies a host or device NV12 frame into a device buffer at the 
+   decoder's layout */
+static void xlnx_sim_copy_nv12(const XmaFrame *frame, 
+                               XvbmBufferHandle buffer, int32_t width, 
+                               int32_t height)
+{
+    uint8_t *dst = xvbm_buffer_get_host_ptr(buffer);
+    size_t size = xlnx_sim_buffer_size(buffer);
+    int32_t stride = XLNX_SIM_ALIGN(width, XLNX_SIM_STRIDE_ALIGN);
+    uint8_t *dst_uv = dst + (size_t)stride * 
+                      XLNX_SIM_ALIGN(height, XLNX_SIM_HEIGHT_ALIGN);
+    const uint8_t *src;
+
+    if(frame->data[0].buffer_type == XMA_DEVICE_BUFFER_TYPE) {
+        src = xvbm_buffer_get_host_ptr(frame->data[0].buffer);
+        if(src) {
+            size_t src_size = xlnx_sim_buffer_size(frame->data[0].buffer);
+            memcpy(dst, src, src_size < size ? src_size : size);
+        }
+        return;
+    }
+    for(int32_t plane = 0; plane < 2; plane++) {
+        src = frame->data[plane].buffer;
+        if(!src) {
+            continue;
+        }
+        for(int32_t y = 0; y < (plane ? height / 2 : height); y++) {
+            memcpy((plane ? dst_uv : dst) + (size_t)y * stride, 
+                   src + (size_t)y * frame->frame_props.linesize[plane], 
+                   width);
+        }
+    }
+}
+
+int32_t xma_filter_session_send_frame(XmaFilterSession *session, 
+                                      XmaFrame *frame)
+{
+    XlnxSimLaJob *job;
+    XvbmBufferHandle buffer;
+
+    if(!session || !frame) {
+        return XMA_ERROR_INVALID;
+    }
+    if(frame->is_last_frame) {
+        session->flushing = 1;
+        return XMA_SUCCESS;
+    }
+    if(session->flushing) {
+        return XMA_ERROR;
+    }
+    if(session->count == session->queue_size || 
+       !(buffer = xlnx_sim_pool_get(session->pool))) {
+        return XMA_TRY_AGAIN;
+    }
+    xlnx_sim_copy_nv12(frame, buffer, session->width, session->height);
+
+    job = &session->queue[(session->head + session->count) % 
+                          session->queue_size];
+    job->buffer = buffer;
+    job->pts = frame->pts;
+    job->done_ns = xlnx_sim_cu_schedule(session->device, XLNX_SIM_LOOKAHEAD,
+                                        (int64_t)session->width * 
+                                        session->height);
+    session->count++;
+    return XMA_SUCCESS;
+}
+
+int32_t xma_filter_session_recv_frame(XmaFilterSession *session, 
+                                      XmaFrame *frame)
+{
+    XmaSideDataHandle qp_map;
+    XlnxSimLaJob *job;
+    size_t qp_size;
+
+    if(!session || !frame) {
+        return XMA_ERROR_INVALID;
+    }
+    xvbm_buffer_pool_entry_free(session->last_out);
+    session->last_out = NULL;
+
+    /* Frames leave once the window behind them is full */
+    if(session->count == 0) {
+        return session->flushing ? XMA_EOS : XMA_TRY_AGAIN;
+    }
+    if(!session->flushing && session->count <= session->depth) {
+        return XMA_TRY_AGAIN;
+    }
+    job = &session->queue[session->head];
+    xlnx_sim_wait_until(job->done_ns);
+
+    qp_size = (size_t)((session->width + XLNX_SIM_QP_BLOCK - 1) / 
+                       XLNX_SIM_QP_BLOCK) * 
+              ((session->height + XLNX_SIM_QP_BLOCK - 1) / XLNX_SIM_QP_BLOCK);
+    qp_map = xma_side_data_alloc(NULL, XMA_FRAME_QP_MAP, qp_size, 0);
+    if(!qp_map) {
+        return XMA_ERROR;
+    }
+    xlnx_sim_frame_set_device(frame, job->buffer, session->width, 
+                              session->height, job->pts);
+    xma_frame_add_side_data(frame, qp_map);
+    xma_side_data_dec_ref(qp_map);
+
+    session->last_out = job->buffer;
+    memset(job, 0, sizeof(*job));
+    session->head = (session->head + 1) % session->queue_size;
+    session->count--;
+    return XMA_SUCCESS;
+}
+
+XmaScalerSession *xma_scaler_session_create(XmaScalerProperties *props)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    XmaScalerSession *session;
+
+    if(!props || props->num_outputs <= 0 || 
+       props->num_outputs > MAX_SCALER_OUTPUTS) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Invalid scaler properties\n");
+        return NULL;
+    }
+    if(!xlnx_sim_device_ready(props->dev_index)) {
+        xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                   "Scaler on device %d before xma_initialize\n", 
+                   props->dev_index);
+        return NULL;
+    }
+    session = calloc(1, sizeof(XmaScalerSession));
+    if(!session) {
+        return NULL;
+    }
+    session->device = props->dev_index;
+    session->num_outputs = props->num_outputs;
+    for(int32_t i = 0; i < props->num_outputs; i++) {
+        session->width[i] = props->output[i].width;
+        session->height[i] = props->output[i].height;
+        session->out_pixels += (int64_t)session->width[i] * 
+                               session->height[i];
+        session->pools[i] = xlnx_sim_pool_create(cfg->queue_depth, 
+                                   xlnx_sim_nv12_size(session->width[i], 
+                                                      session->height[i]));
+        if(session->width[i] <= 0 || session->height[i] <= 0 || 
+           !session->pools[i]) {
+            xma_scaler_session_destroy(session);
+            return NULL;
+        }
+    }
+    return session;
+}
+
+int32_t xma_scaler_session_destroy(XmaScalerSession *session)
+{
+    if(!session) {
+        return XMA_ERROR_INVALID;
+    }
+    for(int32_t i = 0; i < session->num_outputs; i++) {
+        xvbm_buffer_pool_entry_free(session->pending[i]);
+        xlnx_sim_pool_release(session->pools[i]);
+    }
+    free(session);
+    return XMA_SUCCESS;
+}
+
+int32_t xma_scaler_session_send_frame(XmaScalerSession *session, 
+                                      XmaFrame *frame)
+{
+    const uint8_t *src;
+    uint8_t *dst;
+    size_t src_size;
+    size_t payload;
+    size_t size;
+    uint8_t luma;
+
+    if(!session || !frame) {
+        return XMA_ERROR_INVALID;
+    }
+    if(frame->is_last_frame || !frame->data[0].buffer) {
+        return XMA_SEND_MORE_DATA;
+    }
+    if(session->pending[0]) {
+        return XMA_TRY_AGAIN;
+    }
+    /* Every output needs a free buffer, or none is taken */
+    for(int32_t i = 0; i < session->num_outputs; i++) {
+        session->pending[i] = xlnx_sim_pool_get(session->pools[i]);
+        if(!session->pending[i]) {
+            for(int32_t j = 0; j < i; j++) {
+                xvbm_buffer_pool_entry_free(session->pending[j]);
+                session->pending[j] = NULL;
+            }
+            return XMA_TRY_AGAIN;
+        }
+    }
+
+    src = xlnx_sim_frame_plane(frame, 0);
+    src_size = frame->data[0].buffer_type == XMA_DEVICE_BUFFER_TYPE ? 
+               xlnx_sim_buffer_size(frame->data[0].buffer) : 
+               (size_t)frame->frame_props.linesize[0] * 
+               frame->frame_props.height;
+    payload = xlnx_sim_config()->passthrough ? 
+              xlnx_sim_payload_size(src, src_size) : 0;
+    luma = src ? src[0] : 16;
+    for(int32_t i = 0; i < session->num_outputs; i++) {
+        dst = xvbm_buffer_get_host_ptr(session->pending[i]);
+        size = xlnx_sim_buffer_size(session->pending[i]);
+        if(payload) {
+            xlnx_sim_payload_put(dst, size / 3 * 2, 
+                                 src + 2 * sizeof(uint32_t), payload);
+        }
+        else {
+            memset(dst, luma, size / 3 * 2);
+            memset(dst + size / 3 * 2, 128, size - size / 3 * 2);
+        }
+    }
+    session->pending_pts = frame->pts;
+    session->done_ns = xlnx_sim_cu_schedule(session->device, 
+                                            XLNX_SIM_SCALER, 
+                                            session->out_pixels);
+    return XMA_SUCCESS;
+}
+
+int32_t xma_scaler_session_recv_frame_list(XmaScalerSession *session, 
+                                           XmaFrame **frame_list)
+{
+    if(!session || !frame_list) {
+        return XMA_ERROR_INVALID;
+    }
+    if(!session->pending[0]) {
+        return XMA_TRY_AGAIN;
+    }
+    xlnx_sim_wait_until(session->done_ns);
+    for(int32_t i = 0; i < session->num_outputs; i++) {
+        xlnx_sim_frame_set_device(frame_list[i], session->pending[i], 
+                                  session->width[i], session->height[i], 
+                                  session->pending_pts);
+        session->pending[i] = NULL;
+    }
+    return XMA_SUCCESS;
+}
@@ -0,0 +1,224 @@
+#include "xlnx_sim.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct XlnxSimSideData {
+    XmaFrameSideDataType type;
+    void                 *payload;
+    size_t               size;
+    int32_t              owns_payload;
+    int32_t              refs;
+} XlnxSimSideData;
+
+static int32_t xlnx_sim_dev_ready[XLNX_SIM_MAX_DEVICES];
+static int32_t xlnx_sim_initialized;
+static pthread_mutex_t xlnx_sim_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int32_t xma_initialize(XmaXclbinParameter *devXclbins, int32_t num_parms)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    int32_t ret = XMA_SUCCESS;
+
+    if(!devXclbins || num_parms <= 0) {
+        return XMA_ERROR_INVALID;
+    }
+    pthread_mutex_lock(&xlnx_sim_init_lock);
+    /* Like XMA, the devices of a process are set up exactly once */
+    if(xlnx_sim_initialized) {
+        ret = XMA_ERROR;
+    }
+    for(int32_t i = 0; i < num_parms && ret == XMA_SUCCESS; i++) {
+        if(devXclbins[i].device_id < 0 || 
+           devXclbins[i].device_id >= cfg->num_devices) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                       "No device %d, %d are simulated\n", 
+                       devXclbins[i].device_id, cfg->num_devices);
+            ret = XMA_ERROR_NO_DEV;
+        }
+    }
+    if(ret == XMA_SUCCESS) {
+        for(int32_t i = 0; i < num_parms; i++) {
+            xlnx_sim_dev_ready[devXclbins[i].device_id] = 1;
+        }
+        xlnx_sim_initialized = 1;
+    }
+    pthread_mutex_unlock(&xlnx_sim_init_lock);
+    return ret;
+}
+
+int32_t xlnx_sim_device_ready(int32_t device)
+{
+    int32_t ready;
+
+    if(device < 0 || device >= XLNX_SIM_MAX_DEVICES) {
+        return 0;
+    }
+    pthread_mutex_lock(&xlnx_sim_init_lock);
+    ready = xlnx_sim_dev_ready[device];
+    pthread_mutex_unlock(&xlnx_sim_init_lock);
+    return ready;
+}
+
+void xma_logmsg(XmaLogLevelType level, const char *name, const char *msg, 
+                ...)
+{
+    static const char *level_names[] = {
+        "CRITICAL", "ERROR", "WARNING", "NOTICE", "INFO", "DEBUG"
+    };
+    char line[1024];
+    va_list ap;
+
+    if((int32_t)level > xlnx_sim_config()->log_level) {
+        return;
+    }
+    va_start(ap, msg);
+    vsnprintf(line, sizeof(line), msg, ap);
+    va_end(ap);
+    fprintf(stderr, "%s %s: %s", name, level_names[level], line);
+}
+
+int32_t xma_frame_planes_get(XmaFrameProperties *frame_props)
+{
+    switch(frame_props->format) {
+        case XMA_YUV420_FMT_TYPE:
+        case XMA_YUV422_FMT_TYPE:
+        case XMA_YUV444_FMT_TYPE:
+        case XMA_RGBP_FMT_TYPE:
+            return 3;
+        case XMA_RGB888_FMT_TYPE:
+            return 1;
+        case XMA_VCU_NV12_FMT_TYPE:
+        case XMA_VCU_NV12_10LE32_FMT_TYPE:
+            return 2;
+        default:
+            return XMA_ERROR;
+    }
+}
+
+XmaSideDataHandle xma_side_data_alloc(void *side_data, 
+                                      XmaFrameSideDataType type, size_t size,
+                                      int32_t use_buffer)
+{
+    XlnxSimSideData *sd;
+
+    if(type >= XMA_FRAME_SIDE_DATA_MAX_COUNT) {
+        return NULL;
+    }
+    sd = calloc(1, sizeof(XlnxSimSideData));
+    if(!sd) {
+        return NULL;
+    }
+    sd->type = type;
+    sd->size = size;
+    sd->refs = 1;
+    if(use_buffer) {
+        sd->payload = side_data;
+        return sd;
+    }
+    sd->payload = calloc(1, size ? size : 1);
+    if(!sd->payload) {
+        free(sd);
+        return NULL;
+    }
+    sd->owns_payload = 1;
+    if(side_data) {
+        memcpy(sd->payload, side_data, size);
+    }
+    return sd;
+}
+
+void *xma_side_data_get_payload(XmaSideDataHandle side_data)
+{
+    return side_data ? ((XlnxSimSideData *)side_data)->payload : NULL;
+}
+
+size_t xma_side_data_get_size(XmaSideDataHandle side_data)
+{
+    return side_data ? ((XlnxSimSideData *)side_data)->size : 0;
+}
+
+static void xlnx_sim_side_data_ref(XmaSideDataHandle side_data)
+{
+    __atomic_add_fetch(&((XlnxSimSideData *)side_data)->refs, 1, 
+                       __ATOMIC_RELAXED);
+}
+
+int32_t xma_side_data_dec_ref(XmaSideDataHandle side_data)
+{
+    XlnxSimSideData *sd = side_data;
+    int32_t refs;
+
+    if(!sd) {
+        return XMA_ERROR_INVALID;
+    }
+    refs = __atomic_sub_fetch(&sd->refs, 1, __ATOMIC_ACQ_REL);
+    if(refs == 0) {
+        if(sd->owns_payload) {
+            free(sd->payload);
+        }
+        free(sd);
+    }
+    return refs;
+}
+
+int32_t xma_frame_add_side_data(XmaFrame *frame, XmaSideDataHandle side_data)
+{
+    XlnxSimSideData *sd = side_data;
+
+    if(!frame || !sd) {
+        return XMA_ERROR_INVALID;
+    }
+    if(!frame->side_data) {
+        frame->side_data = calloc(XMA_FRAME_SIDE_DATA_MAX_COUNT, 
+                                  sizeof(XmaSideDataHandle));
+        if(!frame->side_data) {
+            return XMA_ERROR;
+        }
+    }
+    /* A frame carries one side data of each type, the newest wins */
+    if(frame->side_data[sd->type]) {
+        xma_side_data_dec_ref(frame->side_data[sd->type]);
+    }
+    xlnx_sim_side_data_ref(sd);
+    frame->side_data[sd->type] = sd;
+    return XMA_SUCCESS;
+}
+
+XmaSideDataHandle xma_frame_get_side_data(XmaFrame *frame, 
+                                          XmaFrameSideDataType type)
+{
+    if(!frame || !frame->side_data || type >= XMA_FRAME_SIDE_DATA_MAX_COUNT) {
+        return NULL;
+    }
+    return frame->side_data[type];
+}
+
+int32_t xma_frame_remove_side_data_type(XmaFrame *frame, 
+                                        XmaFrameSideDataType type)
+{
+    if(!frame || type >= XMA_FRAME_SIDE_DATA_MAX_COUNT) {
+        return XMA_ERROR_INVALID;
+    }
+    if(frame->side_data && frame->side_data[type]) {
+        xma_side_data_dec_ref(frame->side_data[type]);
+        frame->side_data[type] = NULL;
+    }
+    return XMA_SUCCESS;
+}
+
+void xma_frame_clear_all_side_data(XmaFrame *frame)
+{
+    if(!frame || !frame->side_data) {
+        return;
+    }
+    for(int32_t i = 0; i < XMA_FRAME_SIDE_DATA_MAX_COUNT; i++) {
+        if(frame->side_data[i]) {
+            xma_side_data_dec_ref(frame->side_data[i]);
+        }
+    }
+    free(frame->side_data);
+    frame->side_data = NULL;
+}
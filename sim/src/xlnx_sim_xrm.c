@@ -0,0 +1,815 @@
+#include "xlnx_sim.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define XLNX_SIM_MAX_ALLOCS  4096
+#define XLNX_SIM_MAX_POOLS   1024
+#define XLNX_SIM_MAX_CONTEXTS 1024
+
+/* requestLoad carries the load shifted by 8, see 
+   XRM_PRECISION_1000000_BIT_MASK */
+#define XLNX_SIM_LOAD(request) ((request) >> 8)
+
+typedef struct XlnxSimKernelInfo {
+    const char *name;
+    const char *alias;
+    int32_t    soft;
+} XlnxSimKernelInfo;
+
+static const XlnxSimKernelInfo xlnx_sim_kernels[XLNX_SIM_NUM_KERNELS] = {
+    [XLNX_SIM_DECODER]   = {"decoder", "DECODER_MPSOC", 0},
+    [XLNX_SIM_SCALER]    = {"scaler", "SCALER_MPSOC", 0},
+    [XLNX_SIM_LOOKAHEAD] = {"lookahead", "LOOKAHEAD_MPSOC", 0},
+    [XLNX_SIM_ENCODER]   = {"encoder", "ENCODER_MPSOC", 0},
+    [XLNX_SIM_DEC_SOFT]  = {"kernel_vcu_decoder", "", 1},
+    [XLNX_SIM_ENC_SOFT]  = {"kernel_vcu_encoder", "", 1}
+};
+
+/* Hard kernels are shared by load, soft kernels hand out channels */
+typedef struct XlnxSimDevice {
+    int32_t free[XLNX_SIM_NUM_KERNELS];
+    uint8_t channel_used[XLNX_SIM_NUM_KERNELS][XLNX_SIM_SOFT_CHANNELS];
+} XlnxSimDevice;
+
+typedef struct XlnxSimCtx {
+    int32_t in_use;
+} XlnxSimCtx;
+
+typedef struct XlnxSimPoolRes {
+    uint64_t          id;
+    XlnxSimCtx        *ctx;
+    /* Capacity set aside on every device, minus what is allocated */
+    int32_t           free[XLNX_SIM_MAX_DEVICES][XLNX_SIM_NUM_KERNELS];
+    xrmCuPoolResource *res;
+} XlnxSimPoolRes;
+
+typedef struct XlnxSimAlloc {
+    uint64_t       service_id;
+    XlnxSimCtx     *ctx;
+    XlnxSimPoolRes *pool;
+    int32_t        device;
+    XlnxSimKernel  kind;
+    int32_t        amount;
+    int32_t        channel;
+} XlnxSimAlloc;
+
+static pthread_mutex_t xlnx_sim_xrm_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t xlnx_sim_xrm_once = PTHREAD_ONCE_INIT;
+static XlnxSimDevice xlnx_sim_devices[XLNX_SIM_MAX_DEVICES];
+static XlnxSimCtx xlnx_sim_ctxs[XLNX_SIM_MAX_CONTEXTS];
+static XlnxSimPoolRes xlnx_sim_pools[XLNX_SIM_MAX_POOLS];
+static XlnxSimAlloc xlnx_sim_allocs[XLNX_SIM_MAX_ALLOCS];
+static uint64_t xlnx_sim_next_id = 1;
+
+static void xlnx_sim_xrm_init(void)
+{
+    for(int32_t d = 0; d < XLNX_SIM_MAX_DEVICES; d++) {
+        for(int32_t k = 0; k < XLNX_SIM_NUM_KERNELS; k++) {
+            xlnx_sim_devices[d].free[k] = xlnx_sim_kernels[k].soft ? 
+                               XLNX_SIM_SOFT_CHANNELS : XLNX_SIM_FULL_LOAD;
+        }
+    }
+}
+
+static int32_t xlnx_sim_kernel_find(const char *name)
+{
+    for(int32_t k = 0; k < XLNX_SIM_NUM_KERNELS; k++) {
+        if(strcmp(xlnx_sim_kernels[k].name, name) == 0) {
+            return k;
+        }
+    }
+    return -1;
+}
+
+/* Capacity a request takes from its kernel */
+static int32_t xlnx_sim_amount(int32_t kind, int32_t request_load)
+{
+    int32_t load = XLNX_SIM_LOAD(request_load);
+
+    if(xlnx_sim_kernels[kind].soft) {
+        return 1;
+    }
+    return load > 0 ? load : 1;
+}
+
+/* Sums a CU list into per kernel needs, -1 on an unknown kernel */
+static int32_t xlnx_sim_list_needs(const xrmCuProperty *props, int32_t num,
+                                   int32_t *need)
+{
+    int32_t kind;
+
+    memset(need, 0, sizeof(int32_t) * XLNX_SIM_NUM_KERNELS);
+    for(int32_t i = 0; i < num; i++) {
+        kind = xlnx_sim_kernel_find(props[i].kernelName);
+        if(kind < 0) {
+            xma_logmsg(XMA_ERROR_LOG, XLNX_SIM_MODULE, 
+                       "Unknown kernel %s\n", props[i].kernelName);
+            return -1;
+        }
+        need[kind] += xlnx_sim_amount(kind, props[i].requestLoad);
+    }
+    return 0;
+}
+
+/* Copies of need that fit into free */
+static int32_t xlnx_sim_fits(const int32_t *free, const int32_t *need)
+{
+    int32_t fits = INT32_MAX;
+
+    for(int32_t k = 0; k < XLNX_SIM_NUM_KERNELS; k++) {
+        if(need[k] > 0 && free[k] / need[k] < fits) {
+            fits = free[k] / need[k];
+        }
+    }
+    return fits == INT32_MAX ? 0 : fits;
+}
+
+static XlnxSimCtx *xlnx_sim_ctx_get(xrmContext context)
+{
+    XlnxSimCtx *ctx = context;
+
+    if(!ctx || ctx < xlnx_sim_ctxs || 
+       ctx >= xlnx_sim_ctxs + XLNX_SIM_MAX_CONTEXTS || !ctx->in_use) {
+        return NULL;
+    }
+    return ctx;
+}
+
+static XlnxSimPoolRes *xlnx_sim_pool_find(XlnxSimCtx *ctx, uint64_t pool_id)
+{
+    for(int32_t i = 0; i < XLNX_SIM_MAX_POOLS; i++) {
+        if(xlnx_sim_pools[i].id == pool_id && xlnx_sim_pools[i].ctx == ctx) {
+            return &xlnx_sim_pools[i];
+        }
+    }
+    return NULL;
+}
+
+/* Every call stands for a request to xrmd */
+static void xlnx_sim_xrm_round_trip(void)
+{
+    int64_t ns = xlnx_sim_config()->xrm_ns;
+    struct timespec ts;
+
+    if(ns <= 0) {
+        return;
+    }
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while(nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+xrmContext xrmCreateContext(uint32_t xrmApiVersion)
+{
+    XlnxSimCtx *ctx = NULL;
+
+    xlnx_sim_xrm_round_trip();
+    if(xrmApiVersion != XRM_API_VERSION_1) {
+        return NULL;
+    }
+    pthread_once(&xlnx_sim_xrm_once, xlnx_sim_xrm_init);
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    for(int32_t i = 0; i < XLNX_SIM_MAX_CONTEXTS; i++) {
+        if(!xlnx_sim_ctxs[i].in_use) {
+            ctx = &xlnx_sim_ctxs[i];
+            ctx->in_use = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return ctx;
+}
+
+/* Called with xlnx_sim_xrm_lock held */
+static void xlnx_sim_alloc_free(XlnxSimAlloc *alloc)
+{
+    XlnxSimDevice *dev = &xlnx_sim_devices[alloc->device];
+
+    if(alloc->pool) {
+        alloc->pool->free[alloc->device][alloc->kind] += alloc->amount;
+    }
+    else {
+        dev->free[alloc->kind] += alloc->amount;
+    }
+    if(alloc->channel >= 0 && xlnx_sim_kernels[alloc->kind].soft) {
+        dev->channel_used[alloc->kind][alloc->channel] = 0;
+    }
+    memset(alloc, 0, sizeof(*alloc));
+}
+
+/* Called with xlnx_sim_xrm_lock held. Leftover reservation goes back to
+   the devices, allocations still out return there when released. */
+static void xlnx_sim_pool_free(XlnxSimPoolRes *pool)
+{
+    for(int32_t i = 0; i < XLNX_SIM_MAX_ALLOCS; i++) {
+        if(xlnx_sim_allocs[i].pool == pool) {
+            xlnx_sim_allocs[i].pool = NULL;
+        }
+    }
+    for(int32_t d = 0; d < XLNX_SIM_MAX_DEVICES; d++) {
+        for(int32_t k = 0; k < XLNX_SIM_NUM_KERNELS; k++) {
+            xlnx_sim_devices[d].free[k] += pool->free[d][k];
+        }
+    }
+    free(pool->res);
+    memset(pool, 0, sizeof(*pool));
+}
+
+int32_t xrmDestroyContext(xrmContext context)
+{
+    XlnxSimCtx *ctx;
+
+    xlnx_sim_xrm_round_trip();
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    if(!ctx) {
+        pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+        return XRM_ERROR_INVALID;
+    }
+    /* Like the daemon, whatever the context still holds is let go */
+    for(int32_t i = 0; i < XLNX_SIM_MAX_ALLOCS; i++) {
+        if(xlnx_sim_allocs[i].ctx == ctx) {
+            xlnx_sim_alloc_free(&xlnx_sim_allocs[i]);
+        }
+    }
+    for(int32_t i = 0; i < XLNX_SIM_MAX_POOLS; i++) {
+        if(xlnx_sim_pools[i].ctx == ctx) {
+            xlnx_sim_pool_free(&xlnx_sim_pools[i]);
+        }
+    }
+    ctx->in_use = 0;
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return XRM_SUCCESS;
+}
+
+static void xlnx_sim_fill_res(xrmCuResource *res, int32_t kind, 
+                              int32_t device, int32_t channel)
+{
+    const XlnxSimKernelInfo *info = &xlnx_sim_kernels[kind];
+
+    memset(res, 0, sizeof(*res));
+    strcpy(res->xclbinFileName, XLNX_SIM_XCLBIN);
+    strcpy(res->kernelPluginFileName, XLNX_SIM_PLUGIN);
+    strcpy(res->kernelName, info->name);
+    strcpy(res->kernelAlias, info->alias);
+    snprintf(res->instanceName, sizeof(res->instanceName), "%s_0", 
+             info->name);
+    snprintf(res->cuName, sizeof(res->cuName), "%s:%s_0", info->name, 
+             info->name);
+    res->deviceId = device;
+    res->cuId = kind;
+    res->channelId = channel;
+    res->cuType = info->soft ? XRM_CU_SOFTKERNEL : XRM_CU_IPKERNEL;
+}
+
+/* Called with xlnx_sim_xrm_lock held. device < 0 takes the first device 
+   with room. */
+static int32_t xlnx_sim_alloc(XlnxSimCtx *ctx, int32_t device, 
+                              xrmCuProperty *prop, xrmCuResource *res)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    XlnxSimPoolRes *pool = NULL;
+    XlnxSimAlloc *alloc = NULL;
+    XlnxSimDevice *dev;
+    int32_t *free_cap = NULL;
+    int32_t kind;
+    int32_t amount;
+    int32_t channel = 0;
+    int32_t d;
+
+    kind = xlnx_sim_kernel_find(prop->kernelName);
+    if(kind < 0) {
+        return XRM_ERROR_NO_KERNEL;
+    }
+    amount = xlnx_sim_amount(kind, prop->requestLoad);
+    if(prop->poolId) {
+        pool = xlnx_sim_pool_find(ctx, prop->poolId);
+        if(!pool) {
+            return XRM_ERROR_INVALID;
+        }
+    }
+    for(d = device < 0 ? 0 : device; d < cfg->num_devices; d++) {
+        free_cap = pool ? &pool->free[d][kind] : &xlnx_sim_devices[d].free[kind];
+        if(*free_cap >= amount || device >= 0) {
+            break;
+        }
+    }
+    if(d >= cfg->num_devices || *free_cap < amount) {
+        return XRM_ERROR;
+    }
+    for(int32_t i = 0; i < XLNX_SIM_MAX_ALLOCS && !alloc; i++) {
+        if(!xlnx_sim_allocs[i].service_id) {
+            alloc = &xlnx_sim_allocs[i];
+        }
+    }
+    if(!alloc) {
+        return XRM_ERROR;
+    }
+
+    dev = &xlnx_sim_devices[d];
+    if(xlnx_sim_kernels[kind].soft) {
+        while(dev->channel_used[kind][channel]) {
+            channel++;
+        }
+        dev->channel_used[kind][channel] = 1;
+    }
+    *free_cap -= amount;
+    alloc->service_id = xlnx_sim_next_id++;
+    alloc->ctx = ctx;
+    alloc->pool = pool;
+    alloc->device = d;
+    alloc->kind = kind;
+    alloc->amount = amount;
+    alloc->channel = channel;
+
+    xlnx_sim_fill_res(res, kind, d, channel);
+    res->allocServiceId = alloc->service_id;
+    res->channelLoad = prop->requestLoad;
+    res->poolId = prop->poolId;
+    return XRM_SUCCESS;
+}
+
+static int32_t xlnx_sim_alloc_locked(xrmContext context, int32_t device, 
+                                     xrmCuProperty *prop, xrmCuResource *res)
+{
+    XlnxSimCtx *ctx;
+    int32_t ret;
+
+    if(!prop || !res) {
+        return XRM_ERROR_INVALID;
+    }
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    ret = ctx ? xlnx_sim_alloc(ctx, device, prop, res) : XRM_ERROR_INVALID;
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return ret;
+}
+
+int32_t xrmCuAlloc(xrmContext context, xrmCuProperty *cuProp, 
+                   xrmCuResource *cuRes)
+{
+    xlnx_sim_xrm_round_trip();
+    return xlnx_sim_alloc_locked(context, -1, cuProp, cuRes);
+}
+
+int32_t xrmCuAllocFromDev(xrmContext context, int32_t deviceId, 
+                          xrmCuProperty *cuProp, xrmCuResource *cuRes)
+{
+    xlnx_sim_xrm_round_trip();
+    if(deviceId < 0 || deviceId >= xlnx_sim_config()->num_devices) {
+        return XRM_ERROR_INVALID;
+    }
+    return xlnx_sim_alloc_locked(context, deviceId, cuProp, cuRes);
+}
+
+/* Called with xlnx_sim_xrm_lock held */
+static bool xlnx_sim_release(XlnxSimCtx *ctx, xrmCuResource *res)
+{
+    for(int32_t i = 0; i < XLNX_SIM_MAX_ALLOCS; i++) {
+        if(xlnx_sim_allocs[i].service_id && 
+           xlnx_sim_allocs[i].service_id == res->allocServiceId && 
+           xlnx_sim_allocs[i].ctx == ctx) {
+            xlnx_sim_alloc_free(&xlnx_sim_allocs[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+int32_t xrmCuListAlloc(xrmContext context, xrmCuListProperty *cuListProp, 
+                       xrmCuListResource *cuListRes)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    XlnxSimCtx *ctx;
+    int32_t ret = XRM_ERROR;
+
+    xlnx_sim_xrm_round_trip();
+    if(!cuListProp || !cuListRes || cuListProp->cuNum <= 0 || 
+       cuListProp->cuNum > XRM_MAX_LIST_CU_NUM) {
+        return XRM_ERROR_INVALID;
+    }
+    memset(cuListRes, 0, sizeof(*cuListRes));
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    if(!ctx) {
+        pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+        return XRM_ERROR_INVALID;
+    }
+    /* A list lands whole on one device or not at all */
+    for(int32_t d = 0; d < cfg->num_devices && ret != XRM_SUCCESS; d++) {
+        ret = XRM_SUCCESS;
+        for(int32_t i = 0; i < cuListProp->cuNum && ret == XRM_SUCCESS; 
+                                                                      i++) {
+            ret = xlnx_sim_alloc(ctx, d, &cuListProp->cuProps[i], 
+                                 &cuListRes->cuResources[i]);
+            if(ret == XRM_SUCCESS) {
+                cuListRes->cuNum = i + 1;
+            }
+        }
+        if(ret != XRM_SUCCESS) {
+            for(int32_t i = 0; i < cuListRes->cuNum; i++) {
+                xlnx_sim_release(ctx, &cuListRes->cuResources[i]);
+            }
+            memset(cuListRes, 0, sizeof(*cuListRes));
+        }
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return ret;
+}
+
+bool xrmCuRelease(xrmContext context, xrmCuResource *cuRes)
+{
+    XlnxSimCtx *ctx;
+    bool ret = false;
+
+    xlnx_sim_xrm_round_trip();
+    if(!cuRes) {
+        return false;
+    }
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    if(ctx) {
+        ret = xlnx_sim_release(ctx, cuRes);
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return ret;
+}
+
+bool xrmCuListRelease(xrmContext context, xrmCuListResource *cuListRes)
+{
+    XlnxSimCtx *ctx;
+    bool ret = true;
+
+    xlnx_sim_xrm_round_trip();
+    if(!cuListRes || cuListRes->cuNum <= 0) {
+        return false;
+    }
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    for(int32_t i = 0; i < cuListRes->cuNum; i++) {
+        if(!ctx || !xlnx_sim_release(ctx, &cuListRes->cuResources[i])) {
+            ret = false;
+        }
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return ret;
+}
+
+/* Pool copies that fit on every allowed device. device < 0 allows all, 
+   mask limits them further when non zero. Called with the lock held. */
+static int32_t xlnx_sim_pool_fits(const int32_t *need, int32_t device, 
+                                  uint64_t mask, int32_t *fits)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    int32_t total = 0;
+
+    for(int32_t d = 0; d < cfg->num_devices; d++) {
+        fits[d] = 0;
+        if((device >= 0 && d != device) || 
+           (mask && !(mask & (1ULL << d)))) {
+            continue;
+        }
+        fits[d] = xlnx_sim_fits(xlnx_sim_devices[d].free, need);
+        total += fits[d];
+    }
+    return total;
+}
+
+static int32_t xlnx_sim_check(xrmContext context, 
+                              const xrmCuProperty *props, int32_t cu_num,
+                              int32_t list_num, int32_t device, 
+                              uint64_t mask)
+{
+    int32_t need[XLNX_SIM_NUM_KERNELS];
+    int32_t fits[XLNX_SIM_MAX_DEVICES];
+    int32_t total;
+
+    /* Like XRM, a constraint to a device that is not there is an error */
+    if(cu_num <= 0 || cu_num > XRM_MAX_LIST_CU_NUM || 
+       device >= xlnx_sim_config()->num_devices ||
+       xlnx_sim_list_needs(props, cu_num, need) != 0) {
+        return XRM_ERROR_INVALID;
+    }
+    pthread_once(&xlnx_sim_xrm_once, xlnx_sim_xrm_init);
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    if(!xlnx_sim_ctx_get(context)) {
+        pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+        return XRM_ERROR_INVALID;
+    }
+    total = xlnx_sim_pool_fits(need, device, mask, fits);
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return total / (list_num > 0 ? list_num : 1);
+}
+
+int32_t xrmCheckCuPoolAvailableNum(xrmContext context, 
+                                   xrmCuPoolProperty *cuPoolProp)
+{
+    xlnx_sim_xrm_round_trip();
+    if(!cuPoolProp) {
+        return XRM_ERROR_INVALID;
+    }
+    return xlnx_sim_check(context, cuPoolProp->cuListProp.cuProps, 
+                          cuPoolProp->cuListProp.cuNum, 
+                          cuPoolProp->cuListNum, -1, 0);
+}
+
+int32_t xrmCheckCuPoolAvailableNumV2(xrmContext context, 
+                                     xrmCuPoolPropertyV2 *cuPoolProp)
+{
+    xrmCuProperty props[XRM_MAX_LIST_CU_NUM];
+    const xrmCuPropertyV2 *v2;
+    int32_t cu_num;
+    int32_t device = -1;
+    uint64_t constraint;
+
+    xlnx_sim_xrm_round_trip();
+    if(!cuPoolProp) {
+        return XRM_ERROR_INVALID;
+    }
+    cu_num = cuPoolProp->cuListProp.cuNum;
+    if(cu_num <= 0 || cu_num > XRM_MAX_LIST_CU_NUM) {
+        return XRM_ERROR_INVALID;
+    }
+    memset(props, 0, sizeof(xrmCuProperty) * cu_num);
+    for(int32_t i = 0; i < cu_num; i++) {
+        v2 = &cuPoolProp->cuListProp.cuProps[i];
+        strcpy(props[i].kernelName, v2->kernelName);
+        strcpy(props[i].kernelAlias, v2->kernelAlias);
+        props[i].requestLoad = v2->requestLoad;
+        /* One hardware device constraint pins the whole list */
+        constraint = (v2->deviceInfo >> XRM_DEVICE_INFO_CONSTRAINT_TYPE_SHIFT)
+                     & 0xff;
+        if(constraint == XRM_DEVICE_INFO_CONSTRAINT_TYPE_HARDWARE_DEVICE_INDEX) {
+            device = (v2->deviceInfo >> XRM_DEVICE_INFO_DEVICE_INDEX_SHIFT) & 
+                     0xff;
+        }
+    }
+    return xlnx_sim_check(context, props, cu_num, cuPoolProp->cuListNum, 
+                          device, cuPoolProp->deviceIdMask);
+}
+
+uint64_t xrmCuPoolReserve(xrmContext context, xrmCuPoolProperty *cuPoolProp)
+{
+    const XlnxSimConfig *cfg = xlnx_sim_config();
+    const xrmCuListProperty *list;
+    int32_t need[XLNX_SIM_NUM_KERNELS];
+    int32_t fits[XLNX_SIM_MAX_DEVICES];
+    int32_t list_num;
+    XlnxSimPoolRes *pool = NULL;
+    xrmCuResource *res;
+    XlnxSimCtx *ctx;
+    int32_t kind;
+    int32_t placed = 0;
+    uint64_t id = 0;
+
+    xlnx_sim_xrm_round_trip();
+    if(!cuPoolProp) {
+        return 0;
+    }
+    list = &cuPoolProp->cuListProp;
+    list_num = cuPoolProp->cuListNum > 0 ? cuPoolProp->cuListNum : 1;
+    if(list->cuNum <= 0 || list->cuNum * list_num > XRM_MAX_POOL_CU_NUM ||
+       xlnx_sim_list_needs(list->cuProps, list->cuNum, need) != 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    for(int32_t i = 0; ctx && i < XLNX_SIM_MAX_POOLS && !pool; i++) {
+        if(!xlnx_sim_pools[i].id) {
+            pool = &xlnx_sim_pools[i];
+        }
+    }
+    if(!pool || xlnx_sim_pool_fits(need, -1, 0, fits) < list_num) {
+        pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+        return 0;
+    }
+    pool->res = calloc(1, sizeof(xrmCuPoolResource));
+    if(!pool->res) {
+        pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+        return 0;
+    }
+    pool->id = id = xlnx_sim_next_id++;
+    pool->ctx = ctx;
+
+    /* Lists go to the first device with room, each whole on one device */
+    for(int32_t d = 0; d < cfg->num_devices && placed < list_num; d++) {
+        for(; fits[d] > 0 && placed < list_num; fits[d]--, placed++) {
+            for(int32_t k = 0; k < XLNX_SIM_NUM_KERNELS; k++) {
+                xlnx_sim_devices[d].free[k] -= need[k];
+                pool->free[d][k] += need[k];
+            }
+            for(int32_t i = 0; i < list->cuNum; i++) {
+                kind = xlnx_sim_kernel_find(list->cuProps[i].kernelName);
+                res = &pool->res->cuResources[pool->res->cuNum++];
+                xlnx_sim_fill_res(res, kind, d, 0);
+                res->channelLoad = list->cuProps[i].requestLoad;
+                res->poolId = id;
+            }
+        }
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return id;
+}
+
+bool xrmCuPoolRelinquish(xrmContext context, uint64_t poolId)
+{
+    XlnxSimPoolRes *pool;
+    XlnxSimCtx *ctx;
+
+    xlnx_sim_xrm_round_trip();
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    pool = ctx && poolId ? xlnx_sim_pool_find(ctx, poolId) : NULL;
+    if(pool) {
+        xlnx_sim_pool_free(pool);
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return pool != NULL;
+}
+
+int32_t xrmReservationQuery(xrmContext context, uint64_t poolId, 
+                            xrmCuPoolResource *cuPoolRes)
+{
+    XlnxSimPoolRes *pool;
+    XlnxSimCtx *ctx;
+
+    xlnx_sim_xrm_round_trip();
+    if(!cuPoolRes) {
+        return XRM_ERROR_INVALID;
+    }
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    pool = ctx && poolId ? xlnx_sim_pool_find(ctx, poolId) : NULL;
+    if(pool) {
+        memcpy(cuPoolRes, pool->res, sizeof(*cuPoolRes));
+    }
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    return pool ? XRM_SUCCESS : XRM_ERROR_INVALID;
+}
+
+/* Load plugins. Every CU handles 4K60 worth of pixels, so a channel's 
+   load is its pixel rate against that. Props arrive as the JSON made by 
+   convertXmaPropsToJson below. */
+typedef struct XlnxSimDims {
+    int64_t width;
+    int64_t height;
+    int64_t fps_num;
+    int64_t fps_den;
+} XlnxSimDims;
+
+static const char *xlnx_sim_json_int(const char *json, const char *key, 
+                                     int64_t *value)
+{
+    const char *p = strstr(json, key);
+
+    if(!p) {
+        return NULL;
+    }
+    p += strlen(key);
+    *value = strtoll(p, NULL, 10);
+    return p;
+}
+
+/* Next {"width":..,"height":..,"frame-rate":{"num":..,"den":..}} block */
+static const char *xlnx_sim_json_dims(const char *json, XlnxSimDims *dims)
+{
+    const char *p = xlnx_sim_json_int(json, "\"width\":", &dims->width);
+
+    if(!p || !(p = xlnx_sim_json_int(p, "\"height\":", &dims->height)) || 
+       !(p = xlnx_sim_json_int(p, "\"num\":", &dims->fps_num)) || 
+       !(p = xlnx_sim_json_int(p, "\"den\":", &dims->fps_den))) {
+        return NULL;
+    }
+    return p;
+}
+
+static int64_t xlnx_sim_dims_load(const XlnxSimDims *dims)
+{
+    int64_t rate;
+    int64_t load;
+
+    if(dims->fps_den <= 0 || dims->fps_num <= 0) {
+        return -1;
+    }
+    rate = dims->width * dims->height * dims->fps_num / dims->fps_den;
+    load = (rate * XLNX_SIM_FULL_LOAD + XLNX_SIM_CU_PIXEL_RATE - 1) / 
+           XLNX_SIM_CU_PIXEL_RATE;
+    return load > 0 ? load : 1;
+}
+
+int32_t xrmExecPluginFunc(xrmContext context, char *xrmPluginName, 
+                          uint32_t funcId, xrmPluginFuncParam *param)
+{
+    XlnxSimDims dims;
+    XlnxSimDims in_dims;
+    const char *p;
+    int64_t load;
+    int64_t out_load = 0;
+    XlnxSimCtx *ctx;
+
+    xlnx_sim_xrm_round_trip();
+    pthread_mutex_lock(&xlnx_sim_xrm_lock);
+    ctx = xlnx_sim_ctx_get(context);
+    pthread_mutex_unlock(&xlnx_sim_xrm_lock);
+    if(!ctx || !xrmPluginName || !param || funcId) {
+        return XRM_ERROR_INVALID;
+    }
+    p = xlnx_sim_json_dims(param->input, &dims);
+    load = p ? xlnx_sim_dims_load(&dims) : -1;
+    if(load <= 0) {
+        return XRM_ERROR_INVALID;
+    }
+
+    if(strcmp(xrmPluginName, "xrmU30EncPlugin") == 0) {
+        /* Encoder load, soft kernel instances and lookahead load */
+        snprintf(param->output, sizeof(param->output), "%lld 1 %lld", 
+                 (long long)load, (long long)load);
+    }
+    else if(strcmp(xrmPluginName, "xrmU30DecPlugin") == 0) {
+        snprintf(param->output, sizeof(param->output), "%lld", 
+                 (long long)load);
+    }
+    else if(strcmp(xrmPluginName, "xrmU30ScalPlugin") == 0) {
+        /* The scaler's cost is what it writes, summed over the outputs */
+        in_dims = dims;
+        while((p = xlnx_sim_json_dims(p, &dims)) != NULL) {
+            /* Outputs without a rate of their own run at the input's */
+            if(dims.fps_num <= 0 || dims.fps_den <= 0) {
+                dims.fps_num = in_dims.fps_num;
+                dims.fps_den = in_dims.fps_den;
+            }
+            out_load += xlnx_sim_dims_load(&dims);
+        }
+        if(out_load > XLNX_SIM_FULL_LOAD) {
+            return XRM_ERROR;
+        }
+        snprintf(param->output, sizeof(param->output), "%lld", 
+                 (long long)(out_load > 0 ? out_load : load));
+    }
+    else {
+        return XRM_ERROR_NO_KERNEL;
+    }
+    return XRM_SUCCESS;
+}
+
+static int32_t xlnx_sim_json_put_dims(char *json, size_t size, 
+                                      int32_t width, int32_t height, 
+                                      XmaFraction rate)
+{
+    return snprintf(json, size, 
+                    "{\"width\":%d,\"height\":%d,\"frame-rate\":"
+                    "{\"num\":%d,\"den\":%d}}", width, height, 
+                    rate.numerator, rate.denominator);
+}
+
+/* Stand-in for libxmaPropsTOjson, the library dlopens this one instead 
+   when built for the simulator */
+void convertXmaPropsToJson(void *props, char *funcName, char *jsonJob)
+{
+    XmaEncoderProperties *enc = props;
+    XmaDecoderProperties *dec = props;
+    XmaFilterProperties *filter = props;
+    XmaScalerProperties *scal = props;
+    size_t size = XRM_MAX_PLUGIN_FUNC_PARAM_LEN;
+    int32_t len;
+
+    len = snprintf(jsonJob, size, 
+                   "{\"request\":{\"name\":\"%s\",\"parameters\":{\"input\":", 
+                   funcName);
+    if(strcmp(funcName, "ENCODER") == 0) {
+        len += xlnx_sim_json_put_dims(jsonJob + len, size - len, enc->width,
+                                      enc->height, enc->framerate);
+    }
+    else if(strcmp(funcName, "DECODER") == 0) {
+        len += xlnx_sim_json_put_dims(jsonJob + len, size - len, dec->width,
+                                      dec->height, dec->framerate);
+    }
+    else if(strcmp(funcName, "LOOKAHEAD") == 0) {
+        len += xlnx_sim_json_put_dims(jsonJob + len, size - len, 
+                                      filter->input.width, 
+                                      filter->input.height, 
+                                      filter->input.framerate);
+    }
+    else if(strcmp(funcName, "SCALER") == 0) {
+        len += xlnx_sim_json_put_dims(jsonJob + len, size - len, 
+                                      scal->input.width, scal->input.height,
+                                      scal->input.framerate);
+        len += snprintf(jsonJob + len, size - len, ",\"output\":[");
+        for(int32_t i = 0; i < scal->num_outputs && 
+                           i < MAX_SCALER_OUTPUTS; i++) {
+            len += snprintf(jsonJob + len, size - len, i ? "," : "");
+            len += xlnx_sim_json_put_dims(jsonJob + len, size - len, 
+                                          scal->output[i].width, 
+                                          scal->output[i].height, 
+                                          scal->output[i].framerate);
+        }
+        len += snprintf(jsonJob + len, size - len, "]");
+    }
+    snprintf(jsonJob + len, size - len, "}}}");
+}
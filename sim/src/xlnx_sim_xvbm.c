@@ -0,0 +1,196 @@
+#include "xlnx_sim.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct XlnxSimBuffer {
+    XlnxSimPool          *pool;
+    int32_t              refs;
+    uint8_t              *data;
+    struct XlnxSimBuffer *next;
+} XlnxSimBuffer;
+
+struct XlnxSimPool {
+    pthread_mutex_t lock;
+    XlnxSimBuffer   *free_list;
+    XlnxSimBuffer   *buffers;
+    int32_t         num_buffers;
+    uint32_t        num_free;
+    size_t          size;
+    /* One for the owning session plus one per buffer out */
+    int32_t         refs;
+};
+
+static void xlnx_sim_pool_destroy(XlnxSimPool *pool)
+{
+    for(int32_t i = 0; i < pool->num_buffers; i++) {
+        free(pool->buffers[i].data);
+    }
+    free(pool->buffers);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+static void xlnx_sim_pool_unref(XlnxSimPool *pool)
+{
+    int32_t last;
+
+    pthread_mutex_lock(&pool->lock);
+    last = --pool->refs == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if(last) {
+        xlnx_sim_pool_destroy(pool);
+    }
+}
+
+XlnxSimPool *xlnx_sim_pool_create(int32_t num_buffers, size_t size)
+{
+    XlnxSimPool *pool = calloc(1, sizeof(XlnxSimPool));
+
+    if(!pool) {
+        return NULL;
+    }
+    pool->buffers = calloc(num_buffers, sizeof(XlnxSimBuffer));
+    if(!pool->buffers) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->num_buffers = num_buffers;
+    pool->num_free = num_buffers;
+    pool->size = size;
+    pool->refs = 1;
+    for(int32_t i = num_buffers - 1; i >= 0; i--) {
+        pool->buffers[i].pool = pool;
+        pool->buffers[i].next = pool->free_list;
+        pool->free_list = &pool->buffers[i];
+    }
+    return pool;
+}
+
+void xlnx_sim_pool_release(XlnxSimPool *pool)
+{
+    if(pool) {
+        xlnx_sim_pool_unref(pool);
+    }
+}
+
+XvbmBufferHandle xlnx_sim_pool_get(XlnxSimPool *pool)
+{
+    XlnxSimBuffer *buf;
+
+    pthread_mutex_lock(&pool->lock);
+    buf = pool->free_list;
+    if(buf) {
+        pool->free_list = buf->next;
+        pool->num_free--;
+        pool->refs++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if(!buf) {
+        return NULL;
+    }
+
+    /* Device memory is only backed once a buffer is first used */
+    if(!buf->data) {
+        buf->data = calloc(1, pool->size);
+        if(!buf->data) {
+            buf->refs = 1;
+            xvbm_buffer_pool_entry_free(buf);
+            return NULL;
+        }
+    }
+    buf->refs = 1;
+    buf->next = NULL;
+    return buf;
+}
+
+size_t xlnx_sim_buffer_size(XvbmBufferHandle b_handle)
+{
+    return ((XlnxSimBuffer *)b_handle)->pool->size;
+}
+
+void *xvbm_buffer_get_host_ptr(XvbmBufferHandle b_handle)
+{
+    return b_handle ? ((XlnxSimBuffer *)b_handle)->data : NULL;
+}
+
+int32_t xvbm_buffer_read(XvbmBufferHandle b_handle, void *dst, size_t size, 
+                         size_t offset)
+{
+    XlnxSimBuffer *buf = b_handle;
+
+    if(!buf || !dst || offset > buf->pool->size || 
+       size > buf->pool->size - offset) {
+        return -1;
+    }
+    /* Reading into the buffer's own host mapping is a no-op sync */
+    if(buf->data + offset != dst) {
+        memmove(dst, buf->data + offset, size);
+    }
+    return 0;
+}
+
+int32_t xvbm_buffer_write(XvbmBufferHandle b_handle, const void *src, 
+                          size_t size, size_t offset)
+{
+    XlnxSimBuffer *buf = b_handle;
+
+    if(!buf || !src || offset > buf->pool->size || 
+       size > buf->pool->size - offset) {
+        return -1;
+    }
+    if(buf->data + offset != src) {
+        memmove(buf->data + offset, src, size);
+    }
+    return 0;
+}
+
+void xvbm_buffer_pool_entry_free(XvbmBufferHandle b_handle)
+{
+    XlnxSimBuffer *buf = b_handle;
+    XlnxSimPool *pool;
+
+    if(!buf || __atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    pool = buf->pool;
+    pthread_mutex_lock(&pool->lock);
+    buf->next = pool->free_list;
+    pool->free_list = buf;
+    pool->num_free++;
+    pthread_mutex_unlock(&pool->lock);
+    xlnx_sim_pool_unref(pool);
+}
+
+void xvbm_buffer_refcnt_inc(XvbmBufferHandle b_handle)
+{
+    if(b_handle) {
+        __atomic_add_fetch(&((XlnxSimBuffer *)b_handle)->refs, 1, 
+                           __ATOMIC_RELAXED);
+    }
+}
+
+XvbmPoolHandle xvbm_get_pool_handle(XvbmBufferHandle b_handle)
+{
+    return b_handle ? ((XlnxSimBuffer *)b_handle)->pool : NULL;
+}
+
+uint32_t xvbm_get_freelist_count(XvbmPoolHandle p_handle)
+{
+    XlnxSimPool *pool = p_handle;
+    uint32_t count;
+
+    if(!pool) {
+        return 0;
+    }
+    pthread_mutex_lock(&pool->lock);
+    count = pool->num_free;
+    pthread_mutex_unlock(&pool->lock);
+    return count;
+}
+
+uint32_t xvbm_buffer_pool_num_buffers_get(XvbmBufferHandle b_handle)
+{
+    return b_handle ? ((XlnxSimBuffer *)b_handle)->pool->num_buffers : 0;
+}
@@ -0,0 +1,656 @@
+#include "xilinx_encoder.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_SAMPLE_SYNC    0x02000000
+#define TEST_SAMPLE_NONSYNC 0x01010000
+#define TEST_WIDTH          320
+#define TEST_HEIGHT         240
+#define TEST_FPS            30
+#define TEST_FRAMES         60
+#define TEST_GOP            20
+#define TEST_SYNTH_FRAMES   40
+#define TEST_SYNTH_GOP      10
+
+static uint32_t test_rng = 1;
+
+static uint8_t test_rand()
+{
+    test_rng = test_rng * 1103515245 + 12345;
+    return (uint8_t)(test_rng >> 16);
+}
+
+/* One access unit handed to the muxer and what its chunk has to hold */
+typedef struct {
+    uint8_t *data;              /* Annex-B access unit */
+    int32_t size;
+    uint8_t *sample;            /* expected mdat payload, NULL = unchecked */
+    int32_t sample_size;
+    int64_t pts;
+    int64_t dts;
+    bool    key;
+} TestFrame;
+
+typedef struct {
+    const TestFrame *frames;
+    int32_t         num_frames;
+    int32_t         codec_id;
+    int32_t         fps;
+    /* Parameter sets expected in avcC/hvcC, NULL = unchecked */
+    const uint8_t   *ps[3];
+    int32_t         ps_size[3];
+    const char      *error;
+} TestMp4Parser;
+
+static uint32_t test_get32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static uint64_t test_get64(const uint8_t *p)
+{
+    return ((uint64_t)test_get32(p) << 32) | test_get32(p + 4);
+}
+
+static bool test_is_header_nal(int32_t codec_id, int32_t type)
+{
+    return codec_id == ENCODER_ID_HEVC ? (type >= 32 && type <= 35) :
+                                         (type >= 7 && type <= 9);
+}
+
+/* Offset of the first child box of type within [start, end), or -1 when
+   it is missing or a box does not fit its parent */
+static int64_t test_find_box(const uint8_t *buf, size_t start, size_t end,
+                             const char *type)
+{
+    uint32_t size;
+
+    while(start + 8 <= end) {
+        size = test_get32(buf + start);
+        if(size < 8 || start + size > end) {
+            return -1;
+        }
+        if(memcmp(buf + start + 4, type, 4) == 0) {
+            return start;
+        }
+        start += size;
+    }
+    return -1;
+}
+
+/* Walks a box path such as "moov/trak/mdia"; container boxes only */
+static int64_t test_find_path(const uint8_t *buf, size_t start, size_t end,
+                              const char *path)
+{
+    int64_t box = -1;
+
+    for(; *path; path += path[4] == '/' ? 5 : 4) {
+        box = test_find_box(buf, start, end, path);
+        if(box < 0) {
+            return -1;
+        }
+        start = box + 8;
+        end = box + test_get32(buf + box);
+    }
+    return box;
+}
+
+static bool test_check_array(TestMp4Parser *parser, const uint8_t **p,
+                             const uint8_t *end, int32_t idx)
+{
+    int32_t size;
+
+    if(*p + 2 > end) {
+        parser->error = "parameter set array cut short";
+        return false;
+    }
+    size = ((*p)[0] << 8) | (*p)[1];
+    if(*p + 2 + size > end) {
+        parser->error = "parameter set does not fit its box";
+        return false;
+    }
+    if(parser->ps[idx] && (size != parser->ps_size[idx] ||
+                           memcmp(*p + 2, parser->ps[idx], size) != 0)) {
+        parser->error = "parameter set differs from the stream";
+        return false;
+    }
+    *p += 2 + size;
+    return true;
+}
+
+static bool test_check_init(TestMp4Parser *parser, const uint8_t *buf,
+                            size_t size)
+{
+    bool hevc = parser->codec_id == ENCODER_ID_HEVC;
+    int64_t moov, stsd, entry, config;
+    const uint8_t *p, *end;
+
+    if(test_find_box(buf, 0, size, "ftyp") != 0) {
+        parser->error = "stream does not start with ftyp";
+        return false;
+    }
+    moov = test_find_box(buf, 0, size, "moov");
+    if(moov < 0 || test_find_path(buf, 0, size, "moov/mvhd") < 0 ||
+       test_find_path(buf, 0, size, "moov/mvex/trex") < 0) {
+        parser->error = "moov, mvhd or trex missing";
+        return false;
+    }
+    stsd = test_find_path(buf, 0, size, "moov/trak/mdia/minf/stbl/stsd");
+    if(stsd < 0) {
+        parser->error = "stsd missing";
+        return false;
+    }
+    /* Full box header and entry count come before the sample entry, the
+       visual sample entry fields before its config box */
+    entry = test_find_box(buf, stsd + 16, stsd + test_get32(buf + stsd),
+                          hevc ? "hvc1" : "avc1");
+    if(entry < 0) {
+        parser->error = "wrong or missing sample entry";
+        return false;
+    }
+    config = test_find_box(buf, entry + 86, entry + test_get32(buf + entry),
+                           hevc ? "hvcC" : "avcC");
+    if(config < 0) {
+        parser->error = "avcC/hvcC missing";
+        return false;
+    }
+    p = buf + config + 8;
+    end = buf + config + test_get32(buf + config);
+    if(hevc) {
+        /* 22 bytes of fixed fields, then VPS, SPS and PPS arrays */
+        if(p + 23 > end || p[0] != 1 || p[22] != 3) {
+            parser->error = "bad hvcC header";
+            return false;
+        }
+        p += 23;
+        for(int32_t i = 0; i < 3; i++) {
+            if(p + 3 > end || (p[0] & 0x3f) != 32 + i || p[1] ||
+               p[2] != 1) {
+                parser->error = "bad hvcC array";
+                return false;
+            }
+            p += 3;
+            if(!test_check_array(parser, &p, end, i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if(p + 6 > end || p[0] != 1 || p[4] != 0xff || p[5] != 0xe1 ||
+       (parser->ps[0] && (p[1] != parser->ps[0][1] ||
+                          p[3] != parser->ps[0][3]))) {
+        parser->error = "bad avcC header";
+        return false;
+    }
+    p += 6;
+    if(!test_check_array(parser, &p, end, 0)) {
+        return false;
+    }
+    if(p + 1 > end || p[0] != 1) {
+        parser->error = "bad avcC PPS count";
+        return false;
+    }
+    p++;
+    return test_check_array(parser, &p, end, 1);
+}
+
+/* One chunk: moof with a single sample and the mdat right behind it. The
+   sample lasts until the next one is decoded, the last one as long as the
+   one before it. */
+static bool test_check_chunk(TestMp4Parser *parser, const uint8_t *buf,
+                             size_t moof, size_t mdat, int32_t idx)
+{
+    const TestFrame *frame = &parser->frames[idx];
+    size_t moof_end = moof + test_get32(buf + moof);
+    int64_t mfhd, tfdt, trun, duration;
+    const uint8_t *p;
+
+    if(idx + 1 < parser->num_frames) {
+        duration = parser->frames[idx + 1].dts - frame->dts;
+    } else if(idx > 0) {
+        duration = frame->dts - parser->frames[idx - 1].dts;
+    } else {
+        duration = 90000 / parser->fps;
+    }
+    mfhd = test_find_box(buf, moof + 8, moof_end, "mfhd");
+    tfdt = test_find_path(buf, moof + 8, moof_end, "traf/tfdt");
+    trun = test_find_path(buf, moof + 8, moof_end, "traf/trun");
+    if(mfhd < 0 || tfdt < 0 || trun < 0 ||
+       test_find_path(buf, moof + 8, moof_end, "traf/tfhd") < 0) {
+        parser->error = "mfhd, tfhd, tfdt or trun missing";
+        return false;
+    }
+    if(test_get32(buf + mfhd + 12) != (uint32_t)idx + 1) {
+        parser->error = "fragment sequence number out of order";
+        return false;
+    }
+    if(buf[tfdt + 8] != 1 || (int64_t)test_get64(buf + tfdt + 12) !=
+                             frame->dts - parser->frames[0].dts) {
+        parser->error = "tfdt does not match DTS";
+        return false;
+    }
+    p = buf + trun + 12;
+    if(test_get32(p) != 1 || moof + test_get32(p + 4) != mdat + 8) {
+        parser->error = "trun does not point at the mdat";
+        return false;
+    }
+    if(test_get32(p + 8) != (uint32_t)duration) {
+        parser->error = "trun duration does not match the DTS step";
+        return false;
+    }
+    if(test_get32(p + 12) != test_get32(buf + mdat) - 8 ||
+       (frame->sample && test_get32(p + 12) != (uint32_t)frame->sample_size) ||
+       test_get32(p + 16) != (frame->key ? TEST_SAMPLE_SYNC :
+                                           TEST_SAMPLE_NONSYNC) ||
+       (int32_t)test_get32(p + 20) != frame->pts - frame->dts) {
+        parser->error = "trun does not match the sample";
+        return false;
+    }
+    if(frame->sample &&
+       memcmp(buf + mdat + 8, frame->sample, frame->sample_size) != 0) {
+        parser->error = "mdat payload differs from the access unit";
+        return false;
+    }
+    return true;
+}
+
+/* Init segment first, then one moof + mdat chunk per access unit in order,
+   with a styp ahead of every key frame and box sizes that add up to the
+   file */
+static bool test_parse(TestMp4Parser *parser, const uint8_t *buf, size_t size)
+{
+    size_t pos = 0;
+    uint32_t box_size;
+    int32_t num_chunks = 0;
+    int32_t num_styp = 0;
+    int32_t num_keys = 0;
+    int64_t moof = -1;
+    const uint8_t *type;
+
+    if(!test_check_init(parser, buf, size)) {
+        return false;
+    }
+    while(pos < size) {
+        box_size = pos + 8 <= size ? test_get32(buf + pos) : 0;
+        if(box_size < 8 || pos + box_size > size) {
+            parser->error = "top level box does not fit the stream";
+            return false;
+        }
+        type = buf + pos + 4;
+        if(memcmp(type, "styp", 4) == 0) {
+            if(num_chunks >= parser->num_frames ||
+               !parser->frames[num_chunks].key || moof >= 0) {
+                parser->error = "styp before a non key frame";
+                return false;
+            }
+            num_styp++;
+        } else if(memcmp(type, "moof", 4) == 0) {
+            moof = pos;
+        } else if(memcmp(type, "mdat", 4) == 0) {
+            if(moof < 0 || num_chunks >= parser->num_frames) {
+                parser->error = "mdat without moof";
+                return false;
+            }
+            num_keys += parser->frames[num_chunks].key;
+            if(num_styp != num_keys) {
+                parser->error = "key frame without styp";
+                return false;
+            }
+            if(!test_check_chunk(parser, buf, moof, pos, num_chunks)) {
+                return false;
+            }
+            num_chunks++;
+            moof = -1;
+        } else if((memcmp(type, "ftyp", 4) != 0 &&
+                   memcmp(type, "moov", 4) != 0) || num_chunks > 0) {
+            parser->error = "unexpected top level box";
+            return false;
+        }
+        pos += box_size;
+    }
+    if(num_chunks != parser->num_frames) {
+        parser->error = "frames missing from output";
+        return false;
+    }
+    return true;
+}
+
+/* Closes mux, reads the fMP4 file back from fd and checks it against
+   frames and the mux stats */
+static int32_t test_check_mp4(const char *name, XlnxMp4Mux *mux, int32_t fd,
+                              TestMp4Parser *parser)
+{
+    XlnxMp4MuxStats stats;
+    int32_t num_keys = 0;
+    uint8_t *mp4 = NULL;
+    int32_t ret = -1;
+    off_t mp4_size;
+
+    if(Mp4Mux_Flush(mux) != 0) {
+        printf("FAIL %s: Mp4Mux_Flush\n", name);
+        Mp4Mux_Close(mux);
+        return -1;
+    }
+    Mp4Mux_GetStats(mux, &stats);
+    Mp4Mux_Close(mux);
+    for(int32_t i = 0; i < parser->num_frames; i++) {
+        num_keys += parser->frames[i].key;
+    }
+    if(stats.num_fragments != parser->num_frames ||
+       stats.num_segments != num_keys) {
+        printf("FAIL %s: %lld fragments, %lld segments for %d frames and %d "
+               "IDRs\n", name, (long long)stats.num_fragments,
+               (long long)stats.num_segments, parser->num_frames, num_keys);
+        return -1;
+    }
+    mp4_size = lseek(fd, 0, SEEK_END);
+    mp4 = malloc(mp4_size > 0 ? mp4_size : 1);
+    if(!mp4 || mp4_size <= 0 || pread(fd, mp4, mp4_size, 0) != mp4_size ||
+       mp4_size != stats.bytes_written) {
+        printf("FAIL %s: cannot read back the fMP4 file\n", name);
+        goto done;
+    }
+    if(!test_parse(parser, mp4, mp4_size)) {
+        printf("FAIL %s: %s\n", name, parser->error);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    free(mp4);
+    return ret;
+}
+
+/* Appends one NAL with a 3 or 4 byte start code; payload bytes are random
+   but can never form a start code. Header NALs stay out of the sample. */
+static void test_put_nal(TestFrame *frame, int32_t codec_id, int32_t type,
+                         int32_t size, int32_t sc_len)
+{
+    uint8_t *nal;
+
+    memset(frame->data + frame->size, 0, sc_len - 1);
+    frame->data[frame->size + sc_len - 1] = 1;
+    frame->size += sc_len;
+    nal = frame->data + frame->size;
+    for(int32_t j = 0; j < size; j++) {
+        nal[j] = test_rand();
+    }
+    for(int32_t j = 0; j + 2 < size; j++) {
+        if(nal[j] == 0 && nal[j + 1] == 0) {
+            nal[j + 2] |= 0x80;
+        }
+    }
+    /* A trailing zero would be taken for part of the next start code */
+    nal[size - 1] |= 0x80;
+    if(codec_id == ENCODER_ID_HEVC) {
+        nal[0] = type << 1;
+        nal[1] = 1;
+    } else {
+        nal[0] = 0x60 | type;
+    }
+    frame->size += size;
+    if(!test_is_header_nal(codec_id, type)) {
+        frame->sample[frame->sample_size] = size >> 24;
+        frame->sample[frame->sample_size + 1] = size >> 16;
+        frame->sample[frame->sample_size + 2] = size >> 8;
+        frame->sample[frame->sample_size + 3] = size;
+        memcpy(frame->sample + frame->sample_size + 4, nal, size);
+        frame->sample_size += 4 + size;
+    }
+}
+
+/* Muxes synthetic access units with slice sizes around memchr corner
+   cases, mixed start code lengths, one B frame of reordering and an
+   uneven frame spacing, then checks every box and payload */
+static int32_t test_mux_synthetic(int32_t codec_id)
+{
+    static const int32_t sizes[] = {
+        3, 4, 5, 100, 1500, 65536, 200000
+    };
+    /* 90 kHz frame steps of 30, 29.97 and 15 fps */
+    static const int32_t steps[] = {3000, 3003, 3000, 6000};
+    bool hevc = codec_id == ENCODER_ID_HEVC;
+    const char *name = hevc ? "hevc synthetic" : "h264 synthetic";
+    char path[] = "/tmp/test_mp4_mux_XXXXXX";
+    TestFrame frames[TEST_SYNTH_FRAMES];
+    TestMp4Parser parser;
+    XlnxMp4Mux *mux;
+    int32_t num_hdr = hevc ? 3 : 2;
+    int64_t dts = -3000;
+    int32_t ret = -1;
+    int32_t fd = -1;
+    uint8_t *copy;
+
+    memset(frames, 0, sizeof(frames));
+    memset(&parser, 0, sizeof(parser));
+    for(int32_t i = 0; i < TEST_SYNTH_FRAMES; i++) {
+        TestFrame *frame = &frames[i];
+        int32_t slices = 1 + i % 3;
+        int32_t capacity = 64 + num_hdr * 40;
+
+        for(int32_t s = 0; s < slices; s++) {
+            capacity += 4 + sizes[(i + s) % (sizeof(sizes) /
+                                            sizeof(sizes[0]))];
+        }
+        frame->data = malloc(capacity);
+        frame->sample = malloc(capacity);
+        if(!frame->data || !frame->sample) {
+            printf("out of memory\n");
+            goto done;
+        }
+        frame->key = i % TEST_SYNTH_GOP == 0;
+        /* AUD and parameter sets lead every IDR, like encoder output. 24
+           bytes leave the HEVC SPS its 15 bytes of profile, tier and
+           level. */
+        if(frame->key) {
+            test_put_nal(frame, codec_id, hevc ? 35 : 9, hevc ? 3 : 2, 4);
+            for(int32_t h = 0; h < num_hdr; h++) {
+                test_put_nal(frame, codec_id, hevc ? 32 + h : 7 + h, 24,
+                             h % 2 ? 3 : 4);
+                if(i == 0) {
+                    parser.ps[h] = frame->data + frame->size - 24;
+                    parser.ps_size[h] = 24;
+                }
+            }
+        }
+        /* Mixed start code lengths */
+        for(int32_t s = 0; s < slices; s++) {
+            test_put_nal(frame, codec_id, frame->key ? (hevc ? 19 : 5) : 1,
+                         sizes[(i + s) % (sizeof(sizes) / sizeof(sizes[0]))],
+                         (i + s) % 2 ? 3 : 4);
+        }
+        frame->dts = dts;
+        frame->pts = (i % 3 == 2) ? frame->dts : frame->dts + 3000;
+        dts += steps[i % (sizeof(steps) / sizeof(steps[0]))];
+    }
+
+    fd = mkstemp(path);
+    if(fd < 0) {
+        printf("FAIL %s: cannot create %s\n", name, path);
+        goto done;
+    }
+    unlink(path);
+    mux = Mp4Mux_Open(fd, codec_id, 1920, 1080, 30);
+    if(!mux) {
+        printf("FAIL %s: Mp4Mux_Open\n", name);
+        goto done;
+    }
+    for(int32_t i = 0; i < TEST_SYNTH_FRAMES; i++) {
+        copy = malloc(frames[i].size);
+        if(copy) {
+            memcpy(copy, frames[i].data, frames[i].size);
+        }
+        if(!copy || Mp4Mux_WritePacket(mux, (const char *)copy,
+                                       frames[i].size, frames[i].pts,
+                                       frames[i].dts) != 0 ||
+           memcmp(copy, frames[i].data, frames[i].size) != 0) {
+            printf("FAIL %s: packet %d rejected or modified\n", name, i);
+            free(copy);
+            Mp4Mux_Close(mux);
+            goto done;
+        }
+        free(copy);
+    }
+    parser.frames = frames;
+    parser.num_frames = TEST_SYNTH_FRAMES;
+    parser.codec_id = codec_id;
+    parser.fps = 30;
+    ret = test_check_mp4(name, mux, fd, &parser);
+
+done:
+    if(fd >= 0) {
+        close(fd);
+    }
+    for(int32_t i = 0; i < TEST_SYNTH_FRAMES; i++) {
+        free(frames[i].data);
+        free(frames[i].sample);
+    }
+    return ret;
+}
+
+/* Encodes TEST_FRAMES frames into an fMP4 file with the frame numbered pts
+   and dts of every packet scaled to 90 kHz. Returns 1 when there is no
+   encoder to run on. */
+static int32_t test_encode_mp4(int32_t codec_id, int32_t num_bframes)
+{
+    const char *codec = codec_id == ENCODER_ID_HEVC ? "hevc" : "h264";
+    size_t frame_size = TEST_WIDTH * TEST_HEIGHT * 3 / 2;
+    char path[] = "/tmp/test_mp4_mux_XXXXXX";
+    XlnxEncoderFrameStats stats;
+    TestFrame frames[TEST_FRAMES];
+    TestMp4Parser parser;
+    XlnxEncoderConfig cfg;
+    XlnxEncoderHandle *enc = NULL;
+    XlnxMp4Mux *mux = NULL;
+    int32_t num_pkts = 0;
+    char *frame = malloc(frame_size);
+    char *out = malloc(frame_size + 4096);
+    int32_t ret = -1;
+    int32_t fd = -1;
+    int32_t flushing = 0;
+    int len = 0;
+
+    memset(frames, 0, sizeof(frames));
+    memset(&parser, 0, sizeof(parser));
+    if(!frame || !out) {
+        printf("out of memory\n");
+        goto done;
+    }
+    for(size_t i = 0; i < frame_size; i++) {
+        frame[i] = test_rand();
+    }
+
+    Encoder_ConfigInit(&cfg);
+    cfg.codec_id = codec_id;
+    cfg.width = TEST_WIDTH;
+    cfg.height = TEST_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.num_bframes = num_bframes;
+    cfg.gop_size = TEST_GOP;
+    cfg.lookahead_depth = 0;
+    enc = Encoder_Open(&cfg);
+    if(!enc) {
+        printf("skip %s encoder to fMP4, no encoder available\n", codec);
+        ret = 1;
+        goto done;
+    }
+    fd = mkstemp(path);
+    if(fd < 0) {
+        printf("FAIL %s: cannot create %s\n", codec, path);
+        goto done;
+    }
+    unlink(path);
+    mux = Mp4Mux_Open(fd, codec_id, TEST_WIDTH, TEST_HEIGHT, TEST_FPS);
+    if(!mux) {
+        printf("FAIL %s: Mp4Mux_Open\n", codec);
+        goto done;
+    }
+
+    for(int32_t i = 0; ; i++) {
+        if(i < TEST_FRAMES) {
+            if(Encoder_EncodeFrame(enc, frame, frame + TEST_WIDTH *
+                                   TEST_HEIGHT, out, &len) != 0) {
+                printf("FAIL %s: frame %d not encoded\n", codec, i);
+                goto done;
+            }
+        } else {
+            flushing = 1;
+            if(Encoder_FlushFrame(enc, out, &len) != 0) {
+                break;
+            }
+        }
+        if(len <= 0) {
+            continue;
+        }
+        if(Encoder_GetFrameStats(enc, &stats) != 0 ||
+           num_pkts >= TEST_FRAMES ||
+           Mp4Mux_WritePacket(mux, out, len, stats.pts * 90000 / TEST_FPS,
+                              stats.dts * 90000 / TEST_FPS) != 0) {
+            printf("FAIL %s: packet %d not muxed%s\n", codec, num_pkts,
+                   flushing ? " while flushing" : "");
+            goto done;
+        }
+        frames[num_pkts].pts = stats.pts * 90000 / TEST_FPS;
+        frames[num_pkts].dts = stats.dts * 90000 / TEST_FPS;
+        frames[num_pkts++].key = stats.is_idr != 0;
+    }
+    if(num_pkts != TEST_FRAMES) {
+        printf("FAIL %s: %d packets for %d frames\n", codec, num_pkts,
+               TEST_FRAMES);
+        goto done;
+    }
+    /* Payload and parameter sets are the muxer's to pick, only the box
+       layout and timing are checked */
+    parser.frames = frames;
+    parser.num_frames = num_pkts;
+    parser.codec_id = codec_id;
+    parser.fps = TEST_FPS;
+    ret = test_check_mp4(codec, mux, fd, &parser);
+    mux = NULL;
+
+done:
+    Mp4Mux_Close(mux);
+    if(fd >= 0) {
+        close(fd);
+    }
+    Encoder_Close(enc);
+    free(frame);
+    free(out);
+    return ret;
+}
+
+int main()
+{
+    int32_t failures = 0;
+    int32_t cases = 0;
+    int32_t ret;
+
+    /* Functional run on the simulator, a card ignores this */
+    setenv("XLNX_SIM_SPEED", "0", 0);
+
+    for(int32_t codec_id = ENCODER_ID_H264; codec_id <= ENCODER_ID_HEVC;
+        codec_id++) {
+        failures += test_mux_synthetic(codec_id) != 0;
+        cases++;
+    }
+
+    /* B frames give samples a composition offset */
+    for(int32_t codec_id = ENCODER_ID_H264; codec_id <= ENCODER_ID_HEVC;
+        codec_id++) {
+        for(int32_t bframes = 0; bframes <= 2; bframes += 2) {
+            ret = test_encode_mp4(codec_id, bframes);
+            if(ret != 1) {
+                failures += ret != 0;
+                cases++;
+            }
+        }
+    }
+
+    printf("%s: %d of %d cases passed\n", failures ? "FAIL" : "PASS",
+           cases - failures, cases);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,143 @@
+#include "xlnx_scene_detect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_PAD      37
+#define TEST_GUARD    0xa5
+/* Random, all black and all white luma, the last two hit the rounding and
+   the largest block sums */
+#define TEST_FILLS    3
+
+static const char *test_kernels[] = {"c", "sse2", "avx2"};
+static const int32_t test_blocks_w[] = {1, 2, 3, 4, 5, 7, 8, 9, 31, 33, 240,
+                                        241};
+static const int32_t test_blocks_h[] = {1, 2, 3, 17};
+static const size_t test_counts[] = {0, 1, 7, 15, 16, 17, 31, 32, 33, 63, 
+                                     64, 65, 1000, 32400};
+
+#define TEST_COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+static uint32_t test_rng = 1;
+
+static uint8_t test_rand()
+{
+    test_rng = test_rng * 1103515245 + 12345;
+    return (uint8_t)(test_rng >> 16);
+}
+
+static uint8_t test_fill_value(int32_t fill)
+{
+    return fill == 0 ? test_rand() : fill == 1 ? 0 : 255;
+}
+
+/* Downscales with the current kernel and checks every block mean against 
+   the C reference, with a guard row after the grid that must stay 
+   untouched */
+static int32_t test_downscale(const char *kernel, int32_t blocks_w, 
+                              int32_t blocks_h, int32_t pad, int32_t fill)
+{
+    int32_t stride = blocks_w * XLNX_SCENE_BLOCK_SIZE + pad;
+    size_t luma_size = (size_t)stride * blocks_h * XLNX_SCENE_BLOCK_SIZE;
+    size_t num_blocks = (size_t)blocks_w * blocks_h;
+    uint8_t *luma = malloc(luma_size);
+    uint8_t *out = malloc(num_blocks + blocks_w);
+    uint8_t *ref = malloc(num_blocks + blocks_w);
+    int32_t ret = 0;
+
+    if(!luma || !out || !ref) {
+        printf("out of memory\n");
+        ret = -1;
+        goto done;
+    }
+    for(size_t i = 0; i < luma_size; i++) {
+        luma[i] = test_fill_value(fill);
+    }
+    memset(out, TEST_GUARD, num_blocks + blocks_w);
+    memset(ref, TEST_GUARD, num_blocks + blocks_w);
+    xlnx_scene_downscale_c(luma, stride, blocks_w, blocks_h, ref);
+    xlnx_scene_downscale(luma, stride, blocks_w, blocks_h, out);
+    if(memcmp(out, ref, num_blocks + blocks_w) != 0) {
+        printf("FAIL %s downscale %dx%d blocks pad %d fill %d\n", kernel, 
+               blocks_w, blocks_h, pad, fill);
+        ret = -1;
+    }
+
+done:
+    free(luma);
+    free(out);
+    free(ref);
+    return ret;
+}
+
+/* Offsets the inputs by one byte so the kernels see unaligned loads */
+static int32_t test_sad(const char *kernel, size_t count, int32_t fill)
+{
+    uint8_t *a = malloc(count + 1);
+    uint8_t *b = malloc(count + 1);
+    uint64_t sad;
+    uint64_t ref;
+    int32_t ret = 0;
+
+    if(!a || !b) {
+        printf("out of memory\n");
+        ret = -1;
+        goto done;
+    }
+    for(size_t i = 0; i <= count; i++) {
+        a[i] = test_fill_value(fill);
+        /* Extremes against their opposite, the largest difference */
+        b[i] = fill ? 255 - a[i] : test_rand();
+    }
+    ref = xlnx_scene_sad_c(a + 1, b + 1, count);
+    sad = xlnx_scene_sad(a + 1, b + 1, count);
+    if(sad != ref) {
+        printf("FAIL %s sad of %zu fill %d: %llu, expected %llu\n", kernel, 
+               count, fill, (unsigned long long)sad, 
+               (unsigned long long)ref);
+        ret = -1;
+    }
+
+done:
+    free(a);
+    free(b);
+    return ret;
+}
+
+int main()
+{
+    int32_t failures = 0;
+    int32_t cases = 0;
+
+    for(size_t k = 0; k < TEST_COUNT(test_kernels); k++) {
+        if(xlnx_scene_detect_set_kernel(test_kernels[k]) != 0) {
+            printf("skip %s, not supported by this CPU\n", test_kernels[k]);
+            continue;
+        }
+        for(int32_t fill = 0; fill < TEST_FILLS; fill++) {
+            for(size_t w = 0; w < TEST_COUNT(test_blocks_w); w++) {
+                for(size_t h = 0; h < TEST_COUNT(test_blocks_h); h++) {
+                    failures += test_downscale(test_kernels[k], 
+                                               test_blocks_w[w], 
+                                               test_blocks_h[h], 0, 
+                                               fill) != 0;
+                    failures += test_downscale(test_kernels[k], 
+                                               test_blocks_w[w], 
+                                               test_blocks_h[h], TEST_PAD, 
+                                               fill) != 0;
+                    cases += 2;
+                }
+            }
+            for(size_t c = 0; c < TEST_COUNT(test_counts); c++) {
+                failures += test_sad(test_kernels[k], test_counts[c], 
+                                     fill) != 0;
+                cases++;
+            }
+        }
+    }
+
+    printf("%s: %d of %d cases passed\n", failures ? "FAIL" : "PASS", 
+           cases - failures, cases);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,435 @@
+#include "xilinx_encoder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_WIDTH        640
+#define TEST_HEIGHT       360
+#define TEST_DEC_WIDTH    1920  /* the legacy decoder is fixed to 1080p */
+#define TEST_DEC_HEIGHT   1080
+#define TEST_FPS          30
+#define TEST_FRAMES       60
+/* Longer than the run, so the only IDRs are frame 0 and the forced ones */
+#define TEST_LONG_GOP     300
+#define TEST_IDR_A        17
+#define TEST_IDR_B        41
+/* Empty Decoder_frame calls that may pass without a frame while draining */
+#define TEST_DRAIN_TRIES  1000
+
+static uint32_t test_rng = 1;
+
+static uint8_t test_rand()
+{
+    test_rng = test_rng * 1103515245 + 12345;
+    return (uint8_t)(test_rng >> 16);
+}
+
+typedef struct {
+    char    *data;          /* every packet the encoder returned, in order */
+    size_t  size;
+    int32_t sizes[TEST_FRAMES];
+    int32_t is_idr[TEST_FRAMES];      /* by pts */
+    int32_t num_pkts;
+} TestStream;
+
+/* Encodes TEST_FRAMES frames of one random NV12 picture, forcing an IDR on
+   the frames in force_idr (-1 terminated), and collects the packets. Every
+   frame has to come back as exactly one packet starting with a start code,
+   with each pts seen once and dts rising. Returns 1 when there is no
+   encoder to run on. */
+static int32_t test_encode(const char *name, XlnxEncoderConfig *cfg,
+                           const int32_t *force_idr, TestStream *stream)
+{
+    size_t frame_size = (size_t)cfg->width * cfg->height * 3 / 2;
+    /* Room for one more packet at the end, grown as packets come in */
+    size_t room = frame_size + 4096;
+    size_t capacity = 4 * room;
+    char *grown;
+    XlnxEncoderFrameStats stats;
+    XlnxEncoderFrame frame;
+    XlnxEncoderHandle *enc;
+    int32_t seen[TEST_FRAMES];
+    int64_t last_dts = INT64_MIN;
+    int32_t ret = -1;
+    int len = 0;
+
+    memset(stream, 0, sizeof(*stream));
+    memset(seen, 0, sizeof(seen));
+    memset(&frame, 0, sizeof(frame));
+    enc = Encoder_Open(cfg);
+    if(!enc) {
+        printf("skip %s, no encoder available\n", name);
+        return 1;
+    }
+    frame.buffer = malloc(frame_size);
+    stream->data = malloc(capacity);
+    if(!frame.buffer || !stream->data) {
+        printf("out of memory\n");
+        goto done;
+    }
+    for(size_t i = 0; i < frame_size; i++) {
+        frame.buffer[i] = test_rand();
+    }
+    frame.size = frame_size;
+    frame.offset[1] = cfg->width * cfg->height;
+    frame.stride[0] = cfg->width;
+    frame.stride[1] = cfg->width;
+
+    for(int32_t i = 0; ; i++) {
+        if(stream->size + room > capacity) {
+            grown = realloc(stream->data, 2 * capacity);
+            if(!grown) {
+                printf("out of memory\n");
+                goto done;
+            }
+            stream->data = grown;
+            capacity *= 2;
+        }
+        if(i < TEST_FRAMES) {
+            frame.force_idr = 0;
+            for(const int32_t *f = force_idr; *f >= 0; f++) {
+                frame.force_idr |= *f == i;
+            }
+            if(Encoder_EncodeFrameStrided(enc, &frame,
+                                          stream->data + stream->size,
+                                          &len) != 0) {
+                printf("FAIL %s: frame %d not encoded\n", name, i);
+                goto done;
+            }
+        } else if(Encoder_FlushFrame(enc, stream->data + stream->size,
+                                     &len) != 0) {
+            break;
+        }
+        if(len <= 0) {
+            continue;
+        }
+        if(Encoder_GetFrameStats(enc, &stats) != 0 ||
+           stream->num_pkts >= TEST_FRAMES || stats.pts < 0 ||
+           stats.pts >= TEST_FRAMES || seen[stats.pts]++ ||
+           stats.dts <= last_dts) {
+            printf("FAIL %s: packet %d out of place\n", name,
+                   stream->num_pkts);
+            goto done;
+        }
+        if(len < 4 || memcmp(stream->data + stream->size, "\0\0", 2) != 0) {
+            printf("FAIL %s: packet %d has no start code\n", name,
+                   stream->num_pkts);
+            goto done;
+        }
+        last_dts = stats.dts;
+        stream->is_idr[stats.pts] = stats.is_idr;
+        stream->sizes[stream->num_pkts++] = len;
+        stream->size += len;
+    }
+    if(stream->num_pkts != TEST_FRAMES) {
+        printf("FAIL %s: %d packets for %d frames\n", name, stream->num_pkts,
+               TEST_FRAMES);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    Encoder_Close(enc);
+    free(frame.buffer);
+    return ret;
+}
+
+static int32_t test_frames_packets(int32_t codec_id, int32_t num_bframes)
+{
+    const int32_t no_idr[] = {-1};
+    XlnxEncoderConfig cfg;
+    TestStream stream;
+    char name[64];
+    int32_t ret;
+
+    snprintf(name, sizeof(name), "%s encode, %d B frames",
+             codec_id ? "hevc" : "h264", num_bframes);
+    Encoder_ConfigInit(&cfg);
+    cfg.codec_id = codec_id;
+    cfg.width = TEST_WIDTH;
+    cfg.height = TEST_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.gop_size = 30;
+    cfg.num_bframes = num_bframes;
+    cfg.lookahead_depth = 0;
+    ret = test_encode(name, &cfg, no_idr, &stream);
+    if(ret == 0 && !stream.is_idr[0]) {
+        printf("FAIL %s: stream does not open on an IDR\n", name);
+        ret = -1;
+    }
+    free(stream.data);
+    return ret;
+}
+
+/* The packets carrying the forced frames, and only those besides frame 0,
+   have to be IDRs */
+static int32_t test_forced_idr(int32_t codec_id)
+{
+    const int32_t force_idr[] = {TEST_IDR_A, TEST_IDR_B, -1};
+    XlnxEncoderConfig cfg;
+    TestStream stream;
+    const char *name = codec_id ? "hevc forced IDR" : "h264 forced IDR";
+    int32_t expect;
+    int32_t ret;
+
+    Encoder_ConfigInit(&cfg);
+    cfg.codec_id = codec_id;
+    cfg.width = TEST_WIDTH;
+    cfg.height = TEST_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.gop_size = TEST_LONG_GOP;
+    cfg.num_bframes = 0;
+    cfg.lookahead_depth = 0;
+    ret = test_encode(name, &cfg, force_idr, &stream);
+    for(int32_t pts = 0; ret == 0 && pts < TEST_FRAMES; pts++) {
+        expect = pts == 0 || pts == TEST_IDR_A || pts == TEST_IDR_B;
+        if(!stream.is_idr[pts] != !expect) {
+            printf("FAIL %s: pts %d is%s an IDR\n", name, pts,
+                   expect ? " not" : "");
+            ret = -1;
+        }
+    }
+    free(stream.data);
+    return ret;
+}
+
+/* A packet larger than the declared outBuf is never copied: the call says
+   XLNX_ENC_NEED_SPACE and the packet comes from Encoder_ReceivePacket */
+static int32_t test_small_output()
+{
+    const char *name = "h264 small output buffer";
+    size_t frame_size = TEST_WIDTH * TEST_HEIGHT * 3 / 2;
+    XlnxEncoderPacket *pkt;
+    XlnxEncoderConfig cfg;
+    XlnxEncoderHandle *enc;
+    char *frame = malloc(frame_size);
+    char out[16];
+    int32_t num_pkts = 0;
+    int32_t ret = -1;
+    int len = 0;
+    int rc;
+
+    Encoder_ConfigInit(&cfg);
+    cfg.width = TEST_WIDTH;
+    cfg.height = TEST_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.lookahead_depth = 0;
+    enc = Encoder_Open(&cfg);
+    if(!enc) {
+        printf("skip %s, no encoder available\n", name);
+        free(frame);
+        return 1;
+    }
+    if(!frame || Encoder_GetMaxPacketSize(enc) < (int)frame_size ||
+       Encoder_SetOutputCapacity(enc, sizeof(out)) != 0) {
+        printf("FAIL %s: setup\n", name);
+        goto done;
+    }
+    memset(frame, 0x80, frame_size);
+    for(int32_t i = 0; i < TEST_FRAMES; i++) {
+        memset(out, 0x5a, sizeof(out));
+        rc = Encoder_EncodeFrame(enc, frame, frame + TEST_WIDTH * TEST_HEIGHT,
+                                 out, &len);
+        if(rc == 0 && len == 0) {
+            continue;
+        }
+        /* Every packet is larger than 16 bytes, none may land in out */
+        if(rc != XLNX_ENC_NEED_SPACE || out[0] != 0x5a) {
+            printf("FAIL %s: frame %d returned %d with %d bytes\n", name, i,
+                   rc, len);
+            goto done;
+        }
+        pkt = Encoder_ReceivePacket(enc);
+        if(!pkt || pkt->size != len) {
+            printf("FAIL %s: packet %d not held for the caller\n", name,
+                   num_pkts);
+            Encoder_PacketUnref(pkt);
+            goto done;
+        }
+        Encoder_PacketUnref(pkt);
+        num_pkts++;
+    }
+    if(num_pkts == 0) {
+        printf("FAIL %s: no packets\n", name);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    Encoder_Close(enc);
+    free(frame);
+    return ret;
+}
+
+/* A bitrate change goes through; frame rate and VBR ceiling changes, which
+   the device cannot apply, are refused and leave the channel running */
+static int32_t test_reconfigure()
+{
+    const char *name = "h264 reconfigure";
+    size_t frame_size = TEST_WIDTH * TEST_HEIGHT * 3 / 2;
+    XlnxEncoderDynParams params;
+    XlnxEncoderConfig cfg;
+    XlnxEncoderHandle *enc;
+    char *frame = malloc(frame_size);
+    char *out = malloc(frame_size + 4096);
+    int32_t ret = -1;
+    int len = 0;
+
+    Encoder_ConfigInit(&cfg);
+    cfg.width = TEST_WIDTH;
+    cfg.height = TEST_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.control_rate = 2;
+    cfg.bit_rate = 2000;
+    cfg.max_bitrate = 4000;
+    cfg.lookahead_depth = 0;
+    enc = Encoder_Open(&cfg);
+    if(!enc) {
+        printf("skip %s, no encoder available\n", name);
+        free(frame);
+        free(out);
+        return 1;
+    }
+    if(!frame || !out) {
+        printf("out of memory\n");
+        goto done;
+    }
+    memset(frame, 0x80, frame_size);
+    memset(&params, 0, sizeof(params));
+    params.fps = TEST_FPS / 2;
+    if(Encoder_Reconfigure(enc, &params) == 0) {
+        printf("FAIL %s: frame rate change accepted\n", name);
+        goto done;
+    }
+    params.fps = 0;
+    params.max_bitrate = 6000;
+    if(Encoder_Reconfigure(enc, &params) == 0) {
+        printf("FAIL %s: max bitrate change accepted\n", name);
+        goto done;
+    }
+    params.max_bitrate = 4000;
+    params.bit_rate = 3000;
+    if(Encoder_Reconfigure(enc, &params) != 0) {
+        printf("FAIL %s: bitrate change refused\n", name);
+        goto done;
+    }
+    for(int32_t i = 0; i < TEST_FRAMES; i++) {
+        if(Encoder_EncodeFrame(enc, frame, frame + TEST_WIDTH * TEST_HEIGHT,
+                               out, &len) != 0) {
+            printf("FAIL %s: frame %d not encoded\n", name, i);
+            goto done;
+        }
+    }
+    ret = 0;
+
+done:
+    Encoder_Close(enc);
+    free(frame);
+    free(out);
+    return ret;
+}
+
+/* Feeds 1080p H264 encoder output through the legacy decoder: one frame
+   out per access unit, the tail drained with empty sends */
+static int32_t test_decode()
+{
+    const int32_t no_idr[] = {-1};
+    const char *name = "h264 decode";
+    XlnxEncoderConfig cfg;
+    TestStream stream;
+    unsigned char *out = NULL;
+    size_t offset = 0;
+    int32_t decoded = 0;
+    int32_t ret;
+    int rc;
+
+    Encoder_ConfigInit(&cfg);
+    cfg.width = TEST_DEC_WIDTH;
+    cfg.height = TEST_DEC_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.gop_size = 30;
+    cfg.num_bframes = 0;
+    cfg.lookahead_depth = 0;
+    ret = test_encode(name, &cfg, no_idr, &stream);
+    if(ret != 0) {
+        free(stream.data);
+        return ret;
+    }
+    if(Decoder_Init() != 0) {
+        printf("skip %s, no decoder available\n", name);
+        free(stream.data);
+        return 1;
+    }
+    out = malloc(TEST_DEC_WIDTH * TEST_DEC_HEIGHT * 3 / 2);
+    if(!out) {
+        printf("out of memory\n");
+        ret = -1;
+        goto done;
+    }
+    for(int32_t i = 0; i < stream.num_pkts; i++) {
+        rc = Decoder_frame((unsigned char *)stream.data + offset, out,
+                           stream.sizes[i]);
+        if(rc < 0) {
+            printf("FAIL %s: access unit %d rejected\n", name, i);
+            ret = -1;
+            goto done;
+        }
+        decoded += rc == 0;
+        offset += stream.sizes[i];
+    }
+    for(int32_t tries = 0; decoded < stream.num_pkts &&
+                           tries < TEST_DRAIN_TRIES; tries++) {
+        rc = Decoder_frame(NULL, out, 0);
+        if(rc < 0) {
+            break;
+        }
+        if(rc == 0) {
+            decoded++;
+        } else {
+            usleep(1000);
+        }
+    }
+    if(decoded != stream.num_pkts) {
+        printf("FAIL %s: %d frames for %d access units\n", name, decoded,
+               stream.num_pkts);
+        ret = -1;
+    }
+
+done:
+    Decoder_release();
+    free(out);
+    free(stream.data);
+    return ret;
+}
+
+int main()
+{
+    int32_t failures = 0;
+    int32_t cases = 0;
+    int32_t results[9];
+    int32_t num = 0;
+
+    /* Functional run on the simulator, a card ignores this */
+    setenv("XLNX_SIM_SPEED", "0", 0);
+
+    for(int32_t codec_id = 0; codec_id < 2; codec_id++) {
+        results[num++] = test_frames_packets(codec_id, 0);
+        results[num++] = test_frames_packets(codec_id, 2);
+        results[num++] = test_forced_idr(codec_id);
+    }
+    results[num++] = test_small_output();
+    results[num++] = test_reconfigure();
+    results[num++] = test_decode();
+
+    for(int32_t i = 0; i < num; i++) {
+        if(results[i] != 1) {
+            failures += results[i] != 0;
+            cases++;
+        }
+    }
+    printf("%s: %d of %d cases passed\n", failures ? "FAIL" : "PASS",
+           cases - failures, cases);
+    return failures ? 1 : 0;
+}
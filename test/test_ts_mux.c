@@ -0,0 +1,523 @@
+#include "xilinx_encoder.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_TS_PACKET    188
+#define TEST_TS_PAYLOAD   184
+#define TEST_PAT_PID      0x0000
+#define TEST_TYPE_H264    0x1b
+#define TEST_TYPE_HEVC    0x24
+#define TEST_VIDEO_STREAM 0xe0
+/* The muxer shifts timestamps by 1.4 s to leave room for B frames */
+#define TEST_TS_OFFSET    126000
+#define TEST_WIDTH        320
+#define TEST_HEIGHT       240
+#define TEST_FPS          30
+#define TEST_FRAMES       60
+#define TEST_SYNTH_FRAMES 40
+/* Room for every packet of a test stream, dummy packets are sized by the
+   bit rate */
+#define TEST_STREAM_SIZE  (8 << 20)
+
+static uint32_t test_rng = 1;
+
+static uint8_t test_rand()
+{
+    test_rng = test_rng * 1103515245 + 12345;
+    return (uint8_t)(test_rng >> 16);
+}
+
+/* One access unit handed to the muxer */
+typedef struct {
+    const uint8_t *data;
+    int32_t       size;
+    int64_t       pts;
+    int64_t       dts;
+    bool          key;
+} TestAu;
+
+typedef struct {
+    const TestAu *aus;
+    int32_t      num_aus;
+    int32_t      codec_id;
+    int32_t      pmt_pid;
+    int32_t      video_pid;
+    int32_t      cc[0x2000];
+    int32_t      num_pat;
+    int32_t      num_pes;
+    int64_t      last_pcr;
+    int64_t      pes_pcr;
+    uint8_t      *pes;
+    int32_t      pes_size;
+    const char   *error;
+} TestTsParser;
+
+static uint32_t test_crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xffffffff;
+
+    for(size_t i = 0; i < len; i++) {
+        crc ^= (uint32_t)data[i] << 24;
+        for(int32_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04c11db7 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static int64_t test_timestamp(const uint8_t *p)
+{
+    return ((int64_t)(p[0] & 0x0e) << 29) | (p[1] << 22) |
+           ((p[2] & 0xfe) << 14) | (p[3] << 7) | (p[4] >> 1);
+}
+
+static bool test_check_section(TestTsParser *parser, const uint8_t *payload,
+                               int32_t table_id)
+{
+    const uint8_t *sect = payload + 1 + payload[0];
+    int32_t sect_len = ((sect[1] & 0x0f) << 8) | sect[2];
+
+    if(sect[0] != table_id || 3 + sect_len > TEST_TS_PAYLOAD - 1) {
+        parser->error = "bad PSI section header";
+        return false;
+    }
+    /* CRC over the whole section including its CRC field is zero */
+    if(test_crc32(sect, 3 + sect_len) != 0) {
+        parser->error = "PSI CRC mismatch";
+        return false;
+    }
+    if(table_id == 0x00) {
+        parser->pmt_pid = ((sect[10] & 0x1f) << 8) | sect[11];
+        parser->num_pat++;
+    } else {
+        if(sect[12] != (parser->codec_id == ENCODER_ID_HEVC ? TEST_TYPE_HEVC :
+                                                              TEST_TYPE_H264)) {
+            parser->error = "wrong PMT stream type";
+            return false;
+        }
+        parser->video_pid = ((sect[13] & 0x1f) << 8) | sect[14];
+    }
+    return true;
+}
+
+/* The PES just gathered has to carry the next access unit unchanged, with
+   its timestamps and a PCR at or before its DTS */
+static bool test_check_pes(TestTsParser *parser)
+{
+    const TestAu *au;
+    const uint8_t *p = parser->pes;
+    int64_t pts, dts;
+    int32_t hdr_len;
+
+    if(parser->num_pes >= parser->num_aus) {
+        parser->error = "more PES packets than access units";
+        return false;
+    }
+    au = &parser->aus[parser->num_pes++];
+    if(parser->pes_size < 9 || p[0] != 0 || p[1] != 0 || p[2] != 1 ||
+       p[3] != TEST_VIDEO_STREAM) {
+        parser->error = "bad PES start code";
+        return false;
+    }
+    hdr_len = 9 + p[8];
+    pts = test_timestamp(p + 9);
+    dts = (p[7] & 0x40) ? test_timestamp(p + 14) : pts;
+    if(pts != au->pts + TEST_TS_OFFSET || dts != au->dts + TEST_TS_OFFSET) {
+        parser->error = "PTS/DTS mismatch";
+        return false;
+    }
+    if(parser->pes_pcr < 0 || parser->pes_pcr > dts) {
+        parser->error = "missing PCR or PCR after DTS";
+        return false;
+    }
+    if(parser->pes_size - hdr_len != au->size ||
+       memcmp(p + hdr_len, au->data, au->size) != 0) {
+        parser->error = "PES payload mismatch";
+        return false;
+    }
+    return true;
+}
+
+static bool test_parse(TestTsParser *parser, const uint8_t *ts, size_t size)
+{
+    const uint8_t *pkt, *payload;
+    int32_t pid, payload_len;
+    int64_t pcr;
+    bool pusi;
+
+    if(size == 0 || size % TEST_TS_PACKET) {
+        parser->error = "output is not a whole number of packets";
+        return false;
+    }
+    if((((ts[1] & 0x1f) << 8) | ts[2]) != TEST_PAT_PID) {
+        parser->error = "stream does not start with a PAT";
+        return false;
+    }
+    for(size_t off = 0; off < size; off += TEST_TS_PACKET) {
+        pkt = ts + off;
+        if(pkt[0] != 0x47) {
+            parser->error = "lost sync byte";
+            return false;
+        }
+        pusi = pkt[1] & 0x40;
+        pid = ((pkt[1] & 0x1f) << 8) | pkt[2];
+        payload = pkt + 4;
+        pcr = -1;
+        if(pkt[3] & 0x20) {
+            if(payload[0] > TEST_TS_PAYLOAD - 1) {
+                parser->error = "adaptation field too long";
+                return false;
+            }
+            if(payload[0] > 0 && (payload[1] & 0x10)) {
+                pcr = ((int64_t)payload[2] << 25) | (payload[3] << 17) |
+                      (payload[4] << 9) | (payload[5] << 1) |
+                      (payload[6] >> 7);
+                if(pcr < parser->last_pcr) {
+                    parser->error = "PCR went backwards";
+                    return false;
+                }
+                parser->last_pcr = pcr;
+            }
+            payload += 1 + payload[0];
+        }
+        payload_len = TEST_TS_PACKET - (int32_t)(payload - pkt);
+        if(!(pkt[3] & 0x10)) {
+            continue;
+        }
+        if(parser->cc[pid] >= 0 &&
+           (pkt[3] & 0x0f) != ((parser->cc[pid] + 1) & 0x0f)) {
+            parser->error = "continuity counter discontinuity";
+            return false;
+        }
+        parser->cc[pid] = pkt[3] & 0x0f;
+
+        if(pid == TEST_PAT_PID) {
+            if(!test_check_section(parser, payload, 0x00)) {
+                return false;
+            }
+        } else if(pid == parser->pmt_pid) {
+            if(!test_check_section(parser, payload, 0x02)) {
+                return false;
+            }
+        } else if(pid == parser->video_pid) {
+            if(pusi && parser->pes_size > 0) {
+                if(!test_check_pes(parser)) {
+                    return false;
+                }
+                parser->pes_size = 0;
+            }
+            if(pusi) {
+                parser->pes_pcr = pcr;
+            }
+            memcpy(parser->pes + parser->pes_size, payload, payload_len);
+            parser->pes_size += payload_len;
+        } else {
+            parser->error = "packet on unknown PID";
+            return false;
+        }
+    }
+    if(parser->pes_size > 0 && !test_check_pes(parser)) {
+        return false;
+    }
+    if(parser->num_pes != parser->num_aus) {
+        parser->error = "access units missing from output";
+        return false;
+    }
+    return true;
+}
+
+/* Closes mux, reads the TS file back from fd and checks it carries aus:
+   valid tables in front of every key frame, continuity counters, PCR and
+   each PES holding its access unit with its timestamps */
+static int32_t test_check_ts(const char *name, int32_t codec_id,
+                             XlnxTsMux *mux, int32_t fd, const TestAu *aus,
+                             int32_t num_aus)
+{
+    TestTsParser *parser = calloc(1, sizeof(TestTsParser));
+    uint8_t *ts = NULL;
+    int64_t total = 0;
+    int32_t num_keys = 0;
+    int32_t ret = -1;
+    off_t ts_size;
+
+    TsMux_Close(mux);
+    for(int32_t i = 0; i < num_aus; i++) {
+        total += aus[i].size;
+        num_keys += aus[i].key;
+    }
+    ts_size = lseek(fd, 0, SEEK_END);
+    ts = malloc(ts_size > 0 ? ts_size : 1);
+    if(parser) {
+        parser->pes = malloc(total + num_aus * TEST_TS_PACKET);
+    }
+    if(!parser || !parser->pes || !ts) {
+        printf("out of memory\n");
+        goto done;
+    }
+    if(ts_size <= 0 || pread(fd, ts, ts_size, 0) != ts_size) {
+        printf("FAIL %s: cannot read back the TS file\n", name);
+        goto done;
+    }
+    parser->aus = aus;
+    parser->num_aus = num_aus;
+    parser->codec_id = codec_id;
+    parser->pmt_pid = -1;
+    parser->video_pid = -1;
+    parser->last_pcr = -1;
+    parser->pes_pcr = -1;
+    for(int32_t pid = 0; pid < 0x2000; pid++) {
+        parser->cc[pid] = -1;
+    }
+    if(!test_parse(parser, ts, ts_size)) {
+        printf("FAIL %s: %s at PES %d\n", name, parser->error,
+               parser->num_pes);
+        goto done;
+    }
+    if(parser->num_pat != num_keys + !aus[0].key) {
+        printf("FAIL %s: %d PATs for %d key frames\n", name,
+               parser->num_pat, num_keys);
+        goto done;
+    }
+    ret = 0;
+
+done:
+    if(parser) {
+        free(parser->pes);
+    }
+    free(parser);
+    free(ts);
+    return ret;
+}
+
+/* Muxes random access units with sizes around the packet payload
+   boundaries, which exercise the stuffing, and one B frame of
+   reordering */
+static int32_t test_mux_synthetic(int32_t codec_id)
+{
+    static const int32_t sizes[] = {
+        5000, 1, 2, 150, 165, 166, 167, 168, 175, 176, 177, 183, 184, 185,
+        350, 351, 352, 368, 369, 1500, 65536, 200000
+    };
+    const char *name = codec_id == ENCODER_ID_HEVC ? "hevc synthetic" :
+                                                   "h264 synthetic";
+    char path[] = "/tmp/test_ts_mux_XXXXXX";
+    TestAu aus[TEST_SYNTH_FRAMES];
+    uint8_t *data[TEST_SYNTH_FRAMES];
+    XlnxTsMux *mux;
+    int32_t ret = -1;
+    int32_t fd;
+
+    memset(data, 0, sizeof(data));
+    for(int32_t i = 0; i < TEST_SYNTH_FRAMES; i++) {
+        TestAu *au = &aus[i];
+        uint8_t *p;
+
+        au->size = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+        p = data[i] = malloc(au->size);
+        if(!p) {
+            printf("out of memory\n");
+            goto done;
+        }
+        for(int32_t j = 0; j < au->size; j++) {
+            p[j] = test_rand();
+        }
+        /* Start the access unit with a real NAL so key frames are found */
+        au->key = (i % 10) == 0 && au->size >= 5;
+        if(au->size >= 5) {
+            p[0] = 0;
+            p[1] = 0;
+            p[2] = 0;
+            p[3] = 1;
+            if(codec_id == ENCODER_ID_HEVC) {
+                p[4] = (au->key ? 19 : 1) << 1;
+            } else {
+                p[4] = au->key ? 0x65 : 0x41;
+            }
+            /* Keep the random payload free of accidental key frame NALs */
+            for(int32_t j = 5; j + 2 < au->size; j++) {
+                if(p[j] == 0 && p[j + 1] == 0) {
+                    p[j + 2] |= 0x80;
+                }
+            }
+        }
+        au->data = p;
+        au->dts = (int64_t)i * 3000 - 3000;
+        au->pts = (i % 3 == 2) ? au->dts : au->dts + 3000;
+    }
+
+    fd = mkstemp(path);
+    if(fd < 0) {
+        printf("FAIL %s: cannot create %s\n", name, path);
+        goto done;
+    }
+    unlink(path);
+    mux = TsMux_Open(fd, codec_id);
+    if(!mux) {
+        printf("FAIL %s: TsMux_Open\n", name);
+        close(fd);
+        goto done;
+    }
+    for(int32_t i = 0; i < TEST_SYNTH_FRAMES; i++) {
+        if(TsMux_WritePacket(mux, (const char *)aus[i].data, aus[i].size,
+                             aus[i].pts, aus[i].dts) != 0) {
+            printf("FAIL %s: access unit %d not muxed\n", name, i);
+            TsMux_Close(mux);
+            close(fd);
+            goto done;
+        }
+    }
+    ret = test_check_ts(name, codec_id, mux, fd, aus, TEST_SYNTH_FRAMES);
+    close(fd);
+
+done:
+    for(int32_t i = 0; i < TEST_SYNTH_FRAMES; i++) {
+        free(data[i]);
+    }
+    return ret;
+}
+
+/* Encodes TEST_FRAMES frames into a TS file the way app/main.c does, with
+   the frame numbered pts and dts of every packet scaled to 90 kHz.
+   Returns 1 when there is no encoder to run on. */
+static int32_t test_encode_ts(int32_t codec_id, int32_t num_bframes)
+{
+    const char *codec = codec_id == ENCODER_ID_HEVC ? "hevc" : "h264";
+    size_t frame_size = TEST_WIDTH * TEST_HEIGHT * 3 / 2;
+    char path[] = "/tmp/test_ts_mux_XXXXXX";
+    XlnxEncoderFrameStats stats;
+    XlnxEncoderConfig cfg;
+    XlnxEncoderHandle *enc = NULL;
+    XlnxTsMux *mux = NULL;
+    TestAu aus[TEST_FRAMES];
+    int32_t num_aus = 0;
+    char *frame = malloc(frame_size);
+    char *out = malloc(frame_size + 4096);
+    uint8_t *stream = malloc(TEST_STREAM_SIZE);
+    size_t stream_size = 0;
+    int32_t ret = -1;
+    int32_t fd = -1;
+    int32_t flushing = 0;
+    int len = 0;
+
+    if(!frame || !out || !stream) {
+        printf("out of memory\n");
+        goto done;
+    }
+    for(size_t i = 0; i < frame_size; i++) {
+        frame[i] = test_rand();
+    }
+
+    Encoder_ConfigInit(&cfg);
+    cfg.codec_id = codec_id;
+    cfg.width = TEST_WIDTH;
+    cfg.height = TEST_HEIGHT;
+    cfg.fps = TEST_FPS;
+    cfg.num_bframes = num_bframes;
+    cfg.gop_size = 20;
+    cfg.lookahead_depth = 0;
+    enc = Encoder_Open(&cfg);
+    if(!enc) {
+        printf("skip %s encoder to TS, no encoder available\n", codec);
+        ret = 1;
+        goto done;
+    }
+    fd = mkstemp(path);
+    if(fd < 0) {
+        printf("FAIL %s: cannot create %s\n", codec, path);
+        goto done;
+    }
+    unlink(path);
+    mux = TsMux_Open(fd, codec_id);
+    if(!mux) {
+        printf("FAIL %s: TsMux_Open\n", codec);
+        goto done;
+    }
+
+    for(int32_t i = 0; ; i++) {
+        if(i < TEST_FRAMES) {
+            if(Encoder_EncodeFrame(enc, frame, frame + TEST_WIDTH *
+                                   TEST_HEIGHT, out, &len) != 0) {
+                printf("FAIL %s: frame %d not encoded\n", codec, i);
+                goto done;
+            }
+        } else {
+            flushing = 1;
+            if(Encoder_FlushFrame(enc, out, &len) != 0) {
+                break;
+            }
+        }
+        if(len <= 0) {
+            continue;
+        }
+        if(Encoder_GetFrameStats(enc, &stats) != 0 ||
+           num_aus >= TEST_FRAMES || stream_size + len > TEST_STREAM_SIZE ||
+           TsMux_WritePacket(mux, out, len, stats.pts * 90000 / TEST_FPS,
+                             stats.dts * 90000 / TEST_FPS) != 0) {
+            printf("FAIL %s: packet %d not muxed%s\n", codec, num_aus,
+                   flushing ? " while flushing" : "");
+            goto done;
+        }
+        memcpy(stream + stream_size, out, len);
+        aus[num_aus].data = stream + stream_size;
+        aus[num_aus].size = len;
+        aus[num_aus].pts = stats.pts * 90000 / TEST_FPS;
+        aus[num_aus].dts = stats.dts * 90000 / TEST_FPS;
+        aus[num_aus].key = stats.is_idr != 0;
+        stream_size += len;
+        num_aus++;
+    }
+    if(num_aus != TEST_FRAMES) {
+        printf("FAIL %s: %d packets for %d frames\n", codec, num_aus,
+               TEST_FRAMES);
+        goto done;
+    }
+    ret = test_check_ts(codec, codec_id, mux, fd, aus, num_aus);
+    mux = NULL;
+
+done:
+    TsMux_Close(mux);
+    if(fd >= 0) {
+        close(fd);
+    }
+    Encoder_Close(enc);
+    free(stream);
+    free(frame);
+    free(out);
+    return ret;
+}
+
+int main()
+{
+    int32_t failures = 0;
+    int32_t cases = 0;
+    int32_t ret;
+
+    /* Functional run on the simulator, a card ignores this */
+    setenv("XLNX_SIM_SPEED", "0", 0);
+
+    for(int32_t codec_id = ENCODER_ID_H264; codec_id <= ENCODER_ID_HEVC;
+        codec_id++) {
+        failures += test_mux_synthetic(codec_id) != 0;
+        cases++;
+    }
+
+    /* B frames put dts below pts and below zero at the start */
+    for(int32_t codec_id = ENCODER_ID_H264; codec_id <= ENCODER_ID_HEVC;
+        codec_id++) {
+        for(int32_t bframes = 0; bframes <= 2; bframes += 2) {
+            ret = test_encode_ts(codec_id, bframes);
+            if(ret != 1) {
+                failures += ret != 0;
+                cases++;
+            }
+        }
+    }
+
+    printf("%s: %d of %d cases passed\n", failures ? "FAIL" : "PASS",
+           cases - failures, cases);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,106 @@
+#include "xlnx_yuv_convert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_PAD      37
+#define TEST_GUARD    0xa5
+
+static const char *test_kernels[] = {"c", "sse2", "avx2", "avx512bw"};
+static const int32_t test_widths[] = {1, 2, 3, 15, 16, 17, 31, 33, 63, 64, 
+                                      65, 127, 129, 255, 641, 1919, 1921};
+static const int32_t test_heights[] = {1, 2, 3, 5, 17, 1081};
+
+#define TEST_COUNT(a) (sizeof(a) / sizeof(a[0]))
+
+static uint32_t test_rng = 1;
+
+static uint8_t test_rand()
+{
+    test_rng = test_rng * 1103515245 + 12345;
+    return (uint8_t)(test_rng >> 16);
+}
+
+/* Converts with the current kernel and checks every byte against the C
+   reference, including the stride padding, which must stay untouched */
+static int32_t test_convert(const char *kernel, int32_t width, int32_t height,
+                            int32_t pad)
+{
+    int32_t cw = (width + 1) / 2;
+    int32_t ch = (height + 1) / 2;
+    int32_t src_stride = cw + pad;
+    int32_t dst_stride = 2 * cw + pad;
+    size_t src_size = (size_t)src_stride * ch;
+    size_t dst_size = (size_t)dst_stride * ch;
+    uint8_t *u = malloc(src_size);
+    uint8_t *v = malloc(src_size);
+    uint8_t *out = malloc(dst_size);
+    uint8_t *ref = malloc(dst_size);
+    int32_t ret = 0;
+
+    if(!u || !v || !out || !ref) {
+        printf("out of memory\n");
+        ret = -1;
+        goto done;
+    }
+    for(size_t i = 0; i < src_size; i++) {
+        u[i] = test_rand();
+        v[i] = test_rand();
+    }
+    memset(out, TEST_GUARD, dst_size);
+    memset(ref, TEST_GUARD, dst_size);
+    for(int32_t row = 0; row < ch; row++) {
+        xlnx_yuv_interleave_uv_c(u + (size_t)row * src_stride, 
+                                 v + (size_t)row * src_stride, 
+                                 ref + (size_t)row * dst_stride, cw);
+    }
+
+    if(xlnx_yuv_i420_to_nv12_uv(u, v, src_stride, out, dst_stride, width, 
+                                height) != 0 ||
+       memcmp(out, ref, dst_size) != 0) {
+        printf("FAIL %s %dx%d pad %d\n", kernel, width, height, pad);
+        ret = -1;
+    }
+
+done:
+    free(u);
+    free(v);
+    free(out);
+    free(ref);
+    return ret;
+}
+
+int main()
+{
+    int32_t failures = 0;
+    int32_t cases = 0;
+
+    for(size_t k = 0; k < TEST_COUNT(test_kernels); k++) {
+        if(xlnx_yuv_convert_set_kernel(test_kernels[k]) != 0) {
+            printf("skip %s, not supported by this CPU\n", test_kernels[k]);
+            continue;
+        }
+        for(size_t w = 0; w < TEST_COUNT(test_widths); w++) {
+            for(size_t h = 0; h < TEST_COUNT(test_heights); h++) {
+                /* Packed planes take the single run path, padded ones the
+                   per row path */
+                failures += test_convert(test_kernels[k], test_widths[w], 
+                                         test_heights[h], 0) != 0;
+                failures += test_convert(test_kernels[k], test_widths[w], 
+                                         test_heights[h], TEST_PAD) != 0;
+                cases += 2;
+            }
+        }
+    }
+
+    if(xlnx_yuv_i420_to_nv12_uv(NULL, NULL, 8, NULL, 16, 16, 16) != -1) {
+        printf("FAIL NULL planes accepted\n");
+        failures++;
+    }
+    cases++;
+
+    printf("%s: %d of %d cases passed\n", failures ? "FAIL" : "PASS", 
+           cases - failures, cases);
+    return failures ? 1 : 0;
+}